@@ -46,6 +46,7 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <pthread.h>
 
 #include <time.h>
 
@@ -64,22 +65,115 @@
 
 /* local variables */
 static uint32_t	exporter_sysid = 0;
+static pthread_mutex_t exporter_sysid_mutex = PTHREAD_MUTEX_INITIALIZER;
 static char *DynamicSourcesDir = NULL;
 
+#define SOURCE_HASH_SIZE	256
+typedef struct sourceIndex_s {
+	FlowSource_t	*last;		// last hit
+	FlowSource_t	*bucket[SOURCE_HASH_SIZE];
+} sourceIndex_t;
+
+#define EXPORTER_HASH_SIZE	64	// initial size - doubled as exporters show up
+typedef struct exporterNode_s {
+	struct exporterNode_s	*next;
+	exporter_t				*exporter;
+} exporterNode_t;
+
 /* local prototypes */
 static uint32_t AssignExporterID(void);
 
+static inline uint32_t SourceHash(ip_addr_t *ip);
+
+static inline uint32_t ExporterHash(ip_addr_t *ip, uint32_t version, uint32_t id);
+
+static int BuildSourceIndex(FlowSource_t *FlowSource);
+
+static int GrowExporterIndex(exporterIndex_t *index);
+
 /* local functions */
 static uint32_t AssignExporterID(void) {
+uint32_t sysid;
+
+	// receiver threads share the exporter ids
+	pthread_mutex_lock(&exporter_sysid_mutex);
+	sysid = exporter_sysid < 0xFFFF ? ++exporter_sysid : 0;
+	pthread_mutex_unlock(&exporter_sysid_mutex);
 
-	if ( exporter_sysid >= 0xFFFF ) {
+	if ( sysid == 0 ) 
 		LogError("Too many exporters (id > 65535). Flow records collected but without reference to exporter");
+
+	return sysid;
+
+} // End of AssignExporterID
+
+static inline uint32_t SourceHash(ip_addr_t *ip) {
+uint64_t h = (ip->V6[0] ^ ip->V6[1]) * 0x9E3779B97F4A7C15ULL;
+
+	return (uint32_t)(h >> 32) & (SOURCE_HASH_SIZE - 1);
+
+} // End of SourceHash
+
+static inline uint32_t ExporterHash(ip_addr_t *ip, uint32_t version, uint32_t id) {
+uint64_t h = (ip->V6[0] ^ ip->V6[1] ^ ((uint64_t)version << 32 | id)) * 0x9E3779B97F4A7C15ULL;
+
+	return (uint32_t)(h >> 32);
+
+} // End of ExporterHash
+
+static int BuildSourceIndex(FlowSource_t *FlowSource) {
+sourceIndex_t *index;
+FlowSource_t *fs;
+
+	index = (sourceIndex_t *)calloc(1, sizeof(sourceIndex_t));
+	if ( !index ) {
+		LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
 		return 0;
 	}
 
-	return ++exporter_sysid;
+	fs = FlowSource;
+	while ( fs ) {
+		uint32_t slot = SourceHash(&fs->ip);
+		fs->hash_next = index->bucket[slot];
+		index->bucket[slot] = fs;
+		fs = fs->next;
+	}
+	FlowSource->source_index = index;
 
-} // End of AssignExporterID
+	return 1;
+
+} // End of BuildSourceIndex
+
+static int GrowExporterIndex(exporterIndex_t *index) {
+exporterNode_t **bucket;
+uint32_t i, size;
+
+	size = index->bucket ? 2 * (index->mask + 1) : EXPORTER_HASH_SIZE;
+	bucket = (exporterNode_t **)calloc(size, sizeof(exporterNode_t *));
+	if ( !bucket ) {
+		LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+
+	// rehash all nodes into the new buckets
+	for ( i=0; index->bucket && i<=index->mask; i++ ) {
+		exporterNode_t *node = index->bucket[i];
+		while ( node ) {
+			exporterNode_t *next = node->next;
+			exporter_t *e = node->exporter;
+			uint32_t slot = ExporterHash(&e->info.ip, e->info.version, e->info.id) & (size - 1);
+			node->next   = bucket[slot];
+			bucket[slot] = node;
+			node = next;
+		}
+	}
+	free(index->bucket);
+	index->bucket = bucket;
+	index->mask	  = size - 1;
+
+	return 1;
+
+} // End of GrowExporterIndex
 
 /* global functions */
 
@@ -362,7 +456,7 @@ int				err;
 	(*source)->bookkeeper 	  	  = NULL;
 	(*source)->any_source 	  	  = 0;
 	(*source)->exporter_data  	  = NULL;
-	(*FlowSource)->exporter_count = 0;
+	(*source)->exporter_count 	  = 0;
 
 	switch (ss->ss_family) {
 		case PF_INET: {
@@ -452,11 +546,102 @@ int				err;
 	}
 	(*source)->current = strdup(path);
 
+	// new sources are added to the sender lookup as well
+	if ( (*FlowSource)->source_index ) {
+		sourceIndex_t *index = (*FlowSource)->source_index;
+		uint32_t slot = SourceHash(&(*source)->ip);
+		(*source)->hash_next = index->bucket[slot];
+		index->bucket[slot]	 = *source;
+	}
+
 	LogInfo("Dynamically add source ident: %s in directory: %s", ident, path);
 	return *source;
 
 } // End of AddDynamicSource
 
+FlowSource_t *LookupFlowSource(FlowSource_t *FlowSource, ip_addr_t *ip) {
+sourceIndex_t *index;
+FlowSource_t *fs;
+
+	if ( !FlowSource ) 
+		return NULL;
+
+	// build the index on first use, as all sources are known by now
+	if ( !FlowSource->source_index && !BuildSourceIndex(FlowSource) ) 
+		return NULL;
+
+	index = FlowSource->source_index;
+	fs = index->last;
+	if ( fs && fs->ip.V6[0] == ip->V6[0] && fs->ip.V6[1] == ip->V6[1] ) 
+		return fs;
+
+	fs = index->bucket[SourceHash(ip)];
+	while ( fs ) {
+		if ( fs->ip.V6[0] == ip->V6[0] && fs->ip.V6[1] == ip->V6[1] ) {
+			index->last = fs;
+			return fs;
+		}
+		fs = fs->hash_next;
+	}
+
+	return NULL;
+
+} // End of LookupFlowSource
+
+exporter_t *LookupExporter(FlowSource_t *fs, uint32_t version, uint32_t id) {
+exporterIndex_t *index = &fs->exporter_index;
+exporterNode_t *node;
+exporter_t *e;
+
+	e = index->last;
+	if ( e && e->info.version == version && e->info.id == id &&
+		 e->info.ip.V6[0] == fs->ip.V6[0] && e->info.ip.V6[1] == fs->ip.V6[1]) 
+		return e;
+
+	if ( !index->bucket ) 
+		return NULL;
+
+	node = index->bucket[ExporterHash(&fs->ip, version, id) & index->mask];
+	while ( node ) {
+		e = node->exporter;
+		if ( e->info.version == version && e->info.id == id &&
+			 e->info.ip.V6[0] == fs->ip.V6[0] && e->info.ip.V6[1] == fs->ip.V6[1]) {
+			index->last = e;
+			return e;
+		}
+		node = node->next;
+	}
+
+	return NULL;
+
+} // End of LookupExporter
+
+int IndexExporter(FlowSource_t *fs, exporter_t *exporter) {
+exporterIndex_t *index = &fs->exporter_index;
+exporterNode_t *node;
+uint32_t slot;
+
+	// keep chains short - grow at an average chain length of 2
+	if ( (!index->bucket || index->count >= 2 * (index->mask + 1)) && !GrowExporterIndex(index) ) 
+		return 0;
+
+	node = (exporterNode_t *)malloc(sizeof(exporterNode_t));
+	if ( !node ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+
+	slot = ExporterHash(&exporter->info.ip, exporter->info.version, exporter->info.id) & index->mask;
+	node->exporter		 = exporter;
+	node->next			 = index->bucket[slot];
+	index->bucket[slot]	 = node;
+	index->count++;
+	index->last = exporter;
+
+	return 1;
+
+} // End of IndexExporter
+
 int InitExtensionMapList(FlowSource_t *fs) {
 
 	fs->extension_map_list.maps = (extension_map_t **)calloc(BLOCK_SIZE, sizeof(extension_map_t *));
@@ -483,7 +668,7 @@ int ReInitExtensionMapList(FlowSource_t *fs) {
 } // End of ReInitExtensionMapList
 
 int RemoveExtensionMap(FlowSource_t *fs, extension_map_t *map) {
-int slot = map->map_id;
+int slot = map->map_id - fs->extension_map_list.base;
 
 	dbg_printf("Remove extension map ID: %d\n", slot);
 	if ( slot >= fs->extension_map_list.max_maps ) {
@@ -503,6 +688,10 @@ int next_slot = fs->extension_map_list.next_free;
 	dbg_printf("Add extension map\n");
 	// is it a new map, we have not yet in the list
 	if ( map->map_id == INIT_ID ) {
+		if ( fs->extension_map_list.range && next_slot >= fs->extension_map_list.range ) {
+			LogError("Ident: %s, too many extension maps. Max %d maps per receiver", fs->Ident, fs->extension_map_list.range);
+			return 0;
+		}
 		if ( next_slot >= fs->extension_map_list.max_maps ) {
 			// extend map list
 			dbg_printf("List full - extend extension list to %d slots\n", fs->extension_map_list.max_maps + BLOCK_SIZE);
@@ -518,7 +707,7 @@ int next_slot = fs->extension_map_list.next_free;
 	
 		dbg_printf("Add map to slot %d\n", next_slot);
 		fs->extension_map_list.maps[next_slot] = map;
-		map->map_id = next_slot;
+		map->map_id = fs->extension_map_list.base + next_slot;
 		fs->extension_map_list.num_maps++;
 
 		if ( (next_slot + 1) == fs->extension_map_list.num_maps ) {
@@ -53,10 +53,22 @@ typedef struct common_flow_header {
   uint16_t  count;
 } common_flow_header_t;
 
+/* exporter lookup index - hashed on version, id and exporter IP */
+typedef struct exporterIndex_s {
+	exporter_t	*last;		// last hit
+	uint32_t	mask;		// number of buckets - 1
+	uint32_t	count;		// number of indexed exporters
+	struct exporterNode_s **bucket;
+} exporterIndex_t;
+
 typedef struct FlowSource_s {
 	// link
 	struct FlowSource_s *next;
 
+	// sender lookup - the index is kept in the first source of a list
+	struct FlowSource_s	*hash_next;
+	struct sourceIndex_s *source_index;
+
 	// exporter identifiers
 	char 				Ident[IDENTLEN];
 	ip_addr_t			ip;
@@ -79,11 +91,14 @@ typedef struct FlowSource_s {
 	// Any exporter specific data
 	exporter_t			*exporter_data;
 	uint32_t			exporter_count;
+	exporterIndex_t		exporter_index;
 	struct timeval		received;
 
 	// extension map list
 	struct {
 #define BLOCK_SIZE	16
+		int	base;		// first map id - receiver threads use separate id ranges
+		int	range;		// number of ids available from base - 0 for no limit
 		int	next_free;
 		int	max_maps;
 		int num_maps;
@@ -106,6 +121,12 @@ int SetDynamicSourcesDir(FlowSource_t **FlowSource, char *dir);
 
 FlowSource_t *AddDynamicSource(FlowSource_t **FlowSource, struct sockaddr_storage *ss);
 
+FlowSource_t *LookupFlowSource(FlowSource_t *FlowSource, ip_addr_t *ip);
+
+exporter_t *LookupExporter(FlowSource_t *fs, uint32_t version, uint32_t id);
+
+int IndexExporter(FlowSource_t *fs, exporter_t *exporter);
+
 int InitExtensionMapList(FlowSource_t *fs);
 
 int ReInitExtensionMapList(FlowSource_t *fs);
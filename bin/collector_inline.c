@@ -29,7 +29,7 @@
  *  
  */
 
-static inline FlowSource_t *GetFlowSource(struct sockaddr_storage *ss) {
+static inline FlowSource_t *GetFlowSource(FlowSource_t *FlowSource, struct sockaddr_storage *ss) {
 FlowSource_t	*fs;
 void			*ptr;
 ip_addr_t		ip;
@@ -92,22 +92,20 @@ char			as[100];
 	printf("Flow Source IP: %s\n", as);
 #endif
 
+	// any source collects all senders and is the only source in the list
+	// store the current IP address, which identifies the current source
 	fs = FlowSource;
-	while ( fs ) {
-		if ( ip.V6[0] ==  fs->ip.V6[0] && ip.V6[1] == fs->ip.V6[1] ) {
-			fs->port = port;
-			return fs;
-		}
+	if ( fs && fs->any_source ) {
+		fs->ip	 = ip;
+		fs->port = port;
+		fs->sa_family = ss->ss_family;
+		return fs;
+	}
 
-		// if we match any source, store the current IP address - works as faster cache next time
-		// and identifies the current source by IP
-		if ( fs->any_source ) {
-			fs->ip	 = ip;
-			fs->port = port;
-			fs->sa_family = ss->ss_family;
-			return fs;
-		}
-		fs = fs->next;
+	fs = LookupFlowSource(FlowSource, &ip);
+	if ( fs ) {
+		fs->port = port;
+		return fs;
 	}
 
 	if ( ptr ) {
@@ -36,6 +36,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/param.h>
 #include <sys/uio.h>
 #include <unistd.h>
 #include <signal.h>
@@ -63,6 +64,7 @@
 #include "bookkeeper.h"
 #include "nfstatfile.h"
 #include "expire.h"
+#include "ipindex.h"
 
 static uint32_t timeout = 0;
 
@@ -70,6 +72,8 @@ static void PrepareDirLists(channel_t *channel);
 
 static int compare(const FTSENT **f1, const FTSENT **f2);
 
+static int UnlinkDataFile(char *path);
+
 static void IntHandler(int signal) {
 
 	switch (signal) {
@@ -259,6 +263,21 @@ static int compare(const FTSENT **f1, const FTSENT **f2) {
 	return strcmp( (*f1)->fts_name, (*f2)->fts_name);
 } // End of compare
 
+static int UnlinkDataFile(char *path) {
+char indexfile[MAXPATHLEN];
+
+	if ( unlink(path) < 0 )
+		return -1;
+
+	// the IP index of the file, if any
+	snprintf(indexfile, MAXPATHLEN-1, "%s%s", path, IPINDEX_SUFFIX);
+	indexfile[MAXPATHLEN-1] = '\0';
+	unlink(indexfile);
+
+	return 0;
+
+} // End of UnlinkDataFile
+
 void RescanDir(char *dir, dirstat_t *dirstat) {
 FTS 		*fts;
 FTSENT 		*ftsent;
@@ -428,7 +447,7 @@ time_t 		now = time(NULL);
 				// expire size-wise if needed
 				if ( !size_done ) {
 					if ( dirstat->filesize > sizelimit ) {
-						if ( unlink(ftsent->fts_path) == 0 ) {
+						if ( UnlinkDataFile(ftsent->fts_path) == 0 ) {
 							dirstat->filesize -= 512 * ftsent->fts_statp->st_blocks;
 							num_expired++;
 							dir_files--;
@@ -446,7 +465,7 @@ time_t 		now = time(NULL);
 				// this part of the code is executed only when size-wise is fullfilled
 				if ( !lifetime_done ) {
 					if ( expire_timelimit && strcmp(p, expire_timelimit) < 0  ) {
-						if ( unlink(ftsent->fts_path) == 0 ) {
+						if ( UnlinkDataFile(ftsent->fts_path) == 0 ) {
 							dirstat->filesize -= 512 * ftsent->fts_statp->st_blocks;
 							num_expired++;
 							dir_files--;
@@ -634,7 +653,7 @@ uint64_t	sizelimit, num_expired;
 			dbg_printf("	Size expire %llu %llu\n", current_stat->filesize, sizelimit);
 			if ( current_stat->filesize > sizelimit ) {
 				// need to delete this file
-				if ( unlink(expire_channel->ftsent->fts_path) == 0 ) {
+				if ( UnlinkDataFile(expire_channel->ftsent->fts_path) == 0 ) {
 					// Update profile stat
 					current_stat->filesize 			  -= 512 * expire_channel->ftsent->fts_statp->st_blocks;
 					current_stat->numfiles--;
@@ -663,7 +682,7 @@ uint64_t	sizelimit, num_expired;
 			// this part of the code is executed only when size-wise is already fullfilled
 			if ( strcmp(p, expire_timelimit) < 0  ) {
 				// need to delete this file
-				if ( unlink(expire_channel->ftsent->fts_path) == 0 ) {
+				if ( UnlinkDataFile(expire_channel->ftsent->fts_path) == 0 ) {
 					// Update profile stat
 					current_stat->filesize -= 512 * expire_channel->ftsent->fts_statp->st_blocks;
 					current_stat->numfiles--;
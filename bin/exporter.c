@@ -352,6 +352,10 @@ uint64_t total_bytes;
 				total_bytes += ret;
 		}
 
+		// column blocks hold flow records only - no exporter and sampler records
+		if ( nffile->block_header->id == DATA_BLOCK_TYPE_3 ) 
+			continue;
+
 		if ( nffile->block_header->id != DATA_BLOCK_TYPE_2 ) {
 			skipped_blocks++;
 			continue;
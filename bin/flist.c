@@ -65,6 +65,8 @@
 #include "nfdump.h"
 #include "nffile.h"
 #include "flist.h"
+#include "ipindex.h"
+#include "iouring.h"
 
 /*
  * Select a single file
@@ -216,11 +218,51 @@ static struct entry_filter_s {
 
 // globals
 extern uint32_t	twin_first, twin_last;
+extern char 	*CurrentIdent;
 
 static char		*first_file, *last_file;
 static char		*current_file = NULL;
 static stringlist_t source_dirs, file_list;
 
+// read ahead: next file of the list, opened while the current file is processed
+static nffile_t	*prefetch_nffile = NULL;
+static char		*prefetch_file = NULL;
+
+#ifdef HAVE_LINUX_IO_URING_H
+/*
+ * io_uring probe of the upcoming files
+ * With a time window, the next PROBE_DEPTH files of the list are opened and their
+ * file header and stat record are read asynchronously. Files outside the time window
+ * are skipped without any synchronous open or read. For the next ADVISE_DEPTH files
+ * within the time window fadvise(WILLNEED) is issued, so the kernel reads ahead,
+ * while the previous files are processed.
+ */
+#define PROBE_DEPTH		32
+#define ADVISE_DEPTH	2
+#define PROBE_SIZE	(sizeof(file_header_t) + sizeof(stat_record_t))
+
+enum { PROBE_FREE = 0, PROBE_OPEN, PROBE_READ, PROBE_READY, PROBE_ADVISE, PROBE_DONE };
+
+typedef struct probe_s {
+	int		state;
+	int		fd;
+	int		valid;		// header and stat record read successfully
+	int		in_window;	// file matches the time window
+	uint8_t	buff[PROBE_SIZE];
+} probe_t;
+
+static struct probe_ring_s {
+	uring_t	*uring;
+	int		next;		// next file of the list to probe
+	int		current;	// file of the list to be opened
+	int		drain;		// do not queue further operations
+	int		disabled;	// io_uring not available
+	time_t	twin_start;
+	time_t	twin_end;
+	probe_t	probe[PROBE_DEPTH];
+} probe_ring;
+#endif
+
 /* Function prototypes */
 static inline int CheckTimeWindow(uint32_t t_start, uint32_t t_end, stat_record_t *stat_record);
 
@@ -236,6 +278,22 @@ static char *GuessSubDir(char *channeldir, char *filename);
 
 static char *VerifyFileRange(char *path, char *last_file);
 
+static void PrefetchNextFile(nffile_t *nffile, int *cnt, time_t twin_start, time_t twin_end);
+
+#ifdef HAVE_LINUX_IO_URING_H
+static void ProbeSubmit(int index);
+
+static void ProbeDone(probe_t *probe);
+
+static void ProbeAdvise(int index);
+
+static void ProbeComplete(struct io_uring_cqe *cqe);
+
+static void ProbeReset(void);
+#endif
+
+static int ProbeFile(int index, time_t twin_start, time_t twin_end);
+
 /* Functions */
 
 static int compare(const FTSENT **f1, const FTSENT **f2) {
@@ -796,6 +854,9 @@ printf("DGB: short fts: '%s', filer_first: '%s', filter_last: '%s'\n",
 				// skip pcap file
 				if ( strstr(ftsent->fts_name, "pcap") != NULL )
 					continue;
+				// skip IP index file
+				if ( strstr(ftsent->fts_name, IPINDEX_SUFFIX) != NULL )
+					continue;
 
 				if ( file_list_level && (
 					( fts_level != file_list_level ) ||
@@ -992,6 +1053,253 @@ char *GetCurrentFilename(void) {
 	return current_file;
 } // End of GetCurrentFilename
 
+#ifdef HAVE_LINUX_IO_URING_H
+static void ProbeSubmit(int index) {
+probe_t *probe = &probe_ring.probe[index % PROBE_DEPTH];
+struct io_uring_sqe *sqe;
+
+	probe->fd		 = -1;
+	probe->valid	 = 0;
+	probe->in_window = 0;
+
+	sqe = UringGetSQE(probe_ring.uring);
+	if ( !sqe ) {
+		// the file is opened the regular way
+		probe->state = PROBE_DONE;
+		return;
+	}
+	sqe->opcode		= IORING_OP_OPENAT;
+	sqe->fd			= AT_FDCWD;
+	sqe->addr		= (uint64_t)(pointer_addr_t)file_list.list[index];
+	sqe->open_flags	= O_RDONLY;
+	sqe->user_data	= index;
+	probe->state	= PROBE_OPEN;
+
+} // End of ProbeSubmit
+
+static void ProbeDone(probe_t *probe) {
+
+	if ( probe->fd >= 0 ) 
+		close(probe->fd);
+	probe->fd	 = -1;
+	probe->state = PROBE_DONE;
+
+} // End of ProbeDone
+
+static void ProbeAdvise(int index) {
+probe_t *probe = &probe_ring.probe[index % PROBE_DEPTH];
+struct io_uring_sqe *sqe;
+
+	sqe = probe_ring.drain ? NULL : UringGetSQE(probe_ring.uring);
+	if ( !sqe ) {
+		ProbeDone(probe);
+		return;
+	}
+	// start reading the data blocks
+	sqe->opcode			= IORING_OP_FADVISE;
+	sqe->fd				= probe->fd;
+	sqe->off			= 0;
+	sqe->len			= 0;
+	sqe->fadvise_advice	= POSIX_FADV_WILLNEED;
+	sqe->user_data		= index;
+	probe->state		= PROBE_ADVISE;
+
+} // End of ProbeAdvise
+
+static void ProbeComplete(struct io_uring_cqe *cqe) {
+int index = (int)cqe->user_data;
+probe_t *probe = &probe_ring.probe[index % PROBE_DEPTH];
+struct io_uring_sqe *sqe;
+
+	switch (probe->state) {
+		case PROBE_OPEN:
+			if ( cqe->res < 0 ) {
+				ProbeDone(probe);
+				break;
+			}
+			probe->fd = cqe->res;
+			sqe = probe_ring.drain ? NULL : UringGetSQE(probe_ring.uring);
+			if ( !sqe ) {
+				ProbeDone(probe);
+				break;
+			}
+			// file header and stat record
+			sqe->opcode		= IORING_OP_READ;
+			sqe->fd			= probe->fd;
+			sqe->addr		= (uint64_t)(pointer_addr_t)probe->buff;
+			sqe->len		= PROBE_SIZE;
+			sqe->off		= 0;
+			sqe->user_data	= index;
+			probe->state	= PROBE_READ;
+			break;
+		case PROBE_READ: {
+			file_header_t *file_header = (file_header_t *)probe->buff;
+			stat_record_t stat_record;
+			if ( cqe->res == PROBE_SIZE && file_header->magic == MAGIC && 
+				 file_header->version == LAYOUT_VERSION_1 ) {
+				// the stat record follows the file header unaligned
+				memcpy((void *)&stat_record, probe->buff + sizeof(file_header_t), sizeof(stat_record_t));
+				probe->valid	 = 1;
+				probe->in_window = CheckTimeWindow(probe_ring.twin_start, probe_ring.twin_end, &stat_record);
+			}
+			if ( !probe->valid || !probe->in_window || probe_ring.drain ) {
+				ProbeDone(probe);
+				break;
+			}
+			// files further ahead are advised, when they come closer
+			if ( index <= (probe_ring.current + ADVISE_DEPTH) ) 
+				ProbeAdvise(index);
+			else 
+				probe->state = PROBE_READY;
+			} break;
+		case PROBE_ADVISE:
+			ProbeDone(probe);
+			break;
+	}
+
+} // End of ProbeComplete
+
+static void ProbeReset(void) {
+struct io_uring_cqe *cqe;
+int i;
+
+	if ( !probe_ring.uring ) 
+		return;
+
+	// wait for all pending operations
+	probe_ring.drain = 1;
+	UringSubmit(probe_ring.uring, 0);
+	while ( probe_ring.uring->inflight ) {
+		if ( UringSubmit(probe_ring.uring, 1) < 0 ) 
+			break;
+		while ( (cqe = UringPeekCQE(probe_ring.uring)) != NULL ) {
+			ProbeComplete(cqe);
+			UringSeenCQE(probe_ring.uring);
+		}
+	}
+
+	for ( i=0; i<PROBE_DEPTH; i++ ) {
+		if ( probe_ring.probe[i].state != PROBE_FREE ) 
+			ProbeDone(&probe_ring.probe[i]);
+		probe_ring.probe[i].state = PROBE_FREE;
+	}
+
+	UringFree(probe_ring.uring);
+	probe_ring.uring = NULL;
+	probe_ring.drain = 0;
+
+} // End of ProbeReset
+#endif
+
+/*
+ * Returns 0, if file index of the list is known to be outside the time window.
+ * Otherwise the file needs to be opened.
+ */
+static int ProbeFile(int index, time_t twin_start, time_t twin_end) {
+#ifdef HAVE_LINUX_IO_URING_H
+struct io_uring_cqe *cqe;
+probe_t *probe;
+int i, ret;
+
+	// stdin, single files or no time window to skip files
+	if ( probe_ring.disabled || file_list.list[index] == NULL || file_list.num_strings == 1 ||
+		 (twin_start == 0 && twin_end == 0) ) 
+		return 1;
+
+	if ( !probe_ring.uring ) {
+		probe_ring.uring = UringInit(PROBE_DEPTH);
+		if ( !probe_ring.uring ) {
+			probe_ring.disabled = 1;
+			return 1;
+		}
+		probe_ring.next = index;
+	}
+	probe_ring.twin_start = twin_start;
+	probe_ring.twin_end	  = twin_end;
+	probe_ring.current	  = index;
+
+	// the file is opened now - no need to advise
+	probe = &probe_ring.probe[index % PROBE_DEPTH];
+	if ( index < probe_ring.next && probe->state == PROBE_READY ) 
+		ProbeDone(probe);
+
+	// keep PROBE_DEPTH files in flight
+	while ( probe_ring.next < file_list.num_strings && probe_ring.next < (index + PROBE_DEPTH) ) 
+		ProbeSubmit(probe_ring.next++);
+
+	// advise the next files within the time window
+	for ( i=index+1; i<probe_ring.next && i<=(index + ADVISE_DEPTH); i++ ) {
+		if ( probe_ring.probe[i % PROBE_DEPTH].state == PROBE_READY ) 
+			ProbeAdvise(i);
+	}
+
+	if ( UringSubmit(probe_ring.uring, 0) < 0 ) {
+		ProbeReset();
+		probe_ring.disabled = 1;
+		return 1;
+	}
+	while ( probe->state != PROBE_DONE ) {
+		while ( (cqe = UringPeekCQE(probe_ring.uring)) != NULL ) {
+			ProbeComplete(cqe);
+			UringSeenCQE(probe_ring.uring);
+		}
+		if ( probe->state == PROBE_DONE ) 
+			break;
+		// submit queued operations and wait for the next completion
+		if ( UringSubmit(probe_ring.uring, 1) < 0 ) {
+			ProbeReset();
+			probe_ring.disabled = 1;
+			return 1;
+		}
+	}
+	UringSubmit(probe_ring.uring, 0);
+
+	// invalid files are opened to report the error
+	ret = !probe->valid || probe->in_window;
+	probe->state = PROBE_FREE;
+
+	if ( (index + 1) == file_list.num_strings ) 
+		ProbeReset();
+
+	return ret;
+#else
+	return 1;
+#endif
+
+} // End of ProbeFile
+
+void SetFileProbe(int enable) {
+#ifdef HAVE_LINUX_IO_URING_H
+	probe_ring.disabled = !enable;
+#endif
+} // End of SetFileProbe
+
+static void PrefetchNextFile(nffile_t *nffile, int *cnt, time_t twin_start, time_t twin_end) {
+
+	while ( *cnt < file_list.num_strings ) {
+		if ( !ProbeFile(*cnt, twin_start, twin_end) ) {
+			(*cnt)++;
+			continue;
+		}
+		nffile_t *next = OpenFile(file_list.list[*cnt], prefetch_nffile);	// Open the file
+		if ( !next ) 
+			break;
+		prefetch_nffile = next;
+		(*cnt)++;
+
+		if ( CheckTimeWindow(twin_start, twin_end, next->stat_record) ) {
+			prefetch_file = file_list.list[*cnt - 1];
+			StartReadAhead(next);
+			break;
+		} 
+		CloseFile(next);
+	}
+
+	// OpenFile() sets the ident of the last opened file
+	CurrentIdent = nffile->file_header->ident;
+
+} // End of PrefetchNextFile
+
 nffile_t *GetNextFile(nffile_t *nffile, time_t twin_start, time_t twin_end) {
 static int cnt;
 
@@ -1003,6 +1311,25 @@ static int cnt;
 	} else {
 		// is it first time init ?
 		cnt  = 0;
+		if ( prefetch_file ) {
+			CloseFile(prefetch_nffile);
+			prefetch_file = NULL;
+		}
+#ifdef HAVE_LINUX_IO_URING_H
+		ProbeReset();
+#endif
+	}
+
+	if ( prefetch_file ) {
+		// next file is already open - swap it into the caller's file handle
+		nffile_t tmp 	 = *nffile;
+		*nffile 		 = *prefetch_nffile;
+		*prefetch_nffile = tmp;
+
+		current_file  = prefetch_file;
+		prefetch_file = NULL;
+		PrefetchNextFile(nffile, &cnt, twin_start, twin_end);
+		return nffile;
 	}
 
 	// no or no more files available
@@ -1016,6 +1343,10 @@ static int cnt;
 #ifdef DEVEL
 		printf("Process: '%s'\n", file_list.list[cnt] ? file_list.list[cnt] : "<stdin>");
 #endif
+		if ( !ProbeFile(cnt, twin_start, twin_end) ) {
+			cnt++;
+			continue;
+		}
 		nffile = OpenFile(file_list.list[cnt], nffile);	// Open the file
 		if ( !nffile ) {
 			return NULL;
@@ -1031,6 +1362,10 @@ static int cnt;
 
 		if ( CheckTimeWindow(twin_start, twin_end, nffile->stat_record) ) {
 			// printf("Return file: %s\n", string);
+			if ( ReadAheadEnabled() ) {
+				StartReadAhead(nffile);
+				PrefetchNextFile(nffile, &cnt, twin_start, twin_end);
+			}
 			return nffile;
 		} 
 		CloseFile(nffile);
@@ -43,6 +43,7 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <pthread.h>
+#include <sched.h>
 #include <assert.h>
 
 #include "util.h"
@@ -53,44 +54,100 @@
 #include "netflow_pcap.h"
 #include "flowtree.h"
 
-static void spin_lock(int *p);
-static void spin_unlock(int volatile *p);
+static int FlowNodeCMP(struct FlowNode *e1, struct FlowNode *e2);
 
-static void spin_lock(int *p) {
-    while(!__sync_bool_compare_and_swap(p, 0, 1));
-}
+static inline uint32_t FlowNodeHash(struct FlowNode *node);
 
-static void spin_unlock(int volatile *p) {
-    __asm volatile (""); // acts as a memory barrier.
-    *p = 0;
-}
+static inline void PushFreeBatches(struct FlowNode *first, struct FlowNode *last, uint32_t num);
 
-#define GetTreeLock(a)		spin_lock(&((a)->list_lock))
-#define ReleaseTreeLock(a)	spin_unlock(&((a)->list_lock))
+static int RefillLocalNodes(void);
 
+static void ReturnLocalNodes(void);
 
-static int FlowNodeCMP(struct FlowNode *e1, struct FlowNode *e2);
+static inline struct FlowNode *TryPop_Node(NodeList_t *NodeList, int *busy);
+
+static struct FlowNode *GrowNodePool(void);
+
+static inline void Schedule_Node(struct FlowNode *node);
+
+static void GrowFlowShard(void);
 
-// Insert the IP RB tree code here
-RB_GENERATE(FlowTree, FlowNode, entry, FlowNodeCMP);
+static void WakeNodeLists(void);
 
-// Flow Cache to store all nodes
+static int NodesStarved(void);
+
+// Flow Cache to store all nodes - the upper limit of the node pool
 static uint32_t FlowCacheSize = 512 * 1024;
 static uint32_t expireActiveTimeout = 300;
 static uint32_t expireInactiveTimeout = 60;
-static struct FlowNode *FlowElementCache;
 
-// free list 
-static struct FlowNode *FlowNode_FreeList;
+/*
+ * node pool
+ * Each thread allocates from and frees into its private node cache. Freed nodes are
+ * returned as a batch to the shared free stack. The free stack is a stack of batches:
+ * the nodes of a batch are linked by their right pointer, the first nodes of the 
+ * batches by their left pointer. An allocating thread, whose cache runs empty, takes 
+ * the free stack at once, keeps the first batch and pushes back the rest. 
+ * The pool grows in chunks of nodes on demand up to FlowCacheSize. The mutex is only
+ * used to grow the pool and to wait for free nodes, if the pool is exhausted.
+ * A waiting thread wakes up the flow threads periodically, as only they can return
+ * nodes by expiring flows, even if their queues run empty.
+ */
+#define NODE_BATCH	256
+#define NODE_REFILL	(4 * NODE_BATCH)
+#define NODE_CHUNK	(64 * NODE_REFILL)	// 64k nodes
+#define BatchSize(n) ((n)->hash)	// number of nodes in the batch - first node only
+
+typedef struct NodeChunk_s {
+	struct NodeChunk_s	*next;
+	struct FlowNode		*nodes;
+} NodeChunk_t;
+
+static NodeChunk_t *NodeChunks;
+static uint32_t	PoolSize;					// nodes allocated in all chunks
+static struct FlowNode *FreeStack;
+static uint32_t	FreeNodes;					// nodes in the free stack and in batches being taken from it
 static pthread_mutex_t m_FreeList = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t  c_FreeList = PTHREAD_COND_INITIALIZER;
-static uint32_t	EmptyFreeList;
+static uint32_t	EmptyFreeList;				// number of threads waiting for nodes
 static uint32_t	EmptyFreeListEvents = 0;
-static uint32_t	Allocated;
+static int32_t	Allocated;			// nodes taken from the pool
+static uint32_t	CacheExhausted;		// exhausted cache already logged
+static NodeList_t *NodeLists;		// queues of all flow threads
 
-// Flow tree
-static FlowTree_t *FlowTree;
-static int NumFlows = 0;
+static __thread struct FlowNode *LocalFreeList;
+static __thread uint32_t LocalFree;		// number of nodes in LocalFreeList
+static __thread int32_t  LocalAllocated;	// not yet accounted in Allocated
+
+/*
+ * flow table
+ * Each flow thread owns its shard of the flow table and is the only one to insert, 
+ * lookup and remove nodes - so no locking is needed. Nodes are hashed on the flow key.
+ * Each shard also keeps a timer wheel with one slot per second to expire flows. 
+ * A flow is linked into the slot of its earliest possible expire time. Packets of 
+ * a flow only update t_last - the flow is moved lazily, when its slot is due and the 
+ * flow turns out to be still active. Expire_FlowTree() therefore only touches the flows 
+ * of the slots due since the last run. The timeouts are limited to 3600s, therefore
+ * a single wheel covers all expire times.
+ * The hash table of a shard starts small and doubles, when the average chain length 
+ * exceeds 2, up to the size needed for a full node cache.
+ */
+#define WHEEL_SIZE	4096
+#define WHEEL_MASK	(WHEEL_SIZE - 1)
+#define SHARD_BUCKETS	4096	// initial number of buckets
+
+typedef struct FlowShard_s {
+	struct FlowNode **bucket;
+	uint32_t	mask;
+	uint32_t	maxmask;	// mask of the largest table
+	uint32_t	NumFlows;
+	struct FlowNode **wheel;
+	time_t		t_wheel;	// next second to expire - 0: not yet set
+	time_t		t_clock;	// time of the last processed packet
+} FlowShard_t;
+
+static __thread FlowShard_t FlowShard;
+static uint32_t TotalFlows;		// flows in all shards
 
 // Simple unprotected list
 typedef struct FlowNode_list_s {
@@ -100,34 +157,164 @@ typedef struct FlowNode_list_s {
 } Linked_list_t;
 
 /* Free list handling functions */
-// Get next free node from free list
-struct FlowNode *New_Node(void) {
-struct FlowNode *node;
 
-	pthread_mutex_lock(&m_FreeList);
-    while ( FlowNode_FreeList == NULL ) {
-		EmptyFreeList = 1;
-		EmptyFreeListEvents++;
-        pthread_cond_wait(&c_FreeList, &m_FreeList);
-	}
+// push a list of batches linked by their left pointer onto the free stack
+// num: number of nodes added to the free nodes - 0 for batches pushed back by an allocator
+static inline void PushFreeBatches(struct FlowNode *first, struct FlowNode *last, uint32_t num) {
 
-	node = FlowNode_FreeList;
-	if ( node == NULL ) {
-		// should never happen , as we were waiting for a free node
-		LogError("*** Software ERROR *** New_Node() unexpected error in %s line %d: %s: %u\n", 
-			__FILE__, __LINE__, "Node list exhausted", NumFlows);
+	// count the nodes before they become visible - the pool is never seen exhausted too early
+	if ( num ) 
+		__atomic_add_fetch(&FreeNodes, num, __ATOMIC_SEQ_CST);
+
+	last->left = __atomic_load_n(&FreeStack, __ATOMIC_RELAXED);
+	while ( !__atomic_compare_exchange_n(&FreeStack, &last->left, first, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED) )
+		;
+
+	// wake up allocators waiting for nodes
+	if ( __atomic_load_n(&EmptyFreeList, __ATOMIC_SEQ_CST) ) {
+		pthread_mutex_lock(&m_FreeList);
+		pthread_cond_broadcast(&c_FreeList);
 		pthread_mutex_unlock(&m_FreeList);
+	}
+
+} // End of PushFreeBatches
+
+// allocate a new chunk of nodes - returns the list of its batches, NULL if the pool reached its limit
+// must be called with m_FreeList locked
+static struct FlowNode *GrowNodePool(void) {
+NodeChunk_t *chunk;
+struct FlowNode *nodes;
+uint32_t i, size;
+
+	if ( PoolSize >= FlowCacheSize )
+		return NULL;
+
+	size = FlowCacheSize - PoolSize;
+	if ( size > NODE_CHUNK ) 
+		size = NODE_CHUNK;
+
+	chunk = (NodeChunk_t *)malloc(sizeof(NodeChunk_t));
+	nodes = (struct FlowNode *)calloc(size, sizeof(struct FlowNode));
+	if ( !chunk || !nodes ) {
+		LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
+		free(chunk);
+		free(nodes);
 		return NULL;
 	}
+
+	// link the nodes in batches of NODE_REFILL nodes
+	for (i=0; i < size; i++ ) {
+		nodes[i].memflag = NODE_FREE;
+		if ( (i % NODE_REFILL) == 0 ) {
+			// first node of a batch
+			BatchSize(&nodes[i]) = (size - i) < NODE_REFILL ? size - i : NODE_REFILL;
+			nodes[i].left = (i + NODE_REFILL) < size ? &nodes[i+NODE_REFILL] : NULL;
+		}
+		nodes[i].right = ((i + 1) % NODE_REFILL) && (i + 1) < size ? &nodes[i+1] : NULL;
+	}
+
+	chunk->nodes = nodes;
+	chunk->next	 = NodeChunks;
+	NodeChunks	 = chunk;
+	__atomic_add_fetch(&PoolSize, size, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&FreeNodes, size, __ATOMIC_SEQ_CST);
+
+	return nodes;
+
+} // End of GrowNodePool
+
+static int RefillLocalNodes(void) {
+struct FlowNode *batch, *last, *empty;
+
+	// take all batches of the free stack at once
+	batch = __atomic_exchange_n(&FreeStack, NULL, __ATOMIC_ACQUIRE);
+	if ( batch == NULL ) {
+		pthread_mutex_lock(&m_FreeList);
+		// another thread may have grown the pool meanwhile
+		batch = __atomic_exchange_n(&FreeStack, NULL, __ATOMIC_SEQ_CST);
+		if ( batch == NULL ) 
+			batch = GrowNodePool();
+		if ( batch == NULL ) {
+			// pool exhausted - wait for returned nodes
+			__atomic_add_fetch(&EmptyFreeList, 1, __ATOMIC_SEQ_CST);
+			EmptyFreeListEvents++;
+			while ( (batch = __atomic_exchange_n(&FreeStack, NULL, __ATOMIC_SEQ_CST)) == NULL ) {
+				struct timespec ts;
+				// idle flow threads expire their flows, when woken up
+				WakeNodeLists();
+				clock_gettime(CLOCK_REALTIME, &ts);
+				ts.tv_sec++;
+				pthread_cond_timedwait(&c_FreeList, &m_FreeList, &ts);
+			}
+			__atomic_sub_fetch(&EmptyFreeList, 1, __ATOMIC_SEQ_CST);
+		}
+		pthread_mutex_unlock(&m_FreeList);
+	}
+
+	// keep the first batch and give back the rest
+	LocalFreeList = batch;
+	LocalFree	  = BatchSize(batch);
+	__atomic_sub_fetch(&FreeNodes, LocalFree, __ATOMIC_SEQ_CST);
+	if ( batch->left ) {
+		empty = NULL;
+		// usually the stack is still empty - otherwise link the rest below the new batches
+		if ( __atomic_compare_exchange_n(&FreeStack, &empty, batch->left, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED) ) {
+			if ( __atomic_load_n(&EmptyFreeList, __ATOMIC_SEQ_CST) ) {
+				pthread_mutex_lock(&m_FreeList);
+				pthread_cond_broadcast(&c_FreeList);
+				pthread_mutex_unlock(&m_FreeList);
+			}
+		} else {
+			last = batch->left;
+			while ( last->left ) 
+				last = last->left;
+			PushFreeBatches(batch->left, last, 0);
+		}
+		batch->left = NULL;
+	}
+
+	return 1;
+
+} // End of RefillLocalNodes
+
+// return the private node cache to the free stack
+static void ReturnLocalNodes(void) {
+
+	if ( LocalAllocated ) {
+		__atomic_add_fetch(&Allocated, LocalAllocated, __ATOMIC_RELAXED);
+		LocalAllocated = 0;
+	}
+
+	if ( LocalFreeList == NULL ) 
+		return;
+
+	BatchSize(LocalFreeList) = LocalFree;
+	PushFreeBatches(LocalFreeList, LocalFreeList, LocalFree);
+	LocalFreeList = NULL;
+	LocalFree	  = 0;
+
+} // End of ReturnLocalNodes
+
+// Get next free node from free list
+struct FlowNode *New_Node(void) {
+struct FlowNode *node;
+
+	if ( LocalFreeList == NULL && !RefillLocalNodes() ) 
+		return NULL;
+
+	node = LocalFreeList;
 	if ( node->memflag != NODE_FREE ) {
 		LogError("*** Software ERROR *** New_Node() unexpected error in %s line %d: %s\n", 
 			__FILE__, __LINE__, "Tried to allocate a non free Node");
 		abort();
 	}
 
-	FlowNode_FreeList = node->right;
-	Allocated++;
-	pthread_mutex_unlock(&m_FreeList);
+	LocalFreeList = node->right;
+	LocalFree--;
+	if ( ++LocalAllocated >= NODE_BATCH ) {
+		__atomic_add_fetch(&Allocated, LocalAllocated, __ATOMIC_RELAXED);
+		LocalAllocated = 0;
+	}
 
 	node->left 	  = NULL;
 	node->right	  = NULL;
@@ -140,6 +327,11 @@ struct FlowNode *node;
 // return node into free list
 void Free_Node(struct FlowNode *node) {
 
+	if ( node->memflag == NODE_SIGNAL ) {
+		free(node);
+		return;
+	}
+
 	if ( node->memflag == NODE_FREE ) {
 		LogError("Free_Node() Fatal: Tried to free an already freed Node");
 		abort();
@@ -155,43 +347,66 @@ void Free_Node(struct FlowNode *node) {
 
 	memset((void *)node, 0, sizeof(struct FlowNode));
 
-	pthread_mutex_lock(&m_FreeList);
-	node->right = FlowNode_FreeList;
-	node->left  = NULL;
+	node->right = LocalFreeList;
 	node->memflag = NODE_FREE;
-	FlowNode_FreeList = node;
-	Allocated--;
-	if ( EmptyFreeList ) {
-		EmptyFreeList = 0;
-		pthread_cond_signal(&c_FreeList);
+	LocalFreeList = node;
+	if ( --LocalAllocated <= -NODE_BATCH ) {
+		__atomic_add_fetch(&Allocated, LocalAllocated, __ATOMIC_RELAXED);
+		LocalAllocated = 0;
 	}
-	pthread_mutex_unlock(&m_FreeList);
+	if ( ++LocalFree > NODE_REFILL ) 
+		ReturnLocalNodes();
 
 } // End of Free_Node
 
-/* safety check - this must never become 0 - otherwise the cache is too small */
+/* 
+ * safety check - this must never become 0 - otherwise the cache is too small 
+ * Allocated lags behind by the batches of all threads and does not count the nodes in the
+ * private caches, therefore the pool is checked directly: it is exhausted, if it reached 
+ * its limit and no free nodes are left. FreeNodes is used instead of the free stack, which
+ * is empty for a moment, whenever a thread takes it to pick a batch. Threads waiting for 
+ * nodes can not make progress until a flow thread returns nodes.
+ * The messages are logged once, until less than half of the cache is used again.
+ */
+#define NodesExhausted() (__atomic_load_n(&FreeNodes, __ATOMIC_SEQ_CST) == 0 && \
+	__atomic_load_n(&PoolSize, __ATOMIC_RELAXED) >= FlowCacheSize)
+#define NodesWaiting() (__atomic_load_n(&EmptyFreeList, __ATOMIC_RELAXED) > 0)
+
 void CacheCheck(FlowSource_t *fs, time_t when, int live) {
 uint32_t num;
 
 // live = 1;
+	FlowShard.t_clock = when;
+
 	// if the cache is exhausted - force expire now
-	if (FlowCacheSize == NumFlows || (live && FlowNode_FreeList == NULL) ) {
-		LogInfo("Node cache exhausted! - Force expire");	
+	if (FlowCacheSize == TotalFlows || (live && (NodesExhausted() || NodesWaiting())) ) {
+		if ( (__atomic_fetch_or(&CacheExhausted, 1, __ATOMIC_RELAXED) & 1) == 0 )
+			LogInfo("Node cache exhausted! - Force expire");	
 		Expire_FlowTree(fs, when);
+		// hand the expired nodes to the waiting threads
+		ReturnLocalNodes();
+	} else {
+		// the cache recovered, once less than half of it is used
+		if ( __atomic_load_n(&CacheExhausted, __ATOMIC_RELAXED) && 
+			 __atomic_load_n(&TotalFlows, __ATOMIC_RELAXED) < (FlowCacheSize >> 1) ) 
+			__atomic_store_n(&CacheExhausted, 0, __ATOMIC_RELAXED);
+		return;
 	}
 
 	// if still exhausted force flush of all flows
-	if (FlowCacheSize == NumFlows || (live && FlowNode_FreeList == NULL)) {
-		LogError("Node cache exhausted! - Force immediate flush - increase flow cache > %u", FlowCacheSize);	
+	if (FlowCacheSize == TotalFlows || (live && NodesExhausted() && NodesWaiting())) {
 		num  = Flush_FlowTree(fs);
-		LogError("Expired flows: %u", num);	
+		ReturnLocalNodes();
+		if ( (__atomic_fetch_or(&CacheExhausted, 2, __ATOMIC_RELAXED) & 2) == 0 ) {
+			LogError("Node cache exhausted! - Force immediate flush - increase flow cache > %u", FlowCacheSize);	
+			LogError("Expired flows: %u", num);	
+		}
 	}
 
 } // End of CacheCheck
 
 /* flow tree functions */
 int Init_FlowTree(uint32_t CacheSize, int32_t expireActive, int32_t expireInactive) {
-int i;
 
 	if ( expireActive ) {
 		if ( expireActive < 0 || expireActive > 3600 ) {
@@ -211,63 +426,92 @@ int i;
 		LogInfo("Set inactive flow expire timout to %us", expireInactiveTimeout);
 	}
 
-	FlowTree = malloc(sizeof(FlowTree_t));
-	if ( !FlowTree ) {
-		LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
-		return 0;
-	}
-	RB_INIT(FlowTree);
-
-	if ( CacheSize == 0 )
-		CacheSize = FlowCacheSize;
-	else
+	if ( CacheSize )
 		FlowCacheSize = CacheSize;
 
-	FlowElementCache = calloc(CacheSize, sizeof(struct FlowNode));
-	if ( !FlowElementCache ) {
-		LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
-		free(FlowTree);
-		FlowTree = NULL;
+	if ( FlowCacheSize <= 2 * NODE_BATCH ) {
+		LogError("Node cache size %u too small", FlowCacheSize);
 		return 0;
 	}
 
-	// init free list
-	FlowNode_FreeList 		   = FlowElementCache;
-	FlowNode_FreeList->left    = NULL;
-	FlowNode_FreeList->right   = &FlowElementCache[1];
-	FlowNode_FreeList->memflag = NODE_FREE;
-	for (i=1; i < (CacheSize-1); i++ ) {
-		FlowElementCache[i].memflag = NODE_FREE;
-		FlowElementCache[i].left  = &FlowElementCache[i-1];
-		FlowElementCache[i].right = &FlowElementCache[i+1];
-	}
-	FlowElementCache[i].left  	= &FlowElementCache[i-1];
-	FlowElementCache[i].right 	= NULL;
-	FlowElementCache[i].memflag = NODE_FREE;
+	// start with the first chunk of nodes - the pool grows on demand
+	NodeChunks = NULL;
+	PoolSize   = 0;
+	FreeNodes  = 0;
+	FreeStack  = GrowNodePool();
+	if ( !FreeStack )
+		return 0;
 
 	EmptyFreeList = 0;
 	Allocated 	  = 0;
-	NumFlows 	  = 0;
+	TotalFlows	  = 0;
 
 	return 1;
 } // End of Init_FlowTree
 
 void Dispose_FlowTree(void) {
-struct FlowNode *node, *nxt;
+NodeChunk_t *chunk;
 
-	// Dump all incomplete flows to the file
-	nxt = NULL;
-	for (node = RB_MIN(FlowTree, FlowTree); node != NULL; node = nxt) {
-		nxt = RB_NEXT(FlowTree, FlowTree, node);
-		Remove_Node(node);
-	}
-	free(FlowElementCache);
-	FlowElementCache 	 = NULL;
-	FlowNode_FreeList 	 = NULL;
+	while ( NodeChunks ) {
+		chunk = NodeChunks;
+		NodeChunks = chunk->next;
+		free(chunk->nodes);
+		free(chunk);
+	}
+	PoolSize	  = 0;
+	FreeNodes	  = 0;
+	FreeStack	  = NULL;
 	EmptyFreeList = 0;
 
 } // End of Dispose_FlowTree
 
+// setup the flow table shard of the calling flow thread
+int Init_FlowShard(void) {
+uint32_t size, maxsize;
+
+	// the largest table has an average chain length of 2 with a full node cache
+	maxsize = 1;
+	while ( maxsize < (FlowCacheSize >> 1) ) 
+		maxsize <<= 1;
+	size = maxsize < SHARD_BUCKETS ? maxsize : SHARD_BUCKETS;
+
+	FlowShard.bucket = (struct FlowNode **)calloc(size, sizeof(struct FlowNode *));
+	if ( !FlowShard.bucket ) {
+		LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+	FlowShard.mask	   = size - 1;
+	FlowShard.maxmask  = maxsize - 1;
+	FlowShard.NumFlows = 0;
+
+	FlowShard.wheel = (struct FlowNode **)calloc(WHEEL_SIZE, sizeof(struct FlowNode *));
+	if ( !FlowShard.wheel ) {
+		LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+	FlowShard.t_wheel = 0;
+	FlowShard.t_clock = 0;
+
+	return 1;
+
+} // End of Init_FlowShard
+
+void Dispose_FlowShard(void) {
+uint32_t i;
+
+	for ( i=0; FlowShard.bucket && i<=FlowShard.mask; i++ ) {
+		while ( FlowShard.bucket[i] ) 
+			Remove_Node(FlowShard.bucket[i]);
+	}
+	free(FlowShard.bucket);
+	FlowShard.bucket = NULL;
+	free(FlowShard.wheel);
+	FlowShard.wheel = NULL;
+
+	ReturnLocalNodes();
+
+} // End of Dispose_FlowShard
+
 static int FlowNodeCMP(struct FlowNode *e1, struct FlowNode *e2) {
 uint64_t    *a = e1->src_addr.v6;
 uint64_t    *b = e2->src_addr.v6;
@@ -280,32 +524,128 @@ int i;
  
 } // End of FlowNodeCMP
 
+static inline uint32_t FlowNodeHash(struct FlowNode *node) {
+uint64_t h;
+
+	h = (node->src_addr.v6[0] ^ node->dst_addr.v6[0]) * 0x9E3779B97F4A7C15ULL;
+	h ^= node->src_addr.v6[1] * 0xC2B2AE3D27D4EB4FULL;
+	h ^= node->dst_addr.v6[1] * 0x165667B19E3779F9ULL;
+	h ^= ((uint64_t)node->src_port << 32 | (uint64_t)node->dst_port << 16 | 
+		  (uint64_t)node->proto << 8 | node->version) * 0x27D4EB2F165667C5ULL;
+	h ^= h >> 29;
+
+	return (uint32_t)(h ^ (h >> 32));
+
+} // End of FlowNodeHash
+
+// link the node into the wheel slot of its earliest expire time
+static inline void Schedule_Node(struct FlowNode *node) {
+struct FlowNode **slot;
+time_t t_expire, t_inactive;
+
+	// a flow expires, once a timeout is exceeded
+	t_expire   = node->t_first.tv_sec + expireActiveTimeout;
+	t_inactive = node->t_last.tv_sec + expireInactiveTimeout;
+	if ( t_inactive < t_expire ) 
+		t_expire = t_inactive;
+	t_expire++;
+
+	if ( FlowShard.t_wheel == 0 ) 
+		FlowShard.t_wheel = node->t_first.tv_sec;
+
+	// keep the expire time within the range of the wheel
+	if ( t_expire < FlowShard.t_wheel ) 
+		t_expire = FlowShard.t_wheel;
+	else if ( t_expire >= (FlowShard.t_wheel + WHEEL_SIZE) ) 
+		t_expire = FlowShard.t_wheel + WHEEL_SIZE - 1;
+
+	slot = &FlowShard.wheel[t_expire & WHEEL_MASK];
+	node->wheel_next = *slot;
+	node->wheel_prev = slot;
+	if ( *slot ) 
+		(*slot)->wheel_prev = &node->wheel_next;
+	*slot = node;
+
+} // End of Schedule_Node
+
+// double the hash table of the shard
+static void GrowFlowShard(void) {
+struct FlowNode **bucket, *node, *nxt;
+uint32_t i, mask;
+
+	mask   = (FlowShard.mask << 1) | 1;
+	bucket = (struct FlowNode **)calloc(mask + 1, sizeof(struct FlowNode *));
+	if ( !bucket ) {
+		LogError("calloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
+		// continue with longer chains
+		FlowShard.maxmask = FlowShard.mask;
+		return;
+	}
+
+	for ( i=0; i<=FlowShard.mask; i++ ) {
+		for ( node = FlowShard.bucket[i]; node != NULL; node = nxt ) {
+			nxt = node->hash_next;
+			node->hash_next = bucket[node->hash & mask];
+			bucket[node->hash & mask] = node;
+		}
+	}
+
+	free(FlowShard.bucket);
+	FlowShard.bucket = bucket;
+	FlowShard.mask	 = mask;
+
+} // End of GrowFlowShard
+
 struct FlowNode *Lookup_Node(struct FlowNode *node) {
-	return RB_FIND(FlowTree, FlowTree, node);
-} // End of Lookup_FlowTree
+struct FlowNode *n;
+uint32_t hash = FlowNodeHash(node);
+
+	n = FlowShard.bucket[hash & FlowShard.mask];
+	while ( n ) {
+		if ( n->hash == hash && FlowNodeCMP(n, node) == 0 ) 
+			return n;
+		n = n->hash_next;
+	}
+	return NULL;
+
+} // End of Lookup_Node
 
 struct FlowNode *Insert_Node(struct FlowNode *node) {
 struct FlowNode *n;
+uint32_t hash = FlowNodeHash(node);
+uint32_t slot = hash & FlowShard.mask;
 
 	dbg_assert(node->left == NULL);
 	dbg_assert(node->right == NULL);
 
-	// return RB_INSERT(FlowTree, FlowTree, node);
-	n = RB_INSERT(FlowTree, FlowTree, node);
-	if ( n ) { // existing node
-		return n;
-	} else {
-		NumFlows++;
-		return NULL;
+	n = FlowShard.bucket[slot];
+	while ( n ) {
+		if ( n->hash == hash && FlowNodeCMP(n, node) == 0 ) 
+			// existing node
+			return n;
+		n = n->hash_next;
 	}
+
+	node->hash		= hash;
+	node->hash_next	= FlowShard.bucket[slot];
+	FlowShard.bucket[slot] = node;
+	Schedule_Node(node);
+	FlowShard.NumFlows++;
+	__atomic_add_fetch(&TotalFlows, 1, __ATOMIC_RELAXED);
+
+	if ( FlowShard.NumFlows > (FlowShard.mask << 1) && FlowShard.mask < FlowShard.maxmask ) 
+		GrowFlowShard();
+
+	return NULL;
+
 } // End of Insert_Node
 
 void Remove_Node(struct FlowNode *node) {
-struct FlowNode *rev_node;
+struct FlowNode *rev_node, **n;
 
 #ifdef DEVEL
 	assert(node->memflag == NODE_IN_USE);
-	if ( NumFlows == 0 ) {
+	if ( FlowShard.NumFlows == 0 ) {
 		LogError("Remove_Node() Fatal Tried to remove a Node from empty tree");
 		return;
 	}
@@ -318,9 +658,26 @@ struct FlowNode *rev_node;
 		rev_node->rev_node = NULL;
 		node->rev_node	   = NULL;
 	}
-	RB_REMOVE(FlowTree, FlowTree, node);
+
+	n = &FlowShard.bucket[node->hash & FlowShard.mask];
+	while ( *n && *n != node ) 
+		n = &((*n)->hash_next);
+	if ( *n ) 
+		*n = node->hash_next;
+	node->hash_next = NULL;
+
+	// unlink from the timer wheel
+	if ( node->wheel_prev ) {
+		*node->wheel_prev = node->wheel_next;
+		if ( node->wheel_next ) 
+			node->wheel_next->wheel_prev = node->wheel_prev;
+		node->wheel_next = NULL;
+		node->wheel_prev = NULL;
+	}
+
 	Free_Node(node);
-	NumFlows--;
+	FlowShard.NumFlows--;
+	__atomic_sub_fetch(&TotalFlows, 1, __ATOMIC_RELAXED);
 
 } // End of Remove_Node
 
@@ -361,26 +718,28 @@ struct FlowNode lookup_node, *rev_node;
 
 uint32_t Flush_FlowTree(FlowSource_t *fs) {
 struct FlowNode *node, *nxt;
-uint32_t n = NumFlows;
+uint32_t i, n = FlowShard.NumFlows;
 
 	// Dump all incomplete flows to the file
-	nxt = NULL;
-	for (node = RB_MIN(FlowTree, FlowTree); node != NULL; node = nxt) {
-		StorePcapFlow(fs, node);
-		nxt = RB_NEXT(FlowTree, FlowTree, node);
+	for ( i=0; i<=FlowShard.mask; i++ ) {
+		for (node = FlowShard.bucket[i]; node != NULL; node = nxt) {
+			StorePcapFlow(fs, node);
+			nxt = node->hash_next;
 #ifdef DEVEL
 if ( node->left || node->right ) {
 	assert(node->proto == 17);
 	 node->left = node->right = NULL;
 }
 #endif
-		Remove_Node(node);
+			Remove_Node(node);
+		}
 	}
 
 #ifdef DEVEL
-	if ( NumFlows != 0 )
-		LogError("### Flush_FlowTree() remaining flows: %u\n", NumFlows);
+	if ( FlowShard.NumFlows != 0 )
+		LogError("### Flush_FlowTree() remaining flows: %u\n", FlowShard.NumFlows);
 #endif
+	FlowShard.t_wheel = 0;
 
 	return n;
 
@@ -388,53 +747,81 @@ if ( node->left || node->right ) {
 
 uint32_t Expire_FlowTree(FlowSource_t *fs, time_t when) {
 struct FlowNode *node, *nxt;
+uint32_t expireCnt;
 
-	if ( NumFlows == 0 )
-		return NumFlows;
+	if ( FlowShard.NumFlows == 0 ) {
+		// restart the wheel with the next flow
+		FlowShard.t_wheel = 0;
+		return FlowShard.NumFlows;
+	}
 
-	uint32_t expireCnt = 0;
-	// Dump all incomplete flows to the file
-	nxt = NULL;
-	for (node = RB_MIN(FlowTree, FlowTree); node != NULL; node = nxt) {
-		nxt = RB_NEXT(FlowTree, FlowTree, node);
-		if ( when == 0 || 
-			 (when - node->t_last.tv_sec) > expireInactiveTimeout || 
-			 (when - node->t_first.tv_sec) > expireActiveTimeout) {
-			StorePcapFlow(fs, node);
-			Remove_Node(node);
-			expireCnt++;
+	if ( when == 0 ) {
+		Flush_FlowTree(fs);
+		return FlowShard.NumFlows;
+	}
+
+	// after a long gap, every slot is due once
+	if ( (when - FlowShard.t_wheel) >= WHEEL_SIZE ) 
+		FlowShard.t_wheel = when - WHEEL_SIZE + 1;
+
+	expireCnt = 0;
+	// process the slots of all seconds up to when
+	while ( FlowShard.t_wheel <= when ) {
+		struct FlowNode **slot = &FlowShard.wheel[FlowShard.t_wheel & WHEEL_MASK];
+
+		// take the slot list - still active flows are scheduled again
+		node  = *slot;
+		*slot = NULL;
+		FlowShard.t_wheel++;
+		for ( ; node != NULL; node = nxt) {
+			nxt = node->wheel_next;
+			node->wheel_next = NULL;
+			node->wheel_prev = NULL;
+			if ( (when - node->t_last.tv_sec) > expireInactiveTimeout || 
+				 (when - node->t_first.tv_sec) > expireActiveTimeout) {
+				StorePcapFlow(fs, node);
+				Remove_Node(node);
+				expireCnt++;
+			} else {
+				Schedule_Node(node);
+			}
 		}
 	}
 	if ( expireCnt ) 
-		LogInfo("Expired Nodes: %u, in use: %u, total flows: %u", 
-			expireCnt, Allocated, NumFlows);
+		LogInfo("Expired Nodes: %u, in use: %d, total flows: %u", 
+			expireCnt, Allocated, FlowShard.NumFlows);
 	
-	return NumFlows;
+	return FlowShard.NumFlows;
 } // End of Expire_FlowTree
 
 /* Node list functions */
 NodeList_t *NewNodeList(void) {
 NodeList_t *NodeList;
 
-	NodeList = (NodeList_t *)malloc(sizeof(NodeList_t));
+	NodeList = (NodeList_t *)calloc(1, sizeof(NodeList_t));
 	if ( !NodeList ) {
 		LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
 		return NULL;
 	}
-	NodeList->list 		= NULL;
-	NodeList->last 		= NULL;
+	NodeList->head 		= &NodeList->stub;
+	NodeList->tail 		= &NodeList->stub;
 	NodeList->length	= 0;
-	NodeList->list_lock	= 0;
 	NodeList->waiting	= 0;
 	NodeList->waits		= 0;
 	pthread_mutex_init(&NodeList->m_list, NULL);
 	pthread_cond_init(&NodeList->c_list, NULL);
 
+	pthread_mutex_lock(&m_FreeList);
+	NodeList->next = NodeLists;
+	NodeLists = NodeList;
+	pthread_mutex_unlock(&m_FreeList);
+
 	return NodeList;
 
 } // End of NewNodeList
 
 void DisposeNodeList(NodeList_t *NodeList) {
+NodeList_t **n;
 
 	if ( !NodeList )
 		return;
@@ -443,153 +830,301 @@ void DisposeNodeList(NodeList_t *NodeList) {
 		LogError("Try to free non empty NodeList");
 		return;
 	}
+
+	pthread_mutex_lock(&m_FreeList);
+	n = &NodeLists;
+	while ( *n && *n != NodeList ) 
+		n = &((*n)->next);
+	if ( *n ) 
+		*n = NodeList->next;
+	pthread_mutex_unlock(&m_FreeList);
+
  	free(NodeList);
 
 } // End of DisposeNodeList
 
+void Push_Node(NodeList_t *NodeList, struct FlowNode *node) {
+struct FlowNode *prev;
+
+	node->left  = NULL;
+	node->right = NULL;
+
+	// link the node at head - the previous head gets linked to the new node
+	prev = __atomic_exchange_n(&NodeList->head, node, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&prev->right, node, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&NodeList->length, 1, __ATOMIC_RELAXED);
+
 #ifdef DEVEL
-void ListCheck(NodeList_t *NodeList);
-void ListCheck(NodeList_t *NodeList) {
-uint32_t len = 0, mem = 0, proto;
-static uint32_t loops = 0;
-struct FlowNode *node, *n;
-	
-//	DumpList(NodeList);
-	loops++;
-	node = NodeList->list;
-	while (node) {
-		len++;
-		if ( node == NodeList->last ) {
-			mem = len;
+	printf("pushed node 0x%llx proto: %u, length: %u\n", 
+		(unsigned long long)node, node->proto, NodeList->length);
+#endif
+
+	// wake up the consumer, if it is sleeping
+	if ( __atomic_load_n(&NodeList->waiting, __ATOMIC_SEQ_CST) ) {
+		pthread_mutex_lock(&NodeList->m_list);
+		pthread_cond_signal(&NodeList->c_list);
+		pthread_mutex_unlock(&NodeList->m_list);
+	}
+
+} // End of Push_Node
+
+// single consumer pop - returns NULL with busy set, if a producer is in the middle of a push
+static inline struct FlowNode *TryPop_Node(NodeList_t *NodeList, int *busy) {
+struct FlowNode *tail, *next;
+
+	*busy = 0;
+	tail = NodeList->tail;
+	next = __atomic_load_n(&tail->right, __ATOMIC_ACQUIRE);
+	if ( tail == &NodeList->stub ) {
+		if ( next == NULL ) {
+			*busy = __atomic_load_n(&NodeList->head, __ATOMIC_SEQ_CST) != tail;
+			return NULL;
 		}
-		if ( node->memflag != NODE_IN_USE ) {
-			printf("mem flag error : len: %u, last: %u, Nodelist: %u, loops: %u\n", len, mem, NodeList->length, loops);
+		NodeList->tail = next;
+		tail = next;
+		next = __atomic_load_n(&next->right, __ATOMIC_ACQUIRE);
+	}
+
+	if ( next == NULL ) {
+		if ( tail != __atomic_load_n(&NodeList->head, __ATOMIC_SEQ_CST) ) {
+			*busy = 1;
+			return NULL;
 		}
-		if ( node->right == NULL ) {
-			proto = node->proto;
-			n = node;
+		// last node in queue - put the stub back behind it
+		Push_Node(NodeList, &NodeList->stub);
+		__atomic_sub_fetch(&NodeList->length, 1, __ATOMIC_RELAXED);
+		next = __atomic_load_n(&tail->right, __ATOMIC_ACQUIRE);
+		if ( next == NULL ) {
+			*busy = 1;
+			return NULL;
 		}
-
-		node=node->right;
-	}
-	if ( len != NodeList->length) {
-		printf("Len miss match: len: %u, last: %u, proto: %u, Nodelist: %u, loops: %u, allocated: %u, node: %llx\n", 
-			len, mem, proto, NodeList->length, loops, Allocated, (long long unsigned)n);
-		assert(len==NodeList->length);
-	} else {
-		printf("Len: %u ok last: %u, proto: %u in loop %u, allocated: %u\n", 
-			len, mem, proto, loops, Allocated);
 	}
-}
-#endif
 
-void Push_Node(NodeList_t *NodeList, struct FlowNode *node) {
+	NodeList->tail = next;
+	tail->left  = NULL;
+	tail->right = NULL;
+	__atomic_sub_fetch(&NodeList->length, 1, __ATOMIC_RELAXED);
 
-	GetTreeLock(NodeList);
-	// pthread_mutex_lock(&NodeList->m_list);
-	if ( NodeList->length == 0 ) {
-		// empty list
-		NodeList->list = node;
-		node->left = NULL;
-		node->right = NULL;
-	} else {
-		NodeList->last->right = node;
-		node->left = NodeList->last;
-		node->right = NULL;
+	return tail;
+
+} // End of TryPop_Node
+
+// threads wait for nodes and none were returned meanwhile - checked with m_FreeList locked, 
+// as a waiting thread holds the lock from taking the free stack until it leaves the wait
+static int NodesStarved(void) {
+int starved;
+
+	if ( !NodesWaiting() ) 
+		return 0;
+
+	pthread_mutex_lock(&m_FreeList);
+	starved = NodesWaiting() && __atomic_load_n(&FreeStack, __ATOMIC_SEQ_CST) == NULL;
+	pthread_mutex_unlock(&m_FreeList);
+
+	return starved;
+
+} // End of NodesStarved
+
+// wake up all sleeping flow threads - must be called with m_FreeList locked
+static void WakeNodeLists(void) {
+NodeList_t *NodeList;
+
+	for ( NodeList = NodeLists; NodeList != NULL; NodeList = NodeList->next ) {
+		if ( __atomic_load_n(&NodeList->waiting, __ATOMIC_SEQ_CST) ) {
+			pthread_mutex_lock(&NodeList->m_list);
+			pthread_cond_signal(&NodeList->c_list);
+			pthread_mutex_unlock(&NodeList->m_list);
+		}
 	}
-	NodeList->last = node;
-	NodeList->length++;
 
+} // End of WakeNodeLists
+
+struct FlowNode *Pop_Node(NodeList_t *NodeList, FlowSource_t *fs, int *done) {
+struct FlowNode *node;
+int busy;
+
+	while ( 1 ) {
+		node = TryPop_Node(NodeList, &busy);
+		if ( node ) {
 #ifdef DEVEL
-	printf("pushed node 0x%llx proto: %u, length: %u first: %llx, last: %llx\n", 
-		(unsigned long long)node, node->proto, NodeList->length, 
-		(unsigned long long)NodeList->list, (unsigned long long)NodeList->last);
-	ListCheck(NodeList);
+			printf("popped node 0x%llx proto: %u, length: %u\n", 
+				(unsigned long long)node, node->proto, NodeList->length);
 #endif
+			return node;
+		}
 
-	if ( NodeList->waiting ) {
-		pthread_cond_signal(&NodeList->c_list);
-	}
-	ReleaseTreeLock(NodeList);
- 	// pthread_mutex_unlock(&NodeList->m_list);
-	// pthread_cond_signal(&NodeList->c_list);
+		if ( busy ) {
+			// a producer is just linking its node
+			sched_yield();
+			continue;
+		}
 
-} // End of Push_Node
+		if ( *done ) {
+			dbg_printf("Pop_Node done\n");
+			return NULL;
+		}
 
-struct FlowNode *Pop_Node(NodeList_t *NodeList, int *done) {
-struct FlowNode *node;
+		// queue empty - hand back cached free nodes before going to sleep
+		ReturnLocalNodes();
+
+		// no more packets arrive, while the packet threads wait for nodes - expire the flows now
+		// nodes queued before the packet threads started to wait are processed first
+		if ( FlowShard.NumFlows && NodesStarved() && 
+			 __atomic_load_n(&NodeList->head, __ATOMIC_SEQ_CST) == &NodeList->stub && NodeList->tail == &NodeList->stub ) 
+			CacheCheck(fs, FlowShard.t_clock, 1);
 
-	GetTreeLock(NodeList);
-    while ( NodeList->length == 0 && !*done ) {
 		pthread_mutex_lock(&NodeList->m_list);
-		NodeList->waiting = 1;
-		NodeList->waits++;
-		ReleaseTreeLock(NodeList);
-		// sleep ad wait
-        pthread_cond_wait(&NodeList->c_list, &NodeList->m_list);
-
-		// wake up
-		GetTreeLock(NodeList);
-		NodeList->waiting = 0;
+		__atomic_store_n(&NodeList->waiting, 1, __ATOMIC_SEQ_CST);
+		if ( __atomic_load_n(&NodeList->head, __ATOMIC_SEQ_CST) == &NodeList->stub && 
+			 NodeList->tail == &NodeList->stub && !*done ) {
+			struct timespec ts;
+			// sleep and wait - wake up periodically in case the terminate signal got lost
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec++;
+			NodeList->waits++;
+			pthread_cond_timedwait(&NodeList->c_list, &NodeList->m_list, &ts);
+		}
+		__atomic_store_n(&NodeList->waiting, 0, __ATOMIC_RELAXED);
 		pthread_mutex_unlock(&NodeList->m_list);
 	}
 
-	if ( NodeList->length == 0 && *done ) {
-		ReleaseTreeLock(NodeList);
-		dbg_printf("Pop_Node done\n");
+	/* not reached */
+
+} // End of Pop_Node
+
+/* Dispatcher functions */
+FlowDispatch_t *NewFlowDispatch(NodeList_t **NodeList, uint32_t numLists, time_t t_win, time_t t_expire) {
+FlowDispatch_t *dispatch;
+
+	dispatch = (FlowDispatch_t *)calloc(1, sizeof(FlowDispatch_t));
+	if ( !dispatch ) {
+		LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
 		return NULL;
 	}
+	dispatch->NodeList	 = NodeList;
+	dispatch->numLists	 = numLists;
+	dispatch->t_win		 = t_win;
+	dispatch->t_expire	 = t_expire;
+	dispatch->t_start	 = 0;
+	dispatch->lastExpire = 0;
+	pthread_mutex_init(&dispatch->m_dispatch, NULL);
 
-	if ( NodeList->list == NULL ) { 
-		// should never happen - list is supposed to have at least one item
-		ReleaseTreeLock(NodeList);
-		LogError("Unexpected empty FlowNode_ProcessList");
-		return NULL;
+	return dispatch;
+
+} // End of NewFlowDispatch
+
+void DisposeFlowDispatch(FlowDispatch_t *dispatch) {
+
+	if ( !dispatch )
+		return;
+
+	pthread_mutex_destroy(&dispatch->m_dispatch);
+	free(dispatch);
+
+} // End of DisposeFlowDispatch
+
+// hash the flow key independent of the direction - both directions go to the same flow thread
+static inline uint32_t DispatchHash(struct FlowNode *node) {
+uint64_t h;
+
+	h  = node->src_addr.v6[0] ^ node->src_addr.v6[1] ^ node->dst_addr.v6[0] ^ node->dst_addr.v6[1];
+	h ^= (uint64_t)(node->src_port ^ node->dst_port) << 8 | node->proto;
+	h *= 0x9E3779B97F4A7C15ULL;
+
+	return (uint32_t)(h >> 32);
+
+} // End of DispatchHash
+
+void Dispatch_Node(FlowDispatch_t *dispatch, struct FlowNode *node) {
+uint32_t i;
+
+	if ( dispatch->numLists == 1 ) {
+		Push_Node(dispatch->NodeList[0], node);
+		return;
 	}
 
-	node = NodeList->list;
-	NodeList->list = node->right;
-	if ( NodeList->list ) 
-		NodeList->list->left = NULL;
-	else 
-		NodeList->last = NULL;
+	i = ((uint64_t)DispatchHash(node) * dispatch->numLists) >> 32;
+	Push_Node(dispatch->NodeList[i], node);
 
-	node->left = NULL;
-	node->right = NULL;
+} // End of Dispatch_Node
 
-	NodeList->length--;
+// push a signal node into the queue of each flow thread - must be called with m_dispatch locked
+static void BroadcastSignal(FlowDispatch_t *dispatch, uint8_t type, time_t t_start, time_t t_clock) {
+struct FlowNode *node;
+uint32_t i;
+
+	for ( i=0; i<dispatch->numLists; i++ ) {
+		// signal nodes do not depend on the node cache, which may be exhausted
+		node = (struct FlowNode *)calloc(1, sizeof(struct FlowNode));
+		if ( node ) {
+			node->memflag = NODE_SIGNAL;
+		} else {
+			LogError("malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
+			node = New_Node();
+		}
+		node->fin			 = type;
+		node->t_first.tv_sec = t_start;
+		node->t_last.tv_sec  = t_clock;
+		Push_Node(dispatch->NodeList[i], node);
+	}
 
-#ifdef DEVEL
-	printf("popped node 0x%llx proto: %u, length: %u first: %llx, last: %llx\n", 
-		(unsigned long long)node, node->proto, NodeList->length, 
-		(unsigned long long)NodeList->list, (unsigned long long)NodeList->last);
-	ListCheck(NodeList);
-#endif
+} // End of BroadcastSignal
 
-	ReleaseTreeLock(NodeList);
+// signal the flow threads to rotate, if t_clock enters a new time window
+void Dispatch_Window(FlowDispatch_t *dispatch, time_t t_clock) {
 
-	return node;
-} // End of Pop_Node
+	if ( (t_clock - __atomic_load_n(&dispatch->t_start, __ATOMIC_ACQUIRE)) < dispatch->t_win )
+		return;
+
+	pthread_mutex_lock(&dispatch->m_dispatch);
+	if ( dispatch->t_start == 0 ) {
+		// first packet
+		__atomic_store_n(&dispatch->t_start, t_clock - (t_clock % dispatch->t_win), __ATOMIC_RELEASE);
+	} else if ( (t_clock - dispatch->t_start) >= dispatch->t_win ) {
+		BroadcastSignal(dispatch, SIGNAL_NODE, dispatch->t_start, t_clock);
+		__atomic_store_n(&dispatch->t_start, t_clock - (t_clock % dispatch->t_win), __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&dispatch->m_dispatch);
+
+} // End of Dispatch_Window
+
+// signal the flow threads to expire flows, if the expire interval has passed
+void Dispatch_Expire(FlowDispatch_t *dispatch, time_t t_clock) {
+
+	if ( (t_clock - __atomic_load_n(&dispatch->lastExpire, __ATOMIC_ACQUIRE)) <= dispatch->t_expire )
+		return;
+
+	pthread_mutex_lock(&dispatch->m_dispatch);
+	if ( (t_clock - dispatch->lastExpire) > dispatch->t_expire ) {
+		BroadcastSignal(dispatch, EXPIRE_NODE, 0, t_clock);
+		__atomic_store_n(&dispatch->lastExpire, t_clock, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&dispatch->m_dispatch);
+
+} // End of Dispatch_Expire
 
 #ifdef DEVEL
 void DumpList(NodeList_t *NodeList) {
 struct FlowNode *node;
 
 	printf("FlowNode_ProcessList: 0x%llx, length: %u\n", 
-		(unsigned long long)NodeList->list, NodeList->length);
-	node = NodeList->list;
+		(unsigned long long)NodeList->tail, NodeList->length);
+	node = NodeList->tail;
 	while ( node ) {
 		printf("node: 0x%llx\n", (unsigned long long)node);
-		printf("  ->left: 0x%llx\n", (unsigned long long)node->left);
 		printf("  ->right: 0x%llx\n", (unsigned long long)node->right);
 		node = node->right;
 	}
-	printf("tail: 0x%llx\n\n", (unsigned long long)NodeList->last);
+	printf("head: 0x%llx\n\n", (unsigned long long)NodeList->head);
 } // End of DumpList
 #endif
 
 void DumpNodeStat(NodeList_t *NodeList) {
-	LogInfo("Nodes in use: %u, Flows: %u, Nodes list length: %u, Waiting for freelist: %u", 
-		Allocated, NumFlows, NodeList->length, EmptyFreeListEvents);
+int32_t inUse = __atomic_load_n(&Allocated, __ATOMIC_RELAXED);
+
+	// per thread counts are accounted in batches - the sum may be off by a few batches
+	LogInfo("Nodes in use: %d, Pool: %u, Flows: %u, Nodes list length: %u, Waiting for freelist: %u", 
+		inUse > 0 ? inUse : 0, __atomic_load_n(&PoolSize, __ATOMIC_RELAXED), FlowShard.NumFlows, 
+		NodeList->length, EmptyFreeListEvents);
 	EmptyFreeListEvents = 0;
 } // End of DumpNodeStat
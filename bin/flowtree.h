@@ -45,14 +45,18 @@
 #include <signal.h>
 
 #include "collector.h"
-#include "rbtree.h"
 
 #define v4 ip_union._v4
 #define v6 ip_union._v6
 
 struct FlowNode {
-	// tree
-	RB_ENTRY(FlowNode) entry;
+	// flow table hash chain
+	struct FlowNode *hash_next;
+	uint32_t	hash;
+
+	// expire timer wheel slot
+	struct FlowNode *wheel_next;
+	struct FlowNode **wheel_prev;
 
 	// linked list
 	struct FlowNode *left;
@@ -78,12 +82,15 @@ struct FlowNode {
 
 #define NODE_FREE	0xA5
 #define NODE_IN_USE	0x5A
+#define NODE_SIGNAL	0x3C	// allocated outside the node cache
 	uint16_t	memflag;	// internal houskeeping flag
 	uint8_t		flags;
 #define FIN_NODE 1
+#define EXPIRE_NODE 254
 #define SIGNAL_NODE 255
 	uint8_t		fin;		// double use:  1: fin received - flow can be exported, if complete
-							//            255: empty node - used to wake up flow thread priodically on quite lines
+							//            254: empty node - expire flows up to t_last
+							//            255: empty node - rotate file of time window t_first
 	
 	// flow stat data
 	struct timeval	t_first;
@@ -102,28 +109,47 @@ struct FlowNode {
 	} latency;
 };
 
+/* 
+ * lock-free multi producer, single consumer node queue
+ * producers link new nodes at head, the consumer pops them at tail. 
+ * Nodes are linked by their right pointer
+ */
 typedef struct NodeList_s {
-	struct FlowNode *list;
-	struct FlowNode *last;
-	sig_atomic_t	list_lock;
-	pthread_mutex_t m_list;
+	struct NodeList_s *next;	// all queues - to wake up the flow threads
+	struct FlowNode *head;
+	struct FlowNode *tail;
+	struct FlowNode stub;
+	pthread_mutex_t m_list;		// only used to sleep on an empty queue
 	pthread_cond_t  c_list;
 	uint32_t length;
 	uint32_t waiting;
 	uint64_t waits;
 } NodeList_t;
 
-
-/* flow tree type */
-typedef RB_HEAD(FlowTree, FlowNode) FlowTree_t;
-
-// Insert the RB prototypes here
-RB_PROTOTYPE(FlowTree, FlowNode, entry, FlowNodeCMP);
+/*
+ * flow dispatcher
+ * Distributes the nodes of the packet threads over the queues of the flow threads. 
+ * Both directions of a flow end up in the same queue. All flow threads receive 
+ * the same signal nodes to rotate and expire in sync with the packet time.
+ */
+typedef struct FlowDispatch_s {
+	NodeList_t	**NodeList;		// one queue per flow thread
+	uint32_t	numLists;
+	time_t		t_win;			// rotation interval
+	time_t		t_expire;		// expire interval
+	time_t		t_start;		// start of current time window
+	time_t		lastExpire;		// time of last expire signal
+	pthread_mutex_t m_dispatch;
+} FlowDispatch_t;
 
 int Init_FlowTree(uint32_t CacheSize, int32_t expireActive, int32_t expireInactive);
 
 void Dispose_FlowTree(void);
 
+int Init_FlowShard(void);
+
+void Dispose_FlowShard(void);
+
 uint32_t Flush_FlowTree(FlowSource_t *fs);
 
 uint32_t Expire_FlowTree(FlowSource_t *fs, time_t when);
@@ -151,10 +177,21 @@ void DisposeNodeList(NodeList_t *NodeList);
 
 void Push_Node(NodeList_t *NodeList, struct FlowNode *node);
 
-struct FlowNode *Pop_Node(NodeList_t *NodeList, int *done);
+struct FlowNode *Pop_Node(NodeList_t *NodeList, FlowSource_t *fs, int *done);
 
 void DumpList(NodeList_t *NodeList);
 
+// Dispatcher functions
+FlowDispatch_t *NewFlowDispatch(NodeList_t **NodeList, uint32_t numLists, time_t t_win, time_t t_expire);
+
+void DisposeFlowDispatch(FlowDispatch_t *dispatch);
+
+void Dispatch_Node(FlowDispatch_t *dispatch, struct FlowNode *node);
+
+void Dispatch_Window(FlowDispatch_t *dispatch, time_t t_clock);
+
+void Dispatch_Expire(FlowDispatch_t *dispatch, time_t t_clock);
+
 // Stat functions
 void DumpNodeStat(NodeList_t *NodeList);
 
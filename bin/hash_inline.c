@@ -0,0 +1,143 @@
+/*
+ *  Copyright (c) 2020, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+/*
+ * Hash functions for the flow and stat hash tables
+ * HASH_SFH:  SuperFastHash by Paul Hsieh - processes the key 16 bits at a time
+ * HASH_MX64: multiply/xorshift hash over the key as uint64_t words, seeded per run
+ * The default is selected at compile time with -DDEFAULT_HASH=HASH_SFH|HASH_MX64
+ * and may be changed at run time ( nfdump -H ).
+ */
+
+#define HASH_SFH	0
+#define HASH_MX64	1
+
+#ifndef DEFAULT_HASH
+#define DEFAULT_HASH HASH_MX64
+#endif
+
+static inline uint32_t SuperFastHash (const char * data, int len);
+
+static inline uint32_t MX64Hash(const uint64_t *key, int keylen, uint64_t seed);
+
+static inline uint32_t KeyHash(int hash_type, uint64_t seed, const void *key, int keysize);
+
+#undef get16bits
+#if (defined(__GNUC__) && defined(__i386__)) || defined(__WATCOMC__) \
+  || defined(_MSC_VER) || defined (__BORLANDC__) || defined (__TURBOC__)
+#define get16bits(d) (*((const uint16_t *) (d)))
+#endif
+
+#if !defined (get16bits)
+#define get16bits(d) ((((uint32_t)(((const uint8_t *)(d))[1])) << 8)\
+					   +(uint32_t)(((const uint8_t *)(d))[0]) )
+#endif
+
+static inline uint32_t SuperFastHash (const char * data, int len) {
+uint32_t hash = len, tmp;
+int rem;
+
+	if (len <= 0 || data == NULL) return 0;
+
+	rem = len & 3;
+	len >>= 2;
+
+	/* Main loop */
+	for (;len > 0; len--) {
+		hash  += get16bits (data);
+		tmp	= (get16bits (data+2) << 11) ^ hash;
+		hash   = (hash << 16) ^ tmp;
+		data  += 2*sizeof (uint16_t);
+		hash  += hash >> 11;
+	}
+
+	/* Handle end cases */
+	switch (rem) {
+		case 3: hash += get16bits (data);
+				hash ^= hash << 16;
+				hash ^= data[sizeof (uint16_t)] << 18;
+				hash += hash >> 11;
+				break;
+		case 2: hash += get16bits (data);
+				hash ^= hash << 11;
+				hash += hash >> 17;
+				break;
+		case 1: hash += *data;
+				hash ^= hash << 10;
+				hash += hash >> 1;
+	}
+
+	/* Force "avalanching" of final 127 bits */
+	hash ^= hash << 3;
+	hash += hash >> 5;
+	hash ^= hash << 4;
+	hash += hash >> 17;
+	hash ^= hash << 25;
+	hash += hash >> 6;
+
+	return hash;
+} // End of SuperFastHash
+
+static inline uint32_t MX64Hash(const uint64_t *key, int keylen, uint64_t seed) {
+uint64_t hash = seed ^ ((uint64_t)keylen * 0x9E3779B97F4A7C15ULL);
+int i;
+
+	// the multiply of each word does not depend on the previous words
+	// only the combine step is serial
+	for ( i=0; i<keylen; i++ ) {
+		uint64_t k = key[i] * 0xBF58476D1CE4E5B9ULL;
+		k ^= k >> 31;
+		hash = (hash ^ k) * 0x94D049BB133111EBULL;
+		hash = (hash << 27) | (hash >> 37);
+	}
+
+	// final avalanche - fmix64 of MurmurHash3
+	hash ^= hash >> 33;
+	hash *= 0xFF51AFD7ED558CCDULL;
+	hash ^= hash >> 33;
+	hash *= 0xC4CEB9FE1A85EC53ULL;
+	hash ^= hash >> 33;
+
+	return (uint32_t)hash;
+
+} // End of MX64Hash
+
+/*
+ * hash a key of keysize bytes. For HASH_MX64 the key must be 8 byte aligned 
+ * and unused bytes of the last uint64_t word must be 0
+ */
+static inline uint32_t KeyHash(int hash_type, uint64_t seed, const void *key, int keysize) {
+
+	if ( hash_type == HASH_SFH )
+		return SuperFastHash((const char *)key, keysize);
+	else
+		return MX64Hash((const uint64_t *)key, (keysize + 7) >> 3, seed);
+
+} // End of KeyHash
@@ -37,6 +37,22 @@ static inline void siftDown(SortElement_t *SortElement, uint32_t root, uint32_t
 
 static inline void siftUp(SortElement_t *SortElement, uint32_t numbersSize, uint32_t node);
 
+static inline int SortKeyCMP(SortElement_t *e1, SortElement_t *e2);
+
+/*
+ * Elements with the same count are ordered by their record key. The first in key order
+ * sorts to the top in both directions, so ties are printed in the same order, independent
+ * of the order the records were inserted or hashed.
+ */
+static inline int SortKeyCMP(SortElement_t *e1, SortElement_t *e2) {
+
+	if ( !e1->key || !e2->key )
+		return 0;
+
+	return memcmp(e1->key, e2->key, e1->keysize < e2->keysize ? e1->keysize : e2->keysize);
+
+} // End of SortKeyCMP
+
 static void heapSort(SortElement_t *SortElement, uint32_t array_size, int topN, int direction) {
 int32_t	i, maxindex;
 
@@ -74,12 +90,14 @@ uint32_t i, parent, child;
 
         // Compare with left child node
 		child = 2*i+1;
-        if( (child) < numbersSize && SortElement[child].count > SortElement[parent].count)
+        if( (child) < numbersSize && (SortElement[child].count > SortElement[parent].count ||
+			(SortElement[child].count == SortElement[parent].count && SortKeyCMP(&SortElement[child], &SortElement[parent]) < 0)))
             parent = child;
 
         // Compare with right child node
 		child = 2*i+2;
-        if( (child) < numbersSize && SortElement[child].count > SortElement[parent].count)
+        if( (child) < numbersSize && (SortElement[child].count > SortElement[parent].count ||
+			(SortElement[child].count == SortElement[parent].count && SortKeyCMP(&SortElement[child], &SortElement[parent]) < 0)))
             parent = child;
 
         if ( i != parent ) {
@@ -100,12 +118,14 @@ uint32_t i, parent, child;
 
         // Compare with left child node
 		child = 2*i+1;
-        if( (child) < numbersSize && SortElement[child].count < SortElement[parent].count)
+        if( (child) < numbersSize && (SortElement[child].count < SortElement[parent].count ||
+			(SortElement[child].count == SortElement[parent].count && SortKeyCMP(&SortElement[child], &SortElement[parent]) < 0)))
             parent = child;
 
         // Compare with right child node
 		child = 2*i+2;
-        if( (child) < numbersSize && SortElement[child].count < SortElement[parent].count)
+        if( (child) < numbersSize && (SortElement[child].count < SortElement[parent].count ||
+			(SortElement[child].count == SortElement[parent].count && SortKeyCMP(&SortElement[child], &SortElement[parent]) < 0)))
             parent = child;
 
         if ( i != parent ) {
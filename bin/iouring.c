@@ -0,0 +1,223 @@
+/*
+ *  Copyright (c) 2020, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#include "config.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "util.h"
+#include "iouring.h"
+
+static int io_uring_setup(uint32_t entries, struct io_uring_params *p) {
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+} // End of io_uring_setup
+
+static int io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+} // End of io_uring_enter
+
+uring_t *UringInit(uint32_t entries) {
+struct io_uring_params params;
+uring_t *uring;
+
+	uring = calloc(1, sizeof(uring_t));
+	if ( !uring ) {
+		LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return NULL;
+	}
+
+	memset((void *)&params, 0, sizeof(params));
+	uring->fd = io_uring_setup(entries, &params);
+	if ( uring->fd < 0 ) {
+		// not supported by the kernel or not permitted - the caller falls back to read()
+		free(uring);
+		return NULL;
+	}
+	uring->entries = params.sq_entries;
+
+	uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	uring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if ( params.features & IORING_FEAT_SINGLE_MMAP ) {
+		if ( uring->cq_ring_size > uring->sq_ring_size )
+			uring->sq_ring_size = uring->cq_ring_size;
+		uring->cq_ring_size = uring->sq_ring_size;
+	}
+
+	uring->sq_ring = mmap(NULL, uring->sq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, 
+		uring->fd, IORING_OFF_SQ_RING);
+	if ( uring->sq_ring == MAP_FAILED ) {
+		LogError("mmap() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		close(uring->fd);
+		free(uring);
+		return NULL;
+	}
+
+	if ( params.features & IORING_FEAT_SINGLE_MMAP ) {
+		uring->cq_ring = uring->sq_ring;
+	} else {
+		uring->cq_ring = mmap(NULL, uring->cq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, 
+			uring->fd, IORING_OFF_CQ_RING);
+		if ( uring->cq_ring == MAP_FAILED ) {
+			LogError("mmap() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			munmap(uring->sq_ring, uring->sq_ring_size);
+			close(uring->fd);
+			free(uring);
+			return NULL;
+		}
+	}
+
+	uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, 
+		uring->fd, IORING_OFF_SQES);
+	if ( uring->sqes == MAP_FAILED ) {
+		LogError("mmap() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		if ( uring->cq_ring != uring->sq_ring )
+			munmap(uring->cq_ring, uring->cq_ring_size);
+		munmap(uring->sq_ring, uring->sq_ring_size);
+		close(uring->fd);
+		free(uring);
+		return NULL;
+	}
+
+	uring->sq_head	= (uint32_t *)((pointer_addr_t)uring->sq_ring + params.sq_off.head);
+	uring->sq_tail	= (uint32_t *)((pointer_addr_t)uring->sq_ring + params.sq_off.tail);
+	uring->sq_mask	= (uint32_t *)((pointer_addr_t)uring->sq_ring + params.sq_off.ring_mask);
+	uring->sq_array	= (uint32_t *)((pointer_addr_t)uring->sq_ring + params.sq_off.array);
+	uring->sq_local	= *uring->sq_tail;
+
+	uring->cq_head	= (uint32_t *)((pointer_addr_t)uring->cq_ring + params.cq_off.head);
+	uring->cq_tail	= (uint32_t *)((pointer_addr_t)uring->cq_ring + params.cq_off.tail);
+	uring->cq_mask	= (uint32_t *)((pointer_addr_t)uring->cq_ring + params.cq_off.ring_mask);
+	uring->cqes		= (struct io_uring_cqe *)((pointer_addr_t)uring->cq_ring + params.cq_off.cqes);
+
+	return uring;
+
+} // End of UringInit
+
+void UringFree(uring_t *uring) {
+
+	if ( !uring )
+		return;
+
+	munmap(uring->sqes, uring->sqes_size);
+	if ( uring->cq_ring != uring->sq_ring )
+		munmap(uring->cq_ring, uring->cq_ring_size);
+	munmap(uring->sq_ring, uring->sq_ring_size);
+	close(uring->fd);
+	free(uring);
+
+} // End of UringFree
+
+/*
+ * Returns the next free submission entry or NULL, if the queue is full.
+ * The entry is cleared and queued with the next UringSubmit()
+ */
+struct io_uring_sqe *UringGetSQE(uring_t *uring) {
+struct io_uring_sqe *sqe;
+uint32_t head;
+
+	head = __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+	if ( (uring->sq_local - head) >= uring->entries ) 
+		return NULL;
+
+	uint32_t index = uring->sq_local & *uring->sq_mask;
+	sqe = &uring->sqes[index];
+	memset((void *)sqe, 0, sizeof(struct io_uring_sqe));
+	uring->sq_array[index] = index;
+	uring->sq_local++;
+
+	return sqe;
+
+} // End of UringGetSQE
+
+/*
+ * Submit all queued entries and wait for at least wait_nr completions
+ * Returns the number of submitted entries or -1 on error
+ */
+int UringSubmit(uring_t *uring, uint32_t wait_nr) {
+uint32_t to_submit;
+int ret;
+
+	to_submit = uring->sq_local - *uring->sq_tail;
+	__atomic_store_n(uring->sq_tail, uring->sq_local, __ATOMIC_RELEASE);
+
+	if ( to_submit == 0 && wait_nr == 0 ) 
+		return 0;
+
+	do {
+		ret = io_uring_enter(uring->fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+	} while ( ret < 0 && errno == EINTR );
+
+	if ( ret < 0 ) {
+		LogError("io_uring_enter() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return -1;
+	}
+	uring->inflight += ret;
+
+	return ret;
+
+} // End of UringSubmit
+
+/*
+ * Returns the next completion entry or NULL, if none is available
+ */
+struct io_uring_cqe *UringPeekCQE(uring_t *uring) {
+uint32_t head, tail;
+
+	head = *uring->cq_head;
+	tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+	if ( head == tail ) 
+		return NULL;
+
+	return &uring->cqes[head & *uring->cq_mask];
+
+} // End of UringPeekCQE
+
+void UringSeenCQE(uring_t *uring) {
+
+	__atomic_store_n(uring->cq_head, *uring->cq_head + 1, __ATOMIC_RELEASE);
+	uring->inflight--;
+
+} // End of UringSeenCQE
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ *  Copyright (c) 2020, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#ifndef _IOURING_H
+#define _IOURING_H 1
+
+#include "config.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#include <sys/types.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include <linux/io_uring.h>
+
+/*
+ * Minimal io_uring submission and completion queue on top of the raw
+ * syscalls. A single thread owns the ring.
+ */
+typedef struct uring_s {
+	int			fd;
+	uint32_t	entries;
+	uint32_t	inflight;		// submitted, but not yet completed operations
+
+	// submission queue
+	uint32_t	*sq_head;
+	uint32_t	*sq_tail;
+	uint32_t	*sq_mask;
+	uint32_t	*sq_array;
+	uint32_t	sq_local;		// local tail - sqes not yet submitted
+	struct io_uring_sqe *sqes;
+
+	// completion queue
+	uint32_t	*cq_head;
+	uint32_t	*cq_tail;
+	uint32_t	*cq_mask;
+	struct io_uring_cqe	*cqes;
+
+	// mappings
+	void		*sq_ring;
+	size_t		sq_ring_size;
+	void		*cq_ring;
+	size_t		cq_ring_size;
+	size_t		sqes_size;
+} uring_t;
+
+uring_t *UringInit(uint32_t entries);
+
+void UringFree(uring_t *uring);
+
+struct io_uring_sqe *UringGetSQE(uring_t *uring);
+
+int UringSubmit(uring_t *uring, uint32_t wait_nr);
+
+struct io_uring_cqe *UringPeekCQE(uring_t *uring);
+
+void UringSeenCQE(uring_t *uring);
+
+#endif
+
+#endif //_IOURING_H
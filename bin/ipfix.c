@@ -40,6 +40,7 @@
 #include <time.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <pthread.h>
 
 #ifdef HAVE_STDINT_H
 #include <stdint.h>
@@ -288,7 +289,10 @@ static struct cache_s {
 static int verbose;
 static uint32_t default_sampling;
 static uint32_t overwrite_sampling;
-static uint32_t	processed_records;
+static __thread uint32_t	processed_records;
+
+// the translation cache is shared by the receiver threads
+static pthread_mutex_t	template_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 // externals
 extern uint32_t Max_num_extensions;
@@ -378,14 +382,16 @@ static exporterDomain_t *GetExporter(FlowSource_t *fs, ipfix_header_t *ipfix_hea
 #define IP_STRING_LEN   40
 char ipstr[IP_STRING_LEN];
 exporterDomain_t **e = (exporterDomain_t **)&(fs->exporter_data);
+exporterDomain_t *exporter;
 uint32_t ObservationDomain = ntohl(ipfix_header->ObservationDomain);
 
-	while ( *e ) {
-		if ( (*e)->info.id == ObservationDomain && (*e)->info.version == 10 && 
-			 (*e)->info.ip.V6[0] == fs->ip.V6[0] && (*e)->info.ip.V6[1] == fs->ip.V6[1]) 
-			return *e;
+	exporter = (exporterDomain_t *)LookupExporter(fs, 10, ObservationDomain);
+	if ( exporter ) 
+		return exporter;
+
+	// append new exporter
+	while ( *e ) 
 		e = &((*e)->next);
-	}
 
 	if ( fs->sa_family == AF_INET ) {
 		uint32_t _ip = htonl(fs->ip.V4);
@@ -422,6 +428,7 @@ uint32_t ObservationDomain = ntohl(ipfix_header->ObservationDomain);
 	(*e)->sampler 			= NULL;
 
 	FlushInfoExporter(fs, &((*e)->info));
+	IndexExporter(fs, (exporter_t *)(*e));
 
 	dbg_printf("[%u] New exporter: SysID: %u, Observation domain %u from: %s:%u\n", 
 		ObservationDomain, (*e)->info.sysid, ObservationDomain, ipstr, fs->port);
@@ -2084,7 +2091,7 @@ ipfix_header_t		*ipfix_header;
 void				*flowset_header;
 
 #ifdef DEVEL
-static uint32_t		packet_cntr = 0;
+static __thread uint32_t packet_cntr = 0;
 uint32_t 			ObservationDomain;
 #endif
 
@@ -2188,13 +2195,17 @@ uint32_t 			ObservationDomain;
 				// Process_ipfix_templates(exporter, flowset_header, fs);
 				exporter->TemplateRecords++;
 				dbg_printf("Process template flowset, length: %u\n", flowset_length);
+				pthread_mutex_lock(&template_mutex);
 				Process_ipfix_templates(exporter, flowset_header, flowset_length, fs);
+				pthread_mutex_unlock(&template_mutex);
 				break;
 			case IPFIX_OPTIONS_FLOWSET_ID:
 				// option_flowset = (option_template_flowset_t *)flowset_header;
 				exporter->TemplateRecords++;
 				dbg_printf("Process option template flowset, length: %u\n", flowset_length);
+				pthread_mutex_lock(&template_mutex);
 				Process_ipfix_option_templates(exporter, flowset_header, fs);
+				pthread_mutex_unlock(&template_mutex);
 				break;
 			default: {
 				if ( flowset_id < IPFIX_MIN_RECORD_FLOWSET_ID ) {
@@ -51,6 +51,7 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <pthread.h>
 
 #include "util.h"
 #include "rbtree.h"
@@ -65,6 +66,8 @@ static void Free_node(struct IPFragNode *node, int free_data);
 
 static void Remove_node(struct IPFragNode *node, int free_data);
 
+static void *IPFrag_Update(time_t when, uint32_t src, uint32_t dst, uint32_t ident, uint32_t *length, uint32_t ip_off, void *data);
+
 // Insert the IP RB tree code here
 RB_GENERATE(IPFragTree, IPFragNode, entry, IPFragNodeCMP);
 
@@ -72,6 +75,9 @@ static IPFragTree_t *IPFragTree;
 static uint32_t NumFragments;
 static time_t lastExpire = 0;
 
+// packet threads of a fanout group share the fragment tree
+static pthread_mutex_t m_IPFragTree = PTHREAD_MUTEX_INITIALIZER;
+
 static int IPFragNodeCMP(struct IPFragNode *e1, struct IPFragNode *e2) {
 uint32_t    *a = &e1->src_addr;
 uint32_t    *b = &e2->src_addr;
@@ -192,6 +198,17 @@ struct IPFragNode *node, *nxt;
 } // End of IPFragTree_expire
 
 void *IPFrag_tree_Update(time_t when, uint32_t src, uint32_t dst, uint32_t ident, uint32_t *length, uint32_t ip_off, void *data) {
+void *defragmented;
+
+	pthread_mutex_lock(&m_IPFragTree);
+	defragmented = IPFrag_Update(when, src, dst, ident, length, ip_off, data);
+	pthread_mutex_unlock(&m_IPFragTree);
+
+	return defragmented;
+
+} // End of IPFrag_tree_Update
+
+static void *IPFrag_Update(time_t when, uint32_t src, uint32_t dst, uint32_t ident, uint32_t *length, uint32_t ip_off, void *data) {
 struct IPFragNode FindNode, *n;
 hole_t *hole, *h, *hole_parent;
 uint16_t more_fragments, first, last, max;
@@ -360,7 +377,7 @@ char src_s[16], dst_s[16];
 		return NULL;
 	}
 
-} // End of IPFrag_tree_Update
+} // End of IPFrag_Update
 
 uint32_t IPFragEntries() {
 	return NumFragments;
@@ -0,0 +1,646 @@
+/*
+ *  Copyright (c) 2020, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "util.h"
+#include "nfdump.h"
+#include "nffile.h"
+#include "nfx.h"
+#include "nftree.h"
+#include "nfcolumn.h"
+#include "ipindex.h"
+
+// address of a data block
+typedef struct ip_ref_s {
+	uint64_t	ip[2];
+	uint32_t	block;
+	uint32_t	fill;
+} ip_ref_t;
+
+// loaded index file
+typedef struct ipindex_s {
+	void				*buff;
+	ipindex_header_t	*header;
+	uint8_t				*flags;
+	ipindex_entry_t		*entry;
+	uint32_t			*ref;
+	uint8_t				*bloom;
+} ipindex_t;
+
+typedef struct ipindex_lookup_s {
+	ipindex_t	*ipindex;
+	uint32_t	block;
+} ipindex_lookup_t;
+
+/* function prototypes */
+static int RefCompare(const void *p1, const void *p2);
+
+static inline uint64_t IPHash(uint64_t ip);
+
+static void AddBlockMaps(data_block_header_t *block_header, extension_map_list_t *extension_map_list);
+
+static uint32_t AddBlockRefs(data_block_header_t *block_header, uint32_t block, ip_ref_t **ref, size_t *NumRefs, size_t *MaxRefs);
+
+static int WriteIndexFile(char *filename, void *buff, size_t size);
+
+static int LoadIPIndex(char *filename, uint32_t NumBlocks, ipindex_t *ipindex);
+
+static int FullLookup(uint64_t *ip, int exact, void *data);
+
+static int BloomLookup(uint64_t *ip, int exact, void *data);
+
+static int NoAddress(uint64_t *ip, int exact, void *data);
+
+/* function definitions */
+
+static int RefCompare(const void *p1, const void *p2) {
+ip_ref_t *r1 = (ip_ref_t *)p1;
+ip_ref_t *r2 = (ip_ref_t *)p2;
+
+	if ( r1->ip[1] != r2->ip[1] ) 
+		return r1->ip[1] < r2->ip[1] ? -1 : 1;
+	if ( r1->ip[0] != r2->ip[0] ) 
+		return r1->ip[0] < r2->ip[0] ? -1 : 1;
+	if ( r1->block != r2->block ) 
+		return r1->block < r2->block ? -1 : 1;
+	return 0;
+
+} // End of RefCompare
+
+static inline uint64_t IPHash(uint64_t ip) {
+
+	// 64bit finalizer of murmur3
+	ip ^= ip >> 33;
+	ip *= 0xff51afd7ed558ccdLL;
+	ip ^= ip >> 33;
+	ip *= 0xc4ceb9fe1a85ec53LL;
+	ip ^= ip >> 33;
+	return ip;
+
+} // End of IPHash
+
+int IPIndexMode(char *mode) {
+
+	if ( strcasecmp(mode, "full") == 0 ) 
+		return IPINDEX_FULL;
+	if ( strcasecmp(mode, "bloom") == 0 ) 
+		return IPINDEX_BLOOM;
+
+	LogError("Unknown IP index mode '%s' - expected full or bloom", mode);
+	return -1;
+
+} // End of IPIndexMode
+
+/*
+ * Registers the extension maps of a data block, which are needed to decode
+ * the following column blocks.
+ */
+static void AddBlockMaps(data_block_header_t *block_header, extension_map_list_t *extension_map_list) {
+record_header_t	*record;
+uint32_t		i, sumSize;
+
+	sumSize = 0;
+	record  = (record_header_t *)((pointer_addr_t)block_header + sizeof(data_block_header_t));
+	for ( i=0; i<block_header->NumRecords; i++ ) {
+		if ( (sumSize + record->size) > block_header->size || record->size < sizeof(record_header_t) ) 
+			return;
+		sumSize += record->size;
+		if ( record->type == ExtensionMapType ) 
+			Insert_Extension_Map(extension_map_list, (extension_map_t *)record);
+		record = (record_header_t *)((pointer_addr_t)record + record->size);
+	}
+
+} // End of AddBlockMaps
+
+/*
+ * Appends the distinct addresses of a data block to the ref array.
+ * Returns the number of addresses or 0, if the block can not be indexed.
+ */
+static uint32_t AddBlockRefs(data_block_header_t *block_header, uint32_t block, ip_ref_t **ref, size_t *NumRefs, size_t *MaxRefs) {
+common_record_t	*record;
+ip_ref_t		*r;
+size_t			start;
+uint32_t		i, j, sumSize;
+
+	if ( block_header->id != DATA_BLOCK_TYPE_2 )
+		return 0;
+
+	start	= *NumRefs;
+	sumSize = 0;
+	record  = (common_record_t *)((pointer_addr_t)block_header + sizeof(data_block_header_t));
+	for ( i=0; i<block_header->NumRecords; i++ ) {
+		// a block with maps or exporter records is always read
+		if ( record->type != CommonRecordType || (sumSize + record->size) > block_header->size ||
+			 record->size < (COMMON_RECORD_DATA_SIZE + ((record->flags & FLAG_IPV6_ADDR) ? 32 : 8)) ) {
+			*NumRefs = start;
+			return 0;
+		}
+
+		if ( (*NumRefs + 2) > *MaxRefs ) {
+			size_t MaxRefs_new = *MaxRefs ? 2 * *MaxRefs : 65536;
+			r = (ip_ref_t *)realloc(*ref, MaxRefs_new * sizeof(ip_ref_t));
+			if ( !r ) {
+				LogError("realloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+				*NumRefs = start;
+				return 0;
+			}
+			*ref	 = r;
+			*MaxRefs = MaxRefs_new;
+		}
+
+		// same address words as in the master record
+		r = &(*ref)[*NumRefs];
+		memset((void *)r, 0, 2 * sizeof(ip_ref_t));
+		if ( (record->flags & FLAG_IPV6_ADDR) != 0 ) {
+			memcpy((void *)r[0].ip, (void *)record->data, 2 * sizeof(uint64_t));
+			memcpy((void *)r[1].ip, (void *)&record->data[4], 2 * sizeof(uint64_t));
+		} else {
+			r[0].ip[1] = record->data[0];
+			r[1].ip[1] = record->data[1];
+		}
+		r[0].block = r[1].block = block;
+		*NumRefs += 2;
+
+		sumSize += record->size;
+		record = (common_record_t *)((pointer_addr_t)record + record->size);
+	}
+
+	if ( *NumRefs == start ) 
+		return 0;
+
+	// distinct addresses of the block
+	r = &(*ref)[start];
+	qsort((void *)r, *NumRefs - start, sizeof(ip_ref_t), RefCompare);
+	j = 0;
+	for ( i=1; i<(*NumRefs - start); i++ ) {
+		if ( r[i].ip[0] != r[j].ip[0] || r[i].ip[1] != r[j].ip[1] ) 
+			r[++j] = r[i];
+	}
+	j++;
+	*NumRefs = start + j;
+
+	return j;
+
+} // End of AddBlockRefs
+
+static int WriteIndexFile(char *filename, void *buff, size_t size) {
+char	indexfile[MAXPATHLEN], tmpfile[MAXPATHLEN];
+ssize_t	ret;
+int		fd;
+
+	if ( snprintf(indexfile, MAXPATHLEN, "%s%s", filename, IPINDEX_SUFFIX) >= MAXPATHLEN ||
+		 snprintf(tmpfile, MAXPATHLEN, "%s%s.tmp", filename, IPINDEX_SUFFIX) >= MAXPATHLEN ) {
+		LogError("Path too long for index file of '%s'", filename);
+		return 0;
+	}
+
+	fd = open(tmpfile, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH );
+	if ( fd < 0 ) {
+		LogError("Failed to open index file '%s': %s", tmpfile, strerror(errno));
+		return 0;
+	}
+
+	ret = write(fd, buff, size);
+	if ( ret != size ) {
+		LogError("write() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		close(fd);
+		unlink(tmpfile);
+		return 0;
+	}
+	close(fd);
+
+	// replace any old index at once
+	if ( rename(tmpfile, indexfile) < 0 ) {
+		LogError("rename() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		unlink(tmpfile);
+		return 0;
+	}
+
+	return 1;
+
+} // End of WriteIndexFile
+
+/*
+ * Reads all data blocks of the open file and writes the IP index of filename
+ */
+int WriteIPIndex(nffile_t *nffile, char *filename, int mode) {
+ipindex_header_t	*header;
+struct stat			data_stat;
+ip_ref_t			*ref;
+uint8_t				*flags, *buff, *p;
+uint32_t			NumBlocks, MaxBlocks, count, MaxCount, bits, i;
+size_t				NumRefs, MaxRefs, size;
+int					ret, done;
+column_reader_t		*column_reader;
+extension_map_list_t *extension_map_list;
+
+	if ( fstat(nffile->fd, &data_stat) < 0 ) {
+		LogError("fstat() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+
+	// column blocks are indexed by the addresses of their decoded records
+	column_reader	   = NewColumnReader(NULL);
+	extension_map_list = InitExtensionMaps(NEEDS_EXTENSION_LIST);
+	if ( !column_reader || !extension_map_list ) {
+		if ( column_reader )
+			DisposeColumnReader(column_reader);
+		if ( extension_map_list )
+			FreeExtensionMaps(extension_map_list);
+		return 0;
+	}
+
+	ref		  = NULL;
+	flags	  = NULL;
+	NumRefs	  = MaxRefs = 0;
+	NumBlocks = MaxBlocks = 0;
+	MaxCount  = 0;
+	done	  = 0;
+	while ( !done ) {
+		ret = ReadBlock(nffile);
+		switch (ret) {
+			case NF_EOF:
+				done = 1;
+				continue;
+			case NF_CORRUPT:
+			case NF_ERROR:
+				LogError("Failed to read data file '%s' - no index written", filename);
+				done = 2;
+				continue;
+		}
+
+		if ( nffile->block_header->id == DATA_BLOCK_TYPE_2 ) {
+			AddBlockMaps(nffile->block_header, extension_map_list);
+		} else if ( nffile->block_header->id == DATA_BLOCK_TYPE_3 ) {
+			ret = DecodeColumnBlock(column_reader, nffile, extension_map_list);
+			if ( ret < 0 ) {
+				LogError("Failed to decode data file '%s' - no index written", filename);
+				done = 2;
+				continue;
+			}
+		}
+
+		if ( NumBlocks == MaxBlocks ) {
+			MaxBlocks += 1024;
+			p = (uint8_t *)realloc(flags, MaxBlocks);
+			if ( !p ) {
+				LogError("realloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+				done = 2;
+				continue;
+			}
+			flags = p;
+		}
+
+		count = AddBlockRefs(nffile->block_header, NumBlocks, &ref, &NumRefs, &MaxRefs);
+		flags[NumBlocks] = count ? IPBLOCK_INDEXED : 0;
+		if ( count > MaxCount ) 
+			MaxCount = count;
+		NumBlocks++;
+	}
+
+	DisposeColumnReader(column_reader);
+	FreeExtensionMaps(extension_map_list);
+	if ( done == 2 ) {
+		free(ref);
+		free(flags);
+		return 0;
+	}
+
+	bits = 0;
+	if ( mode == IPINDEX_BLOOM ) {
+		bits = 512;
+		while ( bits < MaxCount * BLOOM_BITS ) 
+			bits <<= 1;
+		size = sizeof(ipindex_header_t) + IPINDEX_FLAGS_SIZE(NumBlocks) + (size_t)NumBlocks * (bits >> 3);
+	} else {
+		// all addresses with ascending block numbers
+		qsort((void *)ref, NumRefs, sizeof(ip_ref_t), RefCompare);
+		size = sizeof(ipindex_header_t) + IPINDEX_FLAGS_SIZE(NumBlocks) + NumRefs * (sizeof(ipindex_entry_t) + sizeof(uint32_t));
+	}
+
+	buff = (uint8_t *)calloc(1, size);
+	if ( !buff ) {
+		LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		free(ref);
+		free(flags);
+		return 0;
+	}
+
+	header = (ipindex_header_t *)buff;
+	header->magic	  = IPINDEX_MAGIC;
+	header->version	  = IPINDEX_VERSION;
+	header->mode	  = mode;
+	header->NumBlocks = NumBlocks;
+	header->DataSize  = data_stat.st_size;
+	header->DataTime  = data_stat.st_mtime;
+	p = buff + sizeof(ipindex_header_t);
+	if ( NumBlocks ) 
+		memcpy((void *)p, (void *)flags, NumBlocks);
+	p += IPINDEX_FLAGS_SIZE(NumBlocks);
+
+	if ( mode == IPINDEX_BLOOM ) {
+		header->BloomSize = bits >> 3;
+		// refs are grouped by block
+		for ( i=0; i<NumRefs; i++ ) {
+			uint8_t *bloom = p + (size_t)ref[i].block * header->BloomSize;
+			uint64_t h = IPHash(ref[i].ip[1]);
+			uint32_t h1 = h & 0xFFFFFFFF;
+			uint32_t h2 = (h >> 32) | 1;
+			uint32_t k;
+			for ( k=0; k<BLOOM_HASHES; k++ ) {
+				uint32_t bit = (h1 + k * h2) & (bits - 1);
+				bloom[bit >> 3] |= 1 << (bit & 0x7);
+			}
+		}
+	} else {
+		ipindex_entry_t *entry = (ipindex_entry_t *)p;
+		uint32_t *blocks;
+		uint32_t NumEntries = 0;
+		for ( i=0; i<NumRefs; i++ ) {
+			if ( i == 0 || ref[i].ip[0] != ref[i-1].ip[0] || ref[i].ip[1] != ref[i-1].ip[1] ) {
+				entry[NumEntries].ip[0]	  = ref[i].ip[0];
+				entry[NumEntries].ip[1]	  = ref[i].ip[1];
+				entry[NumEntries].ref	  = i;
+				entry[NumEntries].NumRefs = 0;
+				NumEntries++;
+			}
+			entry[NumEntries-1].NumRefs++;
+		}
+		// block numbers follow the entries
+		blocks = (uint32_t *)((pointer_addr_t)p + NumEntries * sizeof(ipindex_entry_t));
+		for ( i=0; i<NumRefs; i++ ) 
+			blocks[i] = ref[i].block;
+		header->NumEntries = NumEntries;
+		header->NumRefs	   = NumRefs;
+		size = sizeof(ipindex_header_t) + IPINDEX_FLAGS_SIZE(NumBlocks) + NumEntries * sizeof(ipindex_entry_t) + NumRefs * sizeof(uint32_t);
+	}
+
+	ret = WriteIndexFile(filename, (void *)buff, size);
+
+	free(buff);
+	free(ref);
+	free(flags);
+
+	return ret;
+
+} // End of WriteIPIndex
+
+int BuildIPIndex(char *filename, int mode) {
+nffile_t	*nffile;
+int			ret;
+
+	nffile = OpenFile(filename, NULL);
+	if ( !nffile ) 
+		return 0;
+
+	ret = WriteIPIndex(nffile, filename, mode);
+
+	CloseFile(nffile);
+	DisposeFile(nffile);
+
+	return ret;
+
+} // End of BuildIPIndex
+
+/*
+ * Loads the IP index of filename. An index of a modified data file is outdated and ignored.
+ */
+static int LoadIPIndex(char *filename, uint32_t NumBlocks, ipindex_t *ipindex) {
+char		indexfile[MAXPATHLEN];
+struct stat	data_stat, index_stat;
+size_t		size;
+uint8_t		*p;
+int			fd;
+
+	memset((void *)ipindex, 0, sizeof(ipindex_t));
+	// no usable index for a too long path - read all blocks
+	if ( snprintf(indexfile, MAXPATHLEN, "%s%s", filename, IPINDEX_SUFFIX) >= MAXPATHLEN )
+		return 0;
+
+	if ( stat(filename, &data_stat) < 0 || stat(indexfile, &index_stat) < 0 ) 
+		return 0;
+	if ( index_stat.st_size < sizeof(ipindex_header_t) ) 
+		return 0;
+
+	ipindex->buff = malloc(index_stat.st_size);
+	if ( !ipindex->buff ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+
+	fd = open(indexfile, O_RDONLY);
+	if ( fd < 0 || read(fd, ipindex->buff, index_stat.st_size) != index_stat.st_size ) {
+		LogError("Failed to read index file '%s': %s", indexfile, strerror(errno));
+		if ( fd >= 0 ) 
+			close(fd);
+		free(ipindex->buff);
+		return 0;
+	}
+	close(fd);
+
+	ipindex->header = (ipindex_header_t *)ipindex->buff;
+	p = (uint8_t *)ipindex->buff + sizeof(ipindex_header_t);
+	ipindex->flags = p;
+	p += IPINDEX_FLAGS_SIZE(ipindex->header->NumBlocks);
+
+	size = sizeof(ipindex_header_t) + IPINDEX_FLAGS_SIZE(ipindex->header->NumBlocks);
+	switch (ipindex->header->mode) {
+		case IPINDEX_FULL:
+			ipindex->entry = (ipindex_entry_t *)p;
+			ipindex->ref   = (uint32_t *)((pointer_addr_t)p + ipindex->header->NumEntries * sizeof(ipindex_entry_t));
+			size += (size_t)ipindex->header->NumEntries * sizeof(ipindex_entry_t) + (size_t)ipindex->header->NumRefs * sizeof(uint32_t);
+			break;
+		case IPINDEX_BLOOM:
+			ipindex->bloom = p;
+			size += (size_t)ipindex->header->NumBlocks * ipindex->header->BloomSize;
+			break;
+		default:
+			size = 0;
+	}
+
+	if ( ipindex->header->magic != IPINDEX_MAGIC || ipindex->header->version != IPINDEX_VERSION ||
+		 ipindex->header->NumBlocks != NumBlocks || size != index_stat.st_size ||
+		 ipindex->header->DataSize != data_stat.st_size || ipindex->header->DataTime != data_stat.st_mtime ) {
+		free(ipindex->buff);
+		return 0;
+	}
+
+	return 1;
+
+} // End of LoadIPIndex
+
+static int FullLookup(uint64_t *ip, int exact, void *data) {
+ipindex_lookup_t	*lookup  = (ipindex_lookup_t *)data;
+ipindex_t			*ipindex = lookup->ipindex;
+ipindex_entry_t		*entry	 = ipindex->entry;
+uint32_t			lo, hi, mid;
+
+	// first entry with the lower word
+	lo = 0;
+	hi = ipindex->header->NumEntries;
+	while ( lo < hi ) {
+		mid = (lo + hi) >> 1;
+		if ( entry[mid].ip[1] < ip[1] ) 
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for ( ; lo < ipindex->header->NumEntries && entry[lo].ip[1] == ip[1]; lo++ ) {
+		uint32_t *ref = &ipindex->ref[entry[lo].ref];
+		uint32_t l, h;
+		if ( exact && entry[lo].ip[0] != ip[0] ) 
+			continue;
+		l = 0;
+		h = entry[lo].NumRefs;
+		while ( l < h ) {
+			mid = (l + h) >> 1;
+			if ( ref[mid] < lookup->block ) 
+				l = mid + 1;
+			else
+				h = mid;
+		}
+		if ( l < entry[lo].NumRefs && ref[l] == lookup->block ) 
+			return 1;
+	}
+
+	return 0;
+
+} // End of FullLookup
+
+static int BloomLookup(uint64_t *ip, int exact, void *data) {
+ipindex_lookup_t	*lookup  = (ipindex_lookup_t *)data;
+ipindex_t			*ipindex = lookup->ipindex;
+uint32_t			bits	 = ipindex->header->BloomSize << 3;
+uint8_t				*bloom	 = ipindex->bloom + (size_t)lookup->block * ipindex->header->BloomSize;
+uint64_t			h		 = IPHash(ip[1]);
+uint32_t			h1		 = h & 0xFFFFFFFF;
+uint32_t			h2		 = (h >> 32) | 1;
+uint32_t			k;
+
+	// the bloom filter holds the lower word of the addresses only
+	for ( k=0; k<BLOOM_HASHES; k++ ) {
+		uint32_t bit = (h1 + k * h2) & (bits - 1);
+		if ( (bloom[bit >> 3] & (1 << (bit & 0x7))) == 0 ) 
+			return 0;
+	}
+
+	return 1;
+
+} // End of BloomLookup
+
+static int NoAddress(uint64_t *ip, int exact, void *data) {
+	return 0;
+} // End of NoAddress
+
+/*
+ * Returns 1, if the filter matches only flows with any of the addresses of the filter.
+ */
+int IPIndexUsable(FilterEngine_t *engine) {
+
+	return engine->program && !IPMatchFilter(engine, NoAddress, NULL);
+
+} // End of IPIndexUsable
+
+/*
+ * Returns the block selection of filename: 0 for each block, which does not hold any
+ * address required by the filter, or NULL, if the file has no valid index.
+ */
+uint8_t *IPIndexSelect(FilterEngine_t *engine, char *filename, uint32_t NumBlocks) {
+ipindex_t			ipindex;
+ipindex_lookup_t	lookup;
+uint8_t				*select;
+uint32_t			i;
+
+	if ( !filename || !LoadIPIndex(filename, NumBlocks, &ipindex) ) 
+		return NULL;
+
+	select = (uint8_t *)malloc(NumBlocks ? NumBlocks : 1);
+	if ( !select ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		free(ipindex.buff);
+		return NULL;
+	}
+
+	lookup.ipindex = &ipindex;
+	for ( i=0; i<NumBlocks; i++ ) {
+		if ( (ipindex.flags[i] & IPBLOCK_INDEXED) == 0 ) {
+			select[i] = 1;
+			continue;
+		}
+		lookup.block = i;
+		select[i] = IPMatchFilter(engine, ipindex.header->mode == IPINDEX_BLOOM ? BloomLookup : FullLookup, (void *)&lookup);
+	}
+
+	free(ipindex.buff);
+	return select;
+
+} // End of IPIndexSelect
+
+void PrintIPIndex(nffile_t *nffile, char *filename) {
+ipindex_t	ipindex;
+uint32_t	i, indexed;
+
+	printf("File    : %s\n", filename);
+	if ( !LoadIPIndex(filename, nffile->file_header->NumBlocks, &ipindex) ) {
+		printf("Index   : <none or outdated>\n");
+		return;
+	}
+
+	indexed = 0;
+	for ( i=0; i<ipindex.header->NumBlocks; i++ ) 
+		if ( ipindex.flags[i] & IPBLOCK_INDEXED ) 
+			indexed++;
+
+	printf("Index   : %s\n", ipindex.header->mode == IPINDEX_BLOOM ? "bloom" : "full");
+	printf("Blocks  : %u, indexed: %u\n", ipindex.header->NumBlocks, indexed);
+	if ( ipindex.header->mode == IPINDEX_BLOOM ) 
+		printf("Bloom   : %u bytes per block\n", ipindex.header->BloomSize);
+	else
+		printf("Entries : %u addresses, %u block refs\n", ipindex.header->NumEntries, ipindex.header->NumRefs);
+
+	free(ipindex.buff);
+
+} // End of PrintIPIndex
@@ -0,0 +1,108 @@
+/*
+ *  Copyright (c) 2020, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#ifndef _IPINDEX_H
+#define _IPINDEX_H 1
+
+#include "config.h"
+
+#include <sys/types.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "nffile.h"
+#include "nftree.h"
+
+/*
+ * IP index file
+ * =============
+ * Sidecar file <datafile>.ipidx of a data file, which maps the src and dst addresses
+ * of the flows to the data blocks of the file. If a filter matches only flows of given
+ * addresses, nfdump reads only the blocks, which may hold any of these addresses.
+ *
+ *   +--------+-------------+-------------------------------------------+
+ *   | header | block flags | full:  entries | block numbers            |
+ *   |        | 1 per block | bloom: one bloom filter per block         |
+ *   +--------+-------------+-------------------------------------------+
+ *
+ * The index is valid as long as size and modification time of the data file do not change.
+ * Blocks with other records than flow records, such as extension maps or exporter
+ * records, as well as column blocks, are not indexed and always read.
+ */
+#define IPINDEX_SUFFIX	".ipidx"
+#define IPINDEX_MAGIC	0xA50C1DE5
+#define IPINDEX_VERSION	1
+
+// index modes
+#define IPINDEX_NONE	0
+#define IPINDEX_FULL	1		// sorted address table with the list of blocks of each address
+#define IPINDEX_BLOOM	2		// bloom filter of the addresses of each block
+
+typedef struct ipindex_header_s {
+	uint32_t	magic;
+	uint16_t	version;
+	uint16_t	mode;
+	uint32_t	NumBlocks;		// number of data blocks of the data file
+	uint32_t	NumEntries;		// full: number of address entries
+	uint32_t	NumRefs;		// full: number of block numbers
+	uint32_t	BloomSize;		// bloom: bytes per block - power of 2
+	uint64_t	DataSize;		// size and modification time of the data file
+	uint64_t	DataTime;
+} ipindex_header_t;
+
+// block flags
+#define IPBLOCK_INDEXED	1		// all flows of the block are indexed
+// the block flags are padded to 8 bytes
+#define IPINDEX_FLAGS_SIZE(n)	(((size_t)(n) + 7) & ~(size_t)7)
+
+typedef struct ipindex_entry_s {
+	uint64_t	ip[2];			// entries are sorted by ip[1], ip[0]
+	uint32_t	ref;			// index of the first block number
+	uint32_t	NumRefs;		// number of blocks - ascending block numbers
+} ipindex_entry_t;
+
+// bloom filter: number of bits set per address and bits per address of the largest block
+#define BLOOM_HASHES	4
+#define BLOOM_BITS		8
+
+int IPIndexMode(char *mode);
+
+int WriteIPIndex(nffile_t *nffile, char *filename, int mode);
+
+int BuildIPIndex(char *filename, int mode);
+
+void PrintIPIndex(nffile_t *nffile, char *filename);
+
+int IPIndexUsable(FilterEngine_t *engine);
+
+uint8_t *IPIndexSelect(FilterEngine_t *engine, char *filename, uint32_t NumBlocks);
+
+#endif //_IPINDEX_H
@@ -70,6 +70,7 @@
 #include "expire.h"
 #include "collector.h"
 #include "launch.h"
+#include "ipindex.h"
 
 #define DEVEL 1
 
@@ -316,7 +317,7 @@ int				ret, bookkeeper_stat, do_rescan;
 
 } // End of do_expire
 
-void launcher (void *commbuff, FlowSource_t *FlowSource, char *process, int expire) {
+void launcher (void *commbuff, FlowSource_t *FlowSource, char *process, int expire, int ipindex) {
 FlowSource_t	*fs;
 struct sigaction act;
 char 		*args[MAXARGS];
@@ -395,6 +396,13 @@ srecord_t	*InfoRecord;
 
 			fs = FlowSource;
 			while ( fs ) {
+				if ( ipindex ) {
+					char path[MAXPATHLEN];
+					if ( snprintf(path, MAXPATHLEN, "%s/%s", fs->datadir, InfoRecord->fname) >= MAXPATHLEN )
+						LogError("Launcher: ident: %s, Path too long to index '%s'", fs->Ident, InfoRecord->fname);
+					else if ( !BuildIPIndex(path, ipindex) )
+						LogError("Launcher: ident: %s, Failed to index '%s'", fs->Ident, path);
+				}
 				if ( expire ) 
 					do_expire(fs->datadir);
 				fs = fs->next;
@@ -48,6 +48,6 @@ typedef struct srecord_s {
 	int		failed;					// in case of an error
 } srecord_t;
 
-void launcher (void *commbuff, FlowSource_t *FlowSource, char *process, int expire);
+void launcher (void *commbuff, FlowSource_t *FlowSource, char *process, int expire, int ipindex);
 
 #endif //_LAUNCH_H
@@ -63,7 +63,7 @@ extern extension_descriptor_t extension_descriptor[];
 
 /* module limited globals */
 static extension_info_t pcap_extension_info;		// common for all pcap records
-static extension_map_t	*pcap_extension_map;
+static __thread extension_map_t	*pcap_extension_map;	// each flow thread adds its own map
 
 static uint32_t pcap_output_record_size_v4;
 static uint32_t pcap_output_record_size_v6;
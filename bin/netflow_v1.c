@@ -113,6 +113,9 @@ uint16_t	map_size;
 	v1_extension_info.map		   = NULL;
 	v1_extension_info.next		   = NULL;
 	v1_extension_info.offset_cache = NULL;
+	v1_extension_info.plan		   = NULL;
+	v1_extension_info.filter_plan = NULL;
+	v1_extension_info.match_plan  = NULL;
 	v1_extension_info.ref_count	= 0;
 
 	extension_size  = 0;
@@ -170,17 +173,19 @@ uint16_t	map_size;
 
 static inline exporter_v1_t *GetExporter(FlowSource_t *fs, netflow_v1_header_t *header) {
 exporter_v1_t **e = (exporter_v1_t **)&(fs->exporter_data);
+exporter_v1_t *exporter;
 uint16_t	version    = ntohs(header->version);
 #define IP_STRING_LEN   40
 char ipstr[IP_STRING_LEN];
 
 	// search the appropriate exporter engine
-	while ( *e ) {
-		if ( (*e)->info.version == version && 
-			 (*e)->info.ip.V6[0] == fs->ip.V6[0] && (*e)->info.ip.V6[1] == fs->ip.V6[1]) 
-			return *e;
+	exporter = (exporter_v1_t *)LookupExporter(fs, version, 0);
+	if ( exporter ) 
+		return exporter;
+
+	// append new exporter
+	while ( *e ) 
 		e = &((*e)->next);
-	}
 
 	// nothing found
 	*e = (exporter_v1_t *)malloc(sizeof(exporter_v1_t));
@@ -222,6 +227,7 @@ char ipstr[IP_STRING_LEN];
 
 	(*e)->info.sysid = 0;
 	FlushInfoExporter(fs, &((*e)->info));
+	IndexExporter(fs, (exporter_t *)(*e));
 
 	if ( fs->sa_family == AF_INET ) {
 		uint32_t _ip = htonl(fs->ip.V4);
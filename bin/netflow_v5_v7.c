@@ -130,6 +130,9 @@ uint16_t	map_size;
 	v5_extension_info.map		   = NULL;
 	v5_extension_info.next		   = NULL;
 	v5_extension_info.offset_cache = NULL;
+	v5_extension_info.plan		   = NULL;
+	v5_extension_info.filter_plan = NULL;
+	v5_extension_info.match_plan  = NULL;
 	v5_extension_info.ref_count	   = 0;
 
 	// default map - 0 extensions
@@ -181,6 +184,7 @@ uint16_t	map_size;
 
 static inline exporter_v5_t *GetExporter(FlowSource_t *fs, netflow_v5_header_t *header) {
 exporter_v5_t **e = (exporter_v5_t **)&(fs->exporter_data);
+exporter_v5_t *exporter;
 sampler_t *sampler;
 uint16_t	engine_tag = ntohs(header->engine_tag);
 uint16_t	version    = ntohs(header->version);
@@ -188,12 +192,13 @@ uint16_t	version    = ntohs(header->version);
 char ipstr[IP_STRING_LEN];
 
 	// search the appropriate exporter engine
-	while ( *e ) {
-		if ( (*e)->info.version == version && (*e)->info.id == engine_tag &&
-			 (*e)->info.ip.V6[0] == fs->ip.V6[0] && (*e)->info.ip.V6[1] == fs->ip.V6[1]) 
-			return *e;
+	exporter = (exporter_v5_t *)LookupExporter(fs, version, engine_tag);
+	if ( exporter ) 
+		return exporter;
+
+	// append new exporter
+	while ( *e ) 
 		e = &((*e)->next);
-	}
 
 	// nothing found
 	*e = (exporter_v5_t *)malloc(sizeof(exporter_v5_t));
@@ -253,6 +258,7 @@ char ipstr[IP_STRING_LEN];
 
 	(*e)->info.sysid = 0;
 	FlushInfoExporter(fs, &((*e)->info));
+	IndexExporter(fs, (exporter_t *)(*e));
 	sampler->info.exporter_sysid		= (*e)->info.sysid;
 	FlushInfoSampler(fs, &(sampler->info));
 
@@ -41,6 +41,7 @@
 #include <time.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <pthread.h>
 
 #ifdef HAVE_STDINT_H
 #include <stdint.h>
@@ -393,7 +394,10 @@ static output_template_t	*output_templates;
 static uint64_t	boot_time;	// in msec
 static uint16_t				template_id;
 static uint32_t				Max_num_v9_tags;
-static uint32_t				processed_records;
+static __thread uint32_t	processed_records;
+
+// the translation cache is shared by the receiver threads
+static pthread_mutex_t		template_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /* local function prototypes */
 static int HasOptionTable(exporterDomain_t *exporter, uint16_t tableID );
@@ -487,13 +491,15 @@ static inline exporterDomain_t *GetExporter(FlowSource_t *fs, uint32_t exporter_
 #define IP_STRING_LEN   40
 char ipstr[IP_STRING_LEN];
 exporterDomain_t **e = (exporterDomain_t **)&(fs->exporter_data);
+exporterDomain_t *exporter;
+
+	exporter = (exporterDomain_t *)LookupExporter(fs, 9, exporter_id);
+	if ( exporter ) 
+		return exporter;
 
-	while ( *e ) {
-		if ( (*e)->info.id == exporter_id && (*e)->info.version == 9 && 
-			 (*e)->info.ip.V6[0] == fs->ip.V6[0] && (*e)->info.ip.V6[1] == fs->ip.V6[1]) 
-			return *e;
+	// append new exporter
+	while ( *e ) 
 		e = &((*e)->next);
-	}
 
 	if ( fs->sa_family == AF_INET ) {
 		uint32_t _ip = htonl(fs->ip.V4);
@@ -530,6 +536,7 @@ exporterDomain_t **e = (exporterDomain_t **)&(fs->exporter_data);
 	(*e)->next	 	 = NULL;
 
 	FlushInfoExporter(fs, &((*e)->info));
+	IndexExporter(fs, (exporter_t *)(*e));
 
 	dbg_printf("Process_v9: New exporter: SysID: %u, Domain: %u, IP: %s\n", 
 		(*e)->info.sysid, exporter_id, ipstr);
@@ -2036,7 +2043,7 @@ netflow_v9_header_t	*v9_header;
 int64_t 			distance;
 uint32_t 			flowset_id, flowset_length, exporter_id;
 ssize_t				size_left;
-static int pkg_num = 0;
+static __thread int pkg_num = 0;
 
 	pkg_num++;
 	dbg_printf("Process_v9: Next packet: %i\n", pkg_num);
@@ -2147,7 +2154,9 @@ static int pkg_num = 0;
 
 		switch (flowset_id) {
 			case NF9_TEMPLATE_FLOWSET_ID:
+				pthread_mutex_lock(&template_mutex);
 				Process_v9_templates(exporter, flowset_header, fs);
+				pthread_mutex_unlock(&template_mutex);
 				break;
 			case NF9_OPTIONS_FLOWSET_ID: {
 #ifdef DEVEL
@@ -2155,7 +2164,9 @@ static int pkg_num = 0;
 				option_flowset = (option_template_flowset_t *)flowset_header;
 				dbg_printf("Process_v9: Found options flowset: template %u", ntohs(option_flowset->template_id));
 #endif
+				pthread_mutex_lock(&template_mutex);
 				Process_v9_option_templates(exporter, flowset_header, fs);
+				pthread_mutex_unlock(&template_mutex);
 				} break;
 			default: {
 				input_translation_t *table;
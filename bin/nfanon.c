@@ -46,6 +46,7 @@
 #include <arpa/inet.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #ifdef HAVE_STDINT_H
 #include <stdint.h>
@@ -58,16 +59,56 @@
 #include "exporter.h"
 #include "flist.h"
 #include "panonymizer.h"
+#include "nfcolumn.h"
+
+/* parallel anonymization */
+#define JOB_FREE	0
+#define JOB_READY	1
+#define JOB_BUSY	2
+#define JOB_DONE	3
+
+typedef struct anon_job_s {
+	void	*buff;			// input data block incl. block header
+	void	*out;			// anonymized records
+	int		status;
+} anon_job_t;
 
 // module limited globals
 extension_map_list_t *extension_map_list;
 
+static struct worker_pool_s {
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+	int				terminate;
+	int				num_workers;
+	pthread_t		*tid;
+	int				num_jobs;
+	anon_job_t		*job;			// job ring
+	uint64_t		next_put;		// next job to be queued by the main thread
+	uint64_t		next_take;		// next job to be processed by a worker
+	uint64_t		next_flush;		// next job to be appended to the output file
+} WorkerPool;
+
 /* Function Prototypes */
 static void usage(char *name);
 
 static inline void AnonRecord(master_record_t *master_record);
 
-static void process_data(void *wfile);
+static void AnonBlock(data_block_header_t *in, data_block_header_t *out);
+
+static void *WorkerThread(void *arg);
+
+static int StartWorkers(int num_workers);
+
+static void StopWorkers(void);
+
+static int FlowRecordsOnly(nffile_t *nffile, int size);
+
+static void QueueBlock(nffile_t *nffile_r, nffile_t *nffile_w);
+
+static void FlushJobs(nffile_t *nffile_w, int all);
+
+static void process_data(void *wfile, int num_workers);
 
 /* Functions */
 
@@ -83,6 +124,7 @@ static void usage(char *name) {
 					"-M <expr>\tRead input from multiple directories.\n"
 					"-R <expr>\tRead input from sequence of files.\n"
 					"-w <file>\tName of output file. Defaults to input file.\n"
+					"-W <num>\tAnonymize with <num> worker threads.\n"
 					, name);
 } /* usage */
 
@@ -167,12 +209,232 @@ int		i;
 
 } // End of AnonRecord
 
+/*
+ * Anonymize all flow records of block in into block out
+ * The anonymized records have at most the size of the input records,
+ * so PackRecord() never flushes the private output block.
+ */
+static void AnonBlock(data_block_header_t *in, data_block_header_t *out) {
+master_record_t	master_record;
+common_record_t	*flow_record;
+nffile_t		nffile;
+uint32_t		i;
+
+	memset((void *)&nffile, 0, sizeof(nffile));
+	nffile.block_header = out;
+	nffile.buff_ptr		= (void *)((pointer_addr_t)out + sizeof(data_block_header_t));
+	out->NumRecords		= 0;
+	out->size			= 0;
+
+	flow_record = (common_record_t *)((pointer_addr_t)in + sizeof(data_block_header_t));
+	for ( i=0; i < in->NumRecords; i++ ) {
+		extension_info_t *extension_info = extension_map_list->slot[flow_record->ext_map];
+		if ( extension_info ) {
+			ExpandRecord_plan(flow_record, extension_info, NULL, &master_record);
+			AnonRecord(&master_record);
+			PackRecord(&master_record, &nffile);
+		}
+		flow_record = (common_record_t *)((pointer_addr_t)flow_record + flow_record->size);
+	}
+
+} // End of AnonBlock
+
+static void *WorkerThread(void *arg) {
+anon_job_t *job;
+
+	pthread_mutex_lock(&WorkerPool.mutex);
+	while ( 1 ) {
+		while ( !WorkerPool.terminate && WorkerPool.next_take == WorkerPool.next_put )
+			pthread_cond_wait(&WorkerPool.cond, &WorkerPool.mutex);
+		if ( WorkerPool.terminate )
+			break;
+
+		job = &WorkerPool.job[WorkerPool.next_take % WorkerPool.num_jobs];
+		WorkerPool.next_take++;
+		job->status = JOB_BUSY;
+		pthread_mutex_unlock(&WorkerPool.mutex);
+
+		AnonBlock((data_block_header_t *)job->buff, (data_block_header_t *)job->out);
+
+		pthread_mutex_lock(&WorkerPool.mutex);
+		job->status = JOB_DONE;
+		pthread_cond_broadcast(&WorkerPool.cond);
+	}
+	pthread_mutex_unlock(&WorkerPool.mutex);
+
+	PAnonymizer_FreeCache();
+	pthread_exit(NULL);
+
+} // End of WorkerThread
+
+static int StartWorkers(int num_workers) {
+int i, err;
+
+	memset((void *)&WorkerPool, 0, sizeof(WorkerPool));
+	WorkerPool.num_workers = num_workers;
+	WorkerPool.num_jobs	   = 2 * num_workers;
+	WorkerPool.tid = (pthread_t *)calloc(num_workers, sizeof(pthread_t));
+	WorkerPool.job = (anon_job_t *)calloc(WorkerPool.num_jobs, sizeof(anon_job_t));
+	if ( !WorkerPool.tid || !WorkerPool.job ) {
+		LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+
+	for ( i=0; i<WorkerPool.num_jobs; i++ ) {
+		WorkerPool.job[i].buff = malloc(BUFFSIZE);
+		WorkerPool.job[i].out  = malloc(BUFFSIZE);
+		if ( !WorkerPool.job[i].buff || !WorkerPool.job[i].out ) {
+			LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			return 0;
+		}
+		WorkerPool.job[i].status = JOB_FREE;
+	}
+
+	pthread_mutex_init(&WorkerPool.mutex, NULL);
+	pthread_cond_init(&WorkerPool.cond, NULL);
+
+	for ( i=0; i<num_workers; i++ ) {
+		err = pthread_create(&WorkerPool.tid[i], NULL, WorkerThread, NULL);
+		if ( err ) {
+			LogError("pthread_create() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(err) );
+			exit(255);
+		}
+	}
+
+	return 1;
+
+} // End of StartWorkers
+
+static void StopWorkers(void) {
+int i;
+
+	pthread_mutex_lock(&WorkerPool.mutex);
+	WorkerPool.terminate = 1;
+	pthread_cond_broadcast(&WorkerPool.cond);
+	pthread_mutex_unlock(&WorkerPool.mutex);
+
+	for ( i=0; i<WorkerPool.num_workers; i++ )
+		pthread_join(WorkerPool.tid[i], NULL);
+
+	for ( i=0; i<WorkerPool.num_jobs; i++ ) {
+		free(WorkerPool.job[i].buff);
+		free(WorkerPool.job[i].out);
+	}
+	free(WorkerPool.job);
+	free(WorkerPool.tid);
+
+	pthread_mutex_destroy(&WorkerPool.mutex);
+	pthread_cond_destroy(&WorkerPool.cond);
+
+} // End of StopWorkers
 
-static void process_data(void *wfile) {
+/*
+ * Check the records of a block - returns 1, if the block holds flow records only.
+ * These blocks are anonymized by the workers.
+ */
+static int FlowRecordsOnly(nffile_t *nffile, int size) {
+common_record_t *flow_record;
+uint32_t i, sumSize;
+
+	if ( nffile->block_header->size > WRITE_BUFFSIZE ) 
+		return 0;
+
+	sumSize = 0;
+	flow_record = nffile->buff_ptr;
+	for ( i=0; i < nffile->block_header->NumRecords; i++ ) {
+		if ( (sumSize + flow_record->size) > size || (flow_record->size < sizeof(record_header_t)) ) {
+			LogError("Corrupt data file. Inconsistent block size in %s line %d\n", __FILE__, __LINE__);
+			exit(255);
+		}
+		if ( flow_record->type != CommonRecordType )
+			return 0;
+		sumSize += flow_record->size;
+		flow_record = (common_record_t *)((pointer_addr_t)flow_record + flow_record->size);
+	}
+
+	return 1;
+
+} // End of FlowRecordsOnly
+
+static void QueueBlock(nffile_t *nffile_r, nffile_t *nffile_w) {
+common_record_t *flow_record;
+anon_job_t	*job;
+void		*_tmp;
+uint32_t	i;
+
+	// update number of flows matching a given map
+	flow_record = nffile_r->buff_ptr;
+	for ( i=0; i < nffile_r->block_header->NumRecords; i++ ) {
+		uint32_t map_id = flow_record->ext_map;
+		if ( extension_map_list->slot[map_id] == NULL ) 
+			LogError("Corrupt data file! No such extension map id: %u. Skip record", map_id );
+		else
+			extension_map_list->slot[map_id]->ref_count++;
+		flow_record = (common_record_t *)((pointer_addr_t)flow_record + flow_record->size);
+	}
+
+	// make sure the next job is free
+	FlushJobs(nffile_w, 0);
+
+	pthread_mutex_lock(&WorkerPool.mutex);
+	job = &WorkerPool.job[WorkerPool.next_put % WorkerPool.num_jobs];
+
+	// swap buffers - the worker takes the block, the file reads the next block into the free buffer
+	_tmp = job->buff;
+	job->buff = nffile_r->buff_pool[0];
+	nffile_r->buff_pool[0] = _tmp;
+	nffile_r->block_header = nffile_r->buff_pool[0];
+	nffile_r->buff_ptr = (void *)((pointer_addr_t)nffile_r->block_header + sizeof(data_block_header_t));
+
+	job->status = JOB_READY;
+	WorkerPool.next_put++;
+	pthread_cond_broadcast(&WorkerPool.cond);
+	pthread_mutex_unlock(&WorkerPool.mutex);
+
+} // End of QueueBlock
+
+/*
+ * Append the records of the anonymized blocks in sequence to the output file.
+ * Waits for all queued blocks, if all is set, otherwise only for a free job slot.
+ */
+static void FlushJobs(nffile_t *nffile_w, int all) {
+anon_job_t *job;
+
+	pthread_mutex_lock(&WorkerPool.mutex);
+	while ( WorkerPool.next_flush < WorkerPool.next_put ) {
+		job = &WorkerPool.job[WorkerPool.next_flush % WorkerPool.num_jobs];
+		if ( job->status != JOB_DONE ) {
+			if ( !all && (WorkerPool.next_put - WorkerPool.next_flush) < WorkerPool.num_jobs ) 
+				break;
+			pthread_cond_wait(&WorkerPool.cond, &WorkerPool.mutex);
+			continue;
+		}
+		pthread_mutex_unlock(&WorkerPool.mutex);
+
+		// append record by record - the output blocks are the same as with a single thread
+		data_block_header_t *block_header = (data_block_header_t *)job->out;
+		common_record_t *flow_record = (common_record_t *)((pointer_addr_t)block_header + sizeof(data_block_header_t));
+		uint32_t i;
+		for ( i=0; i < block_header->NumRecords; i++ ) {
+			AppendToBuffer(nffile_w, (void *)flow_record, flow_record->size);
+			flow_record = (common_record_t *)((pointer_addr_t)flow_record + flow_record->size);
+		}
+
+		pthread_mutex_lock(&WorkerPool.mutex);
+		job->status = JOB_FREE;
+		WorkerPool.next_flush++;
+	}
+	pthread_mutex_unlock(&WorkerPool.mutex);
+
+} // End of FlushJobs
+
+
+static void process_data(void *wfile, int num_workers) {
 master_record_t		master_record;
 common_record_t     *flow_record;
 nffile_t			*nffile_r;
 nffile_t			*nffile_w;
+column_reader_t		*column_reader;
 int 		i, done, ret, cnt, verbose;
 char		outfile[MAXPATHLEN], *cfile;
 
@@ -224,6 +486,15 @@ char		outfile[MAXPATHLEN], *cfile;
 
 	memcpy((void *)nffile_w->stat_record, (void *)nffile_r->stat_record, sizeof(stat_record_t));
 
+	// column blocks are decoded into flow records and written as regular blocks
+	column_reader = NewColumnReader(NULL);
+	if ( !column_reader ) {
+		CloseFile(nffile_r);
+		DisposeFile(nffile_r);
+		DisposeFile(nffile_w);
+		return;
+	}
+
 	done = 0;
 	while ( !done ) {
 		// get next data block from file
@@ -239,6 +510,8 @@ char		outfile[MAXPATHLEN], *cfile;
 				// fall through - get next file in chain
 			case NF_EOF: {
 				nffile_t *next;
+				if ( num_workers ) 
+					FlushJobs(nffile_w, 1);
     			if ( nffile_w->block_header->NumRecords ) {
         			if ( WriteBlock(nffile_w) <= 0 ) {
             			LogError("Failed to write output buffer to disk: '%s'" , strerror(errno));
@@ -294,11 +567,26 @@ char		outfile[MAXPATHLEN], *cfile;
 				} break; // not really needed
 		}
 
+		if ( nffile_r->block_header->id == DATA_BLOCK_TYPE_3 ) {
+			ret = DecodeColumnBlock(column_reader, nffile_r, extension_map_list);
+			if ( ret <= 0 ) 
+				continue;
+		}
+
 		if ( nffile_r->block_header->id != DATA_BLOCK_TYPE_2 ) {
 			fprintf(stderr, "Can't process block type %u. Skip block.\n", nffile_r->block_header->id);
 			continue;
 		}
 
+		if ( num_workers ) {
+			if ( FlowRecordsOnly(nffile_r, ret) ) {
+				QueueBlock(nffile_r, nffile_w);
+				continue;
+			}
+			// extension maps are processed in sequence
+			FlushJobs(nffile_w, 1);
+		}
+
 		flow_record = nffile_r->buff_ptr;
 		uint32_t sumSize = 0;
 		for ( i=0; i < nffile_r->block_header->NumRecords; i++ ) {
@@ -314,7 +602,7 @@ char		outfile[MAXPATHLEN], *cfile;
 					if ( extension_map_list->slot[map_id] == NULL ) {
 						LogError("Corrupt data file! No such extension map id: %u. Skip record", flow_record->ext_map );
 					} else {
-						ExpandRecord_v2( flow_record, extension_map_list->slot[flow_record->ext_map], NULL, &master_record);
+						ExpandRecord_plan( flow_record, extension_map_list->slot[flow_record->ext_map], NULL, &master_record);
 	
 						// update number of flows matching a given map
 						extension_map_list->slot[map_id]->ref_count++;
@@ -368,6 +656,7 @@ char		outfile[MAXPATHLEN], *cfile;
 	}
 
 	DisposeFile(nffile_w);
+	DisposeColumnReader(column_reader);
 
 	LogError("\n");
 	LogError("Processed %i files.\n", --cnt);
@@ -379,9 +668,11 @@ int main( int argc, char **argv ) {
 char 		*rfile, *Rfile, *wfile, *Mdirs;
 int			c;
 char		CryptoPAnKey[32];
+int			num_workers;
 
 	rfile = Rfile = Mdirs = wfile = NULL;
-	while ((c = getopt(argc, argv, "K:L:r:M:R:w:")) != EOF) {
+	num_workers = 0;
+	while ((c = getopt(argc, argv, "K:L:r:M:R:w:W:")) != EOF) {
 		switch (c) {
 			case 'h':
 				usage(argv[0]);
@@ -413,6 +704,13 @@ char		CryptoPAnKey[32];
 			case 'w':
 				wfile = optarg;
 				break;
+			case 'W':
+				num_workers = atoi(optarg);
+				if ( num_workers < 1 || num_workers > MAXWORKERS ) {
+					LogError("Number of worker threads %s out of range 1..%d\n", optarg, MAXWORKERS);
+					exit(255);
+				}
+				break;
 			default:
 				usage(argv[0]);
 				exit(0);
@@ -432,7 +730,15 @@ char		CryptoPAnKey[32];
 
 	SetupInputFileSequence(Mdirs, rfile, Rfile);
 
-	process_data(wfile);
+	if ( num_workers && !StartWorkers(num_workers) ) 
+		exit(255);
+
+	process_data(wfile, num_workers);
+
+	if ( num_workers ) 
+		StopWorkers();
+	else
+		PAnonymizer_FreeCache();
 
 	FreeExtensionMaps(extension_map_list);
 
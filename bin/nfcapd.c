@@ -54,6 +54,7 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <dirent.h>
+#include <pthread.h>
 
 #ifdef PCAP
 #include "pcap_reader.h"
@@ -78,6 +79,7 @@
 #include "netflow_v5_v7.h"
 #include "netflow_v9.h"
 #include "ipfix.h"
+#include "ipindex.h"
 
 #ifdef HAVE_FTS_H
 #   include <fts.h>
@@ -112,6 +114,37 @@ static FlowSource_t *FlowSource;
 
 static int done, launcher_alive, periodic_trigger, launcher_pid;
 
+/*
+ * multi threaded receive
+ * Each receiver thread reads from its own SO_REUSEPORT socket. The kernel selects the socket
+ * by the sender address and port, so all packets of an exporter end up in the same thread,
+ * which keeps the template state of the exporter. A receiver collects into a private copy
+ * of each flow source, whose block buffer appends the blocks to the shared file.
+ * For the file rotation, the receivers flush their buffers and wait for the main thread.
+ */
+#define MAXRECEIVERS	16
+#define RECEIVE_TIMEOUT	100		// msec - max delay to see a rotation request
+
+typedef struct receiver_s {
+	pthread_t		tid;
+	int				socket;
+	repeater_t		*repeater;
+	FlowSource_t	*FlowSource;	// private copy of the flow source list
+	packet_batch_t	*batch;
+	uint32_t		rotate;			// last rotation request seen
+	uint32_t		ignored_packets;
+} receiver_t;
+
+static struct receiver_ctl_s {
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+	uint32_t		rotate;			// rotation request sequence
+	uint32_t		rotated;		// last rotation done
+	int				synced;			// number of receivers waiting for the rotation
+	int				terminate;		// receivers exit after the rotation
+	uint32_t		ignored_packets;
+} receiver_ctl = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0, 0, 0 };
+
 static const char *nfdump_version = VERSION;
 
 
@@ -122,15 +155,32 @@ static void kill_launcher(int pid);
 
 static void IntHandler(int signal);
 
-static inline FlowSource_t *GetFlowSource(struct sockaddr_storage *ss);
+static inline FlowSource_t *GetFlowSource(FlowSource_t *FlowSource, struct sockaddr_storage *ss);
 
 static void daemonize(void);
 
 static void SetPriv(char *userid, char *groupid );
 
+static int OpenFlowSources(int compress);
+
+static void RotateFiles(time_t t_start, time_t twin, int use_subdirs, char *time_extension, int compress);
+
 static void run(packet_function_t receive_packet, int socket, repeater_t *repeater, 
 	time_t twin, time_t t_begin, int report_seq, int use_subdirs, char *time_extension, int compress);
 
+static FlowSource_t *CopyFlowSources(int receiver, int num_receivers);
+
+static void FreeFlowSources(FlowSource_t *fs);
+
+static void DisposeReceivers(receiver_t *receiver, int num_receivers);
+
+static int SyncReceiver(receiver_t *receiver);
+
+static void *ReceiverThread(void *arg);
+
+static void run_receivers(int *sockets, int num_receivers, repeater_t *repeater, 
+	time_t twin, time_t t_begin, int use_subdirs, char *time_extension, int compress);
+
 /* Functions */
 static void usage(char *name) {
 		printf("usage %s [options] \n"
@@ -157,8 +207,12 @@ static void usage(char *name) {
 					"-z\t\tLZO compress flows in output file.\n"
 					"-y\t\tLZ4 compress flows in output file.\n"
 					"-j\t\tBZ2 compress flows in output file.\n"
+					"-W num[:drop]\tQueue num blocks for an async writer thread. drop: drop flows if queue full.\n"
+					"-Q\t\tWrite a block index into each file.\n"
+					"-c num\t\tReceive with num threads, each on its own socket bound to the same port.\n"
 					"-B bufflen\tSet socket buffer to bufflen bytes\n"
 					"-e\t\tExpire data at each cycle.\n"
+					"-k mode\tWrite an IP index of each new file. mode: full or bloom\n"
 					"-D\t\tFork to background\n"
 					"-E\t\tPrint extended format of netflow data. For debugging purpose only.\n"
 					"-T\t\tInclude extension tags in records.\n"
@@ -356,52 +410,212 @@ static void format_file_block_header(data_block_header_t *header) {
 #include "nffile_inline.c"
 #include "collector_inline.c"
 
+static int OpenFlowSources(int compress) {
+FlowSource_t *fs;
+
+	fs = FlowSource;
+	while ( fs ) {
+
+		// prepare file
+		fs->nffile = OpenNewFile(fs->current, NULL, compress, 0, NULL);
+		if ( !fs->nffile ) {
+			return 0;
+		}
+		// init vars
+		fs->bad_packets		= 0;
+		fs->first_seen      = 0xffffffffffffLL;
+		fs->last_seen 		= 0;
+
+		// next source
+		fs = fs->next;
+	}
+
+	return 1;
+
+} // End of OpenFlowSources
+
+static void RotateFiles(time_t t_start, time_t twin, int use_subdirs, char *time_extension, int compress) {
+FlowSource_t	*fs;
+srecord_t		*commbuff;
+struct tm		*now;
+char			*subdir, fmt[MAXTIMESTRING];
+int				err;
+
+	commbuff = (srecord_t *)shmem;
+	now = localtime(&t_start);
+	strftime(fmt, sizeof(fmt), time_extension, now);
+
+	// prepare sub dir hierarchy
+	if ( use_subdirs ) {
+		subdir = GetSubDir(now);
+		if ( !subdir ) {
+			// failed to generate subdir path - put flows into base directory
+			LogError("Failed to create subdir path!");
+	
+			// failed to generate subdir path - put flows into base directory
+			subdir = NULL;
+		} 
+	} else {
+		subdir = NULL;
+	}
+
+	// for each flow source update the stats, close the file and re-initialize the new file
+	fs = FlowSource;
+	while ( fs ) {
+		char nfcapd_filename[MAXPATHLEN];
+		char error[255];
+		nffile_t *nffile = fs->nffile;
+		writer_stat_t writer_stat;
+		int has_writer_stat;
+
+		if ( verbose ) {
+			// Dump to stdout
+			format_file_block_header(nffile->block_header);
+		}
+
+		if ( nffile->block_header->NumRecords ) {
+			// flush current buffer to disc
+			if ( WriteBlock(nffile) <= 0 )
+				LogError("Ident: %s, failed to write output buffer to disk: '%s'" , 
+					fs->Ident, strerror(errno));
+		} // else - no new records in current block
+
+	
+		// prepare filename
+		if ( subdir ) {
+			if ( SetupSubDir(fs->datadir, subdir, error, 255) ) {
+				snprintf(nfcapd_filename, MAXPATHLEN-1, "%s/%s/nfcapd.%s", fs->datadir, subdir, fmt);
+			} else {
+				LogError("Ident: %s, Failed to create sub hier directories: %s", fs->Ident, error );
+				// skip subdir - put flows directly into current directory
+				snprintf(nfcapd_filename, MAXPATHLEN-1, "%s/nfcapd.%s", fs->datadir, fmt);
+			}
+		} else {
+			snprintf(nfcapd_filename, MAXPATHLEN-1, "%s/nfcapd.%s", fs->datadir, fmt);
+		}
+		nfcapd_filename[MAXPATHLEN-1] = '\0';
+	
+		// update stat record
+		// if no flows were collected, fs->last_seen is still 0
+		// set first_seen to start of this time slot, with twin window size.
+		if ( fs->last_seen == 0 ) {
+			fs->first_seen = (uint64_t)1000 * (uint64_t)t_start;
+			fs->last_seen  = (uint64_t)1000 * (uint64_t)(t_start + twin);
+		}
+		nffile->stat_record->first_seen = fs->first_seen/1000;
+		nffile->stat_record->msec_first	= fs->first_seen - nffile->stat_record->first_seen*1000;
+		nffile->stat_record->last_seen 	= fs->last_seen/1000;
+		nffile->stat_record->msec_last	= fs->last_seen - nffile->stat_record->last_seen*1000;
+
+		// Flush Exporter Stat to file
+		FlushExporterStats(fs);
+		// writer stat is lost, when the file is closed
+		has_writer_stat = GetWriterStat(nffile, &writer_stat);
+		// Close file
+		CloseUpdateFile(nffile, fs->Ident);
+
+		// if rename fails, we are in big trouble, as we need to get rid of the old .current file
+		// otherwise, we will loose flows and can not continue collecting new flows
+		err = rename(fs->current, nfcapd_filename);
+		if ( err ) {
+			LogError("Ident: %s, Can't rename dump file: %s", fs->Ident,  strerror(errno));
+			LogError("Ident: %s, Serious Problem! Fix manually", fs->Ident);
+			if ( launcher_pid )
+				commbuff->failed = 1;
+
+			// we do not update the books here, as the file failed to rename properly
+			// otherwise the books may be wrong
+		} else {
+			struct stat	fstat;
+			if ( launcher_pid )
+				commbuff->failed = 0;
+
+			// Update books
+			stat(nfcapd_filename, &fstat);
+			UpdateBooks(fs->bookkeeper, t_start, 512*fstat.st_blocks);
+		}
+
+		// log stats
+		LogInfo("Ident: '%s' Flows: %llu, Packets: %llu, Bytes: %llu, Sequence Errors: %u, Bad Packets: %u", 
+			fs->Ident, (unsigned long long)nffile->stat_record->numflows, 
+			(unsigned long long)nffile->stat_record->numpackets, 
+			(unsigned long long)nffile->stat_record->numbytes, nffile->stat_record->sequence_failure, fs->bad_packets);
+
+		if ( has_writer_stat ) 
+			LogInfo("Ident: '%s' Writer: Blocks: %u, Max queued: %u, Stalls: %u, Stall time: %llu ms, Dropped blocks: %u, Dropped records: %llu", 
+				fs->Ident, writer_stat.blocks, writer_stat.max_queued, writer_stat.stalls, 
+				(unsigned long long)(writer_stat.stall_usec/1000), writer_stat.dropped_blocks, 
+				(unsigned long long)writer_stat.dropped_records);
+
+		// reset stats
+		fs->bad_packets = 0;
+		fs->first_seen  = 0xffffffffffffLL;
+		fs->last_seen 	= 0;
+
+		if ( !done ) {
+			nffile = OpenNewFile(fs->current, nffile, compress, 0, NULL);
+			if ( !nffile ) {
+				LogError("killed due to fatal error: ident: %s", fs->Ident);
+				break;
+			}
+		}
+
+		// Dump all extension maps and exporters to the buffer
+		FlushStdRecords(fs);
+
+		// next flow source
+		fs = fs->next;
+
+	} // end of while (fs)
+
+	// trigger launcher if required
+	if ( launcher_pid ) {
+		// Signal launcher
+
+		strncpy(commbuff->tstring, fmt, MAXTIMESTRING);
+		commbuff->tstring[MAXTIMESTRING-1] = '\0';
+
+		commbuff->tstamp = t_start;
+		if ( subdir ) {
+			snprintf(commbuff->fname, MAXPATHLEN-1, "%s/nfcapd.%s", subdir, fmt);
+		} else {
+			snprintf(commbuff->fname, MAXPATHLEN-1, "nfcapd.%s", fmt);
+		}
+		commbuff->fname[MAXPATHLEN-1] = '\0';
+
+		if ( launcher_alive ) {
+			LogInfo("Signal launcher");
+			kill(launcher_pid, SIGHUP);
+		} else 
+			LogError("ERROR: Launcher died unexpectedly!");
+
+	}
+
+} // End of RotateFiles
+
 static void run(packet_function_t receive_packet, int socket, repeater_t *repeater, 
 	time_t twin, time_t t_begin, int report_seq, int use_subdirs, char *time_extension, int compress) {
 common_flow_header_t	*nf_header;
 FlowSource_t			*fs;
-struct sockaddr_storage nf_sender;
-socklen_t 	nf_sender_size = sizeof(nf_sender);
+packet_batch_t			*batch;
 time_t 		t_start, t_now;
 uint64_t	export_packets;
 uint32_t	blast_cnt, blast_failures, ignored_packets;
 uint16_t	version;
 ssize_t		cnt;
 void 		*in_buff;
-int 		err;
-srecord_t	*commbuff;
 
 	if ( !Init_v1(verbose) || !Init_v5_v7_input(verbose, default_sampling, overwrite_sampling) || 
 		 !Init_v9(verbose, default_sampling, overwrite_sampling) || !Init_IPFIX(verbose, default_sampling, overwrite_sampling) )
 		return;
 
-	in_buff  = malloc(NETWORK_INPUT_BUFF_SIZE);
-	if ( !in_buff ) {
-		LogError("malloc() allocation error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+	batch = NewPacketBatch(PACKET_BATCH, NETWORK_INPUT_BUFF_SIZE);
+	if ( !batch ) 
 		return;
-	}
-
-	// init vars
-	commbuff = (srecord_t *)shmem;
-	nf_header = (common_flow_header_t *)in_buff;
 
 	// Init each netflow source output data buffer
-	fs = FlowSource;
-	while ( fs ) {
-
-		// prepare file
-		fs->nffile = OpenNewFile(fs->current, NULL, compress, 0, NULL);
-		if ( !fs->nffile ) {
-			return;
-		}
-		// init vars
-		fs->bad_packets		= 0;
-		fs->first_seen      = 0xffffffffffffLL;
-		fs->last_seen 		= 0;
-
-		// next source
-		fs = fs->next;
-	}
+	if ( !OpenFlowSources(compress) )
+		return;
 
 	export_packets = blast_cnt = blast_failures = 0;
 	t_start = t_begin;
@@ -422,36 +636,32 @@ srecord_t	*commbuff;
 		struct timeval tv;
 		int i;
 
-		/* read next bunch of data into beginn of input buffer */
+		/* read next batch of packets into the packet buffers */
 		if ( !done) {
 #ifdef PCAP
-			// Debug code to read from pcap file, or from socket 
-			cnt = receive_packet(socket, in_buff, NETWORK_INPUT_BUFF_SIZE , 0, 
-						(struct sockaddr *)&nf_sender, &nf_sender_size);
+			if ( receive_packet != recvfrom ) {
+				// Debug code to read from pcap file
+				packet_t *packet = &batch->packet[0];
+				packet->sender_size = sizeof(packet->sender);
+				cnt = receive_packet(socket, packet->buff, NETWORK_INPUT_BUFF_SIZE , 0, 
+							(struct sockaddr *)&packet->sender, &packet->sender_size);
 						
-			// in case of reading from file EOF => -2
-			if ( cnt == -2 ) 
-				done = 1;
-#else
-			cnt = recvfrom (socket, in_buff, NETWORK_INPUT_BUFF_SIZE , 0, 
-						(struct sockaddr *)&nf_sender, &nf_sender_size);
+				// in case of reading from file EOF => -2
+				if ( cnt == -2 ) 
+					done = 1;
+				packet->len = cnt;
+				batch->num_packets = cnt > 0 ? 1 : 0;
+			} else
 #endif
+			cnt = ReceiveBatch(socket, batch);
 
 			if ( cnt == -1 && errno != EINTR ) {
 				LogError("ERROR: recvfrom: %s", strerror(errno));
 				continue;
 			}
 
-			i = 0;
-			while ( repeater[i].hostname && (i < MAX_REPEATERS)) {
-				ssize_t len;
-				len = sendto(repeater[i].sockfd, in_buff, cnt, 0, 
-						(struct sockaddr *)&(repeater[i].addr), repeater[i].addrlen);
-				if ( len < 0 ) {
-					LogError("ERROR: sendto(): %s", strerror(errno));
-				}
-				i++;
-			}
+			if ( cnt > 0 ) 
+				RepeatBatch(batch, repeater);
 		}
 
 		/* Periodic file renaming, if time limit reached or if we are done.  */
@@ -460,148 +670,9 @@ srecord_t	*commbuff;
 		t_now = tv.tv_sec;
 
 		if ( ((t_now - t_start) >= twin) || done ) {
-			struct  tm *now;
-			char	*subdir, fmt[MAXTIMESTRING];
 
 			alarm(0);
-			now = localtime(&t_start);
-			strftime(fmt, sizeof(fmt), time_extension, now);
-
-			// prepare sub dir hierarchy
-			if ( use_subdirs ) {
-				subdir = GetSubDir(now);
-				if ( !subdir ) {
-					// failed to generate subdir path - put flows into base directory
-					LogError("Failed to create subdir path!");
-			
-					// failed to generate subdir path - put flows into base directory
-					subdir = NULL;
-				} 
-			} else {
-				subdir = NULL;
-			}
-
-			// for each flow source update the stats, close the file and re-initialize the new file
-			fs = FlowSource;
-			while ( fs ) {
-				char nfcapd_filename[MAXPATHLEN];
-				char error[255];
-				nffile_t *nffile = fs->nffile;
-
-				if ( verbose ) {
-					// Dump to stdout
-					format_file_block_header(nffile->block_header);
-				}
-
-				if ( nffile->block_header->NumRecords ) {
-					// flush current buffer to disc
-					if ( WriteBlock(nffile) <= 0 )
-						LogError("Ident: %s, failed to write output buffer to disk: '%s'" , 
-							fs->Ident, strerror(errno));
-				} // else - no new records in current block
-
-	
-				// prepare filename
-				if ( subdir ) {
-					if ( SetupSubDir(fs->datadir, subdir, error, 255) ) {
-						snprintf(nfcapd_filename, MAXPATHLEN-1, "%s/%s/nfcapd.%s", fs->datadir, subdir, fmt);
-					} else {
-						LogError("Ident: %s, Failed to create sub hier directories: %s", fs->Ident, error );
-						// skip subdir - put flows directly into current directory
-						snprintf(nfcapd_filename, MAXPATHLEN-1, "%s/nfcapd.%s", fs->datadir, fmt);
-					}
-				} else {
-					snprintf(nfcapd_filename, MAXPATHLEN-1, "%s/nfcapd.%s", fs->datadir, fmt);
-				}
-				nfcapd_filename[MAXPATHLEN-1] = '\0';
-	
-				// update stat record
-				// if no flows were collected, fs->last_seen is still 0
-				// set first_seen to start of this time slot, with twin window size.
-				if ( fs->last_seen == 0 ) {
-					fs->first_seen = (uint64_t)1000 * (uint64_t)t_start;
-					fs->last_seen  = (uint64_t)1000 * (uint64_t)(t_start + twin);
-				}
-				nffile->stat_record->first_seen = fs->first_seen/1000;
-				nffile->stat_record->msec_first	= fs->first_seen - nffile->stat_record->first_seen*1000;
-				nffile->stat_record->last_seen 	= fs->last_seen/1000;
-				nffile->stat_record->msec_last	= fs->last_seen - nffile->stat_record->last_seen*1000;
-
-				// Flush Exporter Stat to file
-				FlushExporterStats(fs);
-				// Close file
-				CloseUpdateFile(nffile, fs->Ident);
-
-				// if rename fails, we are in big trouble, as we need to get rid of the old .current file
-				// otherwise, we will loose flows and can not continue collecting new flows
-				err = rename(fs->current, nfcapd_filename);
-				if ( err ) {
-					LogError("Ident: %s, Can't rename dump file: %s", fs->Ident,  strerror(errno));
-					LogError("Ident: %s, Serious Problem! Fix manually", fs->Ident);
-					if ( launcher_pid )
-						commbuff->failed = 1;
-
-					// we do not update the books here, as the file failed to rename properly
-					// otherwise the books may be wrong
-				} else {
-					struct stat	fstat;
-					if ( launcher_pid )
-						commbuff->failed = 0;
-
-					// Update books
-					stat(nfcapd_filename, &fstat);
-					UpdateBooks(fs->bookkeeper, t_start, 512*fstat.st_blocks);
-				}
-
-				// log stats
-				LogInfo("Ident: '%s' Flows: %llu, Packets: %llu, Bytes: %llu, Sequence Errors: %u, Bad Packets: %u", 
-					fs->Ident, (unsigned long long)nffile->stat_record->numflows, 
-					(unsigned long long)nffile->stat_record->numpackets, 
-					(unsigned long long)nffile->stat_record->numbytes, nffile->stat_record->sequence_failure, fs->bad_packets);
-
-				// reset stats
-				fs->bad_packets = 0;
-				fs->first_seen  = 0xffffffffffffLL;
-				fs->last_seen 	= 0;
-
-				if ( !done ) {
-					nffile = OpenNewFile(fs->current, nffile, compress, 0, NULL);
-					if ( !nffile ) {
-						LogError("killed due to fatal error: ident: %s", fs->Ident);
-						break;
-					}
-				}
-
-				// Dump all extension maps and exporters to the buffer
-				FlushStdRecords(fs);
-
-				// next flow source
-				fs = fs->next;
-
-			} // end of while (fs)
-
-			// trigger launcher if required
-			if ( launcher_pid ) {
-				// Signal launcher
-
-				strncpy(commbuff->tstring, fmt, MAXTIMESTRING);
-				commbuff->tstring[MAXTIMESTRING-1] = '\0';
-
-				commbuff->tstamp = t_start;
-				if ( subdir ) {
-					snprintf(commbuff->fname, MAXPATHLEN-1, "%s/nfcapd.%s", subdir, fmt);
-				} else {
-					snprintf(commbuff->fname, MAXPATHLEN-1, "nfcapd.%s", fmt);
-				}
-				commbuff->fname[MAXPATHLEN-1] = '\0';
-
-				if ( launcher_alive ) {
-					LogInfo("Signal launcher");
-					kill(launcher_pid, SIGHUP);
-				} else 
-					LogError("ERROR: Launcher died unexpectedly!");
-
-			}
+			RotateFiles(t_start, twin, use_subdirs, time_extension, compress);
 			
 			LogInfo("Total ignored packets: %u", ignored_packets);
 			ignored_packets = 0;
@@ -641,95 +712,445 @@ srecord_t	*commbuff;
 		if ( cnt == 0 )
 			continue;
 
-		// get flow source record for current packet, identified by sender IP address
-		fs = GetFlowSource(&nf_sender);
-		if ( fs == NULL ) {
-			fs = AddDynamicSource(&FlowSource, &nf_sender);
+		// process all packets of the batch
+		for ( i=0; i<batch->num_packets; i++ ) {
+			packet_t *packet = &batch->packet[i];
+			in_buff   = packet->buff;
+			cnt		  = packet->len;
+			nf_header = (common_flow_header_t *)in_buff;
+
+			// get flow source record for current packet, identified by sender IP address
+			fs = GetFlowSource(FlowSource, &packet->sender);
 			if ( fs == NULL ) {
-				LogError("Skip UDP packet. Ignored packets so far %u packets", ignored_packets);
-				ignored_packets++;
+				fs = AddDynamicSource(&FlowSource, &packet->sender);
+				if ( fs == NULL ) {
+					LogError("Skip UDP packet. Ignored packets so far %u packets", ignored_packets);
+					ignored_packets++;
+					continue;
+				}
+				if ( InitBookkeeper(&fs->bookkeeper, fs->datadir, getpid(), launcher_pid) != BOOKKEEPER_OK ) {
+					LogError("Failed to initialise bookkeeper for new source");
+					// fatal error
+					return;
+				}
+				fs->nffile = OpenNewFile(fs->current, NULL, compress, 0, NULL);
+				if ( !fs->nffile ) {
+					LogError("Failed to open new collector file");
+					return;
+				}
+			}
+
+			/* check for too little data - cnt must be > 0 at this point */
+			if ( cnt < sizeof(common_flow_header_t) ) {
+				LogError("Ident: %s, Data length error: too little data for common netflow header. cnt: %i",fs->Ident, (int)cnt);
+				fs->bad_packets++;
 				continue;
 			}
-			if ( InitBookkeeper(&fs->bookkeeper, fs->datadir, getpid(), launcher_pid) != BOOKKEEPER_OK ) {
-				LogError("Failed to initialise bookkeeper for new source");
-				// fatal error
-				return;
+
+			fs->received = tv;
+			/* Process data - have a look at the common header */
+			version = ntohs(nf_header->version);
+			switch (version) {
+				case 1: 
+					Process_v1(in_buff, cnt, fs);
+					break;
+				case 5: // fall through
+				case 7: 
+					Process_v5_v7(in_buff, cnt, fs);
+					break;
+				case 9: 
+					Process_v9(in_buff, cnt, fs);
+					break;
+				case 10: 
+					Process_IPFIX(in_buff, cnt, fs);
+					break;
+				case 255:
+					// blast test header
+					if ( verbose ) {
+						uint16_t count = ntohs(nf_header->count);
+						if ( blast_cnt != count ) {
+								// LogError("Mismatch blast check: Expected %u got %u\n", blast_cnt, count);
+							blast_cnt = count;
+							blast_failures++;
+						} else {
+							blast_cnt++;
+						}
+						if ( blast_cnt == 65535 ) {
+							fprintf(stderr, "Total missed packets: %u\n", blast_failures);
+							done = 1;
+						}
+						break;
+					}
+				default:
+					// data error, while reading data from socket
+					LogError("Ident: %s, Error reading netflow header: Unexpected netflow version %i", fs->Ident, version);
+					fs->bad_packets++;
+					continue;
+
+					// not reached
+					break;
 			}
-			fs->nffile = OpenNewFile(fs->current, NULL, compress, 0, NULL);
-			if ( !fs->nffile ) {
-				LogError("Failed to open new collector file");
-				return;
+			// each Process_xx function has to process the entire input buffer, therefore it's empty now.
+			export_packets++;
+
+			// flush current buffer to disc
+			if ( fs->nffile->block_header->size > BUFFSIZE ) {
+				// fishy! - we already wrote into someone elses memory! - I'm sorry
+				// reset output buffer - data may be lost, as we don not know, where it happen
+				fs->nffile->block_header->size 		 = 0;
+				fs->nffile->block_header->NumRecords = 0;
+				fs->nffile->buff_ptr = (void *)((pointer_addr_t)fs->nffile->block_header + sizeof(data_block_header_t) );
+				LogError("### Software bug ### Ident: %s, output buffer overflow: expect memory inconsitency", fs->Ident);
 			}
 		}
+	}
 
-		/* check for too little data - cnt must be > 0 at this point */
-		if ( cnt < sizeof(common_flow_header_t) ) {
-			LogError("Ident: %s, Data length error: too little data for common netflow header. cnt: %i",fs->Ident, (int)cnt);
-			fs->bad_packets++;
-			continue;
+	if ( verbose && blast_failures ) {
+		fprintf(stderr, "Total missed packets: %u\n", blast_failures);
+	}
+	FreePacketBatch(batch);
+
+	fs = FlowSource;
+	while ( fs ) {
+		DisposeFile(fs->nffile);
+		fs = fs->next;
+	}
+
+} /* End of run */
+
+static FlowSource_t *CopyFlowSources(int receiver, int num_receivers) {
+FlowSource_t *fs, *copy, *list, **last;
+
+	list = NULL;
+	last = &list;
+	fs = FlowSource;
+	while ( fs ) {
+		copy = (FlowSource_t *)malloc(sizeof(FlowSource_t));
+		if ( !copy ) {
+			LogError("malloc() allocation error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			return NULL;
+		}
+		memcpy((void *)copy, (void *)fs, sizeof(FlowSource_t));
+		copy->next			 = NULL;
+		copy->hash_next		 = NULL;
+		copy->source_index	 = NULL;
+		copy->exporter_data	 = NULL;
+		copy->exporter_count = 0;
+		memset((void *)&copy->exporter_index, 0, sizeof(exporterIndex_t));
+		copy->bad_packets	 = 0;
+		copy->first_seen	 = 0xffffffffffffLL;
+		copy->last_seen		 = 0;
+		copy->extension_map_list.maps = NULL;
+
+		// the records go through a block buffer into the file of the flow source
+		copy->nffile = OpenBlockBuffer(fs->nffile);
+		if ( !copy->nffile || !InitExtensionMapList(copy) ) {
+			copy->next = list;
+			FreeFlowSources(copy);
+			return NULL;
 		}
 
-		fs->received = tv;
-		/* Process data - have a look at the common header */
-		version = ntohs(nf_header->version);
-		switch (version) {
-			case 1: 
-				Process_v1(in_buff, cnt, fs);
-				break;
-			case 5: // fall through
-			case 7: 
-				Process_v5_v7(in_buff, cnt, fs);
-				break;
-			case 9: 
-				Process_v9(in_buff, cnt, fs);
-				break;
-			case 10: 
-				Process_IPFIX(in_buff, cnt, fs);
+		// each receiver uses its own range of extension map ids in the shared file
+		copy->extension_map_list.range = INIT_ID / num_receivers;
+		copy->extension_map_list.base  = receiver * copy->extension_map_list.range;
+
+		*last = copy;
+		last  = &copy->next;
+		fs = fs->next;
+	}
+
+	return list;
+
+} // End of CopyFlowSources
+
+static void FreeFlowSources(FlowSource_t *fs) {
+
+	while ( fs ) {
+		FlowSource_t *next = fs->next;
+		if ( fs->nffile ) {
+			DisposeFile(fs->nffile);
+			free(fs->nffile);
+		}
+		free(fs->extension_map_list.maps);
+		free(fs);
+		fs = next;
+	}
+
+} // End of FreeFlowSources
+
+static void DisposeReceivers(receiver_t *receiver, int num_receivers) {
+int i;
+
+	if ( !receiver ) 
+		return;
+
+	for ( i=0; i<num_receivers; i++ ) {
+		FreeFlowSources(receiver[i].FlowSource);
+		if ( receiver[i].batch ) 
+			FreePacketBatch(receiver[i].batch);
+	}
+	free(receiver);
+
+} // End of DisposeReceivers
+
+static int SyncReceiver(receiver_t *receiver) {
+FlowSource_t *fs, *shared;
+int terminate;
+
+	// flush the buffers and add the stats to the shared flow sources
+	fs	   = receiver->FlowSource;
+	shared = FlowSource;
+	while ( fs ) {
+		FlushExporterStats(fs);
+		if ( WriteBlock(fs->nffile) <= 0 )
+			LogError("Ident: %s, failed to write output buffer to disk: '%s'" , fs->Ident, strerror(errno));
+
+		pthread_mutex_lock(&receiver_ctl.mutex);
+		SumStatRecords(shared->nffile->stat_record, fs->nffile->stat_record);
+		shared->bad_packets += fs->bad_packets;
+		if ( fs->first_seen < shared->first_seen ) 
+			shared->first_seen = fs->first_seen;
+		if ( fs->last_seen > shared->last_seen ) 
+			shared->last_seen = fs->last_seen;
+		pthread_mutex_unlock(&receiver_ctl.mutex);
+
+		memset((void *)fs->nffile->stat_record, 0, sizeof(stat_record_t));
+		fs->bad_packets = 0;
+		fs->first_seen  = 0xffffffffffffLL;
+		fs->last_seen 	= 0;
+
+		fs	   = fs->next;
+		shared = shared->next;
+	}
+
+	// wait for the main thread to rotate the files
+	pthread_mutex_lock(&receiver_ctl.mutex);
+	receiver_ctl.ignored_packets += receiver->ignored_packets;
+	receiver->ignored_packets = 0;
+	receiver_ctl.synced++;
+	pthread_cond_broadcast(&receiver_ctl.cond);
+	while ( receiver_ctl.rotated != receiver->rotate ) 
+		pthread_cond_wait(&receiver_ctl.cond, &receiver_ctl.mutex);
+	terminate = receiver_ctl.terminate;
+	pthread_mutex_unlock(&receiver_ctl.mutex);
+
+	if ( terminate ) 
+		return 0;
+
+	// Dump all extension maps and exporters to the buffer of the new file
+	fs = receiver->FlowSource;
+	while ( fs ) {
+		FlushStdRecords(fs);
+		fs = fs->next;
+	}
+
+	return 1;
+
+} // End of SyncReceiver
+
+static void *ReceiverThread(void *arg) {
+receiver_t				*receiver = (receiver_t *)arg;
+packet_batch_t			*batch = receiver->batch;
+common_flow_header_t	*nf_header;
+FlowSource_t			*fs;
+uint32_t	rotate;
+uint16_t	version;
+int			cnt;
+
+	while ( 1 ) {
+		struct timeval tv;
+		int i;
+
+		cnt = ReceiveBatch(receiver->socket, batch);
+
+		// a timeout lets an idle receiver see rotation requests
+		if ( cnt == -1 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK ) 
+			LogError("ERROR: recvfrom: %s", strerror(errno));
+
+		if ( cnt > 0 ) 
+			RepeatBatch(batch, receiver->repeater);
+
+		rotate = __atomic_load_n(&receiver_ctl.rotate, __ATOMIC_ACQUIRE);
+		if ( rotate != receiver->rotate ) {
+			receiver->rotate = rotate;
+			if ( !SyncReceiver(receiver) ) 
 				break;
-			case 255:
-				// blast test header
-				if ( verbose ) {
-					uint16_t count = ntohs(nf_header->count);
-					if ( blast_cnt != count ) {
-							// LogError("Mismatch blast check: Expected %u got %u\n", blast_cnt, count);
-						blast_cnt = count;
-						blast_failures++;
-					} else {
-						blast_cnt++;
-					}
-					if ( blast_cnt == 65535 ) {
-						fprintf(stderr, "Total missed packets: %u\n", blast_failures);
-						done = 1;
-					}
-					break;
-				}
-			default:
-				// data error, while reading data from socket
-				LogError("Ident: %s, Error reading netflow header: Unexpected netflow version %i", fs->Ident, version);
+		}
+
+		if ( cnt <= 0 )
+			continue;
+
+		gettimeofday(&tv, NULL);
+		for ( i=0; i<batch->num_packets; i++ ) {
+			packet_t *packet = &batch->packet[i];
+
+			// get flow source record for current packet, identified by sender IP address
+			fs = GetFlowSource(receiver->FlowSource, &packet->sender);
+			if ( fs == NULL ) {
+				LogError("Skip UDP packet. Ignored packets so far %u packets", receiver->ignored_packets);
+				receiver->ignored_packets++;
+				continue;
+			}
+
+			/* check for too little data - cnt must be > 0 at this point */
+			if ( packet->len < sizeof(common_flow_header_t) ) {
+				LogError("Ident: %s, Data length error: too little data for common netflow header. cnt: %i",fs->Ident, (int)packet->len);
 				fs->bad_packets++;
 				continue;
+			}
 
-				// not reached
-				break;
+			fs->received = tv;
+			/* Process data - have a look at the common header */
+			nf_header = (common_flow_header_t *)packet->buff;
+			version = ntohs(nf_header->version);
+			switch (version) {
+				case 1: 
+					Process_v1(packet->buff, packet->len, fs);
+					break;
+				case 5: // fall through
+				case 7: 
+					Process_v5_v7(packet->buff, packet->len, fs);
+					break;
+				case 9: 
+					Process_v9(packet->buff, packet->len, fs);
+					break;
+				case 10: 
+					Process_IPFIX(packet->buff, packet->len, fs);
+					break;
+				default:
+					// data error, while reading data from socket
+					LogError("Ident: %s, Error reading netflow header: Unexpected netflow version %i", fs->Ident, version);
+					fs->bad_packets++;
+					continue;
+			}
+
+			if ( fs->nffile->block_header->size > BUFFSIZE ) {
+				// fishy! - we already wrote into someone elses memory! - I'm sorry
+				// reset output buffer - data may be lost, as we don not know, where it happen
+				fs->nffile->block_header->size 		 = 0;
+				fs->nffile->block_header->NumRecords = 0;
+				fs->nffile->buff_ptr = (void *)((pointer_addr_t)fs->nffile->block_header + sizeof(data_block_header_t) );
+				LogError("### Software bug ### Ident: %s, output buffer overflow: expect memory inconsitency", fs->Ident);
+			}
+		}
+	}
+
+	return NULL;
+
+} // End of ReceiverThread
+
+static void run_receivers(int *sockets, int num_receivers, repeater_t *repeater, 
+	time_t twin, time_t t_begin, int use_subdirs, char *time_extension, int compress) {
+receiver_t		*receiver;
+FlowSource_t	*fs;
+struct timeval	timeout;
+sigset_t		signal_set, saved_set;
+time_t 			t_start;
+int				i, err, terminate, ok, num_sockets;
+
+	// the number of running receivers may drop below num_sockets
+	num_sockets = num_receivers;
+	receiver	= NULL;
+	ok = Init_v1(verbose) && Init_v5_v7_input(verbose, default_sampling, overwrite_sampling) && 
+		 Init_v9(verbose, default_sampling, overwrite_sampling) && Init_IPFIX(verbose, default_sampling, overwrite_sampling) &&
+		 OpenFlowSources(compress);
+
+	if ( ok ) {
+		receiver = (receiver_t *)calloc(num_receivers, sizeof(receiver_t));
+		if ( !receiver ) {
+			LogError("malloc() allocation error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			ok = 0;
 		}
-		// each Process_xx function has to process the entire input buffer, therefore it's empty now.
-		export_packets++;
-
-		// flush current buffer to disc
-		if ( fs->nffile->block_header->size > BUFFSIZE ) {
-			// fishy! - we already wrote into someone elses memory! - I'm sorry
-			// reset output buffer - data may be lost, as we don not know, where it happen
-			fs->nffile->block_header->size 		 = 0;
-			fs->nffile->block_header->NumRecords = 0;
-			fs->nffile->buff_ptr = (void *)((pointer_addr_t)fs->nffile->block_header + sizeof(data_block_header_t) );
-			LogError("### Software bug ### Ident: %s, output buffer overflow: expect memory inconsitency", fs->Ident);
+	}
+
+	timeout.tv_sec  = 0;
+	timeout.tv_usec = RECEIVE_TIMEOUT * 1000;
+	for ( i=0; ok && i<num_receivers; i++ ) {
+		receiver[i].socket	   = sockets[i];
+		receiver[i].repeater   = repeater;
+		receiver[i].FlowSource = CopyFlowSources(i, num_receivers);
+		receiver[i].batch	   = NewPacketBatch(PACKET_BATCH, NETWORK_INPUT_BUFF_SIZE);
+		if ( !receiver[i].FlowSource || !receiver[i].batch ) {
+			LogError("Failed to setup receiver %d", i);
+			ok = 0;
+		} else if ( setsockopt(sockets[i], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0 ) {
+			LogError("setsockopt(SO_RCVTIMEO): %s", strerror(errno));
+			ok = 0;
 		}
 	}
 
-	if ( verbose && blast_failures ) {
-		fprintf(stderr, "Total missed packets: %u\n", blast_failures);
+	if ( !ok ) {
+		DisposeReceivers(receiver, num_receivers);
+		// remove the files opened so far
+		fs = FlowSource;
+		while ( fs ) {
+			if ( fs->nffile ) {
+				CloseFile(fs->nffile);
+				unlink(fs->current);
+				DisposeFile(fs->nffile);
+				fs->nffile = NULL;
+			}
+			fs = fs->next;
+		}
+		for ( i=0; i<num_receivers; i++ ) 
+			close(sockets[i]);
+		return;
+	}
+
+	// signals are handled by the main thread
+	sigfillset(&signal_set);
+	pthread_sigmask(SIG_BLOCK, &signal_set, &saved_set);
+	for ( i=0; i<num_receivers; i++ ) {
+		err = pthread_create(&receiver[i].tid, NULL, ReceiverThread, (void *)&receiver[i]);
+		if ( err ) {
+			LogError("pthread_create() error in %s line %d: %s", __FILE__, __LINE__, strerror(err) );
+			// collect and terminate with the receivers already running
+			num_receivers = i;
+			done = 1;
+			break;
+		}
 	}
-	free(in_buff);
+	pthread_sigmask(SIG_SETMASK, &saved_set, NULL);
+	LogInfo("Started %d receivers", num_receivers);
+
+	t_start = t_begin;
+	while ( 1 ) {
+		// sleep is interrupted by the signal handler
+		if ( !done ) 
+			sleep(1);
+
+		if ( ((time(NULL) - t_start) < twin) && !done ) 
+			continue;
+
+		// request the receivers to flush their buffers, and wait for all of them
+		terminate = done;
+		pthread_mutex_lock(&receiver_ctl.mutex);
+		receiver_ctl.synced = 0;
+		__atomic_store_n(&receiver_ctl.rotate, receiver_ctl.rotate + 1, __ATOMIC_RELEASE);
+		while ( receiver_ctl.synced < num_receivers ) 
+			pthread_cond_wait(&receiver_ctl.cond, &receiver_ctl.mutex);
+		pthread_mutex_unlock(&receiver_ctl.mutex);
+
+		RotateFiles(t_start, twin, use_subdirs, time_extension, compress);
+
+		// let the receivers continue with the new files
+		pthread_mutex_lock(&receiver_ctl.mutex);
+		LogInfo("Total ignored packets: %u", receiver_ctl.ignored_packets);
+		receiver_ctl.ignored_packets = 0;
+		receiver_ctl.terminate = terminate;
+		receiver_ctl.rotated   = receiver_ctl.rotate;
+		pthread_cond_broadcast(&receiver_ctl.cond);
+		pthread_mutex_unlock(&receiver_ctl.mutex);
+
+		if ( terminate )
+			break;
+
+		t_start += twin;
+	}
+
+	for ( i=0; i<num_receivers; i++ ) 
+		pthread_join(receiver[i].tid, NULL);
+	DisposeReceivers(receiver, num_sockets);
 
 	fs = FlowSource;
 	while ( fs ) {
@@ -737,7 +1158,10 @@ srecord_t	*commbuff;
 		fs = fs->next;
 	}
 
-} /* End of run */
+	for ( i=0; i<num_sockets; i++ ) 
+		close(sockets[i]);
+
+} // End of run_receivers
 
 int main(int argc, char **argv) {
  
@@ -751,8 +1175,9 @@ FlowSource_t *fs;
 struct sigaction act;
 int		family, bufflen;
 time_t 	twin, t_start;
-int		sock, do_daemonize, expire, spec_time_extension, report_sequence;
+int		sock, do_daemonize, expire, ipindex, spec_time_extension, report_sequence;
 int		subdir_index, sampling_rate, compress;
+int		sockets[MAXRECEIVERS], num_receivers;
 int		c, i;
 #ifdef PCAP
 char	*pcap_file = NULL;
@@ -777,8 +1202,10 @@ char	*pcap_file = NULL;
 	time_extension	= "%Y%m%d%H%M";
 	spec_time_extension = 0;
 	expire			= 0;
+	ipindex			= IPINDEX_NONE;
 	sampling_rate	= 1;
 	compress		= NOT_COMPRESSED;
+	num_receivers	= 1;
 	memset((void *)&repeater, 0, sizeof(repeater));
 	for ( i = 0; i < MAX_REPEATERS; i++ ) {
 		repeater[i].family = AF_UNSPEC;
@@ -788,7 +1215,7 @@ char	*pcap_file = NULL;
 	extension_tags	= DefaultExtensions;
 	dynsrcdir		= NULL;
 
-	while ((c = getopt(argc, argv, "46ef:whEVI:DB:b:jl:J:M:n:N:p:P:R:S:s:T:t:x:Xru:g:yzZ")) != EOF) {
+	while ((c = getopt(argc, argv, "46c:ef:whEVI:DB:b:jk:l:J:M:n:N:p:P:QR:S:s:T:t:x:Xru:g:W:yzZ")) != EOF) {
 		switch (c) {
 			case 'h':
 				usage(argv[0]);
@@ -803,6 +1230,18 @@ char	*pcap_file = NULL;
 			case 'e':
 				expire = 1;
 				break;
+			case 'c':
+				num_receivers = atoi(optarg);
+				if ( num_receivers < 1 || num_receivers > MAXRECEIVERS ) {
+					LogError("Number of receivers out of range 1..%d", MAXRECEIVERS);
+					exit(255);
+				}
+				break;
+			case 'k':
+				ipindex = IPIndexMode(optarg);
+				if ( ipindex < 0 ) 
+					exit(255);
+				break;
 			case 'f': {
 #ifdef PCAP
 				struct stat	fstat;
@@ -989,6 +1428,28 @@ char	*pcap_file = NULL;
 				}
 				compress = LZO_COMPRESSED;
 				break;
+			case 'Q':
+				SetBlockIndex(1);
+				break;
+			case 'W': {
+				// async block writer: -W num[:drop]
+				char *s = strchr(optarg, ':');
+				int drop = 0;
+				if ( s ) {
+					*s++ = '\0';
+					if ( strcmp(s, "drop") != 0 ) {
+						LogError("Unknown write queue option '%s'", s);
+						exit(255);
+					}
+					drop = 1;
+				}
+				int queue_blocks = atoi(optarg);
+				if ( queue_blocks < 1 || queue_blocks > MAXWRITEQUEUE ) {
+					LogError("Write queue length out of range 1..%d", MAXWRITEQUEUE);
+					exit(255);
+				}
+				SetAsyncWriter(queue_blocks, drop);
+				} break;
 			case 'Z':
 				time_extension	= "%Y%m%d%H%M%z";
 				spec_time_extension = 1;
@@ -1033,6 +1494,17 @@ char	*pcap_file = NULL;
 		exit(255);
 	}
 
+	if ( num_receivers > 1 && (mcastgroup || dynsrcdir) ) {
+		fprintf(stderr, "ERROR, -c does not support -J or -M\n");
+		exit(255);
+	}
+#ifdef PCAP
+	if ( num_receivers > 1 && pcap_file ) {
+		fprintf(stderr, "ERROR, -c and -f are mutually exclusive\n");
+		exit(255);
+	}
+#endif
+
 	if ( expire && spec_time_extension ) {
 		fprintf(stderr, "ERROR, -Z timezone extension breaks expire -e\n");
 		exit(255);
@@ -1052,8 +1524,20 @@ char	*pcap_file = NULL;
 #endif
 	if ( mcastgroup ) 
 		sock = Multicast_receive_socket (mcastgroup, listenport, family, bufflen);
-	else 
-		sock = Unicast_receive_socket(bindhost, listenport, family, bufflen );
+	else if ( num_receivers > 1 ) {
+		// one socket per receiver thread, all bound to the same port
+		for ( i=0; i<num_receivers; i++ ) {
+			sockets[i] = Unicast_receive_socket(bindhost, listenport, family, bufflen, 1);
+			if ( sockets[i] == -1 ) {
+				while ( i > 0 ) 
+					close(sockets[--i]);
+				sockets[0] = -1;
+				break;
+			}
+		}
+		sock = sockets[0];
+	} else 
+		sock = Unicast_receive_socket(bindhost, listenport, family, bufflen, 0);
 
 	if ( sock == -1 ) {
 		fprintf(stderr,"Terminated due to errors.\n");
@@ -1152,7 +1636,7 @@ char	*pcap_file = NULL;
 	}
 
 	done = 0;
-	if ( launch_process || expire ) {
+	if ( launch_process || expire || ipindex ) {
 
 		// create laucher comm memory struct
 		shmem = mmap(0, sizeof(srecord_t), PROT_READ | PROT_WRITE, MAP_ANON | MAP_SHARED, -1, 0);
@@ -1167,7 +1651,7 @@ char	*pcap_file = NULL;
 			case 0:
 				// child
 				close(sock);
-				launcher(shmem, FlowSource, launch_process, expire);
+				launcher(shmem, FlowSource, launch_process, expire, ipindex);
 				_exit(0);
 				break;
 			case -1:
@@ -1223,9 +1707,15 @@ char	*pcap_file = NULL;
 	sigaction(SIGCHLD, &act, NULL);
 
 	LogInfo("Startup.");
-	run(receive_packet, sock, repeater, twin, t_start, report_sequence, subdir_index, 
-		time_extension, compress);
-	close(sock);
+	if ( num_receivers > 1 ) {
+		// the receivers close their sockets
+		run_receivers(sockets, num_receivers, repeater, twin, t_start, subdir_index, 
+			time_extension, compress);
+	} else {
+		run(receive_packet, sock, repeater, twin, t_start, report_sequence, subdir_index, 
+			time_extension, compress);
+		close(sock);
+	}
 	kill_launcher(launcher_pid);
 
 	fs = FlowSource;
@@ -0,0 +1,788 @@
+/*
+ *  Copyright (c) 2020, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/param.h>
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "util.h"
+#include "nfdump.h"
+#include "nffile.h"
+#include "nfx.h"
+#include "nftree.h"
+#include "flist.h"
+#include "exporter.h"
+#include "lz4.h"
+#include "nfcolumn.h"
+
+#define NEED_PACKRECORD 1
+#include "nffile_inline.c"
+#undef NEED_PACKRECORD
+
+// distinct extension maps per output file, before the map ids are reused
+#define COLUMN_MAXMAPS	1024
+
+/*
+ * Column writer: collects the expanded records column by column, until the block is full
+ */
+struct column_writer_s {
+	uint32_t	NumRecords;
+	uint32_t	row_size;			// size of the records in a type 2 block
+	uint64_t	*value;				// NUM_COLUMNS x COLUMN_MAXRECORDS values
+	uint8_t		*encode_buff;		// encoded column before compression
+	uint32_t	NumMaps;			// extension maps written to the output file
+	extension_info_t *map[COLUMN_MAXMAPS];
+};
+
+/*
+ * Column reader: decodes the columns of a block on demand. The columns referenced by the filter
+ * are decoded first. Only if any record matches, the remaining columns are decoded and the
+ * matching records are packed into a type 2 block.
+ */
+struct column_reader_s {
+	FilterEngine_t	engine;				// private copy of the filter engine
+	uint32_t		NumFilterColumns;	// 0: filter needs all columns
+	uint32_t		filter_column[NUM_COLUMNS];
+	uint32_t		NumRecords;			// records of the current block
+	uint32_t		NumColumns;			// columns of the current block
+	column_header_t	*header;
+	uint8_t			*data[NUM_COLUMNS];	// column data in the current block
+	uint8_t			decoded[NUM_COLUMNS];
+	uint64_t		*value;				// NUM_COLUMNS x COLUMN_MAXRECORDS decoded values
+	uint8_t			*match;
+	uint8_t			*work_buff;			// decompressed column
+	void			*row_buff;			// type 2 block - swapped with the file buffer
+	size_t			row_buff_size;		// same size as the file buffers
+	master_record_t	master_record;
+};
+
+// worst case size of an encoded column
+#define ENCODE_BUFFSIZE	(10 * COLUMN_MAXRECORDS + 16 + 256 * sizeof(uint64_t))
+
+/* function prototypes */
+static inline uint32_t VarintSize(uint64_t value);
+
+static inline uint8_t *PutVarint(uint8_t *p, uint64_t value);
+
+static inline uint64_t ZigZag(uint64_t delta);
+
+static uint32_t EncodeColumn(uint64_t *value, uint32_t NumRecords, uint8_t *out, uint8_t *encoding);
+
+static int DecodeColumn(column_reader_t *reader, uint32_t column);
+
+static int ColumnMapID(column_writer_t *writer, nffile_t *nffile, extension_info_t *extension_info);
+
+/* functions */
+
+static inline uint32_t VarintSize(uint64_t value) {
+uint32_t size = 1;
+
+	while ( value >= 0x80 ) {
+		value >>= 7;
+		size++;
+	}
+	return size;
+
+} // End of VarintSize
+
+static inline uint8_t *PutVarint(uint8_t *p, uint64_t value) {
+
+	while ( value >= 0x80 ) {
+		*p++ = (value & 0x7F) | 0x80;
+		value >>= 7;
+	}
+	*p++ = value;
+	return p;
+
+} // End of PutVarint
+
+static inline uint64_t ZigZag(uint64_t delta) {
+	return (delta << 1) ^ (uint64_t)((int64_t)delta >> 63);
+} // End of ZigZag
+
+column_writer_t *NewColumnWriter(void) {
+column_writer_t *writer;
+
+	writer = (column_writer_t *)calloc(1, sizeof(column_writer_t));
+	if ( !writer ) {
+		LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return NULL;
+	}
+	writer->value		= (uint64_t *)malloc(NUM_COLUMNS * COLUMN_MAXRECORDS * sizeof(uint64_t));
+	writer->encode_buff	= (uint8_t *)malloc(ENCODE_BUFFSIZE);
+	if ( !writer->value || !writer->encode_buff ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		DisposeColumnWriter(writer);
+		return NULL;
+	}
+
+	return writer;
+
+} // End of NewColumnWriter
+
+void DisposeColumnWriter(column_writer_t *writer) {
+
+	if ( !writer )
+		return;
+	free(writer->value);
+	free(writer->encode_buff);
+	free(writer);
+
+} // End of DisposeColumnWriter
+
+void AddColumnRecord(column_writer_t *writer, nffile_t *nffile, master_record_t *master_record, uint32_t size) {
+uint64_t *record = (uint64_t *)master_record;
+uint32_t i;
+
+	// the packed records of a block must fit into a type 2 block again
+	if ( writer->NumRecords == COLUMN_MAXRECORDS || (writer->row_size + size) > WRITE_BUFFSIZE ) 
+		FlushColumnBlock(writer, nffile);
+
+	for ( i=0; i<NUM_COLUMNS; i++ ) 
+		writer->value[i * COLUMN_MAXRECORDS + writer->NumRecords] = record[i];
+	writer->NumRecords++;
+	writer->row_size += size;
+
+} // End of AddColumnRecord
+
+static uint32_t EncodeColumn(uint64_t *value, uint32_t NumRecords, uint8_t *out, uint8_t *encoding) {
+uint64_t	dict[256], slot_value[512];
+uint8_t		slot_index[512], slot_used[512];
+uint32_t	i, NumDict, dict_size, delta_size;
+uint8_t		*p;
+
+	for ( i=1; i<NumRecords; i++ ) {
+		if ( value[i] != value[0] )
+			break;
+	}
+	if ( i == NumRecords ) {
+		*encoding = COLUMN_CONST;
+		memcpy(out, (void *)value, sizeof(uint64_t));
+		return sizeof(uint64_t);
+	}
+
+	// collect up to 256 distinct values
+	memset((void *)slot_used, 0, sizeof(slot_used));
+	NumDict = 0;
+	for ( i=0; i<NumRecords && NumDict <= 256; i++ ) {
+		uint32_t index = (uint32_t)((value[i] * 0x9E3779B97F4A7C15ULL) >> 55);
+		while ( slot_used[index] && slot_value[index] != value[i] )
+			index = (index + 1) & 0x1FF;
+		if ( !slot_used[index] ) {
+			if ( NumDict == 256 ) {
+				NumDict++;
+				break;
+			}
+			slot_used[index]  = 1;
+			slot_value[index] = value[i];
+			slot_index[index] = NumDict;
+			dict[NumDict++]	  = value[i];
+		}
+	}
+	dict_size = NumDict <= 256 ? sizeof(uint32_t) + NumDict * sizeof(uint64_t) + NumRecords : 0xFFFFFFFF;
+
+	delta_size = sizeof(uint64_t);
+	for ( i=1; i<NumRecords; i++ ) 
+		delta_size += VarintSize(ZigZag(value[i] - value[i-1]));
+
+	if ( dict_size < delta_size && dict_size < NumRecords * sizeof(uint64_t) ) {
+		*encoding = COLUMN_DICT;
+		memcpy(out, (void *)&NumDict, sizeof(uint32_t));
+		memcpy(out + sizeof(uint32_t), (void *)dict, NumDict * sizeof(uint64_t));
+		p = out + sizeof(uint32_t) + NumDict * sizeof(uint64_t);
+		for ( i=0; i<NumRecords; i++ ) {
+			uint32_t index = (uint32_t)((value[i] * 0x9E3779B97F4A7C15ULL) >> 55);
+			while ( slot_value[index] != value[i] )
+				index = (index + 1) & 0x1FF;
+			*p++ = slot_index[index];
+		}
+		return dict_size;
+	}
+
+	if ( delta_size < NumRecords * sizeof(uint64_t) ) {
+		*encoding = COLUMN_DELTA;
+		memcpy(out, (void *)value, sizeof(uint64_t));
+		p = out + sizeof(uint64_t);
+		for ( i=1; i<NumRecords; i++ ) 
+			p = PutVarint(p, ZigZag(value[i] - value[i-1]));
+		return delta_size;
+	}
+
+	*encoding = COLUMN_RAW;
+	memcpy(out, (void *)value, NumRecords * sizeof(uint64_t));
+	return NumRecords * sizeof(uint64_t);
+
+} // End of EncodeColumn
+
+int FlushColumnBlock(column_writer_t *writer, nffile_t *nffile) {
+column_block_t	*column_block;
+uint8_t			*p;
+uint32_t		i;
+int				ret;
+
+	if ( writer->NumRecords == 0 )
+		return 1;
+
+	// records in front of the column block, such as extension maps, are written first
+	if ( nffile->block_header->NumRecords ) {
+		if ( WriteBlock(nffile) <= 0 ) {
+			LogError("Failed to write output buffer to disk: '%s'" , strerror(errno));
+			return 0;
+		}
+	}
+
+	column_block = (column_block_t *)nffile->buff_ptr;
+	column_block->NumColumns = NUM_COLUMNS;
+	column_block->fill		 = 0;
+	p = (uint8_t *)&column_block->column[NUM_COLUMNS];
+
+	for ( i=0; i<NUM_COLUMNS; i++ ) {
+		column_header_t *header = &column_block->column[i];
+		uint32_t raw_size = EncodeColumn(&writer->value[i * COLUMN_MAXRECORDS], writer->NumRecords, 
+			writer->encode_buff, &header->encoding);
+		int size = 0;
+
+		// compress the column, if it pays off
+		if ( header->encoding != COLUMN_CONST ) 
+			size = LZ4_compress_default((const char *)writer->encode_buff, (char *)p, raw_size, raw_size - 1);
+		if ( size > 0 ) {
+			header->compressed = 1;
+			header->size	   = size;
+		} else {
+			header->compressed = 0;
+			header->size	   = raw_size;
+			memcpy(p, writer->encode_buff, raw_size);
+		}
+		header->fill	 = 0;
+		header->raw_size = raw_size;
+		p += header->size;
+	}
+
+	nffile->block_header->id		 = DATA_BLOCK_TYPE_3;
+	nffile->block_header->NumRecords = writer->NumRecords;
+	nffile->block_header->size		 = (pointer_addr_t)p - (pointer_addr_t)nffile->buff_ptr;
+	ret = WriteBlock(nffile);
+
+	// continue with type 2 blocks
+	nffile->block_header->id = DATA_BLOCK_TYPE_2;
+	writer->NumRecords = 0;
+	writer->row_size   = 0;
+
+	if ( ret <= 0 ) {
+		LogError("Failed to write output buffer to disk: '%s'" , strerror(errno));
+		return 0;
+	}
+
+	return 1;
+
+} // End of FlushColumnBlock
+
+/*
+ * The input may reuse a map id for different maps within a few records. Each distinct map gets
+ * its own id in the output file, so a changed map does not end the current column block.
+ */
+static int ColumnMapID(column_writer_t *writer, nffile_t *nffile, extension_info_t *extension_info) {
+extension_map_t	*map = extension_info->map;
+uint32_t		i;
+uint16_t		map_id;
+
+	for ( i=0; i<writer->NumMaps; i++ ) {
+		if ( writer->map[i] == extension_info )
+			return i;
+	}
+
+	// all ids used - restart with the next column block
+	if ( writer->NumMaps == COLUMN_MAXMAPS ) {
+		if ( !FlushColumnBlock(writer, nffile) )
+			return -1;
+		writer->NumMaps = 0;
+	}
+
+	i = writer->NumMaps++;
+	writer->map[i] = extension_info;
+
+	map_id = map->map_id;
+	map->map_id = i;
+	AppendToBuffer(nffile, (void *)map, map->size);
+	map->map_id = map_id;
+
+	return i;
+
+} // End of ColumnMapID
+
+column_reader_t *NewColumnReader(FilterEngine_t *engine) {
+column_reader_t *reader;
+FilterProgram_t	*program;
+uint32_t		i, j;
+uint8_t			need[NUM_COLUMNS];
+
+	reader = (column_reader_t *)calloc(1, sizeof(column_reader_t));
+	if ( !reader ) {
+		LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return NULL;
+	}
+	reader->value	  = (uint64_t *)malloc(NUM_COLUMNS * COLUMN_MAXRECORDS * sizeof(uint64_t));
+	reader->match	  = (uint8_t *)malloc(COLUMN_MAXRECORDS);
+	reader->work_buff = (uint8_t *)malloc(ENCODE_BUFFSIZE);
+	if ( !reader->value || !reader->match || !reader->work_buff ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		DisposeColumnReader(reader);
+		return NULL;
+	}
+
+	// columns referenced by the compiled filter program
+	// the tree interpreter and flow functions may access any column
+	reader->NumFilterColumns = 0;
+	program = engine ? engine->program : NULL;
+	if ( engine ) 
+		reader->engine = *engine;
+	if ( !program ) 
+		return reader;
+
+	memset((void *)need, 0, sizeof(need));
+	for ( i=PROG_START; i<program->NumInstr; i++ ) {
+		FilterInstr_t *instr = &program->instr[i];
+		switch (instr->op) {
+			case OP_IDENT:
+				break;
+			case OP_FUNCTION:
+				return reader;
+			case OP_IPLIST:
+				// IPv6 address in two words
+				if ( instr->offset + 1 >= NUM_COLUMNS )
+					return reader;
+				need[instr->offset + 1] = 1;
+				need[instr->offset] = 1;
+				break;
+			default:
+				if ( instr->offset >= NUM_COLUMNS )
+					return reader;
+				need[instr->offset] = 1;
+		}
+	}
+	j = 0;
+	for ( i=0; i<NUM_COLUMNS; i++ ) {
+		if ( need[i] )
+			reader->filter_column[j++] = i;
+	}
+	// a filter without any column, such as 'any' or 'ident', still needs a column to filter
+	if ( j == 0 )
+		reader->filter_column[j++] = 0;
+	reader->NumFilterColumns = j;
+
+	return reader;
+
+} // End of NewColumnReader
+
+void DisposeColumnReader(column_reader_t *reader) {
+
+	if ( !reader )
+		return;
+	free(reader->value);
+	free(reader->match);
+	free(reader->work_buff);
+	free(reader->row_buff);
+	free(reader);
+
+} // End of DisposeColumnReader
+
+static int DecodeColumn(column_reader_t *reader, uint32_t column) {
+column_header_t	*header;
+uint64_t		*value;
+uint8_t			*p, *end;
+uint32_t		i, NumRecords;
+
+	if ( reader->decoded[column] )
+		return 1;
+
+	NumRecords = reader->NumRecords;
+	value = &reader->value[column * COLUMN_MAXRECORDS];
+	reader->decoded[column] = 1;
+
+	// columns missing in the block are zero
+	if ( column >= reader->NumColumns ) {
+		memset((void *)value, 0, NumRecords * sizeof(uint64_t));
+		return 1;
+	}
+
+	header = &reader->header[column];
+	p = reader->data[column];
+	if ( header->raw_size > ENCODE_BUFFSIZE ) 
+		return 0;
+
+	if ( header->compressed ) {
+		if ( LZ4_decompress_safe((const char *)p, (char *)reader->work_buff, header->size, ENCODE_BUFFSIZE) != header->raw_size ) 
+			return 0;
+		p = reader->work_buff;
+	} else if ( header->size != header->raw_size ) {
+		return 0;
+	}
+	end = p + header->raw_size;
+
+	switch (header->encoding) {
+		case COLUMN_CONST: {
+			uint64_t v;
+			if ( header->raw_size != sizeof(uint64_t) )
+				return 0;
+			memcpy((void *)&v, p, sizeof(uint64_t));
+			for ( i=0; i<NumRecords; i++ )
+				value[i] = v;
+			} break;
+		case COLUMN_DICT: {
+			uint64_t dict[256];
+			uint32_t NumDict;
+			memcpy((void *)&NumDict, p, sizeof(uint32_t));
+			if ( NumDict == 0 || NumDict > 256 || 
+				 header->raw_size != sizeof(uint32_t) + NumDict * sizeof(uint64_t) + NumRecords )
+				return 0;
+			memcpy((void *)dict, p + sizeof(uint32_t), NumDict * sizeof(uint64_t));
+			p += sizeof(uint32_t) + NumDict * sizeof(uint64_t);
+			for ( i=0; i<NumRecords; i++ ) {
+				if ( p[i] >= NumDict )
+					return 0;
+				value[i] = dict[p[i]];
+			}
+			} break;
+		case COLUMN_DELTA: {
+			uint64_t v;
+			if ( header->raw_size < sizeof(uint64_t) )
+				return 0;
+			memcpy((void *)&v, p, sizeof(uint64_t));
+			p += sizeof(uint64_t);
+			value[0] = v;
+			for ( i=1; i<NumRecords; i++ ) {
+				uint64_t zz = 0;
+				int shift = 0;
+				do {
+					if ( p >= end || shift > 63 )
+						return 0;
+					zz |= (uint64_t)(*p & 0x7F) << shift;
+					shift += 7;
+				} while ( *p++ & 0x80 );
+				v += (zz >> 1) ^ (uint64_t)(-(int64_t)(zz & 1));
+				value[i] = v;
+			}
+			} break;
+		case COLUMN_RAW:
+			if ( header->raw_size != NumRecords * sizeof(uint64_t) )
+				return 0;
+			memcpy((void *)value, p, NumRecords * sizeof(uint64_t));
+			break;
+		default:
+			return 0;
+	}
+
+	return 1;
+
+} // End of DecodeColumn
+
+int DecodeColumnBlock(column_reader_t *reader, nffile_t *nffile, extension_map_list_t *extension_map_list) {
+data_block_header_t *block_header = nffile->block_header;
+column_block_t		*column_block = (column_block_t *)nffile->buff_ptr;
+master_record_t		*master_record = &reader->master_record;
+uint64_t			*record = (uint64_t *)master_record;
+nffile_t			rows;
+file_header_t		file_header;
+uint32_t			i, j, size, NumMatched;
+uint8_t				*p, *end;
+
+	reader->NumRecords = block_header->NumRecords;
+	if ( reader->NumRecords > COLUMN_MAXRECORDS || block_header->size < sizeof(column_block_t) ) {
+		LogError("Corrupt column block in %s line %d\n", __FILE__, __LINE__);
+		return NF_CORRUPT;
+	}
+
+	// locate the columns
+	reader->NumColumns = column_block->NumColumns < NUM_COLUMNS ? column_block->NumColumns : NUM_COLUMNS;
+	reader->header = column_block->column;
+	p	= (uint8_t *)&column_block->column[column_block->NumColumns];
+	end = (uint8_t *)nffile->buff_ptr + block_header->size;
+	if ( column_block->NumColumns > (block_header->size / sizeof(column_header_t)) || p > end ) {
+		LogError("Corrupt column block in %s line %d\n", __FILE__, __LINE__);
+		return NF_CORRUPT;
+	}
+	for ( i=0; i<reader->NumColumns; i++ ) {
+		reader->data[i] = p;
+		p += reader->header[i].size;
+		if ( p > end ) {
+			LogError("Corrupt column block in %s line %d\n", __FILE__, __LINE__);
+			return NF_CORRUPT;
+		}
+	}
+	memset((void *)reader->decoded, 0, sizeof(reader->decoded));
+
+	// evaluate the filter on the referenced columns only
+	NumMatched = 0;
+	if ( reader->NumFilterColumns ) {
+		for ( j=0; j<reader->NumFilterColumns; j++ ) {
+			if ( !DecodeColumn(reader, reader->filter_column[j]) ) {
+				LogError("Corrupt column block in %s line %d\n", __FILE__, __LINE__);
+				return NF_CORRUPT;
+			}
+		}
+		memset((void *)master_record, 0, sizeof(master_record_t));
+		reader->engine.nfrecord = record;
+		for ( i=0; i<reader->NumRecords; i++ ) {
+			for ( j=0; j<reader->NumFilterColumns; j++ ) {
+				uint32_t column = reader->filter_column[j];
+				record[column] = reader->value[column * COLUMN_MAXRECORDS + i];
+			}
+			reader->match[i] = (*reader->engine.FilterEngine)(&reader->engine);
+			NumMatched += reader->match[i];
+		}
+		if ( NumMatched == 0 )
+			return 0;
+	} else {
+		memset((void *)reader->match, 1, reader->NumRecords);
+	}
+
+	for ( j=0; j<NUM_COLUMNS; j++ ) {
+		if ( !DecodeColumn(reader, j) ) {
+			LogError("Corrupt column block in %s line %d\n", __FILE__, __LINE__);
+			return NF_CORRUPT;
+		}
+	}
+
+	if ( reader->row_buff_size != nffile->buff_size ) {
+		free(reader->row_buff);
+		reader->row_buff = malloc(nffile->buff_size);
+		if ( !reader->row_buff ) {
+			reader->row_buff_size = 0;
+			LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			return NF_ERROR;
+		}
+		reader->row_buff_size = nffile->buff_size;
+	}
+
+	// pack the matching records into a type 2 block
+	memset((void *)&file_header, 0, sizeof(file_header_t));
+	memset((void *)&rows, 0, sizeof(nffile_t));
+	rows.file_header  = &file_header;
+	rows.fd			  = -1;
+	rows.block_header = (data_block_header_t *)reader->row_buff;
+	rows.block_header->NumRecords = 0;
+	rows.block_header->size		  = 0;
+	rows.block_header->id		  = DATA_BLOCK_TYPE_2;
+	rows.block_header->flags	  = 0;
+	rows.buff_ptr = (void *)((pointer_addr_t)rows.block_header + sizeof(data_block_header_t));
+
+	for ( i=0; i<reader->NumRecords; i++ ) {
+		if ( !reader->match[i] )
+			continue;
+		for ( j=0; j<NUM_COLUMNS; j++ ) 
+			record[j] = reader->value[j * COLUMN_MAXRECORDS + i];
+		if ( extension_map_list->slot[master_record->ext_map] == NULL ) {
+			LogError("Corrupt data file. Missing extension map %u. Skip record.\n", master_record->ext_map);
+			continue;
+		}
+		master_record->map_ref = extension_map_list->slot[master_record->ext_map]->map;
+		PackRecord(master_record, &rows);
+	}
+
+	// swap buffers - the file continues with the type 2 block
+	size = rows.block_header->size;
+	reader->row_buff	 = nffile->buff_pool[0];
+	nffile->buff_pool[0] = (void *)rows.block_header;
+	nffile->block_header = rows.block_header;
+	nffile->buff_ptr	 = (void *)((pointer_addr_t)nffile->block_header + sizeof(data_block_header_t));
+
+	return rows.block_header->NumRecords ? sizeof(data_block_header_t) + size : 0;
+
+} // End of DecodeColumnBlock
+
+void ConvertColumnFile(char *rfile, char *Rfile) {
+extension_map_list_t	*map_list;
+column_writer_t	*writer;
+master_record_t	*master_record;
+nffile_t		*nffile_r, *nffile_w;
+stat_record_t	*_s;
+char 			*filename, outfile[MAXPATHLEN];
+int				i, done, ret;
+
+	map_list	  = InitExtensionMaps(NEEDS_EXTENSION_LIST);
+	writer		  = NewColumnWriter();
+	master_record = (master_record_t *)calloc(1, sizeof(master_record_t));
+	if ( !map_list || !writer || !master_record ) {
+		LogError("Failed to setup column conversion\n");
+		return;
+	}
+
+	SetupInputFileSequence(NULL, rfile, Rfile);
+
+	nffile_r = NULL;
+	while (1) {
+		nffile_r = GetNextFile(nffile_r, 0, 0);
+
+		// last file
+		if ( nffile_r == EMPTY_LIST )
+			break;
+
+		filename = GetCurrentFilename();
+
+		if ( !nffile_r || !filename) {
+			break;
+		}
+	
+		// tmp filename for new output file
+		snprintf(outfile, MAXPATHLEN, "%s-tmp", filename);
+		outfile[MAXPATHLEN-1] = '\0';
+
+		// extension maps, exporter and sampler records keep the compression of the file
+		nffile_w = OpenNewFile(outfile, NULL, FILE_COMPRESSION(nffile_r), IP_ANONYMIZED(nffile_r), NULL);
+		if ( !nffile_w ) {
+			CloseFile(nffile_r);
+			DisposeFile(nffile_r);
+			break;
+		}
+
+		writer->NumMaps = 0;
+
+		// swap stat records :)
+		_s = nffile_r->stat_record;
+		nffile_r->stat_record = nffile_w->stat_record;
+		nffile_w->stat_record = _s;
+	
+		done = 0;
+		while ( !done ) {
+			common_record_t *flow_record;
+			uint32_t sumSize;
+
+			ret = ReadBlock(nffile_r);
+			if ( ret == NF_EOF )
+				break;
+			if ( ret < 0 ) {
+				LogError("Error while reading data block. Abort.\n");
+				done = 2;
+				break;
+			}
+
+			if ( nffile_r->block_header->id != DATA_BLOCK_TYPE_2 ) {
+				// keep other blocks, such as converted column blocks
+				if ( !FlushColumnBlock(writer, nffile_w) || 
+					 (nffile_w->block_header->NumRecords && WriteBlock(nffile_w) <= 0) ) {
+					done = 2;
+					break;
+				}
+				void *_tmp = nffile_r->buff_pool[0];
+				nffile_r->buff_pool[0] = nffile_w->buff_pool[0];
+				nffile_w->buff_pool[0] = _tmp;
+				nffile_w->block_header = nffile_w->buff_pool[0];
+				nffile_r->block_header = nffile_r->buff_pool[0];
+				nffile_r->buff_ptr = (void *)((pointer_addr_t)nffile_r->block_header + sizeof(data_block_header_t));
+				ret = WriteBlock(nffile_w);
+				nffile_w->block_header->id = DATA_BLOCK_TYPE_2;
+				nffile_w->buff_ptr = (void *)((pointer_addr_t)nffile_w->block_header + sizeof(data_block_header_t));
+				if ( ret <= 0 ) 
+					done = 2;
+				continue;
+			}
+
+			sumSize = 0;
+			flow_record = nffile_r->buff_ptr;
+			for ( i=0; i < nffile_r->block_header->NumRecords; i++ ) {
+				if ( (sumSize + flow_record->size) > ret || (flow_record->size < sizeof(record_header_t)) ) {
+					LogError("Corrupt data file. Inconsistent block size in %s line %d\n", __FILE__, __LINE__);
+					done = 2;
+					break;
+				}
+				sumSize += flow_record->size;
+
+				if ( flow_record->type == CommonRecordType &&
+					 map_list->slot[flow_record->ext_map] ) {
+					// fields not covered by the map are zero, as in a freshly expanded record
+					int map_id = ColumnMapID(writer, nffile_w, map_list->slot[flow_record->ext_map]);
+					if ( map_id < 0 ) {
+						done = 2;
+						break;
+					}
+					memset((void *)master_record, 0, sizeof(master_record_t));
+					ExpandRecord_plan(flow_record, map_list->slot[flow_record->ext_map], NULL, master_record);
+					master_record->ext_map = map_id;
+					AddColumnRecord(writer, nffile_w, master_record, flow_record->size);
+				} else {
+					if ( flow_record->type == ExtensionMapType ) {
+						// maps are written with their new id, when first used
+						if ( Insert_Extension_Map(map_list, (extension_map_t *)flow_record) < 0 ) {
+							LogError("Corrupt data file. Unable to decode at %s line %d\n", __FILE__, __LINE__);
+							done = 2;
+							break;
+						}
+					} else {
+						// exporter and sampler records must precede the flows following them
+						if ( !FlushColumnBlock(writer, nffile_w) ) {
+							done = 2;
+							break;
+						}
+						AppendToBuffer(nffile_w, (void *)flow_record, flow_record->size);
+					}
+				}
+				flow_record = (common_record_t *)((pointer_addr_t)flow_record + flow_record->size);
+			}
+		}
+
+		if ( done == 0 && FlushColumnBlock(writer, nffile_w) ) {
+			printf("File %s converted to column blocks\n", filename);
+			if ( !CloseUpdateFile(nffile_w, nffile_r->file_header->ident) ) {
+				unlink(outfile);
+				LogError("Failed to close file: '%s'" , strerror(errno));
+			} else {
+				unlink(filename);
+				rename(outfile, filename);
+			}
+		} else {
+			LogError("Failed to convert file %s\n", filename);
+			CloseFile(nffile_w);
+			unlink(outfile);
+		}
+		DisposeFile(nffile_w);
+
+		if ( done == 2 ) {
+			CloseFile(nffile_r);
+			DisposeFile(nffile_r);
+			break;
+		}
+	}
+
+	free(master_record);
+	DisposeColumnWriter(writer);
+	FreeExtensionMaps(map_list);
+
+} // End of ConvertColumnFile
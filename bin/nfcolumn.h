@@ -0,0 +1,109 @@
+/*
+ *  Copyright (c) 2020, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#ifndef _NFCOLUMN_H
+#define _NFCOLUMN_H 1
+
+#include "config.h"
+
+#include <stddef.h>
+#include <sys/types.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "nfdump.h"
+#include "nffile.h"
+#include "nfx.h"
+#include "nftree.h"
+
+/*
+ * Block type 3: column block
+ * ==========================
+ * A column block holds flow records only. The records are stored expanded, column by column.
+ * Each column holds one 64bit word of the master record of all records in the block, so the
+ * column index equals the offset used by the filter engine. Extension maps, exporter and
+ * sampler records remain in type 2 blocks in front of the column block.
+ *
+ *   +--------------+------------+-----------------+-----+-----------------+----------+-----+----------+
+ *   | block header | NumColumns | column header 0 | ... | column header n | column 0 | ... | column n |
+ *   +--------------+------------+-----------------+-----+-----------------+----------+-----+----------+
+ *
+ * Each column is encoded on its own and LZ4 compressed, if this reduces the size. The file
+ * compression does not apply to column blocks, so a reader decompresses only the columns it needs.
+ */
+// number of columns: all 64bit words of the master record up to the exporter reference
+#define NUM_COLUMNS	(offsetof(master_record_t, exp_ref) >> 3)
+
+// max number of records in a column block
+#define COLUMN_MAXRECORDS	8192
+
+// -J value to convert flow records into column blocks
+#define COLUMN_BLOCKS	4
+
+typedef struct column_header_s {
+	uint8_t		encoding;		// column encoding
+#define COLUMN_CONST	0		// all values equal - one value
+#define COLUMN_DICT		1		// up to 256 distinct values - dictionary + 8bit index per record
+#define COLUMN_DELTA	2		// first value + zigzag varint delta per record
+#define COLUMN_RAW		3		// 64bit value per record
+	uint8_t		compressed;		// 1: encoded column is LZ4 compressed
+	uint16_t	fill;
+	uint32_t	size;			// size of the column data in the block
+	uint32_t	raw_size;		// size of the encoded column before compression
+} column_header_t;
+
+typedef struct column_block_s {
+	uint32_t		NumColumns;
+	uint32_t		fill;
+	column_header_t	column[1];	// NumColumns column headers followed by the column data
+} column_block_t;
+
+typedef struct column_writer_s column_writer_t;
+
+typedef struct column_reader_s column_reader_t;
+
+column_writer_t *NewColumnWriter(void);
+
+void AddColumnRecord(column_writer_t *writer, nffile_t *nffile, master_record_t *master_record, uint32_t size);
+
+int FlushColumnBlock(column_writer_t *writer, nffile_t *nffile);
+
+void DisposeColumnWriter(column_writer_t *writer);
+
+column_reader_t *NewColumnReader(FilterEngine_t *engine);
+
+int DecodeColumnBlock(column_reader_t *reader, nffile_t *nffile, extension_map_list_t *extension_map_list);
+
+void DisposeColumnReader(column_reader_t *reader);
+
+void ConvertColumnFile(char *rfile, char *Rfile);
+
+#endif //_NFCOLUMN_H
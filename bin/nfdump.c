@@ -47,6 +47,7 @@
 #include <sys/resource.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <pthread.h>
 
 #ifdef HAVE_STDINT_H
 #include <stdint.h>
@@ -74,12 +75,36 @@
 #include "nfstat.h"
 #include "nfexport.h"
 #include "ipconv.h"
+#include "nfcolumn.h"
+#include "ipindex.h"
 
 /* hash parameters */
 #define NumPrealloc 128000
 
 #define AGGR_SIZE 7
 
+/* parallel record processing */
+#define JOB_FREE	0
+#define JOB_READY	1
+#define JOB_BUSY	2
+
+typedef struct block_job_s {
+	void		*buff;			// data block incl. block header
+	uint32_t	block_seq;		// sequence number of this block
+	int			status;
+} block_job_t;
+
+typedef struct worker_ctx_s {
+	pthread_t		tid;
+	FilterEngine_t	engine;				// private copy of the filter engine
+	master_record_t	**master_record;	// private expand records - one per extension map slot
+	uint32_t		*ref_count;			// map ref counts - added to the map list by DrainWorkers()
+	hash_FlowTable	*flowTable;			// thread local flow table
+	hash_StatTable	*statTable;			// thread local stat tables
+	stat_record_t	stat_record;
+	uint32_t		recordCount;
+} worker_ctx_t;
+
 /* Global Variables */
 FilterEngine_t	*Engine;
 
@@ -89,6 +114,9 @@ extern uint32_t loopcnt;
 /* Local Variables */
 const char *nfdump_version = VERSION;
 
+// time window for the block index
+static time_t zone_twin_start, zone_twin_end;
+
 static uint64_t total_bytes;
 static uint32_t recordCount;
 static uint32_t skipped_blocks;
@@ -96,6 +124,21 @@ static uint32_t	is_anonymized;
 static time_t 	t_first_flow, t_last_flow;
 static char		Ident[IDENTLEN];
 
+static struct worker_pool_s {
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+	int				terminate;
+	int				num_workers;
+	worker_ctx_t	*ctx;			// num_workers + 1 - the last one is used by the main thread
+	int				num_jobs;
+	block_job_t		*job;			// job ring
+	uint64_t		next_put;		// next job to be queued by the main thread
+	uint64_t		next_take;		// next job to be processed by a worker
+	uint32_t		pending;		// number of queued and not yet finished jobs
+	time_t			twin_start, twin_end;
+	int				flow_stat, element_stat;
+} WorkerPool;
+
 
 int hash_hit = 0; 
 int hash_miss = 0;
@@ -245,9 +288,32 @@ static void usage(char *name);
 
 static void PrintSummary(stat_record_t *stat_record, outputParams_t *outputParams);
 
+static inline void ProcessFlowRecord(worker_ctx_t *ctx, common_record_t *flow_record, uint64_t seq);
+
+static void *WorkerThread(void *arg);
+
+static int InitWorkerContext(worker_ctx_t *ctx);
+
+static int StartWorkers(int num_workers, size_t buff_size, int element_stat, int flow_stat,
+	time_t twin_start, time_t twin_end);
+
+static int FlowRecordsOnly(nffile_t *nffile, int size);
+
+static void QueueBlock(nffile_t *nffile, uint32_t block_seq);
+
+static void DrainWorkers(void);
+
+static void ResetMasterRecords(uint32_t map_id);
+
+static void StopWorkers(stat_record_t *stat_record);
+
+static int ZoneFilter(block_zone_t *zone);
+
+static uint8_t *IPBlockSelect(char *filename, uint32_t NumBlocks);
+
 static stat_record_t process_data(char *wfile, int element_stat, int flow_stat, int sort_flows,
 	printer_t print_record, time_t twin_start, time_t twin_end, 
-	uint64_t limitRecords, outputParams_t *outputParams, int compress);
+	uint64_t limitRecords, outputParams_t *outputParams, int compress, int num_workers);
 
 /* Functions */
 
@@ -265,6 +331,8 @@ static void usage(char *name) {
 					"-B\t\tAggregate netflow records as bidirectional flows - Guess direction.\n"
 					"-r <file>\tread input from file\n"
 					"-w <file>\twrite output to file\n"
+					"-k <num>\tCompress and write output blocks in a thread with <num> queued blocks.\n"
+					"-Q\t\tWrite a block index into the output file.\n"
 					"-f\t\tread netflow filter from file\n"
 					"-n\t\tDefine number of top N for stat or sorted output.\n"
 					"-c\t\tLimit number of matching records\n"
@@ -274,7 +342,7 @@ static void usage(char *name) {
 					"\t\tand ordered by <order>: packets, bytes, flows, bps pps and bpp.\n"
 					"-q\t\tQuiet: Do not print the header and bottom stat lines.\n"
 					"-i <ident>\tChange Ident to <ident> in file given by -r.\n"
-					"-J <num>\tModify file compression: 0: uncompressed - 1: LZO - 2: BZ2 - 3: LZ4 compressed.\n"
+					"-J <num>\tModify file compression: 0: uncompressed - 1: LZO - 2: BZ2 - 3: LZ4 compressed - 4: column blocks.\n"
 					"-z\t\tLZO compress flows in output file. Used in combination with -w.\n"
 					"-y\t\tLZ4 compress flows in output file. Used in combination with -w.\n"
 					"-j\t\tBZ2 compress flows in output file. Used in combination with -w.\n"
@@ -287,10 +355,13 @@ static void usage(char *name) {
 					"\t\trequests either -r filename or -R firstfile:lastfile without pathnames\n"
 					"-m\t\tdeprecated\n"
 					"-O <order> Sort order for aggregated flows - tstart, tend, flows, packets bps pps bbp etc.\n"
+					"-P <num>\tRead ahead and decompress data blocks with <num> threads.\n"
+					"-U\t\tMemory map uncompressed and LZ4 compressed input files.\n"
 					"-R <expr>\tRead input from sequence of files.\n"
 					"\t\t/any/dir  Read all files in that directory.\n"
 					"\t\t/dir/file Read all files beginning with 'file'.\n"
 					"\t\t/dir/file1:file2: Read all files from 'file1' to file2.\n"
+					"-Y\t\tDo not probe the next files of -R or -M for the time window ahead.\n"
 					"-o <mode>\tUse <mode> to print out netflow records:\n"
 					"\t\t raw      Raw record dump.\n"
 					"\t\t line     Standard output line format.\n"
@@ -306,6 +377,8 @@ static void usage(char *name) {
 					"-x <file>\tverify extension records in netflow data file.\n"
 					"-X\t\tDump Filtertable and exit (debug option).\n"
 					"-Z\t\tCheck filter syntax and exit.\n"
+					"-W <num>\tAggregate flows and statistics with <num> worker threads.\n"
+					"-H <hash>\tHash function for aggregation: sfh or mx64 (default).\n"
 					"-t <time>\ttime window for filtering packets\n"
 					"\t\tyyyy/MM/dd.hh:mm:ss[-yyyy/MM/dd.hh:mm:ss]\n", name);
 } /* usage */
@@ -352,13 +425,348 @@ char 		bps_str[NUMBER_STRING_SIZE], pps_str[NUMBER_STRING_SIZE], bpp_str[NUMBER_
 
 } // End of PrintSummary
 
+/*
+ * Parallel record processing
+ * The main thread reads the data blocks and hands them over to the worker threads.
+ * Each worker expands, filters and aggregates the records of a block into its own
+ * flow and stat tables. Blocks containing extension maps, exporter or sampler records
+ * are processed by the main thread, after all pending blocks are done. The thread
+ * local tables are merged into the global tables, when all blocks are processed.
+ */
+static inline void ProcessFlowRecord(worker_ctx_t *ctx, common_record_t *flow_record, uint64_t seq) {
+master_record_t	*master_record;
+exporter_t 		*exp_info;
+void			*ext_data;
+uint32_t		map_id;
+int				match;
+
+	map_id = flow_record->ext_map;
+	if ( map_id >= MAX_EXTENSION_MAPS ) {
+		LogError("Corrupt data file. Extension map id %u too big.\n", flow_record->ext_map);
+		exit(255);
+	}
+	if ( extension_map_list->slot[map_id] == NULL ) {
+		LogError("Corrupt data file. Missing extension map %u. Skip record.\n", flow_record->ext_map);
+		return;
+	}
+	exp_info = exporter_list[flow_record->exporter_sysid];
+
+	master_record = ctx->master_record[map_id];
+	if ( !master_record ) {
+		master_record = (master_record_t *)calloc(1, sizeof(master_record_t));
+		if ( !master_record ) {
+			LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			exit(255);
+		}
+		ctx->master_record[map_id] = master_record;
+	}
+
+	ctx->engine.nfrecord = (uint64_t *)master_record;
+	ext_data = ExpandRecord_filter( flow_record, extension_map_list->slot[map_id],
+		exp_info ? &(exp_info->info) : NULL, master_record);
+
+	// Time based filter
+	// if no time filter is given, the result is always true
+	match  = WorkerPool.twin_start && (master_record->first < WorkerPool.twin_start ||
+			 master_record->last > WorkerPool.twin_end) ? 0 : 1;
+
+	// filter netflow record with user supplied filter
+	if ( match )
+		match = (*ctx->engine.FilterEngine)(&ctx->engine);
+
+	if ( match == 0 )
+		return;
+
+	ExpandRecord_match(extension_map_list->slot[map_id], ext_data, master_record);
+	ctx->recordCount++;
+
+	master_record->label = ctx->engine.label;
+	UpdateStat(&ctx->stat_record, master_record);
+	ctx->ref_count[map_id]++;
+
+	if ( WorkerPool.flow_stat )
+		AddTableFlow(ctx->flowTable, flow_record, master_record, extension_map_list->slot[map_id], seq);
+	if ( WorkerPool.element_stat )
+		AddTableStat(ctx->statTable, flow_record, master_record, seq);
+
+} // End of ProcessFlowRecord
+
+static void *WorkerThread(void *arg) {
+worker_ctx_t *ctx = (worker_ctx_t *)arg;
+block_job_t	 *job;
+
+	pthread_mutex_lock(&WorkerPool.mutex);
+	while ( 1 ) {
+		while ( !WorkerPool.terminate && WorkerPool.next_take == WorkerPool.next_put )
+			pthread_cond_wait(&WorkerPool.cond, &WorkerPool.mutex);
+		if ( WorkerPool.terminate )
+			break;
+
+		job = &WorkerPool.job[WorkerPool.next_take % WorkerPool.num_jobs];
+		WorkerPool.next_take++;
+		job->status = JOB_BUSY;
+		pthread_mutex_unlock(&WorkerPool.mutex);
+
+		data_block_header_t *block_header = (data_block_header_t *)job->buff;
+		common_record_t *record_ptr = (common_record_t *)((pointer_addr_t)block_header + sizeof(data_block_header_t));
+		uint32_t i;
+		for ( i=0; i < block_header->NumRecords; i++ ) {
+			ProcessFlowRecord(ctx, record_ptr, ((uint64_t)job->block_seq << 32) | i);
+			record_ptr = (common_record_t *)((pointer_addr_t)record_ptr + record_ptr->size);
+		}
+
+		pthread_mutex_lock(&WorkerPool.mutex);
+		job->status = JOB_FREE;
+		WorkerPool.pending--;
+		pthread_cond_broadcast(&WorkerPool.cond);
+	}
+	pthread_mutex_unlock(&WorkerPool.mutex);
+
+	pthread_exit(NULL);
+
+} // End of WorkerThread
+
+static int InitWorkerContext(worker_ctx_t *ctx) {
+
+	memset((void *)ctx, 0, sizeof(worker_ctx_t));
+
+	// the filter tree is read only - each worker needs its own record pointer and label
+	ctx->engine = *Engine;
+	ctx->stat_record.first_seen = 0x7fffffff;
+	ctx->stat_record.msec_first = 999;
+
+	ctx->master_record = (master_record_t **)calloc(MAX_EXTENSION_MAPS, sizeof(master_record_t *));
+	ctx->ref_count 	   = (uint32_t *)calloc(MAX_EXTENSION_MAPS, sizeof(uint32_t));
+	if ( !ctx->master_record || !ctx->ref_count ) {
+		LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+
+	if ( WorkerPool.flow_stat && (ctx->flowTable = New_FlowTable()) == NULL )
+		return 0;
+
+	if ( WorkerPool.element_stat && (ctx->statTable = New_StatTable()) == NULL )
+		return 0;
+
+	return 1;
+
+} // End of InitWorkerContext
+
+static int StartWorkers(int num_workers, size_t buff_size, int element_stat, int flow_stat,
+	time_t twin_start, time_t twin_end) {
+int i, err;
+
+	memset((void *)&WorkerPool, 0, sizeof(WorkerPool));
+	WorkerPool.twin_start	= twin_start;
+	WorkerPool.twin_end		= twin_end;
+	WorkerPool.flow_stat	= flow_stat;
+	WorkerPool.element_stat	= element_stat;
+
+	// one additional context for the records processed by the main thread
+	WorkerPool.num_workers = num_workers;
+	WorkerPool.ctx = (worker_ctx_t *)calloc(num_workers + 1, sizeof(worker_ctx_t));
+	WorkerPool.num_jobs = 2 * num_workers;
+	WorkerPool.job = (block_job_t *)calloc(WorkerPool.num_jobs, sizeof(block_job_t));
+	if ( !WorkerPool.ctx || !WorkerPool.job ) {
+		LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+
+	for ( i=0; i<WorkerPool.num_jobs; i++ ) {
+		WorkerPool.job[i].buff = malloc(buff_size);
+		if ( !WorkerPool.job[i].buff ) {
+			LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			return 0;
+		}
+		WorkerPool.job[i].status = JOB_FREE;
+	}
+
+	for ( i=0; i<=num_workers; i++ ) {
+		if ( !InitWorkerContext(&WorkerPool.ctx[i]) )
+			return 0;
+	}
+
+	pthread_mutex_init(&WorkerPool.mutex, NULL);
+	pthread_cond_init(&WorkerPool.cond, NULL);
+
+	for ( i=0; i<num_workers; i++ ) {
+		err = pthread_create(&WorkerPool.ctx[i].tid, NULL, WorkerThread, (void *)&WorkerPool.ctx[i]);
+		if ( err ) {
+			LogError("pthread_create() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(err) );
+			exit(255);
+		}
+	}
+
+	return 1;
+
+} // End of StartWorkers
+
+static int FlowRecordsOnly(nffile_t *nffile, int size) {
+common_record_t *record_ptr;
+uint32_t i, sumSize;
+
+	sumSize = 0;
+	record_ptr = nffile->buff_ptr;
+	for ( i=0; i < nffile->block_header->NumRecords; i++ ) {
+		if ( (sumSize + record_ptr->size) > size || (record_ptr->size < sizeof(record_header_t)) ) {
+			LogError("Corrupt data file. Inconsistent block size in %s line %d\n", __FILE__, __LINE__);
+			exit(255);
+		}
+		if ( record_ptr->type != CommonRecordType )
+			return 0;
+		sumSize += record_ptr->size;
+		record_ptr = (common_record_t *)((pointer_addr_t)record_ptr + record_ptr->size);
+	}
+
+	return 1;
+
+} // End of FlowRecordsOnly
+
+static void QueueBlock(nffile_t *nffile, uint32_t block_seq) {
+block_job_t	*job;
+void		*_tmp;
+
+	pthread_mutex_lock(&WorkerPool.mutex);
+	job = &WorkerPool.job[WorkerPool.next_put % WorkerPool.num_jobs];
+	while ( job->status != JOB_FREE )
+		pthread_cond_wait(&WorkerPool.cond, &WorkerPool.mutex);
+
+	if ( nffile->block_header != nffile->buff_pool[0] ) {
+		// block is in the file mapping - the worker gets a copy
+		memcpy(job->buff, (void *)nffile->block_header, sizeof(data_block_header_t) + nffile->block_header->size);
+	} else {
+		// swap buffers - the worker takes the block, the file reads the next block into the free buffer
+		_tmp = job->buff;
+		job->buff = nffile->buff_pool[0];
+		nffile->buff_pool[0] = _tmp;
+		nffile->block_header = nffile->buff_pool[0];
+		nffile->buff_ptr = (void *)((pointer_addr_t)nffile->block_header + sizeof(data_block_header_t));
+	}
+
+	job->block_seq = block_seq;
+	job->status	   = JOB_READY;
+	WorkerPool.next_put++;
+	WorkerPool.pending++;
+	pthread_cond_broadcast(&WorkerPool.cond);
+	pthread_mutex_unlock(&WorkerPool.mutex);
+
+} // End of QueueBlock
+
+static void DrainWorkers(void) {
+int i, j;
+
+	pthread_mutex_lock(&WorkerPool.mutex);
+	while ( WorkerPool.pending )
+		pthread_cond_wait(&WorkerPool.cond, &WorkerPool.mutex);
+	pthread_mutex_unlock(&WorkerPool.mutex);
+
+	// update number of flows matching a given map
+	for ( i=0; i<=WorkerPool.num_workers; i++ ) {
+		uint32_t *ref_count = WorkerPool.ctx[i].ref_count;
+		for ( j=0; j<=extension_map_list->max_used; j++ ) {
+			if ( ref_count[j] ) {
+				extension_map_list->slot[j]->ref_count += ref_count[j];
+				ref_count[j] = 0;
+			}
+		}
+	}
+
+} // End of DrainWorkers
+
+static void ResetMasterRecords(uint32_t map_id) {
+int i;
+
+	// extension map slot got a new map - the expanded records no longer match
+	for ( i=0; i<=WorkerPool.num_workers; i++ ) {
+		if ( WorkerPool.ctx[i].master_record[map_id] ) {
+			free((void *)WorkerPool.ctx[i].master_record[map_id]);
+			WorkerPool.ctx[i].master_record[map_id] = NULL;
+		}
+	}
+
+} // End of ResetMasterRecords
+
+static void StopWorkers(stat_record_t *stat_record) {
+hash_FlowTable	**flowTables;
+hash_StatTable	**statTables;
+int i, j;
+
+	DrainWorkers();
+
+	pthread_mutex_lock(&WorkerPool.mutex);
+	WorkerPool.terminate = 1;
+	pthread_cond_broadcast(&WorkerPool.cond);
+	pthread_mutex_unlock(&WorkerPool.mutex);
+
+	for ( i=0; i<WorkerPool.num_workers; i++ )
+		pthread_join(WorkerPool.ctx[i].tid, NULL);
+
+	flowTables = (hash_FlowTable **)calloc(WorkerPool.num_workers + 1, sizeof(hash_FlowTable *));
+	statTables = (hash_StatTable **)calloc(WorkerPool.num_workers + 1, sizeof(hash_StatTable *));
+	if ( !flowTables || !statTables ) {
+		LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	for ( i=0; i<=WorkerPool.num_workers; i++ ) {
+		worker_ctx_t *ctx = &WorkerPool.ctx[i];
+		SumStatRecords(stat_record, &ctx->stat_record);
+		recordCount += ctx->recordCount;
+		flowTables[i] = ctx->flowTable;
+		statTables[i] = ctx->statTable;
+		for ( j=0; j<MAX_EXTENSION_MAPS; j++ ) {
+			if ( ctx->master_record[j] )
+				free((void *)ctx->master_record[j]);
+		}
+		free((void *)ctx->master_record);
+		free((void *)ctx->ref_count);
+	}
+
+	if ( WorkerPool.flow_stat )
+		MergeFlowTables(flowTables, WorkerPool.num_workers + 1);
+	if ( WorkerPool.element_stat )
+		MergeStatTables(statTables, WorkerPool.num_workers + 1);
+
+	free((void *)flowTables);
+	free((void *)statTables);
+
+	for ( i=0; i<WorkerPool.num_jobs; i++ )
+		free(WorkerPool.job[i].buff);
+	free((void *)WorkerPool.job);
+	free((void *)WorkerPool.ctx);
+	WorkerPool.ctx = NULL;
+
+	pthread_mutex_destroy(&WorkerPool.mutex);
+	pthread_cond_destroy(&WorkerPool.cond);
+
+} // End of StopWorkers
+
+static int ZoneFilter(block_zone_t *zone) {
+
+	// all flows of the block start before or end after the time window
+	if ( zone_twin_start && (zone->first_max < zone_twin_start || zone->last_min > zone_twin_end) )
+		return 0;
+
+	return ZoneMatchFilter(Engine, zone);
+
+} // End of ZoneFilter
+
+static uint8_t *IPBlockSelect(char *filename, uint32_t NumBlocks) {
+
+	return IPIndexSelect(Engine, filename, NumBlocks);
+
+} // End of IPBlockSelect
+
 stat_record_t process_data(char *wfile, int element_stat, int flow_stat, int sort_flows,
 	printer_t print_record, time_t twin_start, time_t twin_end, 
-	uint64_t limitRecords, outputParams_t *outputParams, int compress) {
+	uint64_t limitRecords, outputParams_t *outputParams, int compress, int num_workers) {
 common_record_t 	*flow_record, *record_ptr;
 master_record_t		*master_record;
 nffile_t			*nffile_w, *nffile_r;
 stat_record_t 		stat_record;
+worker_ctx_t		*main_ctx;
+column_reader_t		*column_reader;
+uint32_t			block_seq;
 int 				done, write_file;
 
 	// time window of all matched flows
@@ -379,6 +787,17 @@ int 				done, write_file;
 	nffile_r = NULL;
 	nffile_w = NULL;
 
+	// skip data blocks of indexed files, which can not match
+	if ( twin_start || Engine->StartNode ) {
+		zone_twin_start = twin_start;
+		zone_twin_end	= twin_end;
+		SetZoneFilter(ZoneFilter);
+	}
+
+	// read only the blocks with the addresses of an ip filter
+	if ( IPIndexUsable(Engine) ) 
+		SetBlockSelect(IPBlockSelect);
+
 	// Get the first file handle
 	nffile_r = GetNextFile(NULL, twin_start, twin_end);
 	if ( !nffile_r ) {
@@ -413,6 +832,28 @@ int 				done, write_file;
 		}
 	}
 
+	// aggregate flows and elements with multiple threads
+	main_ctx  = NULL;
+	block_seq = 0;
+	if ( num_workers && (flow_stat || element_stat) && !limitRecords ) {
+		if ( !StartWorkers(num_workers, nffile_r->buff_size, element_stat, flow_stat, twin_start, twin_end) ) {
+			CloseFile(nffile_r);
+			DisposeFile(nffile_r);
+			return stat_record;
+		}
+		main_ctx = &WorkerPool.ctx[num_workers];
+	}
+
+	// column blocks are filtered on the filter columns before they are decoded
+	column_reader = NewColumnReader(Engine);
+	if ( !column_reader ) {
+		if ( main_ctx )
+			StopWorkers(&stat_record);
+		CloseFile(nffile_r);
+		DisposeFile(nffile_r);
+		return stat_record;
+	}
+
 	// setup Filter Engine to point to master_record, as any record read from file
 	// is expanded into this record
 	// Engine->nfrecord = (uint64_t *)master_record;
@@ -432,6 +873,9 @@ int 				done, write_file;
 					LogError("Read error in file '%s': %s\n",GetCurrentFilename(), strerror(errno) );
 				// fall through - get next file in chain
 			case NF_EOF: {
+				// ident filters match the ident of the current file
+				if ( main_ctx && Engine->IdentList )
+					DrainWorkers();
 				nffile_t *next = GetNextFile(nffile_r, twin_start, twin_end);
 				if ( next == EMPTY_LIST ) {
 					done = 1;
@@ -454,6 +898,16 @@ int 				done, write_file;
 				total_bytes += ret;
 		}
 
+		if ( nffile_r->block_header->id == DATA_BLOCK_TYPE_3 ) {
+			// no record of the block matches, or corrupt block
+			ret = DecodeColumnBlock(column_reader, nffile_r, extension_map_list);
+			if ( ret <= 0 ) {
+				if ( ret < 0 ) 
+					skipped_blocks++;
+				continue;
+			}
+		}
+
 		if ( nffile_r->block_header->id != DATA_BLOCK_TYPE_2 ) {
 			if ( nffile_r->block_header->id == DATA_BLOCK_TYPE_1 ) {
 				LogError("nfdump 1.5.x block type 1 no longer supported. Skip block.\n");
@@ -464,6 +918,16 @@ int 				done, write_file;
 			continue;
 		}
 
+		if ( main_ctx ) {
+			// blocks with flow records only are processed by the workers
+			if ( FlowRecordsOnly(nffile_r, ret) ) {
+				QueueBlock(nffile_r, block_seq++);
+				continue;
+			}
+			// maps, exporter and sampler records must be processed in sequence
+			DrainWorkers();
+		}
+
 		uint32_t sumSize = 0;
 		record_ptr = nffile_r->buff_ptr;
 		for ( i=0; i < nffile_r->block_header->NumRecords && !done; i++ ) {
@@ -481,6 +945,12 @@ int 				done, write_file;
 					int match;
 					uint32_t map_id;
 					exporter_t *exp_info;
+					void *ext_data;
+
+					if ( main_ctx ) {
+						ProcessFlowRecord(main_ctx, flow_record, ((uint64_t)block_seq << 32) | i);
+						break;
+					}
 
 					// valid flow_record converted if needed
 					map_id = flow_record->ext_map;
@@ -498,7 +968,7 @@ int 				done, write_file;
 
 					master_record = &(extension_map_list->slot[map_id]->master_record);
 					Engine->nfrecord = (uint64_t *)master_record;
-					ExpandRecord_v2( flow_record, extension_map_list->slot[map_id], 
+					ext_data = ExpandRecord_filter( flow_record, extension_map_list->slot[map_id], 
 						exp_info ? &(exp_info->info) : NULL, master_record);
 
 					// Time based filter
@@ -516,6 +986,7 @@ int 				done, write_file;
 						// go to next record
 						continue;
 					}
+					ExpandRecord_match(extension_map_list->slot[map_id], ext_data, master_record);
 					recordCount++;
 
 					// Records passed filter -> continue record processing
@@ -566,6 +1037,8 @@ int 				done, write_file;
 						case 1:
 							if ( write_file ) 
 								AppendToBuffer(nffile_w, (void *)map, map->size);
+							if ( main_ctx )
+								ResetMasterRecords(map->map_id);
 							break;
 						default:
 							LogError("Corrupt data file. Unable to decode at %s line %d\n", __FILE__, __LINE__);
@@ -611,9 +1084,15 @@ int 				done, write_file;
 
 		} // for all records
 
+		if ( main_ctx )
+			block_seq++;
 
 	} // while
 
+	if ( main_ctx )
+		StopWorkers(&stat_record);
+
+	DisposeColumnReader(column_reader);
 	CloseFile(nffile_r);
 
 	// flush output file
@@ -656,7 +1135,7 @@ char		*print_order, *query_file, *nameserver, *aggr_fmt;
 int 		c, ffd, ret, element_stat, fdump;
 int 		i, flow_stat, aggregate, aggregate_mask, bidir;
 int 		print_stat, syntax_only, date_sorted, compress;
-int			printPlain, GuessDir, ModifyCompress;
+int			printPlain, GuessDir, ModifyCompress, readahead, readmmap, workers, writequeue;
 time_t 		t_start, t_end;
 uint32_t	limitRecords;
 char 		Ident[IDENTLEN];
@@ -680,6 +1159,10 @@ char 		Ident[IDENTLEN];
 	compress		= NOT_COMPRESSED;
 	is_anonymized	= 0;
 	GuessDir		= 0;
+	readahead		= 0;
+	readmmap		= 0;
+	writequeue		= 0;
+	workers			= 0;
 	nameserver		= NULL;
 
 	print_format    = NULL;
@@ -700,7 +1183,7 @@ char 		Ident[IDENTLEN];
 
 	Ident[0] = '\0';
 
-	while ((c = getopt(argc, argv, "6aA:Bbc:D:E:s:hn:i:jf:qyzr:v:w:J:K:M:NImO:R:XZt:TVv:x:l:L:o:")) != EOF) {
+	while ((c = getopt(argc, argv, "6aA:Bbc:D:E:s:hH:n:i:jf:k:qQyzr:v:w:J:K:M:NImO:P:R:UW:XYZt:TVv:x:l:L:o:")) != EOF) {
 		switch (c) {
 			case 'h':
 				usage(argv[0]);
@@ -846,12 +1329,48 @@ char 		Ident[IDENTLEN];
 				}
 				date_sorted = ret == 6;		// index into order_mode
 				} break;
+			case 'P':
+				readahead = atoi(optarg);
+				if ( readahead < 1 || readahead > MAXWORKERS ) {
+					LogError("Number of read ahead threads %s out of range 1..%d\n", optarg, MAXWORKERS);
+					exit(255);
+				}
+				break;
 			case 'R':
 				Rfile = optarg;
 				break;
+			case 'U':
+				readmmap = 1;
+				break;
+			case 'Y':
+				SetFileProbe(0);
+				break;
+			case 'Q':
+				SetBlockIndex(1);
+				break;
+			case 'W':
+				workers = atoi(optarg);
+				if ( workers < 1 || workers > MAXWORKERS ) {
+					LogError("Number of worker threads %s out of range 1..%d\n", optarg, MAXWORKERS);
+					exit(255);
+				}
+				break;
 			case 'w':
 				wfile = optarg;
 				break;
+			case 'k':
+				writequeue = atoi(optarg);
+				if ( writequeue < 1 || writequeue > MAXWRITEQUEUE ) {
+					LogError("Write queue length %s out of range 1..%d\n", optarg, MAXWRITEQUEUE);
+					exit(255);
+				}
+				break;
+			case 'H':
+				if ( !SetFlowHash(optarg) ) {
+					LogError("Unknown hash function '%s'. Use sfh or mx64\n", optarg);
+					exit(255);
+				}
+				break;
 			case 'n':
 				outputParams->topN = atoi(optarg);
 				if ( outputParams->topN < 0 ) {
@@ -872,8 +1391,8 @@ char 		Ident[IDENTLEN];
 				break;
 			case 'J':
 				ModifyCompress = atoi(optarg);
-				if ( (ModifyCompress < 0) || (ModifyCompress > 3) ) {
-					LogError("Expected -J <num>, 0: uncompressed, 1: LZO, 2: BZ2, 3: LZ4 compressed.\n");
+				if ( (ModifyCompress < 0) || (ModifyCompress > COLUMN_BLOCKS) ) {
+					LogError("Expected -J <num>, 0: uncompressed, 1: LZO, 2: BZ2, 3: LZ4 compressed, 4: column blocks.\n");
 					exit(255);
 				}
 				break;
@@ -905,13 +1424,21 @@ char 		Ident[IDENTLEN];
 		FilterFilename = NULL;
 	}
 	
+	// compress and write output blocks in a separate thread
+	if ( writequeue ) 
+		SetAsyncWriter(writequeue, 0);
+
 	// Modify compression
 	if ( ModifyCompress >= 0 ) {
 		if ( !rfile && !Rfile ) {
 			LogError("Expected -r <file> or -R <dir> to change compression\n");
 			exit(255);
 		}
-		ModifyCompressFile(rfile, Rfile, ModifyCompress);
+		SetReadAhead(readahead);
+		if ( ModifyCompress == COLUMN_BLOCKS ) 
+			ConvertColumnFile(rfile, Rfile);
+		else
+			ModifyCompressFile(rfile, Rfile, ModifyCompress);
 		exit(0);
 	}
 
@@ -1108,6 +1635,14 @@ char 		Ident[IDENTLEN];
 	if ( syntax_only )
 		exit(0);
 
+	// expand only the fields the filter reads, before the filter runs
+	if ( Engine->StartNode ) {
+		uint64_t mask[EXPAND_MASK_SIZE];
+		memset((void *)mask, 0, sizeof(mask));
+		if ( FilterRecordMask(Engine, mask, EXPAND_MASK_SIZE * 64) ) 
+			SetExpandMask(mask);
+	}
+
 	if ( print_order && flow_stat ) {
 		printf("-s record and -O (-m) are mutually exclusive options\n");
 		exit(255);
@@ -1131,10 +1666,17 @@ char 		Ident[IDENTLEN];
 		print_prolog();
 	}
 
+	SetReadAhead(readahead);
+	SetReadMmap(readmmap);
+
+	// bidir aggregation depends on the order of the flows - keep it single threaded
+	if ( bidir )
+		workers = 0;
+
 	nfprof_start(&profile_data);
 	sum_stat = process_data(wfile, element_stat, aggregate || flow_stat, print_order != NULL,
 						print_record, t_start, t_end, 
-						limitRecords, outputParams, compress);
+						limitRecords, outputParams, compress, workers);
 	nfprof_end(&profile_data, recordCount);
 	
 	if ( total_bytes == 0 ) {
@@ -1188,6 +1730,8 @@ char 		Ident[IDENTLEN];
 			}
 			printf("Total flows processed: %u, Blocks skipped: %u, Bytes read: %llu\n", 
 				recordCount, skipped_blocks, (unsigned long long)total_bytes);
+			if ( GetZoneSkipped() )
+				printf("Blocks pruned by index: %u\n", GetZoneSkipped());
 			nfprof_print(&profile_data, stdout);
 		}
 	}
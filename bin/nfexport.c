@@ -298,18 +298,15 @@ char				*string;
 		}
 
 		// preset SortList table - still unsorted
-		for ( i=0; i<=FlowTable->IndexMask; i++ ) {
-			r = FlowTable->bucket[i];
-			if ( !r ) 
-				continue;
-
-			// foreach elem in this bucket
-			while ( r ) {
-				SortList[c].count  = 1000LL * r->flowrecord.first + r->flowrecord.msec_first;	// sort according the date
-				SortList[c].record = (void *)r;
-				c++;
-				r = r->next;
-			}
+		// foreach record in insertion order
+		r = FlowTable->first;
+		while ( r ) {
+			SortList[c].count  = 1000LL * r->flowrecord.first + r->flowrecord.msec_first;	// sort according the date
+			SortList[c].record = (void *)r;
+			SortList[c].key    = (void *)r->hash_key;
+			SortList[c].keysize = FlowTable->keysize;
+			c++;
+			r = r->next;
 		}
 
 		if ( c != maxindex ) {
@@ -330,7 +327,7 @@ char				*string;
 			extension_info = r->map_info_ref;
 
 			flow_record = &(extension_info->master_record);
-			ExpandRecord_v2( raw_record, extension_info, r->exp_ref, flow_record);
+			ExpandRecord_plan( raw_record, extension_info, r->exp_ref, flow_record);
 			flow_record->dPkts 		= r->counter[INPACKETS];
 			flow_record->dOctets 	= r->counter[INBYTES];
 			flow_record->out_pkts 	= r->counter[OUTPACKETS];
@@ -369,55 +366,53 @@ char				*string;
 
 	} else {
 		// print them as they came
-		for ( i=0; i<=FlowTable->IndexMask; i++ ) {
-			r = FlowTable->bucket[i];
-			while ( r ) {
-				master_record_t	*flow_record;
-				common_record_t *raw_record;
-				extension_info_t *extension_info;
-
-				raw_record = &(r->flowrecord);
-				extension_info = r->map_info_ref;
-
-				flow_record = &(extension_info->master_record);
-				ExpandRecord_v2(raw_record, extension_info, r->exp_ref, flow_record);
-				flow_record->dPkts 		= r->counter[INPACKETS];
-				flow_record->dOctets 	= r->counter[INBYTES];
-				flow_record->out_pkts 	= r->counter[OUTPACKETS];
-				flow_record->out_bytes 	= r->counter[OUTBYTES];
-				flow_record->aggr_flows	= r->counter[FLOWS];
-
-				// apply IP mask from aggregation, to provide a pretty output
-				if ( FlowTable->has_masks ) {
-					flow_record->V6.srcaddr[0] &= FlowTable->IPmask[0];
-					flow_record->V6.srcaddr[1] &= FlowTable->IPmask[1];
-					flow_record->V6.dstaddr[0] &= FlowTable->IPmask[2];
-					flow_record->V6.dstaddr[1] &= FlowTable->IPmask[3];
-				}
-
-				if ( FlowTable->apply_netbits )
-					ApplyNetMaskBits(flow_record, FlowTable->apply_netbits);
-
-				if ( aggr_record_mask ) {
-					ApplyAggrMask(flow_record, aggr_record_mask);
-				}
-
-				if ( NeedSwap(GuessDir, flow_record) )  
-					SwapFlow(flow_record);
-
-				// switch to output extension map
-				flow_record->map_ref = extension_info->exportMap ? extension_info->exportMap : extension_info->map;
-				flow_record->ext_map = flow_record->map_ref->map_id;
-				PackRecord(flow_record, nffile);
+		r = FlowTable->first;
+		while ( r ) {
+			master_record_t	*flow_record;
+			common_record_t *raw_record;
+			extension_info_t *extension_info;
+
+			raw_record = &(r->flowrecord);
+			extension_info = r->map_info_ref;
+
+			flow_record = &(extension_info->master_record);
+			ExpandRecord_plan(raw_record, extension_info, r->exp_ref, flow_record);
+			flow_record->dPkts 		= r->counter[INPACKETS];
+			flow_record->dOctets 	= r->counter[INBYTES];
+			flow_record->out_pkts 	= r->counter[OUTPACKETS];
+			flow_record->out_bytes 	= r->counter[OUTBYTES];
+			flow_record->aggr_flows	= r->counter[FLOWS];
+
+			// apply IP mask from aggregation, to provide a pretty output
+			if ( FlowTable->has_masks ) {
+				flow_record->V6.srcaddr[0] &= FlowTable->IPmask[0];
+				flow_record->V6.srcaddr[1] &= FlowTable->IPmask[1];
+				flow_record->V6.dstaddr[0] &= FlowTable->IPmask[2];
+				flow_record->V6.dstaddr[1] &= FlowTable->IPmask[3];
+			}
+
+			if ( FlowTable->apply_netbits )
+				ApplyNetMaskBits(flow_record, FlowTable->apply_netbits);
+
+			if ( aggr_record_mask ) {
+				ApplyAggrMask(flow_record, aggr_record_mask);
+			}
+
+			if ( NeedSwap(GuessDir, flow_record) )  
+				SwapFlow(flow_record);
+
+			// switch to output extension map
+			flow_record->map_ref = extension_info->exportMap ? extension_info->exportMap : extension_info->map;
+			flow_record->ext_map = flow_record->map_ref->map_id;
+			PackRecord(flow_record, nffile);
 #ifdef DEVEL
-				flow_record_to_raw((void *)flow_record, &string, 0);
-				printf("%s\n", string);
+			flow_record_to_raw((void *)flow_record, &string, 0);
+			printf("%s\n", string);
 #endif
-				// Update statistics
-				UpdateStat(nffile->stat_record, flow_record);
+			// Update statistics
+			UpdateStat(nffile->stat_record, flow_record);
 
-				r = r->next;
-			}
+			r = r->next;
 		}
 
 	}
@@ -36,16 +36,19 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/uio.h>
+#include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/param.h>
+#include <sys/mman.h>
 #include <stdio.h>
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include <bzlib.h>
 
 #ifdef HAVE_STDINT_H
@@ -58,6 +61,7 @@
 #include "lz4.h"
 #include "flist.h"
 #include "nffile.h"
+#include "nfx.h"
 #include "nffileV2.h"
 
 /* global vars */
@@ -86,10 +90,181 @@ static void BZ2_prep_stream (bz_stream*);
 static int OpenRaw(char *filename, stat_record_t *stat_record, int *compressed);
 
 extern char *nf_error;
+extern extension_descriptor_t extension_descriptor[];
+extern uint32_t Max_num_extensions;
+
+/*
+ * block read ahead
+ * A reader thread reads the raw data blocks of a file into a ring of slots,
+ * a pool of worker threads decompresses them in parallel and ReadBlock()
+ * returns the blocks in file order.
+ */
+static int ReadAheadWorkers = 0;
+
+/*
+ * mmap reader
+ * Uncompressed and LZ4 files are mapped into memory. Uncompressed blocks are
+ * returned in place, LZ4 blocks are decompressed directly from the mapping.
+ * The mapping is private, so records may still be modified in place.
+ * Only enabled on request, as a file truncated while it is mapped raises SIGBUS.
+ */
+static int ReadMmap = 0;
+
+// the pages of the next window are requested, if less than half of the window is left
+#define MMAP_WINDOW	(8 * 1024 * 1024)
+
+#define SLOT_FREE	0		// slot may be filled by the reader
+#define SLOT_READ	1		// raw block read - waits for a worker
+#define SLOT_BUSY	2		// worker decompresses block
+#define SLOT_DONE	3		// block ready for ReadBlock()
+
+typedef struct block_slot_s {
+	void		*buff;		// data block incl. block header - size buff_size
+	int			status;		// SLOT_*
+	int			ret;		// ReadBlock() return value for this block
+} block_slot_t;
+
+typedef struct readahead_s {
+	// copy of the file parameters used by the threads
+	int				fd;
+	file_header_t	file_header;
+	size_t			buff_size;
+	struct block_index_s *block_index;	// owned by the file - used by the reader thread
+
+	pthread_mutex_t	m_slots;
+	pthread_cond_t	c_slots;
+
+	int				num_slots;
+	block_slot_t	*slot;
+	uint64_t		next_read;		// next block read from file
+	uint64_t		next_decode;	// next block to decompress
+	uint64_t		next_consume;	// next block returned by ReadBlock()
+	int				terminate;
+
+	pthread_t		reader;
+	int				num_threads;	// worker threads started
+	int				num_workers;	// workers, which took their buffer
+	pthread_t		worker[MAXWORKERS];
+	void			*work_buff[MAXWORKERS];	// decompress buffer of each worker
+} readahead_t;
+
+/*
+ * async block writer
+ * WriteBlock() queues the filled block and continues with an empty buffer.
+ * A writer thread compresses and writes the queued blocks in order.
+ * If the queue is full, WriteBlock() either waits for a free slot
+ * or drops the flow records of the block, if requested. All other records,
+ * such as extension maps, exporter and sampler records are still queued, as
+ * later flows depend on them. The dropped flows are subtracted from the stat record.
+ */
+static int WriteQueueBlocks = 0;
+static int WriteQueueDrop	= 0;
+
+#define SLOT_FILLED	4		// block queued - waits for the writer
+
+// position of the out counters in the records of an extension map
+typedef struct out_counter_s {
+	uint16_t	out_pkts;		// offset after the required extensions + 1, 0 if not present
+	uint16_t	out_bytes;		// offset after the required extensions + 1, 0 if not present
+	uint8_t		pkts_size;
+	uint8_t		bytes_size;
+} out_counter_t;
+
+typedef struct writer_s {
+	// copy of the file parameters used by the thread
+	int				fd;
+	int				compression;
+	size_t			buff_size;
+	void			*work_buff;		// compression buffer
+	void			*lzo_wrkmem;	// private LZO work memory
+
+	pthread_mutex_t	m_slots;
+	pthread_cond_t	c_slots;
+
+	int				num_slots;
+	block_slot_t	*slot;
+	uint64_t		next_fill;		// next slot filled by WriteBlock()
+	uint64_t		next_write;		// next slot written to file
+	int				drop;			// drop flow records instead of waiting
+	out_counter_t	*out_counter;	// drop: out counters of each extension map
+	int				error;			// errno of the first failed write - sticky
+	int				terminate;
+
+	pthread_t		tid;
+	writer_stat_t	stat;
+	struct block_index_s *block_index;	// zones of the written blocks - may be NULL
+} writer_t;
+
+/*
+ * block buffer
+ * A block buffer collects records like a file opened for writing, but WriteBlock()
+ * appends its records to the current block of the sink file. Multiple threads may
+ * collect into their own buffer and share one sink file.
+ */
+static pthread_mutex_t sink_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * block index
+ * If enabled by SetBlockIndex(), OpenNewFile() collects a zone for each data block
+ * written, which CloseUpdateFile() appends as index block. Readers without index support
+ * take the index block for corrupt data, therefore it is written only on request.
+ * If a zone filter is set, OpenFile() loads the index of the file and ReadBlock()
+ * skips the blocks, which cannot match the filter.
+ * A block selection, such as from the IP index of the file, skips blocks the same way.
+ * Without index in the file, the header of each skipped block is still read.
+ */
+static int WriteIndex = 0;
+static zone_filter_t ZoneFilter = NULL;
+static block_select_t BlockSelect = NULL;
+static uint32_t ZoneSkipped = 0;
+
+typedef struct block_index_s {
+	uint32_t		NumZones;
+	uint32_t		MaxZones;
+	block_zone_t	*zone;
+	int				error;		// writer: zone allocation failed - no index written
+	off_t			offset;		// writer: file offset of the next block
+	uint32_t		next;		// reader: number of the next block
+	uint32_t		skipped;	// reader: number of blocks skipped
+	uint32_t		NumSelect;
+	uint8_t			*select;	// reader: block selection - 0 skips the block
+} block_index_t;
 
 /* function prototypes */
 static nffile_t *NewFile(void);
 
+static int ReadRawBlock(nffile_t *nffile);
+
+static int UncompressBlock(nffile_t *nffile);
+
+static void StopReadAhead(readahead_t *readahead);
+
+static int StartWriter(nffile_t *nffile);
+
+static int StopWriter(writer_t *writer);
+
+static void RegisterOutCounter(writer_t *writer, extension_map_t *map);
+
+static void SubtractFlow(writer_t *writer, stat_record_t *stat_record, common_record_t *flow_record);
+
+static uint32_t ScanBlock(writer_t *writer, nffile_t *nffile, int drop);
+
+static int QueueWriteBlock(nffile_t *nffile);
+
+static int SinkWriteBlock(nffile_t *nffile);
+
+static block_index_t *NewBlockIndex(off_t offset);
+
+static void FreeBlockIndex(block_index_t *block_index);
+
+static void AddBlockZone(block_index_t *block_index, data_block_header_t *block_header);
+
+static int WriteBlockIndex(nffile_t *nffile);
+
+static block_index_t *ReadBlockIndex(int fd, file_header_t *file_header);
+
+static int TruncateBlockIndex(int fd);
+
 /* function definitions */
 
 void SumStatRecords(stat_record_t *s1, stat_record_t *s2) {
@@ -172,7 +347,7 @@ static void BZ2_prep_stream (bz_stream* bs)
    bs->opaque = NULL;
 } // End of BZ2_prep_stream
 
-static int Compress_Block_LZO(nffile_t *nffile) {
+static int Compress_Block_LZO(nffile_t *nffile, void *lzo_wrkmem) {
 unsigned char __LZO_MMODEL *in;
 unsigned char __LZO_MMODEL *out;
 lzo_uint in_len;
@@ -182,7 +357,7 @@ int r;
 	in  = (unsigned char __LZO_MMODEL *)(nffile->buff_pool[0] + sizeof(data_block_header_t));	
 	out = (unsigned char __LZO_MMODEL *)(nffile->buff_pool[1] + sizeof(data_block_header_t));	
 	in_len = nffile->block_header->size;
-	r = lzo1x_1_compress(in,in_len,out,&out_len,wrkmem);
+	r = lzo1x_1_compress(in,in_len,out,&out_len,lzo_wrkmem);
 
 	if (r != LZO_E_OK) {
 		LogError("Compress_Block_LZO() error compression failed in %s line %d: LZ4 : %d\n", __FILE__, __LINE__, r);
@@ -276,7 +451,8 @@ static int Compress_Block_LZ4(nffile_t *nffile) {
 
 static int Uncompress_Block_LZ4(nffile_t *nffile) {
 
-	const char *in  = (const char *)(nffile->buff_pool[0] + sizeof(data_block_header_t));
+	// the block may be in the file mapping, so read from block_header
+	const char *in  = (const char *)((pointer_addr_t)nffile->block_header + sizeof(data_block_header_t));
 	char *out 		= (char *)(nffile->buff_pool[1] + sizeof(data_block_header_t));
 	int in_len 		= nffile->block_header->size;
 
@@ -291,7 +467,7 @@ static int Uncompress_Block_LZ4(nffile_t *nffile) {
    	}
 
 	// copy header
-	memcpy(nffile->buff_pool[1], nffile->buff_pool[0], sizeof(data_block_header_t));
+	memcpy(nffile->buff_pool[1], (void *)nffile->block_header, sizeof(data_block_header_t));
 	((data_block_header_t *)nffile->buff_pool[1])->size = out_len;
 
 	// swap buffers
@@ -385,6 +561,45 @@ bz_stream bs;
 
 } // End of Uncompress_Block_BZ2
 
+static void MapFile(nffile_t *nffile) {
+struct stat stat_buf;
+off_t	offset;
+void	*map;
+
+	// the blocks start at the current file offset
+	offset = lseek(nffile->fd, 0, SEEK_CUR);
+	if ( offset < 0 || fstat(nffile->fd, &stat_buf) || stat_buf.st_size <= offset ) 
+		return;
+
+	map = mmap(NULL, stat_buf.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, nffile->fd, 0);
+	if ( map == MAP_FAILED ) {
+		// continue with read()
+		LogError("mmap() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return;
+	}
+	madvise(map, stat_buf.st_size, MADV_SEQUENTIAL);
+
+	nffile->map			= map;
+	nffile->map_size	= stat_buf.st_size;
+	nffile->map_offset	= offset;
+	nffile->map_advised	= offset & ~((size_t)getpagesize() - 1);
+
+} // End of MapFile
+
+static void UnmapFile(nffile_t *nffile) {
+
+	munmap(nffile->map, nffile->map_size);
+	nffile->map			= NULL;
+	nffile->map_size	= 0;
+	nffile->map_offset	= 0;
+	nffile->map_advised	= 0;
+
+	// blocks were returned in place - switch back to the buffer
+	nffile->block_header = nffile->buff_pool[0];
+	nffile->buff_ptr	 = (void *)((pointer_addr_t)nffile->block_header + sizeof(data_block_header_t));
+
+} // End of UnmapFile
+
 nffile_t *OpenFile(char *filename, nffile_t *nffile){
 struct stat stat_buf;
 int ret, allocated;
@@ -464,6 +679,22 @@ int ret, allocated;
 
 	CurrentIdent		= nffile->file_header->ident;
 
+	// the index is needed only to skip blocks
+	FreeBlockIndex(nffile->block_index);
+	nffile->block_index = NULL;
+	if ( (ZoneFilter || BlockSelect) && nffile->fd != STDIN_FILENO && (nffile->file_header->flags & FLAG_BLOCK_INDEX) ) 
+		nffile->block_index = ReadBlockIndex(nffile->fd, nffile->file_header);
+	if ( BlockSelect && nffile->fd != STDIN_FILENO ) {
+		uint8_t *select = BlockSelect(filename, nffile->file_header->NumBlocks);
+		if ( select && !nffile->block_index ) 
+			nffile->block_index = NewBlockIndex(0);
+		if ( nffile->block_index ) {
+			nffile->block_index->select	   = select;
+			nffile->block_index->NumSelect = select ? nffile->file_header->NumBlocks : 0;
+		} else 
+			free(select);
+	}
+
 	int compression = FILE_COMPRESSION(nffile);
 	switch (compression) {
 		case NOT_COMPRESSED:
@@ -488,6 +719,10 @@ int ret, allocated;
 			break;
 	}
 
+	if ( ReadMmap && nffile->fd != STDIN_FILENO && 
+		 (compression == NOT_COMPRESSED || compression == LZ4_COMPRESSED) ) 
+		MapFile(nffile);
+
 	return nffile;
 
 } // End of OpenFile
@@ -497,6 +732,27 @@ void CloseFile(nffile_t *nffile){
 	if ( !nffile ) 
 		return;
 
+	// stop read ahead threads before the file gets closed
+	if ( nffile->readahead ) {
+		StopReadAhead(nffile->readahead);
+		nffile->readahead = NULL;
+	}
+
+	// write pending blocks before the file gets closed
+	if ( nffile->writer ) {
+		StopWriter(nffile->writer);
+		nffile->writer = NULL;
+	}
+
+	if ( nffile->block_index ) {
+		ZoneSkipped += nffile->block_index->skipped;
+		FreeBlockIndex(nffile->block_index);
+		nffile->block_index = NULL;
+	}
+
+	if ( nffile->map ) 
+		UnmapFile(nffile);
+
 	// do not close stdout
 	if ( nffile->fd )
 		close(nffile->fd);
@@ -652,6 +908,17 @@ int i;
 nffile_t *DisposeFile(nffile_t *nffile) {
 int i;
 
+	if ( nffile->readahead ) {
+		StopReadAhead(nffile->readahead);
+		nffile->readahead = NULL;
+	}
+
+	if ( nffile->writer ) {
+		StopWriter(nffile->writer);
+		nffile->writer = NULL;
+	}
+
+	FreeBlockIndex(nffile->block_index);
 	free(nffile->file_header);
 	free(nffile->stat_record);
 
@@ -751,6 +1018,14 @@ int 			fd, flags;
 		return NULL;
 	}
 
+	// the file is written without index, if this fails
+	FreeBlockIndex(nffile->block_index);
+	nffile->block_index = WriteIndex ? NewBlockIndex(sizeof(file_header_t) + sizeof(stat_record_t)) : NULL;
+
+	// failing to start the writer is not fatal - blocks are written synchronously
+	if ( WriteQueueBlocks && !StartWriter(nffile) ) 
+		LogError("Failed to start async writer - continue synchronously");
+
 	return nffile;
 
 } /* End of OpenNewFile */
@@ -772,6 +1047,16 @@ nffile_t		*nffile;
 		return NULL;
 	}
 
+	// appended blocks follow the last data block
+	if ( !TruncateBlockIndex(nffile->fd) ) {
+		close(nffile->fd);
+		DisposeFile(nffile);
+		return NULL;
+	}
+	nffile->file_header->flags &= ~FLAG_BLOCK_INDEX;
+	FreeBlockIndex(nffile->block_index);
+	nffile->block_index = NULL;
+
 	// init output data buffer
 	nffile->block_header = malloc(BUFFSIZE + sizeof(data_block_header_t));
 	if ( !nffile->block_header ) {
@@ -840,7 +1125,12 @@ void *p;
 		return 0;
 	}
 
-	// both files open - append data
+	// both files open - append data after the last data block
+	if ( !TruncateBlockIndex(fd_to) ) {
+		close(fd_from);
+		close(fd_to);
+		return 0;
+	}
 	ret = lseek(fd_to, 0, SEEK_END);
 	if ( ret < 0 ) {
 		LogError("lseek() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
@@ -870,6 +1160,10 @@ void *p;
 			break;
 		}
 
+		// the index block of the file is not appended
+		if ( block_header->id == DATA_BLOCK_TYPE_4 ) 
+			break;
+
 		// read data block
 		ret = read(fd_from, p, block_header->size);
 		if ( ret != block_header->size ) {
@@ -983,6 +1277,22 @@ int CloseUpdateFile(nffile_t *nffile, char *ident) {
 		}
 	}
 
+	// all queued blocks must be on disk, before the header gets updated
+	if ( nffile->writer ) {
+		int ok = StopWriter(nffile->writer);
+		nffile->writer = NULL;
+		if ( !ok ) {
+			LogError("Failed to flush output buffer: %s", strerror(errno));
+			return 0;
+		}
+	}
+
+	// the index follows the last data block
+	if ( nffile->block_index && WriteBlockIndex(nffile) ) 
+		nffile->file_header->flags |= FLAG_BLOCK_INDEX;
+	else
+		nffile->file_header->flags &= ~FLAG_BLOCK_INDEX;
+
 	if ( lseek(nffile->fd, 0, SEEK_SET) < 0 ) {
 		// lseek on stdout works if output redirected:
 		// e.g. -w - > outfile
@@ -1020,10 +1330,139 @@ int CloseUpdateFile(nffile_t *nffile, char *ident) {
 
 } /* End of CloseUpdateFile */
 
-int ReadBlock(nffile_t *nffile) {
+static inline int SkipBlock(block_index_t *block_index, uint32_t n) {
+
+	if ( n < block_index->NumSelect && !block_index->select[n] )
+		return 1;
+	if ( ZoneFilter && n < block_index->NumZones && (block_index->zone[n].flags & ZONE_VALID) &&
+		 !ZoneFilter(&block_index->zone[n]) ) 
+		return 1;
+
+	return 0;
+
+} // End of SkipBlock
+
+static int MapRawBlock(nffile_t *nffile) {
+block_index_t		*block_index = nffile->block_index;
+data_block_header_t	*block_header;
+size_t				end;
+
+	if ( block_index ) {
+		// skip the blocks, which cannot match
+		uint32_t next = block_index->next;
+		while ( SkipBlock(block_index, next) ) 
+			next++;
+		if ( next != block_index->next ) {
+			block_index->skipped += next - block_index->next;
+			if ( block_index->NumZones ) {
+				block_index->next = next;
+				if ( next == block_index->NumZones ) 
+					return NF_EOF;
+				nffile->map_offset = block_index->zone[next].offset;
+			} else {
+				// no block offsets - step over each block
+				while ( block_index->next < next ) {
+					if ( (nffile->map_offset + sizeof(data_block_header_t)) > nffile->map_size ) 
+						return NF_EOF;
+					block_header = (data_block_header_t *)((pointer_addr_t)nffile->map + nffile->map_offset);
+					if ( block_header->id == DATA_BLOCK_TYPE_4 ) 
+						return NF_EOF;
+					nffile->map_offset += sizeof(data_block_header_t) + block_header->size;
+					block_index->next++;
+				}
+			}
+		}
+		block_index->next++;
+	}
+
+	if ( nffile->map_offset >= nffile->map_size ) 	// EOF
+		return NF_EOF;
+
+	if ( (nffile->map_offset + sizeof(data_block_header_t)) > nffile->map_size ) {
+		// this is most likely a corrupt file
+		LogError("Corrupt data file: Read %i bytes, requested %u\n", 
+			(int)(nffile->map_size - nffile->map_offset), sizeof(data_block_header_t));
+		return NF_CORRUPT;
+	}
+	block_header = (data_block_header_t *)((pointer_addr_t)nffile->map + nffile->map_offset);
+
+	// the block index follows the last data block
+	if ( block_header->id == DATA_BLOCK_TYPE_4 ) 
+		return NF_EOF;
+
+	// Check for sane buffer size
+	if ( block_header->size > BUFFSIZE || block_header->size == 0 || block_header->NumRecords == 0) {
+		// this is most likely a corrupt file
+		LogError("Corrupt data file: Requested buffer size %u exceeds max. buffer size", block_header->size);
+		return NF_CORRUPT;
+	}
+
+	end = nffile->map_offset + sizeof(data_block_header_t) + block_header->size;
+	if ( end > nffile->map_size ) {
+		LogError("ReadBlock() Corrupt data file: Unexpected EOF while reading data block.\n");
+		return NF_CORRUPT;
+	}
+
+	// request the next window in advance
+	if ( nffile->map_advised < nffile->map_offset ) 
+		nffile->map_advised = nffile->map_offset & ~((size_t)getpagesize() - 1);
+	if ( (end + MMAP_WINDOW/2) > nffile->map_advised && nffile->map_advised < nffile->map_size ) {
+		size_t len = MMAP_WINDOW;
+		if ( (nffile->map_advised + len) > nffile->map_size ) 
+			len = nffile->map_size - nffile->map_advised;
+		madvise((void *)((pointer_addr_t)nffile->map + nffile->map_advised), len, MADV_WILLNEED);
+		nffile->map_advised += len;
+	}
+
+	nffile->block_header = block_header;
+	nffile->buff_ptr	 = (void *)((pointer_addr_t)block_header + sizeof(data_block_header_t));
+	nffile->map_offset	 = end;
+
+	return sizeof(data_block_header_t) + block_header->size;
+
+} // End of MapRawBlock
+
+static int ReadRawBlock(nffile_t *nffile) {
+block_index_t *block_index = nffile->block_index;
 ssize_t ret, read_bytes, buff_bytes, request_size;
 void 	*read_ptr;
-uint32_t compression;
+
+	if ( nffile->map ) 
+		return MapRawBlock(nffile);
+
+	if ( block_index ) {
+		// skip the blocks, which cannot match
+		uint32_t next = block_index->next;
+		while ( SkipBlock(block_index, next) ) 
+			next++;
+		if ( next != block_index->next ) {
+			block_index->skipped += next - block_index->next;
+			if ( block_index->NumZones ) {
+				block_index->next = next;
+				if ( next == block_index->NumZones ) 
+					return NF_EOF;
+				if ( lseek(nffile->fd, block_index->zone[next].offset, SEEK_SET) < 0 ) {
+					LogError("lseek() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+					return NF_ERROR;
+				}
+			} else {
+				// no block offsets - seek over each block
+				while ( block_index->next < next ) {
+					ret = read(nffile->fd, nffile->block_header, sizeof(data_block_header_t));
+					if ( ret == 0 || (ret == sizeof(data_block_header_t) && nffile->block_header->id == DATA_BLOCK_TYPE_4) )
+						return NF_EOF;
+					if ( ret != sizeof(data_block_header_t) ) 
+						return NF_ERROR;
+					if ( lseek(nffile->fd, nffile->block_header->size, SEEK_CUR) < 0 ) {
+						LogError("lseek() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+						return NF_ERROR;
+					}
+					block_index->next++;
+				}
+			}
+		}
+		block_index->next++;
+	}
 
 	ret = read(nffile->fd, nffile->block_header, sizeof(data_block_header_t));
 	if ( ret == 0 )		// EOF
@@ -1042,6 +1481,10 @@ uint32_t compression;
 	// block header read successfully
 	read_bytes = ret;
 
+	// the block index follows the last data block
+	if ( nffile->block_header->id == DATA_BLOCK_TYPE_4 ) 
+		return NF_EOF;
+
 	// Check for sane buffer size
 	if ( nffile->block_header->size > BUFFSIZE ||
 	     nffile->block_header->size == 0 || nffile->block_header->NumRecords == 0) {
@@ -1050,29 +1493,9 @@ uint32_t compression;
 		return NF_CORRUPT;
 	}
 
-	// check block compression - defaults to file compression setting
-
-	compression = FILE_COMPRESSION(nffile);
 	ret = read(nffile->fd, nffile->buff_ptr, nffile->block_header->size);
 	if ( ret == nffile->block_header->size ) {
 		// we have the whole record and are done for now
-		switch (compression) {
-			case NOT_COMPRESSED:
-				break;
-			case LZO_COMPRESSED: 
-				if ( Uncompress_Block_LZO(nffile) < 0 ) 
-					return NF_CORRUPT;
-				break;
-			case LZ4_COMPRESSED: 
-				if ( Uncompress_Block_LZ4(nffile) < 0 ) 
-					return NF_CORRUPT;
-				break;
-			case BZ2_COMPRESSED: 
-				if ( Uncompress_Block_BZ2(nffile) < 0 )
-					return NF_CORRUPT;
-			break;
-		}
-		nffile->buff_ptr = (void *)((pointer_addr_t)nffile->block_header + sizeof(data_block_header_t));
 		return read_bytes + nffile->block_header->size;
 	} 
 			
@@ -1118,7 +1541,18 @@ uint32_t compression;
 		}
 	} while ( request_size > 0 );
 
-	switch (compression) {
+	return read_bytes + nffile->block_header->size;
+
+} // End of ReadRawBlock
+
+static int UncompressBlock(nffile_t *nffile) {
+
+	// column blocks compress each column individually
+	if ( nffile->block_header->id == DATA_BLOCK_TYPE_3 )
+		return sizeof(data_block_header_t) + nffile->block_header->size;
+
+	// check block compression - defaults to file compression setting
+	switch (FILE_COMPRESSION(nffile)) {
 		case NOT_COMPRESSED:
 			break;
 		case LZO_COMPRESSED: 
@@ -1135,11 +1569,753 @@ uint32_t compression;
 		break;
 	}
 
+	return sizeof(data_block_header_t) + nffile->block_header->size;
+
+} // End of UncompressBlock
+
+static void *ReadAheadReader(void *arg) {
+readahead_t *readahead = (readahead_t *)arg;
+nffile_t	nffile;
+int			ret;
+
+	// private file handle for the raw read into the slot buffer
+	memset((void *)&nffile, 0, sizeof(nffile_t));
+	nffile.fd 		   = readahead->fd;
+	nffile.file_header = &readahead->file_header;
+	nffile.buff_size   = readahead->buff_size;
+	nffile.block_index = readahead->block_index;
+
+	do {
+		block_slot_t *slot;
+
+		pthread_mutex_lock(&readahead->m_slots);
+		while ( !readahead->terminate && 
+				(readahead->next_read - readahead->next_consume) >= readahead->num_slots ) {
+			pthread_cond_wait(&readahead->c_slots, &readahead->m_slots);
+		}
+		if ( readahead->terminate ) {
+			pthread_mutex_unlock(&readahead->m_slots);
+			break;
+		}
+		slot = &readahead->slot[readahead->next_read % readahead->num_slots];
+		pthread_mutex_unlock(&readahead->m_slots);
+
+		nffile.block_header = slot->buff;
+		nffile.buff_ptr 	= (void *)((pointer_addr_t)slot->buff + sizeof(data_block_header_t));
+		ret = ReadRawBlock(&nffile);
+
+		pthread_mutex_lock(&readahead->m_slots);
+		slot->ret = ret;
+		// EOF, errors and uncompressed blocks need no worker
+		if ( ret <= 0 || FILE_IS_NOT_COMPRESSED(&nffile) ) 
+			slot->status = SLOT_DONE;
+		else
+			slot->status = SLOT_READ;
+		readahead->next_read++;
+		pthread_cond_broadcast(&readahead->c_slots);
+		pthread_mutex_unlock(&readahead->m_slots);
+
+	} while ( ret > 0 );
+
+	return NULL;
+
+} // End of ReadAheadReader
+
+static void *ReadAheadWorker(void *arg) {
+readahead_t *readahead = (readahead_t *)arg;
+nffile_t	nffile;
+void		*work_buff;
+int			worker;
+
+	// take the buffer allocated for this worker
+	pthread_mutex_lock(&readahead->m_slots);
+	worker	  = readahead->num_workers++;
+	work_buff = readahead->work_buff[worker];
+	pthread_mutex_unlock(&readahead->m_slots);
+
+	memset((void *)&nffile, 0, sizeof(nffile_t));
+	nffile.file_header = &readahead->file_header;
+	nffile.buff_size   = readahead->buff_size;
+
+	while ( 1 ) {
+		block_slot_t *slot;
+		int ret;
+
+		pthread_mutex_lock(&readahead->m_slots);
+		while ( !readahead->terminate ) {
+			// skip EOF and error slots
+			while ( readahead->next_decode < readahead->next_read &&
+					readahead->slot[readahead->next_decode % readahead->num_slots].status != SLOT_READ )
+				readahead->next_decode++;
+			if ( readahead->next_decode < readahead->next_read ) 
+				break;
+			pthread_cond_wait(&readahead->c_slots, &readahead->m_slots);
+		}
+		if ( readahead->terminate ) {
+			pthread_mutex_unlock(&readahead->m_slots);
+			break;
+		}
+		slot = &readahead->slot[readahead->next_decode % readahead->num_slots];
+		slot->status = SLOT_BUSY;
+		readahead->next_decode++;
+		pthread_mutex_unlock(&readahead->m_slots);
+
+		// decompress slot buffer into the work buffer - the buffers get swapped
+		nffile.buff_pool[0] = slot->buff;
+		nffile.buff_pool[1] = work_buff;
+		nffile.block_header = slot->buff;
+		nffile.buff_ptr 	= (void *)((pointer_addr_t)slot->buff + sizeof(data_block_header_t));
+		ret = UncompressBlock(&nffile);
+		slot->buff = nffile.buff_pool[0];
+		work_buff  = nffile.buff_pool[1];
+
+		pthread_mutex_lock(&readahead->m_slots);
+		slot->ret 	 = ret;
+		slot->status = SLOT_DONE;
+		pthread_cond_broadcast(&readahead->c_slots);
+		pthread_mutex_unlock(&readahead->m_slots);
+	}
+
+	// the buffers got swapped - hand back the current one
+	readahead->work_buff[worker] = work_buff;
+	return NULL;
+
+} // End of ReadAheadWorker
+
+static void StopReadAhead(readahead_t *readahead) {
+int i;
+
+	pthread_mutex_lock(&readahead->m_slots);
+	readahead->terminate = 1;
+	pthread_cond_broadcast(&readahead->c_slots);
+	pthread_mutex_unlock(&readahead->m_slots);
+
+	if ( readahead->reader )
+		pthread_join(readahead->reader, NULL);
+	for ( i=0; i<readahead->num_threads; i++ ) 
+		pthread_join(readahead->worker[i], NULL);
+
+	for ( i=0; i<readahead->num_slots; i++ ) 
+		free(readahead->slot[i].buff);
+	free(readahead->slot);
+	for ( i=0; i<MAXWORKERS; i++ ) 
+		free(readahead->work_buff[i]);
+
+	pthread_mutex_destroy(&readahead->m_slots);
+	pthread_cond_destroy(&readahead->c_slots);
+	free(readahead);
+
+} // End of StopReadAhead
+
+void SetReadAhead(int workers) {
+
+	if ( workers < 0 ) 
+		workers = 0;
+	if ( workers > MAXWORKERS ) {
+		LogError("Number of read ahead workers %d limited to %d\n", workers, MAXWORKERS);
+		workers = MAXWORKERS;
+	}
+	ReadAheadWorkers = workers;
+
+} // End of SetReadAhead
+
+void SetReadMmap(int enable) {
+
+	ReadMmap = enable;
+
+} // End of SetReadMmap
+
+int ReadAheadEnabled(void) {
+	return ReadAheadWorkers > 0;
+} // End of ReadAheadEnabled
+
+int StartReadAhead(nffile_t *nffile) {
+readahead_t *readahead;
+int i, err;
+
+	// stdin is read synchronously
+	if ( ReadAheadWorkers == 0 || nffile->readahead || nffile->fd == STDIN_FILENO || nffile->map ) 
+		return 0;
+
+	readahead = calloc(1, sizeof(readahead_t));
+	if ( !readahead ) {
+		LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+
+	readahead->fd 		   = nffile->fd;
+	readahead->file_header = *(nffile->file_header);
+	readahead->buff_size   = nffile->buff_size;
+	readahead->block_index = nffile->block_index;
+	pthread_mutex_init(&readahead->m_slots, NULL);
+	pthread_cond_init(&readahead->c_slots, NULL);
+
+	// keep the workers busy, while ReadBlock() consumes blocks
+	readahead->num_slots = 2 * ReadAheadWorkers + 2;
+	readahead->slot = calloc(readahead->num_slots, sizeof(block_slot_t));
+	if ( !readahead->slot ) {
+		LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		readahead->num_slots = 0;
+		StopReadAhead(readahead);
+		return 0;
+	}
+	for ( i=0; i<readahead->num_slots; i++ ) {
+		readahead->slot[i].buff = malloc(readahead->buff_size);
+		if ( !readahead->slot[i].buff ) {
+			LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			StopReadAhead(readahead);
+			return 0;
+		}
+	}
+
+	if ( !FILE_IS_NOT_COMPRESSED(nffile) ) {
+		// allocate all worker buffers up front - if that fails, the file is read synchronously
+		for ( i=0; i<ReadAheadWorkers; i++ ) {
+			readahead->work_buff[i] = malloc(readahead->buff_size);
+			if ( !readahead->work_buff[i] ) {
+				LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+				StopReadAhead(readahead);
+				return 0;
+			}
+		}
+		for ( i=0; i<ReadAheadWorkers; i++ ) {
+			err = pthread_create(&readahead->worker[i], NULL, ReadAheadWorker, (void *)readahead);
+			if ( err ) {
+				LogError("pthread_create() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(err) );
+				break;
+			}
+			readahead->num_threads++;
+		}
+		if ( readahead->num_threads == 0 ) {
+			StopReadAhead(readahead);
+			return 0;
+		}
+	}
+
+	err = pthread_create(&readahead->reader, NULL, ReadAheadReader, (void *)readahead);
+	if ( err ) {
+		LogError("pthread_create() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(err) );
+		readahead->reader = 0;
+		StopReadAhead(readahead);
+		return 0;
+	}
+
+	nffile->readahead = readahead;
+	return 1;
+
+} // End of StartReadAhead
+
+static int ReadAheadBlock(nffile_t *nffile) {
+readahead_t  *readahead = nffile->readahead;
+block_slot_t *slot;
+int ret;
+
+	pthread_mutex_lock(&readahead->m_slots);
+	slot = &readahead->slot[readahead->next_consume % readahead->num_slots];
+	while ( slot->status != SLOT_DONE ) 
+		pthread_cond_wait(&readahead->c_slots, &readahead->m_slots);
+
+	ret = slot->ret;
+	if ( ret <= 0 ) {
+		// EOF or error - keep the slot, so any further call returns the same
+		pthread_mutex_unlock(&readahead->m_slots);
+		return ret;
+	}
+
+	// swap buffers - the previous block buffer goes back into the ring
+	void *_tmp = slot->buff;
+	slot->buff = nffile->buff_pool[0];
+	nffile->buff_pool[0] = _tmp;
+	slot->status = SLOT_FREE;
+	readahead->next_consume++;
+	pthread_cond_broadcast(&readahead->c_slots);
+	pthread_mutex_unlock(&readahead->m_slots);
+
+	nffile->block_header = nffile->buff_pool[0];
 	nffile->buff_ptr = (void *)((pointer_addr_t)nffile->block_header + sizeof(data_block_header_t));
-	return read_bytes + nffile->block_header->size;
+
+	return ret;
+
+} // End of ReadAheadBlock
+
+int ReadBlock(nffile_t *nffile) {
+int ret;
+
+	if ( nffile->readahead ) 
+		return ReadAheadBlock(nffile);
+
+	ret = ReadRawBlock(nffile);
+	if ( ret <= 0 ) 
+		return ret;
+
+	ret = UncompressBlock(nffile);
+	nffile->buff_ptr = (void *)((pointer_addr_t)nffile->block_header + sizeof(data_block_header_t));
+	return ret;
 
 } // End of ReadBlock
 
+static void *WriterThread(void *arg) {
+writer_t 	 *writer = (writer_t *)arg;
+block_slot_t *slot;
+nffile_t	 nffile;
+int ret;
+
+	// private file view for the compression functions
+	memset((void *)&nffile, 0, sizeof(nffile));
+	nffile.buff_size = writer->buff_size;
+
+	pthread_mutex_lock(&writer->m_slots);
+	while ( 1 ) {
+		slot = &writer->slot[writer->next_write % writer->num_slots];
+		while ( slot->status != SLOT_FILLED && !writer->terminate ) 
+			pthread_cond_wait(&writer->c_slots, &writer->m_slots);
+
+		// terminate, when all queued blocks are written
+		if ( slot->status != SLOT_FILLED ) 
+			break;
+
+		slot->status = SLOT_BUSY;
+		pthread_mutex_unlock(&writer->m_slots);
+
+		nffile.buff_pool[0] = slot->buff;
+		nffile.buff_pool[1] = writer->work_buff;
+		nffile.block_header = nffile.buff_pool[0];
+
+		ret = 1;
+		errno = 0;
+		// after an error, the remaining blocks are discarded
+		if ( !writer->error ) {
+			if ( writer->block_index ) 
+				AddBlockZone(writer->block_index, nffile.block_header);
+			// column blocks compress each column individually
+			switch (nffile.block_header->id == DATA_BLOCK_TYPE_3 ? NOT_COMPRESSED : writer->compression) {
+				case LZO_COMPRESSED: 
+					ret = Compress_Block_LZO(&nffile, writer->lzo_wrkmem);
+					break;
+				case LZ4_COMPRESSED:
+					ret = Compress_Block_LZ4(&nffile);
+					break;
+				case BZ2_COMPRESSED:
+					ret = Compress_Block_BZ2(&nffile);
+					break;
+			}
+			if ( ret > 0 ) 
+				ret = write(writer->fd, (void *)nffile.block_header, 
+					sizeof(data_block_header_t) + nffile.block_header->size);
+			if ( ret > 0 && writer->block_index ) 
+				writer->block_index->offset += ret;
+		}
+
+		// compression swaps the buffers - both have the full size
+		slot->buff 		  = nffile.buff_pool[0];
+		writer->work_buff = nffile.buff_pool[1];
+
+		pthread_mutex_lock(&writer->m_slots);
+		if ( ret <= 0 && !writer->error ) {
+			writer->error = errno ? errno : EIO;
+			LogError("Async writer failed to write block: %s", strerror(writer->error));
+		}
+		slot->status = SLOT_FREE;
+		writer->next_write++;
+		pthread_cond_broadcast(&writer->c_slots);
+	}
+	pthread_mutex_unlock(&writer->m_slots);
+
+	pthread_exit(NULL);
+
+} // End of WriterThread
+
+static int StartWriter(nffile_t *nffile) {
+writer_t *writer;
+int i, err;
+
+	writer = (writer_t *)calloc(1, sizeof(writer_t));
+	if ( !writer ) {
+		LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+
+	writer->fd			= nffile->fd;
+	writer->compression = FILE_COMPRESSION(nffile);
+	writer->buff_size	= nffile->buff_size;
+	writer->drop		= WriteQueueDrop;
+	writer->num_slots	= WriteQueueBlocks;
+	writer->block_index = nffile->block_index;
+	writer->slot 		= (block_slot_t *)calloc(writer->num_slots, sizeof(block_slot_t));
+	writer->work_buff	= malloc(writer->buff_size);
+	writer->lzo_wrkmem	= malloc(LZO1X_1_MEM_COMPRESS);
+	if ( writer->drop ) 
+		writer->out_counter = (out_counter_t *)calloc(MAX_EXTENSION_MAPS, sizeof(out_counter_t));
+	if ( !writer->slot || !writer->work_buff || !writer->lzo_wrkmem || (writer->drop && !writer->out_counter) ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		free(writer->slot);
+		free(writer->work_buff);
+		free(writer->lzo_wrkmem);
+		free(writer->out_counter);
+		free(writer);
+		return 0;
+	}
+
+	for ( i=0; i<writer->num_slots; i++ ) {
+		writer->slot[i].buff = malloc(writer->buff_size);
+		if ( !writer->slot[i].buff ) {
+			LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			while ( --i >= 0 ) 
+				free(writer->slot[i].buff);
+			free(writer->slot);
+			free(writer->work_buff);
+			free(writer->lzo_wrkmem);
+			free(writer->out_counter);
+			free(writer);
+			return 0;
+		}
+		writer->slot[i].status = SLOT_FREE;
+	}
+
+	pthread_mutex_init(&writer->m_slots, NULL);
+	pthread_cond_init(&writer->c_slots, NULL);
+
+	err = pthread_create(&writer->tid, NULL, WriterThread, (void *)writer);
+	if ( err ) {
+		LogError("pthread_create() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(err) );
+		for ( i=0; i<writer->num_slots; i++ ) 
+			free(writer->slot[i].buff);
+		free(writer->slot);
+		free(writer->work_buff);
+		free(writer->lzo_wrkmem);
+		free(writer->out_counter);
+		free(writer);
+		return 0;
+	}
+
+	nffile->writer = writer;
+	return 1;
+
+} // End of StartWriter
+
+static int StopWriter(writer_t *writer) {
+int i, error;
+
+	pthread_mutex_lock(&writer->m_slots);
+	writer->terminate = 1;
+	pthread_cond_broadcast(&writer->c_slots);
+	pthread_mutex_unlock(&writer->m_slots);
+
+	pthread_join(writer->tid, NULL);
+	error = writer->error;
+
+	pthread_mutex_destroy(&writer->m_slots);
+	pthread_cond_destroy(&writer->c_slots);
+
+	for ( i=0; i<writer->num_slots; i++ ) 
+		free(writer->slot[i].buff);
+	free(writer->slot);
+	free(writer->work_buff);
+	free(writer->lzo_wrkmem);
+	free(writer->out_counter);
+	free(writer);
+
+	if ( error ) {
+		errno = error;
+		return 0;
+	}
+	return 1;
+
+} // End of StopWriter
+
+static void RegisterOutCounter(writer_t *writer, extension_map_t *map) {
+out_counter_t *out_counter;
+uint32_t i, offset, max_ids;
+
+	out_counter = &writer->out_counter[map->map_id & EXTENSION_MAP_MASK];
+	memset((void *)out_counter, 0, sizeof(out_counter_t));
+
+	// out counters follow the required extensions at the offset of the map
+	offset  = 0;
+	max_ids = (map->size - sizeof(extension_map_t) + sizeof(uint16_t)) >> 1;
+	for ( i=0; i<max_ids && map->ex_id[i]; i++ ) {
+		uint16_t id = map->ex_id[i];
+		if ( id > Max_num_extensions ) 
+			return;
+		switch (id) {
+			case EX_OUT_PKG_4:
+			case EX_OUT_PKG_8:
+				out_counter->out_pkts  = offset + 1;
+				out_counter->pkts_size = extension_descriptor[id].size;
+				break;
+			case EX_OUT_BYTES_4:
+			case EX_OUT_BYTES_8:
+				out_counter->out_bytes  = offset + 1;
+				out_counter->bytes_size = extension_descriptor[id].size;
+				break;
+		}
+		offset += extension_descriptor[id].size;
+	}
+
+} // End of RegisterOutCounter
+
+static uint64_t GetCounter(uint32_t *p, int size) {
+value64_t v;
+
+	if ( size == 4 )
+		return p[0];
+
+	v.val.val32[0] = p[0];
+	v.val.val32[1] = p[1];
+	return v.val.val64;
+
+} // End of GetCounter
+
+static void SubtractFlow(writer_t *writer, stat_record_t *stat_record, common_record_t *flow_record) {
+out_counter_t *out_counter;
+uint32_t *p;
+uint8_t	 *ext;
+uint64_t packets, bytes;
+
+	// required extensions: IP addresses, packets and bytes
+	p = flow_record->data;
+	p += (flow_record->flags & FLAG_IPV6_ADDR) ? 8 : 2;
+	packets = GetCounter(p, (flow_record->flags & FLAG_PKG_64) ? 8 : 4);
+	p += (flow_record->flags & FLAG_PKG_64) ? 2 : 1;
+	bytes = GetCounter(p, (flow_record->flags & FLAG_BYTES_64) ? 8 : 4);
+	p += (flow_record->flags & FLAG_BYTES_64) ? 2 : 1;
+
+	ext = (uint8_t *)p;
+	out_counter = &writer->out_counter[flow_record->ext_map & EXTENSION_MAP_MASK];
+	if ( out_counter->out_pkts && 
+		 (ext + out_counter->out_pkts - 1 + out_counter->pkts_size) <= ((uint8_t *)flow_record + flow_record->size) )
+		packets += GetCounter((uint32_t *)(ext + out_counter->out_pkts - 1), out_counter->pkts_size);
+	if ( out_counter->out_bytes && 
+		 (ext + out_counter->out_bytes - 1 + out_counter->bytes_size) <= ((uint8_t *)flow_record + flow_record->size) )
+		bytes += GetCounter((uint32_t *)(ext + out_counter->out_bytes - 1), out_counter->bytes_size);
+
+	switch (flow_record->prot) {
+		case IPPROTO_ICMP:
+		case IPPROTO_ICMPV6:
+			stat_record->numflows_icmp--;
+			stat_record->numpackets_icmp -= packets;
+			stat_record->numbytes_icmp	 -= bytes;
+			break;
+		case IPPROTO_TCP:
+			stat_record->numflows_tcp--;
+			stat_record->numpackets_tcp -= packets;
+			stat_record->numbytes_tcp	-= bytes;
+			break;
+		case IPPROTO_UDP:
+			stat_record->numflows_udp--;
+			stat_record->numpackets_udp -= packets;
+			stat_record->numbytes_udp	-= bytes;
+			break;
+		default:
+			stat_record->numflows_other--;
+			stat_record->numpackets_other -= packets;
+			stat_record->numbytes_other	  -= bytes;
+	}
+	stat_record->numflows--;
+	stat_record->numpackets -= packets;
+	stat_record->numbytes	-= bytes;
+
+} // End of SubtractFlow
+
+/*
+ * Walk the records of the current block. Extension maps are registered for the
+ * stat of dropped flows. If drop is set, the flow records are removed from the block
+ * and subtracted from the stat record. Returns the number of dropped records.
+ */
+static uint32_t ScanBlock(writer_t *writer, nffile_t *nffile, int drop) {
+data_block_header_t *block_header = nffile->block_header;
+record_header_t *record;
+uint8_t		*in, *out, *end;
+uint32_t	i, dropped, NumRecords;
+
+	in  = (uint8_t *)block_header + sizeof(data_block_header_t);
+	out = in;
+	end = in + block_header->size;
+	dropped = NumRecords = 0;
+	for ( i=0; i<block_header->NumRecords; i++ ) {
+		record = (record_header_t *)in;
+		if ( (in + sizeof(record_header_t)) > end || record->size < sizeof(record_header_t) || 
+			 (in + record->size) > end ) {
+			// corrupt block - keep the remaining data as it is
+			if ( drop && out != in ) 
+				memmove(out, in, end - in);
+			out += end - in;
+			NumRecords += block_header->NumRecords - i;
+			break;
+		}
+
+		if ( record->type == ExtensionMapType ) 
+			RegisterOutCounter(writer, (extension_map_t *)record);
+
+		if ( drop && record->type == CommonRecordType && record->size >= COMMON_RECORD_DATA_SIZE ) {
+			if ( nffile->stat_record )
+				SubtractFlow(writer, nffile->stat_record, (common_record_t *)record);
+			dropped++;
+		} else {
+			if ( out != in ) 
+				memmove(out, in, record->size);
+			out += record->size;
+			NumRecords++;
+		}
+		in += record->size;
+	}
+
+	if ( drop ) {
+		block_header->size		 = out - ((uint8_t *)block_header + sizeof(data_block_header_t));
+		block_header->NumRecords = NumRecords;
+		nffile->buff_ptr = (void *)out;
+	}
+
+	return dropped;
+
+} // End of ScanBlock
+
+static int QueueWriteBlock(nffile_t *nffile) {
+writer_t 	 		*writer = nffile->writer;
+block_slot_t 		*slot;
+data_block_header_t *block_header;
+uint32_t			queued;
+uint16_t			id, flags;
+int					ret, scanned;
+
+	ret = sizeof(data_block_header_t) + nffile->block_header->size;
+	scanned = 0;
+
+	pthread_mutex_lock(&writer->m_slots);
+	if ( writer->error ) {
+		pthread_mutex_unlock(&writer->m_slots);
+		errno = writer->error;
+		return -1;
+	}
+
+	slot = &writer->slot[writer->next_fill % writer->num_slots];
+	if ( slot->status != SLOT_FREE ) {
+		// writer falls behind
+		writer->stat.stalls++;
+		if ( writer->drop && nffile->block_header->id == DATA_BLOCK_TYPE_2 ) {
+			uint32_t dropped = ScanBlock(writer, nffile, 1);
+			scanned = 1;
+			if ( dropped ) {
+				writer->stat.dropped_blocks++;
+				writer->stat.dropped_records += dropped;
+			}
+			if ( nffile->block_header->NumRecords == 0 ) {
+				// only flows in this block
+				pthread_mutex_unlock(&writer->m_slots);
+				return ret;
+			}
+			// other records are never dropped - wait and queue them
+		}
+
+		struct timeval tstart, tend;
+		gettimeofday(&tstart, NULL);
+		while ( slot->status != SLOT_FREE ) 
+			pthread_cond_wait(&writer->c_slots, &writer->m_slots);
+		gettimeofday(&tend, NULL);
+		writer->stat.stall_usec += (uint64_t)(tend.tv_sec - tstart.tv_sec) * 1000000LL + (tend.tv_usec - tstart.tv_usec);
+	}
+
+	// register the extension maps of queued blocks for later dropped flows
+	if ( writer->drop && !scanned && nffile->block_header->id == DATA_BLOCK_TYPE_2 ) 
+		ScanBlock(writer, nffile, 0);
+
+	// swap buffers - the writer takes the filled block
+	id	  = nffile->block_header->id;
+	flags = nffile->block_header->flags;
+	block_header = (data_block_header_t *)slot->buff;
+	slot->buff = nffile->buff_pool[0];
+	slot->status = SLOT_FILLED;
+	writer->next_fill++;
+
+	writer->stat.blocks++;
+	queued = writer->next_fill - writer->next_write;
+	if ( queued > writer->stat.max_queued ) 
+		writer->stat.max_queued = queued;
+
+	pthread_cond_broadcast(&writer->c_slots);
+	pthread_mutex_unlock(&writer->m_slots);
+
+	// continue with an empty block
+	nffile->buff_pool[0] = (void *)block_header;
+	nffile->block_header = block_header;
+	block_header->size		 = 0;
+	block_header->NumRecords = 0;
+	block_header->id		 = id;
+	block_header->flags		 = flags;
+	nffile->buff_ptr = (void *)((pointer_addr_t) block_header + sizeof (data_block_header_t));
+	nffile->file_header->NumBlocks++;
+
+	return ret;
+
+} // End of QueueWriteBlock
+
+void SetAsyncWriter(int queue_blocks, int drop) {
+
+	if ( queue_blocks > MAXWRITEQUEUE ) 
+		queue_blocks = MAXWRITEQUEUE;
+	WriteQueueBlocks = queue_blocks > 0 ? queue_blocks : 0;
+	WriteQueueDrop	 = drop;
+
+} // End of SetAsyncWriter
+
+int GetWriterStat(nffile_t *nffile, writer_stat_t *writer_stat) {
+
+	if ( !nffile->writer ) 
+		return 0;
+
+	pthread_mutex_lock(&nffile->writer->m_slots);
+	*writer_stat = nffile->writer->stat;
+	pthread_mutex_unlock(&nffile->writer->m_slots);
+
+	return 1;
+
+} // End of GetWriterStat
+
+nffile_t *OpenBlockBuffer(nffile_t *sink) {
+nffile_t *nffile;
+
+	nffile = NewFile();
+	if ( !nffile )
+		return NULL;
+
+	// no file behind a buffer
+	nffile->fd	 = -1;
+	nffile->sink = sink;
+
+	return nffile;
+
+} // End of OpenBlockBuffer
+
+static int SinkWriteBlock(nffile_t *nffile) {
+nffile_t *sink = nffile->sink;
+data_block_header_t *block_header = nffile->block_header;
+int ret;
+
+	pthread_mutex_lock(&sink_mutex);
+
+	ret = 1;
+	// flush the sink block first, if the records do not fit
+	if ( (sink->block_header->size + block_header->size) > WRITE_BUFFSIZE )
+		ret = WriteBlock(sink);
+
+	if ( ret > 0 ) {
+		memcpy(sink->buff_ptr, (void *)((pointer_addr_t)block_header + sizeof(data_block_header_t)), block_header->size);
+		sink->buff_ptr = (void *)((pointer_addr_t)sink->buff_ptr + block_header->size);
+		sink->block_header->size 	   += block_header->size;
+		sink->block_header->NumRecords += block_header->NumRecords;
+		ret = sizeof(data_block_header_t) + block_header->size;
+	}
+
+	pthread_mutex_unlock(&sink_mutex);
+
+	block_header->size 		 = 0;
+	block_header->NumRecords = 0;
+	nffile->buff_ptr = (void *)((pointer_addr_t)block_header + sizeof(data_block_header_t));
+
+	return ret;
+
+} // End of SinkWriteBlock
+
 int WriteBlock(nffile_t *nffile) {
 int ret, compression;
 
@@ -1147,12 +2323,21 @@ int ret, compression;
 	if ( nffile->block_header->size == 0 )
 		return 1;
 
-	compression = FILE_COMPRESSION(nffile);
+	if ( nffile->writer )
+		return QueueWriteBlock(nffile);
+
+	if ( nffile->sink )
+		return SinkWriteBlock(nffile);
+
+	if ( nffile->block_index ) 
+		AddBlockZone(nffile->block_index, nffile->block_header);
+
+	compression = nffile->block_header->id == DATA_BLOCK_TYPE_3 ? NOT_COMPRESSED : FILE_COMPRESSION(nffile);
 	switch (compression) {
 		case NOT_COMPRESSED:
 			break;
 		case LZO_COMPRESSED: 
-			if ( Compress_Block_LZO(nffile) < 0 ) return -1;
+			if ( Compress_Block_LZO(nffile, wrkmem) < 0 ) return -1;
 			break;
 		case LZ4_COMPRESSED:
 			if ( Compress_Block_LZ4(nffile) < 0 ) return -1;
@@ -1164,6 +2349,8 @@ int ret, compression;
 
 	ret = write(nffile->fd, (void *)nffile->block_header, sizeof(data_block_header_t) + nffile->block_header->size);
 	if (ret > 0) {
+		if ( nffile->block_index ) 
+			nffile->block_index->offset += ret;
 		nffile->block_header->size = 0;
 		nffile->block_header->NumRecords = 0;
 		nffile->buff_ptr = (void *)((pointer_addr_t) nffile->block_header + sizeof (data_block_header_t));
@@ -1174,6 +2361,256 @@ int ret, compression;
 
 } // End of WriteBlock
 
+void SetBlockIndex(int enable) {
+	WriteIndex = enable;
+} // End of SetBlockIndex
+
+void SetZoneFilter(zone_filter_t filter) {
+	ZoneFilter = filter;
+} // End of SetZoneFilter
+
+void SetBlockSelect(block_select_t select) {
+	BlockSelect = select;
+} // End of SetBlockSelect
+
+uint32_t GetZoneSkipped(void) {
+	return ZoneSkipped;
+} // End of GetZoneSkipped
+
+static block_index_t *NewBlockIndex(off_t offset) {
+block_index_t *block_index;
+
+	block_index = (block_index_t *)calloc(1, sizeof(block_index_t));
+	if ( !block_index ) {
+		LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return NULL;
+	}
+	block_index->offset = offset;
+
+	return block_index;
+
+} // End of NewBlockIndex
+
+static void FreeBlockIndex(block_index_t *block_index) {
+
+	if ( !block_index )
+		return;
+	free(block_index->zone);
+	free(block_index->select);
+	free(block_index);
+
+} // End of FreeBlockIndex
+
+static void AddBlockZone(block_index_t *block_index, data_block_header_t *block_header) {
+block_zone_t	*zone;
+common_record_t	*record;
+uint32_t		i, j, sumSize;
+
+	if ( block_index->error )
+		return;
+
+	if ( block_index->NumZones == block_index->MaxZones ) {
+		uint32_t MaxZones = block_index->MaxZones ? 2 * block_index->MaxZones : 64;
+		zone = (block_zone_t *)realloc(block_index->zone, MaxZones * sizeof(block_zone_t));
+		if ( !zone ) {
+			LogError("realloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			block_index->error = 1;
+			return;
+		}
+		block_index->zone	  = zone;
+		block_index->MaxZones = MaxZones;
+	}
+
+	zone = &block_index->zone[block_index->NumZones++];
+	memset((void *)zone, 0, sizeof(block_zone_t));
+	zone->offset	 = block_index->offset;
+	zone->NumRecords = block_header->NumRecords;
+	zone->first_min	 = 0xFFFFFFFF;
+	zone->last_min	 = 0xFFFFFFFF;
+	for ( j=0; j<4; j++ )
+		zone->ip_min[j] = 0xFFFFFFFFFFFFFFFFLL;
+
+	// any other block or record is always read
+	if ( block_header->id != DATA_BLOCK_TYPE_2 )
+		return;
+
+	sumSize = 0;
+	record  = (common_record_t *)((pointer_addr_t)block_header + sizeof(data_block_header_t));
+	for ( i=0; i<block_header->NumRecords; i++ ) {
+		uint64_t ip[4];
+
+		if ( record->type != CommonRecordType || (sumSize + record->size) > block_header->size ||
+			 record->size < (COMMON_RECORD_DATA_SIZE + ((record->flags & FLAG_IPV6_ADDR) ? 32 : 8)) )
+			return;
+
+		// same IP words as in the master record
+		if ( (record->flags & FLAG_IPV6_ADDR) != 0 ) {
+			memcpy((void *)ip, (void *)record->data, 4 * sizeof(uint64_t));
+		} else {
+			ip[0] = 0;
+			ip[1] = record->data[0];
+			ip[2] = 0;
+			ip[3] = record->data[1];
+		}
+		for ( j=0; j<4; j++ ) {
+			if ( ip[j] < zone->ip_min[j] )
+				zone->ip_min[j] = ip[j];
+			if ( ip[j] > zone->ip_max[j] )
+				zone->ip_max[j] = ip[j];
+		}
+
+		if ( record->first < zone->first_min )
+			zone->first_min = record->first;
+		if ( record->first > zone->first_max )
+			zone->first_max = record->first;
+		if ( record->last < zone->last_min )
+			zone->last_min = record->last;
+		if ( record->last > zone->last_max )
+			zone->last_max = record->last;
+
+		zone->proto[record->prot >> 6] |= 1LL << (record->prot & 0x3F);
+		j = ZONE_PORT_BIT(record->srcport);
+		zone->srcport[j >> 6] |= 1LL << (j & 0x3F);
+		j = ZONE_PORT_BIT(record->dstport);
+		zone->dstport[j >> 6] |= 1LL << (j & 0x3F);
+		zone->exporter |= 1LL << (record->exporter_sysid & 0x3F);
+
+		sumSize += record->size;
+		record = (common_record_t *)((pointer_addr_t)record + record->size);
+	}
+	zone->flags = ZONE_VALID;
+
+} // End of AddBlockZone
+
+static int WriteBlockIndex(nffile_t *nffile) {
+block_index_t		*block_index = nffile->block_index;
+data_block_header_t	*block_header;
+block_index_tail_t	*tail;
+size_t				size;
+ssize_t				ret;
+
+	if ( block_index->error || block_index->NumZones != nffile->file_header->NumBlocks )
+		return 0;
+
+	size = sizeof(data_block_header_t) + block_index->NumZones * sizeof(block_zone_t) + sizeof(block_index_tail_t);
+	block_header = (data_block_header_t *)malloc(size);
+	if ( !block_header ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+	block_header->NumRecords = block_index->NumZones;
+	block_header->size		 = size - sizeof(data_block_header_t);
+	block_header->id		 = DATA_BLOCK_TYPE_4;
+	block_header->flags		 = 0;
+	memcpy((void *)((pointer_addr_t)block_header + sizeof(data_block_header_t)), (void *)block_index->zone, 
+		block_index->NumZones * sizeof(block_zone_t));
+	tail = (block_index_tail_t *)((pointer_addr_t)block_header + size - sizeof(block_index_tail_t));
+	tail->magic = INDEX_MAGIC;
+	tail->size	= size;
+
+	ret = write(nffile->fd, (void *)block_header, size);
+	free(block_header);
+	if ( ret != size ) {
+		LogError("write() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+
+	return 1;
+
+} // End of WriteBlockIndex
+
+static block_index_t *ReadBlockIndex(int fd, file_header_t *file_header) {
+block_index_t		*block_index;
+block_index_tail_t	tail;
+data_block_header_t	block_header;
+struct stat			stat_buf;
+off_t				offset;
+size_t				size;
+
+	if ( fstat(fd, &stat_buf) ) 
+		return NULL;
+	if ( stat_buf.st_size < (sizeof(file_header_t) + sizeof(stat_record_t) + sizeof(data_block_header_t) + sizeof(block_index_tail_t)) ) 
+		return NULL;
+
+	if ( pread(fd, (void *)&tail, sizeof(block_index_tail_t), stat_buf.st_size - sizeof(block_index_tail_t)) != sizeof(block_index_tail_t) ) 
+		return NULL;
+
+	size = (size_t)file_header->NumBlocks * sizeof(block_zone_t);
+	if ( tail.magic != INDEX_MAGIC || 
+		 tail.size != (sizeof(data_block_header_t) + size + sizeof(block_index_tail_t)) ||
+		 tail.size > (stat_buf.st_size - sizeof(file_header_t) - sizeof(stat_record_t)) ) {
+		LogError("Corrupt block index - read all blocks\n");
+		return NULL;
+	}
+
+	offset = stat_buf.st_size - tail.size;
+	if ( pread(fd, (void *)&block_header, sizeof(data_block_header_t), offset) != sizeof(data_block_header_t) ||
+		 block_header.id != DATA_BLOCK_TYPE_4 || block_header.NumRecords != file_header->NumBlocks ) {
+		LogError("Corrupt block index - read all blocks\n");
+		return NULL;
+	}
+
+	block_index = NewBlockIndex(offset);
+	if ( !block_index )
+		return NULL;
+
+	block_index->zone = (block_zone_t *)malloc(size ? size : sizeof(block_zone_t));
+	if ( !block_index->zone ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		FreeBlockIndex(block_index);
+		return NULL;
+	}
+	if ( pread(fd, (void *)block_index->zone, size, offset + sizeof(data_block_header_t)) != size ) {
+		LogError("pread() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		FreeBlockIndex(block_index);
+		return NULL;
+	}
+	block_index->NumZones = file_header->NumBlocks;
+	block_index->MaxZones = file_header->NumBlocks;
+
+	return block_index;
+
+} // End of ReadBlockIndex
+
+/*
+ * Blocks appended to an existing file are not indexed.
+ * Remove the index block and the flag from the file.
+ */
+static int TruncateBlockIndex(int fd) {
+file_header_t		file_header;
+block_index_tail_t	tail;
+struct stat			stat_buf;
+
+	if ( pread(fd, (void *)&file_header, sizeof(file_header_t), 0) != sizeof(file_header_t) ) 
+		return 0;
+	if ( (file_header.flags & FLAG_BLOCK_INDEX) == 0 )
+		return 1;
+
+	if ( fstat(fd, &stat_buf) ||
+		 pread(fd, (void *)&tail, sizeof(block_index_tail_t), stat_buf.st_size - sizeof(block_index_tail_t)) != sizeof(block_index_tail_t) ) {
+		LogError("read() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+	if ( tail.magic != INDEX_MAGIC || tail.size > stat_buf.st_size ) {
+		LogError("Corrupt block index in %s line %d\n", __FILE__, __LINE__);
+		return 0;
+	}
+
+	if ( ftruncate(fd, stat_buf.st_size - tail.size) ) {
+		LogError("ftruncate() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+
+	file_header.flags &= ~FLAG_BLOCK_INDEX;
+	if ( pwrite(fd, (void *)&file_header, sizeof(file_header_t), 0) != sizeof(file_header_t) ) {
+		LogError("pwrite() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+
+	return 1;
+
+} // End of TruncateBlockIndex
+
 void ModifyCompressFile(char * rfile, char *Rfile, int compress) {
 int 			i, anonymized, compression;
 ssize_t			ret;
@@ -1270,7 +2707,7 @@ char 			*filename, outfile[MAXPATHLEN];
 void QueryFile(char *filename) {
 int i;
 nffile_t	*nffile;
-uint32_t num_records, type1, type2;
+uint32_t num_records, type1, type2, type3, zones;
 struct stat stat_buf;
 ssize_t	ret;
 off_t	fsize;
@@ -1290,6 +2727,7 @@ off_t	fsize;
 	fsize = lseek(nffile->fd, 0, SEEK_CUR);
 	type1 = 0;
 	type2 = 0;
+	type3 = 0;
 	printf("File    : %s\n", filename);
 	printf ("Version : %u - %s\n", nffile->file_header->version,
 		FILE_IS_LZO_COMPRESSED (nffile) ? "lzo compressed" :
@@ -1329,6 +2767,9 @@ off_t	fsize;
 			case DATA_BLOCK_TYPE_2:
 				type2++;
 				break;
+			case DATA_BLOCK_TYPE_3:
+				type3++;
+				break;
 			default:
 				printf("block %i has unknown type %u\n", i, nffile->block_header->id);
 		}
@@ -1350,13 +2791,28 @@ off_t	fsize;
 		}
 	}
 
+	// block index after the last data block
+	zones = 0;
+	if ( (nffile->file_header->flags & FLAG_BLOCK_INDEX) && (fsize + sizeof(data_block_header_t)) <= stat_buf.st_size ) {
+		ret = read(nffile->fd, (void *)nffile->block_header, sizeof(data_block_header_t));
+		if ( ret == sizeof(data_block_header_t) && nffile->block_header->id == DATA_BLOCK_TYPE_4 ) {
+			zones = nffile->block_header->NumRecords;
+			fsize += sizeof(data_block_header_t) + nffile->block_header->size;
+		} else {
+			LogError("Block index expected but not found\n");
+		}
+	}
+
 	if ( fsize < stat_buf.st_size ) {
 		LogError("Extra data detected after regular blocks: %i bytes\n", stat_buf.st_size-fsize);
 	}
 
 	printf(" Type 1 : %u\n", type1);
 	printf(" Type 2 : %u\n", type2);
+	printf(" Type 3 : %u\n", type3);
 	printf("Records : %u\n", num_records);
+	if ( nffile->file_header->flags & FLAG_BLOCK_INDEX ) 
+		printf("Index   : %u zones\n", zones);
 
 	CloseFile(nffile);
 	DisposeFile(nffile);
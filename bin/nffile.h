@@ -104,6 +104,7 @@ typedef struct file_header_s {
 #define FLAG_UNUSED			0x4		// unused
 #define FLAG_BZ2_COMPRESSED 0x8		// records are BZ2 compressed
 #define FLAG_LZ4_COMPRESSED 0x10	// records are LZ4 compressed
+#define FLAG_BLOCK_INDEX	0x20	// block index after the last data block
 #define COMPRESSION_MASK	0x19	// all compression bits
 // shortcuts
 
@@ -163,6 +164,12 @@ typedef struct stat_record_s {
 // nfdump 1.6.x data block type
 #define DATA_BLOCK_TYPE_2		2
 
+// column block - see nfcolumn.h
+#define DATA_BLOCK_TYPE_3		3
+
+// block index - see below
+#define DATA_BLOCK_TYPE_4		4
+
 /*
  *
  * Block type 2:
@@ -180,6 +187,79 @@ typedef struct data_block_header_s {
 								// 2 - block compressed
 } data_block_header_t;
 
+/*
+ * Block index:
+ * ============
+ * If FLAG_BLOCK_INDEX is set, a block of type 4 follows the last data block. It is not counted
+ * in NumBlocks and holds a zone record for each data block, which summarizes the flow records
+ * in the block. A reader skips the blocks, whose zone cannot match the filter, without reading
+ * or decompressing them. The index block ends with a tail, to find the block from the end of
+ * the file. The index is optional, as readers before the index report the block as corrupt.
+ *
+ *   +-----------+-------------+-------------+-----+-------------+--------------+--------+--------+-----+--------+------+
+ *   |Fileheader | stat record | datablock 1 | ... | datablock n | block header | zone 1 | zone 2 | ... | zone n | tail |
+ *   +-----------+-------------+-------------+-----+-------------+--------------+--------+--------+-----+--------+------+
+ */
+typedef struct block_zone_s {
+	uint64_t	offset;			// file offset of the data block
+	uint32_t	flags;
+#define ZONE_VALID	1			// block holds flow records only - summary is valid
+	uint32_t	NumRecords;
+	uint32_t	first_min;		// time window of the flows
+	uint32_t	first_max;
+	uint32_t	last_min;
+	uint32_t	last_max;
+	uint64_t	ip_min[4];		// range of the master record words OffsetSrcIPv6a .. OffsetDstIPv6b
+	uint64_t	ip_max[4];
+	uint64_t	proto[4];		// protocol bitmap
+	uint64_t	srcport[4];		// port bitmaps - bit ZONE_PORT_BIT(port)
+	uint64_t	dstport[4];
+	uint64_t	exporter;		// exporter sysid bitmap - bit sysid & 0x3F
+} block_zone_t;
+
+#define ZONE_PORT_BIT(p)	(((p) ^ ((p) >> 8)) & 0xFF)
+#define ZONE_TEST_BIT(m, b)	(((m)[(b) >> 6] >> ((b) & 0x3F)) & 1)
+
+typedef struct block_index_tail_s {
+	uint32_t	magic;
+#define INDEX_MAGIC	0xA50C1DE4
+	uint32_t	size;			// size of the index block incl. block header and tail
+} block_index_tail_t;
+
+// reader: returns 0, if no flow of the block zone can match
+typedef int (*zone_filter_t)(block_zone_t *zone);
+
+// reader: returns an array with one byte per data block, 0 if the block cannot match,
+// or NULL, if no selection is available for the file
+typedef uint8_t *(*block_select_t)(char *filename, uint32_t NumBlocks);
+
+struct block_index_s;
+
+/*
+ * block read ahead: number of threads, which read and decompress
+ * data blocks in advance
+ */
+#define MAXWORKERS	64
+
+struct readahead_s;
+
+/*
+ * async block writer: number of data blocks, which may be queued
+ * for compression and writing
+ */
+#define MAXWRITEQUEUE	64
+
+struct writer_s;
+
+typedef struct writer_stat_s {
+	uint32_t	blocks;				// number of blocks queued for writing
+	uint32_t	max_queued;			// max number of blocks waiting in the queue
+	uint32_t	stalls;				// number of times the queue was full
+	uint64_t	stall_usec;			// time waited for a free queue slot
+	uint32_t	dropped_blocks;		// blocks with flows dropped due to a full queue
+	uint64_t	dropped_records;	// flow records dropped
+} writer_stat_t;
+
 /*
  * Generic file handle for reading/writing files
  * if a file is read only writeto and block_header are NULL
@@ -193,6 +273,14 @@ typedef struct nffile_s {
 	void				*buff_ptr;		// pointer into buffer for read/write blocks/records
 	stat_record_t 		*stat_record;	// flow stat record
 	int					fd;				// file descriptor
+	void				*map;			// mmap reader: file mapping - NULL if not active
+	size_t				map_size;		// mmap reader: size of the mapping
+	size_t				map_offset;		// mmap reader: offset of the next block
+	size_t				map_advised;	// mmap reader: end of the read ahead window
+	struct readahead_s	*readahead;		// block prefetch pipeline - NULL if not active
+	struct writer_s		*writer;		// async block writer - NULL if not active
+	struct nffile_s		*sink;			// block buffer: file, which receives the blocks - NULL if not a buffer
+	struct block_index_s *block_index;	// block index - NULL if not available
 } nffile_t;
 
 /* 
@@ -264,8 +352,30 @@ int CloseUpdateFile(nffile_t *nffile, char *ident);
 
 int ReadBlock(nffile_t *nffile);
 
+void SetReadAhead(int workers);
+
+void SetReadMmap(int enable);
+
+int ReadAheadEnabled(void);
+
+int StartReadAhead(nffile_t *nffile);
+
 int WriteBlock(nffile_t *nffile);
 
+void SetAsyncWriter(int queue_blocks, int drop);
+
+nffile_t *OpenBlockBuffer(nffile_t *sink);
+
+void SetBlockIndex(int enable);
+
+void SetZoneFilter(zone_filter_t filter);
+
+void SetBlockSelect(block_select_t select);
+
+uint32_t GetZoneSkipped(void);
+
+int GetWriterStat(nffile_t *nffile, writer_stat_t *writer_stat);
+
 int RenameAppend(char *from, char *to);
 
 void ModifyCompressFile(char * rfile, char *Rfile, int compress);
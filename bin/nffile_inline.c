@@ -71,25 +71,12 @@ static inline void CopyV6IP(uint32_t *dst, uint32_t *src) {
 } // End of CopyV6IP
 
 /*
- * Expand file record into master record for further processing
- * LP64 CPUs need special 32bit operations as it is not guarateed, that 64bit
- * values are aligned 
+ * Expand the common record and the required extensions into the master record
+ * Returns a pointer to the first optional extension
  */
-static inline void ExpandRecord_v2(common_record_t *input_record, extension_info_t *extension_info, exporter_info_record_t *exporter_info, master_record_t *output_record ) {
-extension_map_t *extension_map = extension_info->map;
-uint32_t	i, *u;
-void		*p = (void *)input_record;
-// printf("Byte: %u\n", _b);
-
-#ifdef NSEL
-		// nasty bug work around - compat issues 1.6.10 - 1.6.12 onwards
-		union {
-			uint16_t port[2];
-			uint32_t vrf;
-		} compat_nel_bug;
-		compat_nel_bug.vrf = 0;
-		int compat_nel = 0;
-#endif
+static inline void *ExpandRequired(common_record_t *input_record, extension_map_t *extension_map, exporter_info_record_t *exporter_info, master_record_t *output_record ) {
+uint32_t	*u;
+void		*p;
 
 	// set map ref
 	output_record->map_ref = extension_map;
@@ -101,7 +88,9 @@ void		*p = (void *)input_record;
 	if ( exporter_info ) {
 		uint32_t sysid = exporter_info->sysid;
 		output_record->exporter_sysid = sysid;
-		input_record->exporter_sysid  = sysid;
+		// do not dirty unchanged records - the block may be memory mapped
+		if ( input_record->exporter_sysid != sysid ) 
+			input_record->exporter_sysid = sysid;
 		output_record->exp_ref 		  = exporter_info;
 	} else {
 		output_record->exp_ref 		  = NULL;
@@ -159,6 +148,33 @@ void		*p = (void *)input_record;
 		p = (void *)((pointer_addr_t)p + sizeof(uint32_t));
 	}
 
+	return p;
+
+} // End of ExpandRequired
+
+/*
+ * Expand file record into master record for further processing
+ * LP64 CPUs need special 32bit operations as it is not guarateed, that 64bit
+ * values are aligned 
+ */
+static inline void ExpandRecord_v2(common_record_t *input_record, extension_info_t *extension_info, exporter_info_record_t *exporter_info, master_record_t *output_record ) {
+extension_map_t *extension_map = extension_info->map;
+uint32_t	i;
+void		*p;
+// printf("Byte: %u\n", _b);
+
+#ifdef NSEL
+		// nasty bug work around - compat issues 1.6.10 - 1.6.12 onwards
+		union {
+			uint16_t port[2];
+			uint32_t vrf;
+		} compat_nel_bug;
+		compat_nel_bug.vrf = 0;
+		int compat_nel = 0;
+#endif
+
+	p = ExpandRequired(input_record, extension_map, exporter_info, output_record);
+
 	// preset one single flow
 	output_record->aggr_flows = 1;
 
@@ -454,6 +470,123 @@ void		*p = (void *)input_record;
 	
 } // End of ExpandRecord_v2
 
+/*
+ * Run the ops of an expand plan. p points to the first optional extension
+ */
+static inline void RunExpandPlan(expand_plan_t *plan, uint8_t *p, uint8_t *out) {
+expand_op_t	*op;
+int			n;
+
+	op = plan->op;
+	for ( n = plan->NumGroup[XP_COPY8]; n; n--, op++ ) 
+		memcpy(out + op->dst, p + op->src, 8);
+	for ( n = plan->NumGroup[XP_COPY4]; n; n--, op++ ) 
+		memcpy(out + op->dst, p + op->src, 4);
+	for ( n = plan->NumGroup[XP_COPY2]; n; n--, op++ ) 
+		memcpy(out + op->dst, p + op->src, 2);
+	for ( n = plan->NumGroup[XP_COPYN]; n; n--, op++ ) {
+		int j;
+		for ( j=0; j<op->len; j += 8 ) 
+			memcpy(out + op->dst + j, p + op->src + j, 8);
+	}
+	for ( n = plan->NumGroup[XP_IPV4]; n; n--, op++ ) {
+		ip_addr_t *ip = (ip_addr_t *)(out + op->dst);
+		ip->V6[0] = 0;
+		ip->V6[1] = 0;
+		memcpy(&ip->V4, p + op->src, 4);
+	}
+	for ( n = plan->NumGroup[XP_WIDEN16]; n; n--, op++ ) {
+		uint16_t v;
+		memcpy(&v, p + op->src, sizeof(uint16_t));
+		*((uint32_t *)(out + op->dst)) = v;
+	}
+	for ( n = plan->NumGroup[XP_WIDEN32]; n; n--, op++ ) {
+		uint32_t v;
+		memcpy(&v, p + op->src, sizeof(uint32_t));
+		*((uint64_t *)(out + op->dst)) = v;
+	}
+
+	// remaining rare ops
+	for ( ; op->type != XP_END; op++ ) {
+		uint8_t *dst = out + op->dst;
+		switch (op->type) {
+			case XP_COPY1:
+				*dst = p[op->src];
+				break;
+			case XP_SET8:
+				*dst = op->src;
+				break;
+			case XP_SET32:
+				*((uint32_t *)dst) = op->src;
+				break;
+			case XP_STRING:
+				strncpy((char *)dst, (char *)(p + op->src), op->len);
+				dst[op->len - 1] = '\0';	// safety 0
+				break;
+		}
+	}
+
+} // End of RunExpandPlan
+
+/*
+ * Expand file record into master record, using the precomputed expand plan of the
+ * extension map. Maps without a plan are expanded by ExpandRecord_v2
+ */
+static inline void ExpandRecord_plan(common_record_t *input_record, extension_info_t *extension_info, exporter_info_record_t *exporter_info, master_record_t *output_record ) {
+expand_plan_t	*plan = extension_info->plan;
+uint8_t			*p;
+
+	if ( plan == NULL ) {
+		ExpandRecord_v2(input_record, extension_info, exporter_info, output_record);
+		return;
+	}
+
+	p = (uint8_t *)ExpandRequired(input_record, extension_info->map, exporter_info, output_record);
+	output_record->flags = (output_record->flags & ~plan->clear_flags) | plan->set_flags;
+
+	// preset one single flow
+	output_record->aggr_flows = 1;
+
+	RunExpandPlan(plan, p, (uint8_t *)output_record);
+
+} // End of ExpandRecord_plan
+
+/*
+ * Lazy expansion - expand the common record, the required extensions and the fields
+ * the filter reads. Returns a pointer to the optional extensions, which ExpandRecord_match
+ * needs to expand the remaining fields, or NULL, if the record is fully expanded.
+ */
+static inline void *ExpandRecord_filter(common_record_t *input_record, extension_info_t *extension_info, exporter_info_record_t *exporter_info, master_record_t *output_record ) {
+expand_plan_t	*plan = extension_info->filter_plan;
+uint8_t			*p;
+
+	if ( plan == NULL ) {
+		ExpandRecord_plan(input_record, extension_info, exporter_info, output_record);
+		return NULL;
+	}
+
+	p = (uint8_t *)ExpandRequired(input_record, extension_info->map, exporter_info, output_record);
+	output_record->flags = (output_record->flags & ~plan->clear_flags) | plan->set_flags;
+
+	// preset one single flow
+	output_record->aggr_flows = 1;
+
+	RunExpandPlan(plan, p, (uint8_t *)output_record);
+
+	return (void *)p;
+
+} // End of ExpandRecord_filter
+
+/*
+ * Lazy expansion - expand the remaining fields of a record, which matched the filter
+ */
+static inline void ExpandRecord_match(extension_info_t *extension_info, void *p, master_record_t *output_record ) {
+
+	if ( p ) 
+		RunExpandPlan(extension_info->match_plan, (uint8_t *)p, (uint8_t *)output_record);
+
+} // End of ExpandRecord_match
+
 #ifdef NEED_PACKRECORD
 static void PackRecord(master_record_t *master_record, nffile_t *nffile) {
 extension_map_t *extension_map = master_record->map_ref;
@@ -80,6 +80,8 @@ static void SetBGPNextIPaddress(master_record_t *record, int af,  char *next_ip)
 
 static void UpdateRecord(master_record_t *record);
 
+static void GenPcap(int numflows);
+
 static void SetIPaddress(master_record_t *record, int af,  char *src_ip, char *dst_ip) {
 
 	if ( af == PF_INET6 ) {
@@ -164,16 +166,76 @@ static void UpdateRecord(master_record_t *record) {
 
 } // End of UpdateRecord
 
+/*
+ * write a pcap file to stdout: numflows concurrent UDP flows with 3 packets each.
+ * The packets of all flows are interleaved, so all flows are active at the same time.
+ */
+static void GenPcap(int numflows) {
+struct pcap_file_header_s {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t	 thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+} pcap_header = { 0xa1b2c3d4, 2, 4, 0, 0, 65535, 1 };	// ethernet
+uint32_t pkt_header[4];
+uint8_t	 pkt[14 + 20 + 8 + 10];
+uint64_t usec;
+int i, round;
+
+	if ( fwrite((void *)&pcap_header, sizeof(pcap_header), 1, stdout) != 1 ) {
+		fprintf(stderr, "fwrite() error in %s line %d: %s\n", __FILE__, __LINE__, strerror (errno));
+		exit(255);
+	}
+
+	memset((void *)pkt, 0, sizeof(pkt));
+	memcpy((void *)pkt, "\x00\x11\x22\x33\x44\x55\x66\x77\x88\x99\xaa\xbb\x08\x00", 14);
+	pkt[14] = 0x45;			// IPv4 header
+	pkt[17] = 20 + 8 + 10;	// total length
+	pkt[22] = 64;			// ttl
+	pkt[23] = IPPROTO_UDP;
+	pkt[30] = 192; pkt[31] = 168; pkt[32] = 1; pkt[33] = 1;
+	pkt[36] = 5000 >> 8; pkt[37] = 5000 & 0xFF;	// dst port - no DNS, which is flushed at once
+	pkt[39] = 8 + 10;			// udp length
+
+	for ( round=0; round<3; round++ ) {
+		for ( i=0; i<numflows; i++ ) {
+			// src 10.x.y.z:1024 + (i & 0x7fff)
+			pkt[26] = 10; pkt[27] = (i >> 16) & 0xFF; pkt[28] = (i >> 8) & 0xFF; pkt[29] = i & 0xFF;
+			pkt[34] = (1024 + (i & 0x7fff)) >> 8;
+			pkt[35] = (1024 + (i & 0x7fff)) & 0xFF;
+
+			usec = (uint64_t)(round * numflows + i) * 10;
+			pkt_header[0] = when + usec / 1000000;
+			pkt_header[1] = usec % 1000000;
+			pkt_header[2] = sizeof(pkt);
+			pkt_header[3] = sizeof(pkt);
+			if ( fwrite((void *)pkt_header, sizeof(pkt_header), 1, stdout) != 1 || 
+				 fwrite((void *)pkt, sizeof(pkt), 1, stdout) != 1 ) {
+				fprintf(stderr, "fwrite() error in %s line %d: %s\n", __FILE__, __LINE__, strerror (errno));
+				exit(255);
+			}
+		}
+	}
+
+} // End of GenPcap
+
 int main( int argc, char **argv ) {
 int i, c;
 master_record_t		record;
 nffile_t			*nffile;
 
 	when = ISO2UNIX(strdup("200407111030"));
-	while ((c = getopt(argc, argv, "h")) != EOF) {
+	while ((c = getopt(argc, argv, "hP:")) != EOF) {
 		switch(c) {
 			case 'h':
 				break;
+			case 'P':
+				// pcap test data for nfpcapd
+				GenPcap(atoi(optarg));
+				exit(0);
 			default:
 				fprintf(stderr, "ERROR: Unsupported option: '%c'\n", c);
 				exit(255);
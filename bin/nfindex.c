@@ -0,0 +1,172 @@
+/*
+ *  Copyright (c) 2020, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+/*
+ * nfindex writes the IP index file <file>.ipidx of nfcapd data files.
+ * nfdump uses the index to read only the data blocks, which may hold
+ * the addresses of an ip/host filter.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include "util.h"
+#include "nfdump.h"
+#include "nffile.h"
+#include "nfx.h"
+#include "flist.h"
+#include "ipindex.h"
+
+/* Function Prototypes */
+static void usage(char *name);
+
+static void process_data(int mode, int verify);
+
+/* Functions */
+
+static void usage(char *name) {
+		printf("usage %s [options] \n"
+					"-h\t\tthis text you see right here\n"
+					"-V\t\tPrint version and exit.\n"
+					"-b\t\tWrite a bloom filter index instead of the full address index.\n"
+					"-v\t\tPrint the index of the files instead of writing it.\n"
+					"-r\t\tread input from file\n"
+					"-M <expr>\tRead input from multiple directories.\n"
+					"-R <expr>\tRead input from sequence of files.\n"
+					, name);
+} /* usage */
+
+static void process_data(int mode, int verify) {
+nffile_t	*nffile;
+char		*filename;
+int			cnt;
+
+	// Get the first file handle
+	nffile = GetNextFile(NULL, 0, 0);
+	if ( !nffile ) {
+		LogError("GetNextFile() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return;
+	}
+	if ( nffile == EMPTY_LIST ) {
+		LogError("Empty file list. No files to process\n");
+		return;
+	}
+
+	cnt = 0;
+	while ( nffile != EMPTY_LIST ) {
+		filename = GetCurrentFilename();
+		if ( !filename ) {
+			LogError("Can not index stdin");
+		} else if ( verify ) {
+			PrintIPIndex(nffile, filename);
+		} else {
+			if ( WriteIPIndex(nffile, filename, mode) ) 
+				cnt++;
+		}
+
+		nffile = GetNextFile(nffile, 0, 0);
+		if ( nffile == NULL ) {
+			LogError("Unexpected end of file list\n");
+			return;
+		}
+	}
+
+	if ( !verify ) 
+		printf("Indexed %i files\n", cnt);
+
+} // End of process_data
+
+int main( int argc, char **argv ) {
+char 		*rfile, *Rfile, *Mdirs;
+int			c, mode, verify;
+
+	rfile = Rfile = Mdirs = NULL;
+	mode   = IPINDEX_FULL;
+	verify = 0;
+	while ((c = getopt(argc, argv, "bhr:vM:R:V")) != EOF) {
+		switch (c) {
+			case 'h':
+				usage(argv[0]);
+				exit(0);
+				break;
+			case 'b':
+				mode = IPINDEX_BLOOM;
+				break;
+			case 'v':
+				verify = 1;
+				break;
+			case 'V':
+				printf("%s: Version: %s\n",argv[0], VERSION);
+				exit(0);
+				break;
+			case 'r':
+				rfile = optarg;
+				if ( strcmp(rfile, "-") == 0 ) {
+					fprintf(stderr, "Can not index stdin\n");
+					exit(255);
+				}
+				break;
+			case 'M':
+				Mdirs = optarg;
+				break;
+			case 'R':
+				Rfile = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				exit(0);
+		}
+	}
+
+	if ( !rfile && !Rfile ) {
+		fprintf(stderr, "Expect data file(s) -r or -R\n");
+		exit(255);
+	}
+	if ( rfile && Rfile ) {
+		fprintf(stderr, "-r and -R are mutually exclusive. Please specify either -r or -R\n");
+		exit(255);
+	}
+
+	SetupInputFileSequence(Mdirs, rfile, Rfile);
+
+	process_data(mode, verify);
+
+	return 0;
+}
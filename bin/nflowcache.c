@@ -42,6 +42,9 @@
 #include <time.h>
 #include <string.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
 
 #ifdef HAVE_STDINT_H
 #include <stdint.h>
@@ -66,13 +69,22 @@ static int MemoryHandle_init(MemoryHandle_t *handle);
 
 static inline void *MemoryHandle_get(MemoryHandle_t *handle, uint32_t size);
 
-static inline FlowTableRecord_t *hash_insert_FlowTable(uint32_t index_cache, void *flowkey, common_record_t *flow_record);
+static int Init_Table(hash_FlowTable *table);
+
+static void Dispose_Table(hash_FlowTable *table);
+
+static void Grow_Table(hash_FlowTable *table);
+
+static inline FlowTableRecord_t *hash_find_FlowTable(hash_FlowTable *table, uint32_t hash, void *flowkey);
+
+static inline FlowTableRecord_t *hash_lookup_FlowTable(hash_FlowTable *table, uint32_t *index_cache, void *flowkey);
+
+static inline FlowTableRecord_t *hash_insert_FlowTable(hash_FlowTable *table, uint32_t index_cache, void *flowkey, common_record_t *flow_record);
 
 static inline int TimeMsec_CMP(time_t t1, uint16_t offset1, time_t t2, uint16_t offset2 );
 
-static inline uint32_t SuperFastHash (const char * data, int len);
 
-static inline void New_Hash_Key(void *keymem, master_record_t *flow_record, int swap_flow);
+static inline void New_Hash_Key(hash_FlowTable *table, void *keymem, master_record_t *flow_record, int swap_flow);
 
 /* locals */
 static hash_FlowTable FlowTable;
@@ -174,6 +186,12 @@ static uint32_t	bidir_flows				  = 0;
 enum CNT_IND { FLOWS = 0, INPACKETS, INBYTES, OUTPACKETS, OUTBYTES };
 
 #include "applybits_inline.c"
+#include "hash_inline.c"
+
+// hash function for the flow and stat tables - see hash_inline.c
+static int		HashType   = DEFAULT_HASH;
+static uint64_t	HashSeed   = 0;
+static int		HashSeeded = 0;
 
 /* Functions */
 
@@ -274,31 +292,92 @@ hash_FlowTable *GetFlowTable(void) {
 	return &FlowTable;
 } // End of GetFlowTable
 
-int Init_FlowTable(void) {
+int SetFlowHash(char *name) {
+
+	if ( strcasecmp(name, "sfh") == 0 ) 
+		HashType = HASH_SFH;
+	else if ( strcasecmp(name, "mx64") == 0 )
+		HashType = HASH_MX64;
+	else
+		return 0;
+
+	return 1;
+
+} // End of SetFlowHash
+
+int GetFlowHash(uint64_t *seed) {
+
+	if ( !HashSeeded ) {
+		// random seed for each run - hash collisions can not be forced by crafted flows
+		int fd = open("/dev/urandom", O_RDONLY);
+		if ( fd < 0 || read(fd, (void *)&HashSeed, sizeof(HashSeed)) != sizeof(HashSeed) ) {
+			struct timeval tv;
+			gettimeofday(&tv, NULL);
+			HashSeed = ((uint64_t)tv.tv_sec << 32) ^ ((uint64_t)getpid() << 20) ^ tv.tv_usec;
+		}
+		if ( fd >= 0 ) 
+			close(fd);
+		HashSeeded = 1;
+	}
+
+	*seed = HashSeed;
+	return HashType;
+
+} // End of GetFlowHash
+
+static int Init_Table(hash_FlowTable *table) {
 uint32_t maxindex;
 
-	maxindex = (1 << HashBits);
-	FlowTable.IndexMask   = maxindex -1;
-	FlowTable.NumBits	  = HashBits;
-	FlowTable.NumRecords  = 0;
-	FlowTable.bucket	  = (FlowTableRecord_t **)calloc(maxindex, sizeof(FlowTableRecord_t *));
-	FlowTable.bucketcache = (FlowTableRecord_t **)calloc(maxindex, sizeof(FlowTableRecord_t *));
-	if ( !FlowTable.bucket || !FlowTable.bucketcache ) {
+	maxindex = (1U << FlowTableInitBits);
+	table->IndexMask   = maxindex -1;
+	table->NumBits	   = FlowTableInitBits;
+	table->NumRecords  = 0;
+	table->MaxRecords  = (uint64_t)maxindex * FlowTableMaxLoad / 100;
+	table->first	   = NULL;
+	table->last		   = NULL;
+	table->slot		   = (FlowTableSlot_t *)calloc(maxindex, sizeof(FlowTableSlot_t));
+	if ( !table->slot ) {
 		fprintf(stderr, "malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror (errno));
 		return 0;
 	}
 
-	FlowTable.keysize = aggregate_key_len;
+	table->keysize = aggregate_key_len;
 
 	// keylen = number of uint64_t 
- 	FlowTable.keylen  = aggregate_key_len >> 3;	// aggregate_key_len / 8
+ 	table->keylen  = aggregate_key_len >> 3;	// aggregate_key_len / 8
 	if ( (aggregate_key_len & 0x7 ) != 0 )
-		FlowTable.keylen++;
+		table->keylen++;
+
+	dbg_printf("FlowTable.keysize %i bytes\n", table->keysize);
+	dbg_printf("FlowTable.keylen %i uint64_t\n", table->keylen);
 
-	dbg_printf("FlowTable.keysize %i bytes\n", FlowTable.keysize);
-	dbg_printf("FlowTable.keylen %i uint64_t\n", FlowTable.keylen);
+	table->keymem	   = NULL;
+	table->bidirkeymem = NULL;
+	table->hash_type   = GetFlowHash(&table->hash_seed);
 
-	if ( !MemoryHandle_init(&FlowTable.mem) ) 
+	if ( !MemoryHandle_init(&table->mem) )
+		return 0;
+
+	return 1;
+
+} // End of Init_Table
+
+static void Dispose_Table(hash_FlowTable *table) {
+
+	free((void *)table->slot);
+	MemoryHandle_free(&table->mem);
+	table->NumRecords  	= 0;
+	table->slot 		= NULL;
+	table->first 		= NULL;
+	table->last 		= NULL;
+	table->keymem 		= NULL;
+	table->bidirkeymem	= NULL;
+
+} // End of Dispose_Table
+
+int Init_FlowTable(void) {
+
+	if ( !Init_Table(&FlowTable) )
 		return 0;
 
 	initialised = 1;
@@ -311,94 +390,159 @@ void Dispose_FlowTable(void) {
 
 	if ( !initialised )
 		return;
-	free((void *)FlowTable.bucket);
-	free((void *)FlowTable.bucketcache);
-	MemoryHandle_free(&FlowTable.mem);
-	FlowTable.NumRecords  	= 0;
-	FlowTable.bucket 		= NULL;
-	FlowTable.bucketcache 	= NULL;
+	Dispose_Table(&FlowTable);
 
 } // End of Dispose_FlowTable
 
+hash_FlowTable *New_FlowTable(void) {
+hash_FlowTable *table;
 
-static inline FlowTableRecord_t *hash_lookup_FlowTable(uint32_t *index_cache, void *flowkey, master_record_t *flow_record) {
-uint32_t			index;
-int bsize;
-FlowTableRecord_t	*record;
-
-	*index_cache = SuperFastHash((char *)flowkey, FlowTable.keysize);
-	index = *index_cache & FlowTable.IndexMask;
+	table = (hash_FlowTable *)calloc(1, sizeof(hash_FlowTable));
+	if ( !table ) {
+		fprintf(stderr, "malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror (errno));
+		return NULL;
+	}
 
-	if ( FlowTable.bucket[index] == NULL ) {
-		hash_hit++;
+	if ( !Init_Table(table) ) {
+		free((void *)table);
 		return NULL;
 	}
 
-	record = FlowTable.bucket[index];
+	// inherit the aggregation mask settings of the global table
+	memcpy((void *)table->IPmask, (void *)FlowTable.IPmask, sizeof(FlowTable.IPmask));
+	table->has_masks	 = FlowTable.has_masks;
+	table->apply_netbits = FlowTable.apply_netbits;
 
-	// skip records with different hash value ( full 32bit )
-	while ( record )
-		if ( record->hash != *index_cache ) {
-			hash_skip++;
-			record = record->next;
-		} else
-			break;
+	return table;
+
+} // End of New_FlowTable
+
+static void Grow_Table(hash_FlowTable *table) {
+FlowTableSlot_t	*slot;
+uint32_t		i, index, maxindex, mask;
+
+	if ( table->NumBits >= FlowTableMaxBits ) {
+		fprintf(stderr, "Flow table index exhausted: %u records\n", table->NumRecords);
+		exit(255);
+	}
+
+	maxindex = 1U << (table->NumBits + 1);
+	mask	 = maxindex - 1;
+	slot = (FlowTableSlot_t *)calloc(maxindex, sizeof(FlowTableSlot_t));
+	if ( !slot ) {
+		fprintf(stderr, "malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror (errno));
+		exit(255);
+	}
 
+	// rehash with the hash values stored in the slots - the records are not touched
+	for ( i=0; i<=table->IndexMask; i++ ) {
+		if ( table->slot[i].record == NULL )
+			continue;
+		index = table->slot[i].hash & mask;
+		while ( slot[index].record )
+			index = (index + 1) & mask;
+		slot[index] = table->slot[i];
+	}
+
+	free((void *)table->slot);
+	table->slot		  = slot;
+	table->NumBits++;
+	table->IndexMask  = mask;
+	table->MaxRecords = (uint64_t)maxindex * FlowTableMaxLoad / 100;
+	dbg_printf("Flow table index grown to %u slots\n", maxindex);
+
+} // End of Grow_Table
+
+static inline FlowTableRecord_t *hash_find_FlowTable(hash_FlowTable *table, uint32_t hash, void *flowkey) {
+FlowTableSlot_t		*slot;
+uint32_t			index;
+int bsize;
+
+	index = hash & table->IndexMask;
+
+	// linear probing - the first empty slot terminates the search
 	bsize = 0;
-	while ( record ) {
-		uint64_t	*k1 = (uint64_t *)flowkey;
-		uint64_t	*k2 = (uint64_t *)record->hash_key;
-		int i;
+	while ( (slot = &table->slot[index])->record ) {
+		// skip records with different hash value ( full 32bit )
+		if ( slot->hash != hash ) {
+			hash_skip++;
+		} else {
+			uint64_t	*k1 = (uint64_t *)flowkey;
+			uint64_t	*k2 = (uint64_t *)slot->record->hash_key;
+			int i;
 		
-		// compare key and break as soon as keys do not match
-		i = 0;
-		while ( i < FlowTable.keylen ) {
-			if ( k1[i] == k2[i] )
-				i++;
-			else
-				break;
-		}
-		loopcnt += i;
+			// compare key and break as soon as keys do not match
+			i = 0;
+			while ( i < table->keylen ) {
+				if ( k1[i] == k2[i] )
+					i++;
+				else
+					break;
+			}
+			loopcnt += i;
 
-		if ( i == FlowTable.keylen ) {
-			// hit - record found
+			if ( i == table->keylen ) {
+				// hit - record found
 		
-			// some stats for debugging
-			if ( bsize == 0 )
-				hash_hit++;
-			else
-				hash_miss++;
-			return record;
+				// some stats for debugging
+				if ( bsize == 0 )
+					hash_hit++;
+				else
+					hash_miss++;
+				return slot->record;
+			}
 		}
 
-		record = record->next;
+		index = (index + 1) & table->IndexMask;
 		bsize++;
 	}
+
+	if ( bsize == 0 )
+		hash_hit++;
+
 	return NULL;
 
+} // End of hash_find_FlowTable
+
+static inline FlowTableRecord_t *hash_lookup_FlowTable(hash_FlowTable *table, uint32_t *index_cache, void *flowkey) {
+
+	*index_cache = KeyHash(table->hash_type, table->hash_seed, flowkey, table->keysize);
+	return hash_find_FlowTable(table, *index_cache, flowkey);
+
 } // End of hash_lookup_FlowTable
 
 
-inline static FlowTableRecord_t *hash_insert_FlowTable(uint32_t index_cache, void *flowkey, common_record_t *raw_record) {
+inline static FlowTableRecord_t *hash_insert_FlowTable(hash_FlowTable *table, uint32_t index_cache, void *flowkey, common_record_t *raw_record) {
 FlowTableRecord_t	*record;
-uint32_t index = index_cache & FlowTable.IndexMask;
+uint32_t index;
+
+	if ( table->NumRecords >= table->MaxRecords )
+		Grow_Table(table);
 
 	// allocate enough memory for the new flow including all additional information in FlowTableRecord_t
 	// MemoryHandle_get always succeeds. If no memory, MemoryHandle_get already exists cleanly
-	record = MemoryHandle_get(&FlowTable.mem, sizeof(FlowTableRecord_t) - sizeof(common_record_t) + raw_record->size);
+	record = MemoryHandle_get(&table->mem, sizeof(FlowTableRecord_t) - sizeof(common_record_t) + raw_record->size);
 
 	record->next 	 = NULL;
 	record->hash 	 = index_cache;
 	record->hash_key = flowkey;
 
 	memcpy((void *)&record->flowrecord, (void *)raw_record, raw_record->size);
-	if ( FlowTable.bucket[index] == NULL ) 
-		FlowTable.bucket[index] = record;
+
+	// the record is not in the table - take the next free slot
+	index = index_cache & table->IndexMask;
+	while ( table->slot[index].record )
+		index = (index + 1) & table->IndexMask;
+	table->slot[index].hash	  = index_cache;
+	table->slot[index].record = record;
+
+	if ( table->first == NULL )
+		table->first = record;
 	else 
-		FlowTable.bucketcache[index]->next = record;
+		table->last->next = record;
 
-	FlowTable.bucketcache[index] = record;
-  	FlowTable.NumRecords++;
+	table->last = record;
+  	table->NumRecords++;
 
 	return record;
 
@@ -414,14 +558,17 @@ FlowTableRecord_t	*record;
 	record->next 	 = NULL;
 	record->hash 	 = 0;
 	record->hash_key = NULL;
+	record->seq 	 = 0;
 
 	memcpy((void *)&record->flowrecord, (void *)raw_record, raw_record->size);
-	if ( FlowTable.bucket[0] == NULL ) 
-		FlowTable.bucket[0] = record;
+
+	// records are not aggregated - append them to the record list only
+	if ( FlowTable.first == NULL ) 
+		FlowTable.first = record;
 	else 
-		FlowTable.bucketcache[0]->next = record;
+		FlowTable.last->next = record;
 
-	FlowTable.bucketcache[0] = record;
+	FlowTable.last = record;
 	
 	// safe the extension map and exporter reference
 	record->map_info_ref = extension_info;
@@ -437,26 +584,30 @@ FlowTableRecord_t	*record;
 } // End of InsertFlow
 
 
-
 void AddFlow(common_record_t *raw_record, master_record_t *flow_record, extension_info_t *extension_info ) {
-static void			*keymem = NULL, *bidirkeymem = NULL;
+
+	AddTableFlow(&FlowTable, raw_record, flow_record, extension_info, 0);
+
+} // End of AddFlow
+
+void AddTableFlow(hash_FlowTable *table, common_record_t *raw_record, master_record_t *flow_record,
+	extension_info_t *extension_info, uint64_t seq) {
 FlowTableRecord_t	*FlowTableRecord;
 uint32_t			index_cache; 
 
-	if ( keymem == NULL ) {
-		keymem = MemoryHandle_get(&FlowTable.mem ,FlowTable.keysize );
+	if ( table->keymem == NULL ) {
+		table->keymem = MemoryHandle_get(&table->mem ,table->keysize );
 		// the last aligned word may not be fully used. set it to 0 to guarantee
 		// a proper comarison
 
-		// for 64 bit arch int == 8 bytes otherwise 4
-		((int *)keymem)[FlowTable.keylen-1] = 0;
+		((uint64_t *)table->keymem)[table->keylen-1] = 0;
 
 	}
 
-	New_Hash_Key(keymem, flow_record, 0);
+	New_Hash_Key(table, table->keymem, flow_record, 0);
 
 	// Update netflow statistics
-	FlowTableRecord = hash_lookup_FlowTable(&index_cache, keymem, flow_record);
+	FlowTableRecord = hash_lookup_FlowTable(table, &index_cache, table->keymem);
 	if ( FlowTableRecord ) {
 		// flow record found - best case! update all fields
 		FlowTableRecord->counter[INBYTES]    += flow_record->dOctets;
@@ -480,7 +631,7 @@ uint32_t			index_cache;
 
 	} else if ( !bidir_flows || ( flow_record->prot != IPPROTO_TCP && flow_record->prot != IPPROTO_UDP) ) {
 		// no flow record found and no TCP/UDP bidir flows. Insert flow record into hash
-		FlowTableRecord = hash_insert_FlowTable(index_cache, keymem, raw_record);
+		FlowTableRecord = hash_insert_FlowTable(table, index_cache, table->keymem, raw_record);
 
 		FlowTableRecord->counter[INBYTES]	 = flow_record->dOctets;
 		FlowTableRecord->counter[INPACKETS]  = flow_record->dPkts;
@@ -490,27 +641,27 @@ uint32_t			index_cache;
 
 		FlowTableRecord->map_info_ref  	 	 = extension_info;
 		FlowTableRecord->exp_ref  	 		 = flow_record->exp_ref;
+		FlowTableRecord->seq  	 			 = seq;
 
 		// keymen got part of the cache
-		keymem = NULL;
+		table->keymem = NULL;
 	} else {
 		// for bidir flows do
 		uint32_t	bidir_index_cache; 
 
 		// use tmp memory for bidir hash key to search for bidir flow
 		// we need it only to lookup 
-		if ( bidirkeymem == NULL ) {
-			bidirkeymem = MemoryHandle_get(&FlowTable.mem ,FlowTable.keysize );
+		if ( table->bidirkeymem == NULL ) {
+			table->bidirkeymem = MemoryHandle_get(&table->mem ,table->keysize );
 			// the last aligned word may not be fully used. set it to 0 to guarantee
 			// a proper comarison
 
-			// for 64 bit arch int == 8 bytes otherwise 4
-			((int *)bidirkeymem)[FlowTable.keylen-1] = 0;
+			((uint64_t *)table->bidirkeymem)[table->keylen-1] = 0;
 		}
 
 		// generate the hash key for reverse record (bidir)
-		New_Hash_Key(bidirkeymem, flow_record, 1);
-		FlowTableRecord = hash_lookup_FlowTable(&bidir_index_cache, bidirkeymem, flow_record);
+		New_Hash_Key(table, table->bidirkeymem, flow_record, 1);
+		FlowTableRecord = hash_lookup_FlowTable(table, &bidir_index_cache, table->bidirkeymem);
 		if ( FlowTableRecord ) {
 			// we found a corresponding flow - so update all fields in reverse direction
 			FlowTableRecord->counter[OUTBYTES]   += flow_record->dOctets;
@@ -534,7 +685,7 @@ uint32_t			index_cache;
 		} else {
 			// no bidir flow found 
 			// insert original flow into the cache
-			FlowTableRecord = hash_insert_FlowTable(index_cache, keymem, raw_record);
+			FlowTableRecord = hash_insert_FlowTable(table, index_cache, table->keymem, raw_record);
 	
 			FlowTableRecord->counter[INBYTES]	 = flow_record->dOctets;
 			FlowTableRecord->counter[INPACKETS]  = flow_record->dPkts;
@@ -543,70 +694,100 @@ uint32_t			index_cache;
 			FlowTableRecord->counter[FLOWS]   	 = flow_record->aggr_flows ? flow_record->aggr_flows : 1;
 			FlowTableRecord->map_info_ref  	 	 = extension_info;
 			FlowTableRecord->exp_ref  	 		 = flow_record->exp_ref;
+			FlowTableRecord->seq  	 			 = seq;
 
-			keymem = NULL;
+			table->keymem = NULL;
 		}
 
 	} 
 
-} // End of AddFlow
+} // End of AddTableFlow
 
+static int FlowSeqCMP(const void *p1, const void *p2) {
+FlowTableRecord_t *r1 = *((FlowTableRecord_t **)p1);
+FlowTableRecord_t *r2 = *((FlowTableRecord_t **)p2);
 
-#undef get16bits
-#if (defined(__GNUC__) && defined(__i386__)) || defined(__WATCOMC__) \
-  || defined(_MSC_VER) || defined (__BORLANDC__) || defined (__TURBOC__)
-#define get16bits(d) (*((const uint16_t *) (d)))
-#endif
+	if ( r1->seq < r2->seq )
+		return -1;
+	if ( r1->seq > r2->seq )
+		return 1;
+	return 0;
 
-#if !defined (get16bits)
-#define get16bits(d) ((((uint32_t)(((const uint8_t *)(d))[1])) << 8)\
-					   +(uint32_t)(((const uint8_t *)(d))[0]) )
-#endif
+} // End of FlowSeqCMP
 
-static inline uint32_t SuperFastHash (const char * data, int len) {
-uint32_t hash = len, tmp;
-int rem;
+void MergeFlowTables(hash_FlowTable **tables, int numTables) {
+FlowTableRecord_t	**list, *r, *FlowTableRecord;
+uint32_t			i, num;
+int					j;
 
-	if (len <= 0 || data == NULL) return 0;
+	num = 0;
+	for ( j=0; j<numTables; j++ )
+		num += tables[j]->NumRecords;
 
-	rem = len & 3;
-	len >>= 2;
+	list = num ? (FlowTableRecord_t **)malloc(num * sizeof(FlowTableRecord_t *)) : NULL;
+	if ( num && !list ) {
+		fprintf(stderr, "malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror (errno));
+		exit(255);
+	}
 
-	/* Main loop */
-	for (;len > 0; len--) {
-		hash  += get16bits (data);
-		tmp	= (get16bits (data+2) << 11) ^ hash;
-		hash   = (hash << 16) ^ tmp;
-		data  += 2*sizeof (uint16_t);
-		hash  += hash >> 11;
+	num = 0;
+	for ( j=0; j<numTables; j++ ) {
+		r = tables[j]->first;
+		while ( r ) {
+			list[num++] = r;
+			r = r->next;
+		}
 	}
 
-	/* Handle end cases */
-	switch (rem) {
-		case 3: hash += get16bits (data);
-				hash ^= hash << 16;
-				hash ^= data[sizeof (uint16_t)] << 18;
-				hash += hash >> 11;
-				break;
-		case 2: hash += get16bits (data);
-				hash ^= hash << 11;
-				hash += hash >> 17;
-				break;
-		case 1: hash += *data;
-				hash ^= hash << 10;
-				hash += hash >> 1;
+	// insert the records in the order they were first seen, so the global table
+	// ends up exactly the same as if all records were added sequentially
+	if ( num > 1 )
+		qsort((void *)list, num, sizeof(FlowTableRecord_t *), FlowSeqCMP);
+
+	for ( i=0; i<num; i++ ) {
+		r = list[i];
+		FlowTableRecord = hash_find_FlowTable(&FlowTable, r->hash, r->hash_key);
+		if ( FlowTableRecord ) {
+			FlowTableRecord->counter[INBYTES]    += r->counter[INBYTES];
+			FlowTableRecord->counter[INPACKETS]  += r->counter[INPACKETS];
+			FlowTableRecord->counter[OUTBYTES]   += r->counter[OUTBYTES];
+			FlowTableRecord->counter[OUTPACKETS] += r->counter[OUTPACKETS];
+			FlowTableRecord->counter[FLOWS]      += r->counter[FLOWS];
+
+			if ( TimeMsec_CMP(r->flowrecord.first, r->flowrecord.msec_first,
+					FlowTableRecord->flowrecord.first, FlowTableRecord->flowrecord.msec_first) == 2) {
+				FlowTableRecord->flowrecord.first = r->flowrecord.first;
+				FlowTableRecord->flowrecord.msec_first = r->flowrecord.msec_first;
+			}
+			if ( TimeMsec_CMP(r->flowrecord.last, r->flowrecord.msec_last,
+					FlowTableRecord->flowrecord.last, FlowTableRecord->flowrecord.msec_last) == 1) {
+				FlowTableRecord->flowrecord.last = r->flowrecord.last;
+				FlowTableRecord->flowrecord.msec_last = r->flowrecord.msec_last;
+			}
+			FlowTableRecord->flowrecord.tcp_flags |= r->flowrecord.tcp_flags;
+		} else {
+			void *keymem = MemoryHandle_get(&FlowTable.mem, FlowTable.keysize);
+			memcpy(keymem, r->hash_key, FlowTable.keylen * sizeof(uint64_t));
+
+			FlowTableRecord = hash_insert_FlowTable(&FlowTable, r->hash, keymem, &r->flowrecord);
+			memcpy((void *)FlowTableRecord->counter, (void *)r->counter, sizeof(r->counter));
+			FlowTableRecord->map_info_ref = r->map_info_ref;
+			FlowTableRecord->exp_ref	  = r->exp_ref;
+			FlowTableRecord->seq		  = r->seq;
+		}
+	}
+
+	if ( list )
+		free((void *)list);
+
+	for ( j=0; j<numTables; j++ ) {
+		Dispose_Table(tables[j]);
+		free((void *)tables[j]);
+		tables[j] = NULL;
 	}
 
-	/* Force "avalanching" of final 127 bits */
-	hash ^= hash << 3;
-	hash += hash >> 5;
-	hash ^= hash << 4;
-	hash += hash >> 17;
-	hash ^= hash << 25;
-	hash += hash >> 6;
+} // End of MergeFlowTables
 
-	return hash;
-}
 
 int SetBidirAggregation(void) {
 	
@@ -863,13 +1044,13 @@ master_record_t *aggr_record_mask;
 
 } // End of GetMasterAggregateMask
 
-static inline void New_Hash_Key(void *keymem, master_record_t *flow_record, int swap_flow) {
+static inline void New_Hash_Key(hash_FlowTable *table, void *keymem, master_record_t *flow_record, int swap_flow) {
 uint64_t *record = (uint64_t *)flow_record;
 Default_key_t *keyptr;
 
 	// apply src/dst mask bits if requested
-	if ( FlowTable.apply_netbits ) {
-		ApplyNetMaskBits(flow_record, FlowTable.apply_netbits);
+	if ( table->apply_netbits ) {
+		ApplyNetMaskBits(flow_record, table->apply_netbits);
 	}
 
 	if ( aggregate_stack ) {
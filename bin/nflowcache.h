@@ -54,7 +54,7 @@
 
 /* Element of the Flow Table ( cache ) */
 typedef struct FlowTableRecord {
-	// record chain - points to next record with same hash in case of a hash collision
+	// record chain - points to the next record in insertion order
 	struct FlowTableRecord *next;	
 
 	// Hash papameters
@@ -64,6 +64,9 @@ typedef struct FlowTableRecord {
 	// flow counter parameters for FLOWS, INPACKETS, INBYTES, OUTPACKETS, OUTBYTES
 	uint64_t	counter[5];
 
+	// sequence number of the first record of this flow - used to merge thread local tables
+	uint64_t	seq;
+
 	extension_info_t	   *map_info_ref;
 	exporter_info_record_t *exp_ref;
 	// flow record follows
@@ -105,25 +108,51 @@ typedef struct MemoryHandle_s {
 // typically 20 - tradeoff memory/speed
 #define HashBits 20
 
+// number of bits of the initial flow table index. The index grows automatically
+// by doubling its size, whenever it gets filled more than FlowTableMaxLoad percent
+// Max size: 1 << FlowTableMaxBits slots
+#define FlowTableInitBits	16
+#define FlowTableMaxBits	31
+#define FlowTableMaxLoad	50
+
 // Each pre-allocated memory block is 10M
 #define MemBlockSize 10*1024*1024
 #define MaxMemBlocks	256
 
 
+/* 
+ * Slot of the open addressing flow table index. The full hash is kept in the slot,
+ * so collisions are resolved without touching the record in most cases.
+ */
+typedef struct FlowTableSlot_s {
+	uint32_t			hash;			/* full 32bit hash value of the record */
+	FlowTableRecord_t	*record;		/* NULL: empty slot */
+} FlowTableSlot_t;
+
 typedef struct hash_FlowTable {
-	/* hash table data */
-	uint16_t 			NumBits;		/* width of the hash table */
+	/* hash table data - open addressing with linear probing */
+	uint16_t 			NumBits;		/* width of the hash table index */
 	uint32_t			IndexMask;		/* Mask which corresponds to NumBits */
 	uint32_t			NumRecords;		/* number of records in table */
-	FlowTableRecord_t 	**bucket;		/* Hash entry point: points to elements in the flow block */
-	FlowTableRecord_t 	**bucketcache;	/* in case of index collisions, this array points to the last element with that index */
+	uint32_t			MaxRecords;		/* grow the index, when NumRecords reaches this limit */
+	FlowTableSlot_t		*slot;			/* index: 1 << NumBits slots */
+
+	/* all records in insertion order */
+	FlowTableRecord_t 	*first;
+	FlowTableRecord_t 	*last;
 
-	uint32_t			keylen;			/* key length of hash key as number of 4byte ints */
+	uint32_t			keylen;			/* key length of hash key as number of 8byte uint64_t */
 	uint32_t			keysize;		/* size of key in bytes */
+	int					hash_type;		/* hash function and seed - see hash_inline.c */
+	uint64_t			hash_seed;
 
 	/* use a MemoryHandle for the table */
 	MemoryHandle_t		mem;
 
+	/* key buffers for the next lookup - become part of the table on insert */
+	void				*keymem;
+	void				*bidirkeymem;
+
 	/* src/dst IP aggr masks - use to properly maks the IP before printing */
 	uint64_t			IPmask[4];		// 0-1 srcIP, 2-3 dstIP
 	int					has_masks;
@@ -133,10 +162,18 @@ typedef struct hash_FlowTable {
 
 hash_FlowTable *GetFlowTable(void);
 
+int SetFlowHash(char *name);
+
+int GetFlowHash(uint64_t *seed);
+
 int Init_FlowTable(void);
 
 void Dispose_FlowTable(void);
 
+hash_FlowTable *New_FlowTable(void);
+
+void MergeFlowTables(hash_FlowTable **tables, int numTables);
+
 char *VerifyStat(uint16_t Aggregate_Bits);
 
 int SetStat(char *str, int *element_stat, int *flow_stat);
@@ -145,6 +182,9 @@ void InsertFlow(common_record_t *raw_record, master_record_t *flow_record, exten
 
 void AddFlow(common_record_t *raw_record, master_record_t *flow_record, extension_info_t *extension_info );
 
+void AddTableFlow(hash_FlowTable *table, common_record_t *raw_record, master_record_t *flow_record, 
+	extension_info_t *extension_info, uint64_t seq);
+
 int SetBidirAggregation( void );
 
 int ParseAggregateMask( char *arg, char **aggr_fmt  );
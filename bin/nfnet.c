@@ -31,8 +31,12 @@
 
 #include "config.h"
 
+// for recvmmsg/sendmmsg prototypes
+#define _GNU_SOURCE
+
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netdb.h>
 #include <stdio.h>
 #include <errno.h>
@@ -61,7 +65,7 @@ static int joinGroup(int sockfd, int loopBack, int mcastTTL, struct sockaddr_sto
 
 /* function definitions */
 
-int Unicast_receive_socket(const char *bindhost, const char *listenport, int family, int sockbuflen ) {
+int Unicast_receive_socket(const char *bindhost, const char *listenport, int family, int sockbuflen, int reuseport ) {
 struct addrinfo hints, *res, *ressave;
 socklen_t   	optlen;
 int 			error, p, sockfd;
@@ -114,6 +118,14 @@ int 			error, p, sockfd;
         if ( !( sockfd < 0 ) ) {
 			// socket call was successfull
 
+#ifdef SO_REUSEPORT
+			// multiple receivers share the port - the kernel distributes the packets by sender
+			if ( reuseport ) {
+				int on = 1;
+				if ( setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0 ) 
+					LogError("setsockopt(SO_REUSEPORT): %s", strerror(errno));
+			}
+#endif
             if (bind(sockfd, res->ai_addr, res->ai_addrlen) == 0) {
 				if ( res->ai_family == AF_INET ) 
         			LogInfo("Bound to IPv4 host/IP: %s, Port: %s", 
@@ -495,4 +507,167 @@ int ret;
 	return ret;
 } /* End of isMulticast */
 
+packet_batch_t *NewPacketBatch(int max_packets, size_t buff_size) {
+packet_batch_t *batch;
+int i;
+
+	batch = (packet_batch_t *)calloc(1, sizeof(packet_batch_t));
+	if ( !batch ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return NULL;
+	}
+
+#if !defined(HAVE_RECVMMSG)
+	// one packet per recvfrom() call
+	max_packets = 1;
+#endif
+	batch->max_packets = max_packets;
+	batch->buff_size   = buff_size;
+	batch->packet   = (packet_t *)calloc(max_packets, sizeof(packet_t));
+	batch->recv_iov = (struct iovec *)calloc(max_packets, sizeof(struct iovec));
+	batch->send_iov = (struct iovec *)calloc(max_packets, sizeof(struct iovec));
+	if ( !batch->packet || !batch->recv_iov || !batch->send_iov ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		FreePacketBatch(batch);
+		return NULL;
+	}
+
+	for ( i=0; i<max_packets; i++ ) {
+		batch->packet[i].buff = malloc(buff_size);
+		if ( !batch->packet[i].buff ) {
+			LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			FreePacketBatch(batch);
+			return NULL;
+		}
+		batch->recv_iov[i].iov_base = batch->packet[i].buff;
+		batch->recv_iov[i].iov_len  = buff_size;
+		batch->send_iov[i].iov_base = batch->packet[i].buff;
+	}
+
+#ifdef HAVE_RECVMMSG
+	batch->recv_msg = (struct mmsghdr *)calloc(max_packets, sizeof(struct mmsghdr));
+	if ( !batch->recv_msg ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		FreePacketBatch(batch);
+		return NULL;
+	}
+	for ( i=0; i<max_packets; i++ ) {
+		batch->recv_msg[i].msg_hdr.msg_name	   = &batch->packet[i].sender;
+		batch->recv_msg[i].msg_hdr.msg_iov	   = &batch->recv_iov[i];
+		batch->recv_msg[i].msg_hdr.msg_iovlen  = 1;
+	}
+#endif
+
+#ifdef HAVE_SENDMMSG
+	batch->send_msg = (struct mmsghdr *)calloc(max_packets, sizeof(struct mmsghdr));
+	if ( !batch->send_msg ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		FreePacketBatch(batch);
+		return NULL;
+	}
+	for ( i=0; i<max_packets; i++ ) {
+		batch->send_msg[i].msg_hdr.msg_iov	  = &batch->send_iov[i];
+		batch->send_msg[i].msg_hdr.msg_iovlen = 1;
+	}
+#endif
+
+	return batch;
+
+} // End of NewPacketBatch
+
+void FreePacketBatch(packet_batch_t *batch) {
+int i;
+
+	if ( !batch ) 
+		return;
+
+	if ( batch->packet ) {
+		for ( i=0; i<batch->max_packets; i++ ) 
+			free(batch->packet[i].buff);
+	}
+	free(batch->packet);
+	free(batch->recv_iov);
+	free(batch->send_iov);
+	free(batch->recv_msg);
+	free(batch->send_msg);
+	free(batch);
+
+} // End of FreePacketBatch
+
+/*
+ * Receive the next batch of packets. Blocks until at least one packet is available,
+ * and returns the number of packets, or -1 on error, such as EINTR.
+ */
+int ReceiveBatch(int sockfd, packet_batch_t *batch) {
+#ifdef HAVE_RECVMMSG
+int i, num;
+
+	for ( i=0; i<batch->max_packets; i++ ) 
+		batch->recv_msg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+
+	num = recvmmsg(sockfd, batch->recv_msg, batch->max_packets, MSG_WAITFORONE, NULL);
+	if ( num < 0 ) {
+		batch->num_packets = 0;
+		return -1;
+	}
+
+	for ( i=0; i<num; i++ ) {
+		batch->packet[i].len		 = batch->recv_msg[i].msg_len;
+		batch->packet[i].sender_size = batch->recv_msg[i].msg_hdr.msg_namelen;
+	}
+	batch->num_packets = num;
+	return num;
+#else
+ssize_t	cnt;
+
+	batch->packet[0].sender_size = sizeof(struct sockaddr_storage);
+	cnt = recvfrom(sockfd, batch->packet[0].buff, batch->buff_size, 0, 
+		(struct sockaddr *)&batch->packet[0].sender, &batch->packet[0].sender_size);
+	if ( cnt < 0 ) {
+		batch->num_packets = 0;
+		return -1;
+	}
+	batch->packet[0].len = cnt;
+	batch->num_packets	 = 1;
+	return 1;
+#endif
+
+} // End of ReceiveBatch
+
+/*
+ * Send all packets of the last batch to each repeater
+ */
+void RepeatBatch(packet_batch_t *batch, repeater_t *repeater) {
+int i, j;
+
+	for ( i=0; i<MAX_REPEATERS && repeater[i].hostname; i++ ) {
+#ifdef HAVE_SENDMMSG
+		int sent = 0;
+		for ( j=0; j<batch->num_packets; j++ ) {
+			batch->send_iov[j].iov_len = batch->packet[j].len;
+			batch->send_msg[j].msg_hdr.msg_name	   = &repeater[i].addr;
+			batch->send_msg[j].msg_hdr.msg_namelen = repeater[i].addrlen;
+		}
+		while ( sent < batch->num_packets ) {
+			int num = sendmmsg(repeater[i].sockfd, &batch->send_msg[sent], batch->num_packets - sent, 0);
+			if ( num < 0 ) {
+				if ( errno == EINTR ) 
+					continue;
+				LogError("ERROR: sendmmsg(): %s", strerror(errno));
+				break;
+			}
+			sent += num;
+		}
+#else
+		for ( j=0; j<batch->num_packets; j++ ) {
+			ssize_t len;
+			len = sendto(repeater[i].sockfd, batch->packet[j].buff, batch->packet[j].len, 0, 
+					(struct sockaddr *)&(repeater[i].addr), repeater[i].addrlen);
+			if ( len < 0 ) {
+				LogError("ERROR: sendto(): %s", strerror(errno));
+			}
+		}
+#endif
+	}
 
+} // End of RepeatBatch
@@ -68,9 +68,33 @@ typedef struct repeater_s {
 
 #define MAX_REPEATERS 8
 
+/*
+ * batched receive: a ring of packet buffers, filled by a single recvmmsg() call
+ * if available, otherwise by recvfrom() with one packet per call.
+ */
+#define PACKET_BATCH 32
+
+typedef struct packet_s {
+	void					*buff;
+	ssize_t					len;
+	struct sockaddr_storage	sender;
+	socklen_t				sender_size;
+} packet_t;
+
+typedef struct packet_batch_s {
+	int				max_packets;
+	int				num_packets;	// packets received by the last call
+	size_t			buff_size;		// size of each packet buffer
+	packet_t		*packet;
+	struct mmsghdr	*recv_msg;		// recvmmsg() headers - NULL if not available
+	struct mmsghdr	*send_msg;		// sendmmsg() headers - NULL if not available
+	struct iovec	*recv_iov;
+	struct iovec	*send_iov;
+} packet_batch_t;
+
 /* Function prototypes */
 
-int Unicast_receive_socket(const char *bindhost, const char *listenport, int family, int sockbuflen );
+int Unicast_receive_socket(const char *bindhost, const char *listenport, int family, int sockbuflen, int reuseport );
 
 int Multicast_receive_socket (const char *hostname, const char *listenport, int family, int sockbuflen);
 
@@ -80,4 +104,12 @@ int Unicast_send_socket (const char *hostname, const char *listenport, int famil
 int Multicast_send_socket (const char *hostname, const char *listenport, int family, 
 		unsigned int wmem_size, struct sockaddr_storage *addr, int *addrlen);
 
+packet_batch_t *NewPacketBatch(int max_packets, size_t buff_size);
+
+void FreePacketBatch(packet_batch_t *batch);
+
+int ReceiveBatch(int sockfd, packet_batch_t *batch);
+
+void RepeatBatch(packet_batch_t *batch, repeater_t *repeater);
+
 #endif //_NFNET_H
@@ -69,6 +69,9 @@
 #include <netinet/ip_icmp.h>
 #include <arpa/inet.h>
 
+#ifdef HAVE_LINUX_IF_PACKET_H
+#include <linux/if_packet.h>
+#endif
 
 #ifdef HAVE_NET_BPF_H
 # include <net/bpf.h>
@@ -97,6 +100,7 @@
 #include "flowtree.h"
 #include "netflow_pcap.h"
 #include "pcaproc.h"
+#include "packet_ring.h"
 
 #define TIME_WINDOW     300
 #define PROMISC         1
@@ -110,6 +114,8 @@
 
 #define EXPIREINTERVALL 10
 
+#define MAXFLOWTHREADS 16
+
 int verbose = 0;
 
 /*
@@ -124,6 +130,9 @@ static pthread_mutex_t  m_done  = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t terminate = PTHREAD_COND_INITIALIZER;
 static pthread_key_t buffer_key;
 
+// read live packets from a TPACKET_V3 ring, if available
+static int use_packet_ring = 1;
+
 uint32_t linktype;
 uint32_t linkoffset;
 
@@ -161,7 +170,7 @@ typedef struct p_packet_thread_args_s {
 	pthread_t parent;
 
 	// arguments
-	NodeList_t *NodeList;		// push new nodes into this list
+	FlowDispatch_t *dispatch;	// push new nodes to the flow threads
 	pcap_dev_t *pcap_dev; 
 	time_t	t_win;
 	int		subdir_index;
@@ -180,14 +189,33 @@ typedef struct p_flow_thread_args_s {
 
 	// arguments
 	NodeList_t *NodeList;		// pop new nodes from this list
-	FlowSource_t *fs;
+	FlowDispatch_t *dispatch;
+	FlowSource_t *fs;			// flow source of this worker
+	FlowSource_t *master;		// flow source, which owns the file
 	time_t	t_win;
 	char	*time_extension;
 	int		subdir_index;
 	int		compress;
 	int		live;
+	int		numWorkers;
 } p_flow_thread_args_t;
 
+/*
+ * flow workers
+ * Each flow thread processes its slice of the flows in its own flow table and collects 
+ * the records in its own block buffer. At the end of a time window, the workers flush 
+ * their buffers into the file of the master flow source and add their stats. The last
+ * worker to arrive rotates the file, while the others wait.
+ */
+static struct flow_ctl_s {
+	pthread_mutex_t mutex;
+	pthread_cond_t	cond;
+	uint32_t	synced;		// workers arrived in this rotation
+	uint32_t	rotated;	// rotation counter
+	uint32_t	NumFlows;	// flows left in all flow tables
+	int			failed;
+} flow_ctl = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0, 0 };
+
 /*
  * Function prototypes
  */
@@ -203,6 +231,10 @@ static pcap_dev_t *setup_pcap_live(char *device, char *filter, int snaplen);
 
 static pcap_dev_t *setup_pcap_Ffile(FILE *fp, char *filter, int snaplen);
 
+#ifdef PACKET_FANOUT
+static int JoinFanoutGroup(pcap_dev_t *pcap_dev, int group);
+#endif
+
 static pcap_dev_t *setup_pcap_file(char *pcap_file, char *filter, int snaplen);
 
 static void WaitDone(void);
@@ -211,6 +243,14 @@ static void SignalThreadTerminate(thread_info_t *thread_info, pthread_cond_t *th
 
 static void *p_pcap_flush_thread(void *thread_data);
 
+static int RotateFlowFile(p_flow_thread_args_t *args, FlowSource_t *fs, time_t t_start, uint32_t NumFlows, int done);
+
+static int SyncFlowWorker(p_flow_thread_args_t *args, FlowSource_t *fs, time_t t_start, uint32_t NumFlows, int done);
+
+static int RotateFlowWorker(p_flow_thread_args_t *args, time_t t_start, time_t t_clock, int done);
+
+static FlowSource_t *CopyFlowSource(FlowSource_t *fs, int worker, int numWorkers);
+
 static void *p_flow_thread(void *thread_data);
 
 static void *p_packet_thread(void *thread_data);
@@ -225,8 +265,10 @@ static void usage(char *name) {
 					"-u userid\tChange user to username\n"
 					"-g groupid\tChange group to groupname\n"
 					"-i interface\tread packets from interface\n"
+					"-L\t\tread packets from interface with libpcap instead of a packet ring\n"
 					"-r pcapfile\tread packets from file\n"
-					"-B num\tset the node cache size. (default 524288)\n"
+					"-B num\tset the maximum node cache size. (default 524288)\n"
+					"-c num\tprocess flows with num threads. (default 1)\n"
 					"-s snaplen\tset the snapshot length - default 1526\n"
 					"-e active,inactive\tset the active,inactive flow expire time (s) - default 300,60\n"
 					"-l flowdir \tset the flow output directory. (no default) \n"
@@ -238,6 +280,7 @@ static void usage(char *name) {
 					"-z\t\tLZO compress flows in output file.\n"
 					"-y\t\tLZ4 compress flows in output file.\n"
 					"-j\t\tBZ2 compress flows in output file.\n"
+					"-Q\t\tWrite a block index into each file.\n"
 					"-E\t\tPrint extended format of netflow data. for debugging purpose only.\n"
 					"-T\t\tInclude extension tags in records.\n"
 					"-D\t\tdetach from terminal (daemonize)\n"
@@ -404,6 +447,53 @@ uint32_t	linkoffset, linktype;
 		mask = 0;
 	}
 
+#ifdef PACKET_RING
+	// receive packets directly from a TPACKET_V3 ring - fall back to libpcap if it fails
+	handle = use_packet_ring ? pcap_open_dead(DLT_EN10MB, snaplen) : NULL;
+	if ( handle ) {
+		packet_ring_t *ring = NULL;
+		pcap_t *live = NULL;
+		if ( filter ) {
+			// compile the filter for a live device - the kernel strips the VLAN tags
+			// and libpcap matches them with the ancillary data of the socket filter
+			live = pcap_open_live(device, snaplen, PROMISC, TIMEOUT, errbuf);
+			if ( live && pcap_compile(live, &filter_code, filter, 0, net) == -1 ) {
+				LogError("Couldn't parse filter %s: %s", filter, pcap_geterr(live));
+				pcap_close(live);
+				pcap_close(handle);
+				return NULL;
+			}
+		}
+		if ( !filter || live ) {
+			ring = OpenPacketRing(device, snaplen, TIMEOUT, filter ? &filter_code : NULL, errbuf);
+			if ( filter ) {
+				pcap_freecode(&filter_code);
+				pcap_close(live);
+			}
+		}
+		if ( ring ) {
+			pcap_dev = (pcap_dev_t *)calloc(1, sizeof(pcap_dev_t));
+			if ( !pcap_dev ) {
+				LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+				ClosePacketRing(ring);
+				pcap_close(handle);
+				return NULL;
+			}	
+			// the handle is needed to dump the packets into pcap files
+			pcap_dev->handle	 = handle;
+			pcap_dev->ring		 = ring;
+			pcap_dev->snaplen	 = snaplen;
+			pcap_dev->linkoffset = 14;
+			pcap_dev->linktype 	 = DLT_EN10MB;
+			LogInfo("Receive packets on %s from TPACKET_V3 ring: %u blocks of %u bytes", 
+				device, ring->numBlocks, ring->blockSize);
+			return pcap_dev;
+		}
+		LogInfo("Packet ring not available: %s - use libpcap", errbuf);
+		pcap_close(handle);
+	}
+#endif
+
 	/*
 	 *  Open the packet capturing device with the following values:
 	 *
@@ -428,17 +518,22 @@ uint32_t	linkoffset, linktype;
 		/* Compile and apply the filter */
 		if (pcap_compile(handle, &filter_code, filter, 0, net) == -1) {
 			LogError("Couldn't parse filter %s: %s", filter, pcap_geterr(handle));
+			pcap_close(handle);
 			return NULL;
 		}
 		if (pcap_setfilter(handle, &filter_code) == -1) {
 			LogError("Couldn't install filter %s: %s", filter, pcap_geterr(handle));
+			pcap_freecode(&filter_code);
+			pcap_close(handle);
 			return NULL;
 		}
+		pcap_freecode(&filter_code);
 	}
 
 	pcap_dev = (pcap_dev_t *)calloc(1, sizeof(pcap_dev_t));
 	if ( !pcap_dev ) {
 		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		pcap_close(handle);
 		return NULL;
 	}	
 
@@ -480,6 +575,30 @@ uint32_t	linkoffset, linktype;
 
 } // End of setup_pcap_live
 
+#ifdef PACKET_FANOUT
+/*
+ * join the socket of a live capture to a fanout group. The kernel spreads the packets 
+ * over the sockets of the group by the flow hash - after defragmentation
+ */
+static int JoinFanoutGroup(pcap_dev_t *pcap_dev, int group) {
+int fanout_arg = (group & 0xffff) | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+int fd;
+
+#ifdef PACKET_RING
+	fd = pcap_dev->ring ? pcap_dev->ring->fd : pcap_fileno(pcap_dev->handle);
+#else
+	fd = pcap_fileno(pcap_dev->handle);
+#endif
+	if ( setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &fanout_arg, sizeof(fanout_arg)) < 0 ) {
+		LogError("setsockopt(PACKET_FANOUT) error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+
+	return 1;
+
+} // End of JoinFanoutGroup
+#endif
+
 static pcap_dev_t *setup_pcap_file(char *pcap_file, char *filter, int snaplen) {
 FILE *fp;
 
@@ -593,20 +712,223 @@ static void SignalThreadTerminate(thread_info_t *thread_info, pthread_cond_t *th
 
 } // End of SignalThreadEnd
 
+static int RotateFlowFile(p_flow_thread_args_t *args, FlowSource_t *fs, time_t t_start, uint32_t NumFlows, int done) {
+time_t t_win		 = args->t_win;
+int subdir_index	 = args->subdir_index;
+char *time_extension = args->time_extension;
+struct tm *when;
+nffile_t *nffile;
+char FullName[MAXPATHLEN];
+char netflowFname[128];
+char error[256];
+char *subdir, fmt[24];
+
+	when = localtime(&t_start);
+	strftime(fmt, sizeof(fmt), time_extension, when);
+
+	nffile = fs->nffile;
+
+	// prepare sub dir hierarchy
+	if ( subdir_index ) {
+		subdir = GetSubDir(when);
+		if ( !subdir ) {
+			// failed to generate subdir path - put flows into base directory
+			LogError("Failed to create subdir path!");
+		
+			// failed to generate subdir path - put flows into base directory
+			subdir = NULL;
+			snprintf(netflowFname, 127, "nfcapd.%s", fmt);
+		} else {
+			snprintf(netflowFname, 127, "%s/nfcapd.%s", subdir, fmt);
+		}
+
+	} else {
+		subdir = NULL;
+		snprintf(netflowFname, 127, "nfcapd.%s", fmt);
+	}
+	netflowFname[127] = '\0';
+
+	if ( subdir && !SetupSubDir(fs->datadir, subdir, error, 255) ) {
+		// in this case the flows get lost! - the rename will fail
+		// but this should not happen anyway, unless i/o problems, inode problems etc.
+		LogError("Ident: %s, Failed to create sub hier directories: %s", fs->Ident, error );
+	}
+
+	if ( nffile->block_header->NumRecords ) {
+		// flush current buffer to disc
+		if ( WriteBlock(nffile) <= 0 )
+			LogError("Ident: %s, failed to write output buffer to disk: '%s'" , fs->Ident, strerror(errno));
+	} // else - no new records in current block
+
+	// prepare full filename
+	snprintf(FullName, MAXPATHLEN-1, "%s/%s", fs->datadir, netflowFname);
+	FullName[MAXPATHLEN-1] = '\0';
+
+	// update stat record
+	// if no flows were collected, fs->last_seen is still 0
+	// set first_seen to start of this time slot, with twin window size.
+	if ( fs->last_seen == 0 ) {
+		fs->first_seen = (uint64_t)1000 * (uint64_t)t_start;
+		fs->last_seen  = (uint64_t)1000 * (uint64_t)(t_start + t_win);
+	}
+	nffile->stat_record->first_seen = fs->first_seen/1000;
+	nffile->stat_record->msec_first	= fs->first_seen - nffile->stat_record->first_seen*1000;
+	nffile->stat_record->last_seen 	= fs->last_seen/1000;
+	nffile->stat_record->msec_last	= fs->last_seen - nffile->stat_record->last_seen*1000;
+
+	// Flush Exporter Stat to file
+	FlushExporterStats(fs);
+	// Close file
+	CloseUpdateFile(nffile, fs->Ident);
+
+	// if rename fails, we are in big trouble, as we need to get rid of the old .current file
+	// otherwise, we will loose flows and can not continue collecting new flows
+	if ( !RenameAppend(fs->current, FullName) ) {
+		LogError("Ident: %s, Can't rename dump file: %s", fs->Ident,  strerror(errno));
+		LogError("Ident: %s, Serious Problem! Fix manually", fs->Ident);
+/* XXX
+		if ( launcher_pid )
+			commbuff->failed = 1;
+*/
+		// we do not update the books here, as the file failed to rename properly
+		// otherwise the books may be wrong
+	} else {
+		struct stat	fstat;
+/* XXX
+		if ( launcher_pid )
+			commbuff->failed = 0;
+*/
+		// Update books
+		stat(FullName, &fstat);
+		UpdateBooks(fs->bookkeeper, t_start, 512*fstat.st_blocks);
+	}
+
+	LogInfo("Ident: '%s' Flows: %llu, Packets: %llu, Bytes: %llu, Max Flows: %u, Fragments: %u", 
+		fs->Ident, (unsigned long long)nffile->stat_record->numflows, (unsigned long long)nffile->stat_record->numpackets, 
+		(unsigned long long)nffile->stat_record->numbytes, NumFlows, IPFragEntries());
+
+	// reset stats
+	fs->bad_packets = 0;
+	fs->first_seen  = 0xffffffffffffLL;
+	fs->last_seen 	= 0;
+
+	// Dump all extension maps and exporters to the buffer
+	FlushStdRecords(fs);
+
+	if ( done ) 
+		return 1;
+
+	nffile = OpenNewFile(fs->current, nffile, args->compress, 0, NULL);
+	if ( !nffile ) {
+		LogError("Fatal: OpenNewFile() failed for ident: %s", fs->Ident);
+		return 0;
+	}
+
+	return 1;
+
+} // End of RotateFlowFile
+
+static int SyncFlowWorker(p_flow_thread_args_t *args, FlowSource_t *fs, time_t t_start, uint32_t NumFlows, int done) {
+FlowSource_t *master = args->master;
+uint32_t rotated;
+int failed;
+
+	// flush the buffer into the file of the master
+	if ( WriteBlock(fs->nffile) <= 0 )
+		LogError("Ident: %s, failed to write output buffer to disk: '%s'" , fs->Ident, strerror(errno));
+
+	pthread_mutex_lock(&flow_ctl.mutex);
+	SumStatRecords(master->nffile->stat_record, fs->nffile->stat_record);
+	master->bad_packets += fs->bad_packets;
+	if ( fs->first_seen < master->first_seen ) 
+		master->first_seen = fs->first_seen;
+	if ( fs->last_seen > master->last_seen ) 
+		master->last_seen = fs->last_seen;
+	flow_ctl.NumFlows += NumFlows;
+
+	if ( ++flow_ctl.synced == args->numWorkers ) {
+		// last worker - all buffers are flushed, rotate the file
+		if ( !RotateFlowFile(args, master, t_start, flow_ctl.NumFlows, done) ) 
+			flow_ctl.failed = 1;
+		flow_ctl.NumFlows = 0;
+		flow_ctl.synced	  = 0;
+		flow_ctl.rotated++;
+		pthread_cond_broadcast(&flow_ctl.cond);
+	} else {
+		rotated = flow_ctl.rotated;
+		while ( flow_ctl.rotated == rotated ) 
+			pthread_cond_wait(&flow_ctl.cond, &flow_ctl.mutex);
+	}
+	failed = flow_ctl.failed;
+	pthread_mutex_unlock(&flow_ctl.mutex);
+
+	memset((void *)fs->nffile->stat_record, 0, sizeof(stat_record_t));
+	fs->bad_packets = 0;
+	fs->first_seen  = 0xffffffffffffLL;
+	fs->last_seen 	= 0;
+
+	// Dump the extension maps of this worker into the new file
+	if ( !done ) 
+		FlushStdRecords(fs);
+
+	return !failed;
+
+} // End of SyncFlowWorker
+
+static int RotateFlowWorker(p_flow_thread_args_t *args, time_t t_start, time_t t_clock, int done) {
+FlowSource_t *fs = args->fs;
+uint32_t NumFlows;
+
+	// flush all flows to disk
+	DumpNodeStat(args->NodeList);
+	if (done)
+		NumFlows = Flush_FlowTree(fs);
+	else
+		NumFlows = Expire_FlowTree(fs, t_clock);
+
+	if ( args->numWorkers == 1 ) 
+		return RotateFlowFile(args, fs, t_start, NumFlows, done);
+	else
+		return SyncFlowWorker(args, fs, t_start, NumFlows, done);
+
+} // End of RotateFlowWorker
+
+static FlowSource_t *CopyFlowSource(FlowSource_t *fs, int worker, int numWorkers) {
+FlowSource_t *copy;
+
+	copy = (FlowSource_t *)malloc(sizeof(FlowSource_t));
+	if ( !copy ) {
+		LogError("malloc() allocation error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return NULL;
+	}
+	memcpy((void *)copy, (void *)fs, sizeof(FlowSource_t));
+	copy->next			 = NULL;
+	copy->hash_next		 = NULL;
+	copy->source_index	 = NULL;
+	copy->exporter_data	 = NULL;
+	copy->exporter_count = 0;
+	memset((void *)&copy->exporter_index, 0, sizeof(exporterIndex_t));
+
+	// the records go through a block buffer into the file of the flow source
+	copy->nffile = OpenBlockBuffer(fs->nffile);
+	if ( !copy->nffile || !InitExtensionMapList(copy) ) 
+		return NULL;
+
+	// each worker uses its own range of extension map ids in the shared file
+	copy->extension_map_list.range = INIT_ID / numWorkers;
+	copy->extension_map_list.base  = worker * copy->extension_map_list.range;
+
+	return copy;
+
+} // End of CopyFlowSource
+
 __attribute__((noreturn)) static void *p_flow_thread(void *thread_data) {
 // argument dispatching
 p_flow_thread_args_t *args = (p_flow_thread_args_t *)thread_data;
-time_t t_win		 = args->t_win;
-int subdir_index	 = args->subdir_index;
-int compress	 	 = args->compress;
 int live		 	 = args->live;
 FlowSource_t *fs	 = args->fs;
-char *time_extension = args->time_extension;
-static time_t lastExpire = 0;
-time_t t_start, t_clock;
-int err, done;
+int err;
 
-	done 	   = 0;
 	args->done = 0;
 	args->exit = 0;
 
@@ -620,190 +942,54 @@ int err, done;
 		pthread_exit((void *)args);
 	}
 
-	if ( !Init_pcap2nf() ) {
+	if ( !Init_FlowShard() ) {
 		args->done = 1;
 		args->exit = 255;
    		pthread_kill(args->parent, SIGUSR1);
 		pthread_exit((void *)args);
 	}
 
-	// prepare file
-	fs->nffile = OpenNewFile(fs->current, NULL, compress, 0, NULL);
-	if ( !fs->nffile ) {
-		args->done = 1;
-		args->exit = 255;
-   		pthread_kill(args->parent, SIGUSR1);
-		pthread_exit((void *)args);
-	}
-
-	// init vars
-	fs->bad_packets		= 0;
-	fs->first_seen      = 0xffffffffffffLL;
-	fs->last_seen 		= 0;
-
-	t_start = 0;
-	t_clock = 0;
+	// the packet threads signal the end of a time window and the expire interval
 	while ( 1 ) {
 		struct FlowNode	*Node;
+		time_t when;
 
-		Node = Pop_Node(args->NodeList, &args->done);
-		if ( Node ) {
-			t_clock = Node->t_last.tv_sec;
-			dbg_printf("p_flow_thread() Next Node\n");
-		} else {
-			done = args->done;
+		Node = Pop_Node(args->NodeList, fs, &args->done);
+		if ( !Node ) {
+			// flush all flows and close the file of the last time window
 			dbg_printf("p_flow_thread() NULL Node\n");
+			RotateFlowWorker(args, args->dispatch->t_start, 0, 1);
+			break;
 		}
-
-		if ( t_start == 0 ) {
-			t_start = t_clock - (t_clock % t_win);
-		}
-
-		if (((t_clock - t_start) >= t_win) || done) { /* rotate file */
-			struct tm *when;
-			nffile_t *nffile;
-			char FullName[MAXPATHLEN];
-			char netflowFname[128];
-			char error[256];
-			char *subdir, fmt[24];
-			uint32_t NumFlows;
-
-			// flush all flows to disk
-			DumpNodeStat(args->NodeList);
-			if (done)
-				NumFlows = Flush_FlowTree(fs);
-			else
-				NumFlows = Expire_FlowTree(fs, t_clock);
-
-			when = localtime(&t_start);
-			strftime(fmt, sizeof(fmt), time_extension, when);
-
-			nffile = fs->nffile;
-
-			// prepare sub dir hierarchy
-			if ( subdir_index ) {
-				subdir = GetSubDir(when);
-				if ( !subdir ) {
-					// failed to generate subdir path - put flows into base directory
-					LogError("Failed to create subdir path!");
-				
-					// failed to generate subdir path - put flows into base directory
-					subdir = NULL;
-					snprintf(netflowFname, 127, "nfcapd.%s", fmt);
-				} else {
-					snprintf(netflowFname, 127, "%s/nfcapd.%s", subdir, fmt);
+		dbg_printf("p_flow_thread() Next Node\n");
+
+		// the node may be freed while processing
+		when = Node->t_last.tv_sec;
+		switch (Node->fin) {
+			case SIGNAL_NODE: 
+				// rotate file
+				if ( !RotateFlowWorker(args, Node->t_first.tv_sec, when, 0) ) {
+					args->done = 1;
+					args->exit = 255;
+   					pthread_kill(args->parent, SIGUSR1);
 				}
-
-			} else {
-				subdir = NULL;
-				snprintf(netflowFname, 127, "nfcapd.%s", fmt);
-			}
-			netflowFname[127] = '\0';
-	
-			if ( subdir && !SetupSubDir(fs->datadir, subdir, error, 255) ) {
-				// in this case the flows get lost! - the rename will fail
-				// but this should not happen anyway, unless i/o problems, inode problems etc.
-				LogError("Ident: %s, Failed to create sub hier directories: %s", fs->Ident, error );
-			}
-
-			if ( nffile->block_header->NumRecords ) {
-				// flush current buffer to disc
-				if ( WriteBlock(nffile) <= 0 )
-					LogError("Ident: %s, failed to write output buffer to disk: '%s'" , fs->Ident, strerror(errno));
-			} // else - no new records in current block
-
-			// prepare full filename
-			snprintf(FullName, MAXPATHLEN-1, "%s/%s", fs->datadir, netflowFname);
-			FullName[MAXPATHLEN-1] = '\0';
-
-			// update stat record
-			// if no flows were collected, fs->last_seen is still 0
-			// set first_seen to start of this time slot, with twin window size.
-			if ( fs->last_seen == 0 ) {
-				fs->first_seen = (uint64_t)1000 * (uint64_t)t_start;
-				fs->last_seen  = (uint64_t)1000 * (uint64_t)(t_start + t_win);
-			}
-			nffile->stat_record->first_seen = fs->first_seen/1000;
-			nffile->stat_record->msec_first	= fs->first_seen - nffile->stat_record->first_seen*1000;
-			nffile->stat_record->last_seen 	= fs->last_seen/1000;
-			nffile->stat_record->msec_last	= fs->last_seen - nffile->stat_record->last_seen*1000;
-	
-			// Flush Exporter Stat to file
-			FlushExporterStats(fs);
-			// Close file
-			CloseUpdateFile(nffile, fs->Ident);
-	
-			// if rename fails, we are in big trouble, as we need to get rid of the old .current file
-			// otherwise, we will loose flows and can not continue collecting new flows
-			if ( !RenameAppend(fs->current, FullName) ) {
-				LogError("Ident: %s, Can't rename dump file: %s", fs->Ident,  strerror(errno));
-				LogError("Ident: %s, Serious Problem! Fix manually", fs->Ident);
-	/* XXX
-				if ( launcher_pid )
-					commbuff->failed = 1;
-	*/
-				// we do not update the books here, as the file failed to rename properly
-				// otherwise the books may be wrong
-			} else {
-				struct stat	fstat;
-	/* XXX
-				if ( launcher_pid )
-					commbuff->failed = 0;
-	*/
-				// Update books
-				stat(FullName, &fstat);
-				UpdateBooks(fs->bookkeeper, t_start, 512*fstat.st_blocks);
-			}
-
-			LogInfo("Ident: '%s' Flows: %llu, Packets: %llu, Bytes: %llu, Max Flows: %u, Fragments: %u", 
-				fs->Ident, (unsigned long long)nffile->stat_record->numflows, (unsigned long long)nffile->stat_record->numpackets, 
-				(unsigned long long)nffile->stat_record->numbytes, NumFlows, IPFragEntries());
-
-			// reset stats
-			fs->bad_packets = 0;
-			fs->first_seen  = 0xffffffffffffLL;
-			fs->last_seen 	= 0;
-	
-			// Dump all extension maps and exporters to the buffer
-			FlushStdRecords(fs);
-
-			if ( done ) 
+				Free_Node(Node);
 				break;
-	
-			t_start = t_clock - (t_clock % t_win);
-
-			nffile = OpenNewFile(fs->current, nffile, compress, 0, NULL);
-			if ( !nffile ) {
-				LogError("Fatal: OpenNewFile() failed for ident: %s", fs->Ident);
-				args->done = 1;
-				args->exit = 255;
-   				pthread_kill(args->parent, SIGUSR1);
+			case EXPIRE_NODE:
+				Expire_FlowTree(fs, when);
+				Free_Node(Node);
 				break;
-			}
-		}
-
-		time_t when;
-		if ( Node ) {
-			if ( Node->fin != SIGNAL_NODE ) {
+			default:
 				// Process the Node
 				ProcessFlowNode(fs, Node);
-			}
-			when = Node->t_last.tv_sec;
-		} else {
-			when = time(NULL);
-		} 
-		if ( (when - lastExpire) > EXPIREINTERVALL ) {
-			Expire_FlowTree(fs, when);
-			lastExpire = when;
-		} 
-		CacheCheck(fs, when, live);
+				CacheCheck(fs, when, live);
+		}
 
+		if ( args->exit ) 
+			break;
 	}
 
-	while ( fs ) {
-		DisposeFile(fs->nffile);
-		fs = fs->next;
-	}
+	Dispose_FlowShard();
 	LogInfo("Terminating flow processng: exit: %i", args->exit);
 	dbg_printf("End flow thread[%lu]\n", (long unsigned)args->tid);
 
@@ -961,6 +1147,7 @@ int runs = 0;
 __attribute__((noreturn)) static void *p_packet_thread(void *thread_data) {
 // argument dispatching
 p_packet_thread_args_t *args = (p_packet_thread_args_t *)thread_data;
+FlowDispatch_t *dispatch = args->dispatch;
 pcap_dev_t *pcap_dev = args->pcap_dev;
 time_t t_win		 = args->t_win;
 char *pcap_datadir 	 = args->pcap_datadir;
@@ -1033,6 +1220,11 @@ int err;
 		int ret;
 
 		if ( !args->done ) {
+#ifdef PACKET_RING
+			if ( pcap_dev->ring ) 
+				ret = PacketRingNext(pcap_dev->ring, &hdr, &data);
+			else
+#endif
 			ret = pcap_next_ex(pcap_dev->handle, &hdr, &data);
 			t_clock = 0;
 			switch (ret) {
@@ -1040,7 +1232,9 @@ int err;
 					// packet read ok
 					t_clock = hdr->ts.tv_sec;
 					// process packet for flow cache
-					ProcessPacket(args->NodeList, pcap_dev, hdr, data);
+					Dispatch_Window(dispatch, t_clock);
+					ProcessPacket(dispatch, pcap_dev, hdr, data);
+					Dispatch_Expire(dispatch, t_clock);
 					if ( pcap_datadir ) {
 						// keep the packet
 						if (((t_clock - t_start) >= t_win)) { 
@@ -1059,14 +1253,12 @@ int err;
 					dbg_printf("pcap_next_ex() read live - timeout\n");	
 					gettimeofday(&tv, NULL);
 					t_clock = tv.tv_sec;
+					// rotate and expire flows on quiet lines
+					Dispatch_Window(dispatch, t_clock);
+					Dispatch_Expire(dispatch, t_clock);
 					if ((t_clock - t_start) >= t_win) { /* rotate file */
 						if ( t_start ) {
 							// if not first packet, where t_start = 0
-							struct FlowNode	*Node = New_Node();
-							Node->t_first = tv;
-							Node->t_last  = tv;
-							Node->fin  	  = SIGNAL_NODE;
-							Push_Node(args->NodeList, Node);
 							if ( pcap_datadir ) {
 								// keep the packet
 								RotateFile(pcapfile, t_start, live);
@@ -1077,7 +1269,14 @@ int err;
 						}
 						if ( live ) {
 							struct pcap_stat p_stat;
-							if( pcap_stats(pcap_dev->handle, &p_stat) < 0) {
+							int stat_ret;
+#ifdef PACKET_RING
+							if ( pcap_dev->ring ) 
+								stat_ret = PacketRingStats(pcap_dev->ring, &p_stat);
+							else
+#endif
+							stat_ret = pcap_stats(pcap_dev->handle, &p_stat);
+							if( stat_ret < 0 ) {
 								LogInfo("pcap_stats() failed: %s", pcap_geterr(pcapfile->p));
 							} else {
 								LogInfo("Dropped: %u, dropped by interface: %u ",
@@ -1192,14 +1391,16 @@ sigset_t			signal_set;
 struct sigaction	sa;
 int c, snaplen, err, do_daemonize;
 int subdir_index, compress, expire, cache_size;
-int active, inactive;
+int active, inactive, numWorkers, numCapture, i;
 FlowSource_t	*fs;
 dirstat_t 		*dirstat;
 time_t 			t_win;
 char 			*device, *pcapfile, *filter, *datadir, *pcap_datadir, *extension_tags, pidfile[MAXPATHLEN], pidstr[32];
 char			*Ident, *userid, *groupid;
 char			*time_extension;
-pcap_dev_t 		*pcap_dev;
+pcap_dev_t 		*pcap_dev, *capture_dev[MAXFLOWTHREADS];
+NodeList_t		*NodeList[MAXFLOWTHREADS];
+FlowDispatch_t	*dispatch;
 p_packet_thread_args_t *p_packet_thread_args;
 p_flow_thread_args_t *p_flow_thread_args;
 
@@ -1225,7 +1426,8 @@ p_flow_thread_args_t *p_flow_thread_args;
 	cache_size		= 0;
 	active			= 0;
 	inactive		= 0;
-	while ((c = getopt(argc, argv, "B:DEI:e:g:hi:j:r:s:l:p:P:t:u:S:T:Vyz")) != EOF) {
+	numWorkers		= 1;
+	while ((c = getopt(argc, argv, "B:c:DEI:e:g:hi:j:Lr:s:l:p:P:Qt:u:S:T:Vyz")) != EOF) {
 		switch (c) {
 			struct stat fstat;
 			case 'h':
@@ -1248,6 +1450,13 @@ p_flow_thread_args_t *p_flow_thread_args;
 					exit(EXIT_FAILURE);
 				}
 				break;
+			case 'c':
+				numWorkers = atoi(optarg);
+				if ( numWorkers < 1 || numWorkers > MAXFLOWTHREADS ) {
+					LogError("Number of flow threads out of range 1..%d", MAXFLOWTHREADS);
+					exit(EXIT_FAILURE);
+				}
+				break;
 			case 'I':
 				Ident = strdup(optarg);
 				break;
@@ -1363,6 +1572,12 @@ p_flow_thread_args_t *p_flow_thread_args;
 			case 'S':
 				subdir_index = atoi(optarg);
 				break;
+			case 'Q':
+				SetBlockIndex(1);
+				break;
+			case 'L':
+				use_packet_ring = 0;
+				break;
 			case 'T': {
 				size_t len = strlen(optarg);
 				extension_tags = optarg;
@@ -1425,6 +1640,23 @@ p_flow_thread_args_t *p_flow_thread_args;
 		exit(EXIT_FAILURE);
 	}
 
+	// by default one packet thread feeds all flow threads
+	numCapture	   = 1;
+	capture_dev[0] = pcap_dev;
+#ifdef PACKET_FANOUT
+	// capture live packets with one socket per flow thread in a fanout group
+	if ( device && numWorkers > 1 && !pcap_datadir ) {
+		if ( !JoinFanoutGroup(pcap_dev, getpid()) ) 
+			exit(EXIT_FAILURE);
+		for ( numCapture=1; numCapture<numWorkers; numCapture++ ) {
+			capture_dev[numCapture] = setup_pcap_live(device, filter, snaplen);
+			if ( !capture_dev[numCapture] || !JoinFanoutGroup(capture_dev[numCapture], getpid()) ) 
+				exit(EXIT_FAILURE);
+		}
+		LogInfo("Capture packets with %d sockets in fanout group", numCapture);
+	}
+#endif
+
 	SetPriv(userid, groupid);
 
 	if ( subdir_index && !InitHierPath(subdir_index) ) {
@@ -1541,65 +1773,118 @@ p_flow_thread_args_t *p_flow_thread_args;
 		exit(255);
 	}
 
+	// prepare file
+	fs->nffile = OpenNewFile(fs->current, NULL, compress, 0, NULL);
+	if ( !fs->nffile || !Init_pcap2nf() ) {
+		pcap_close(pcap_dev->handle);
+		exit(255);
+	}
+
+	// init vars
+	fs->bad_packets		= 0;
+	fs->first_seen      = 0xffffffffffffLL;
+	fs->last_seen 		= 0;
+
+	// one node queue per flow thread
+	for ( i=0; i<numWorkers; i++ ) {
+		NodeList[i] = NewNodeList();
+		if ( !NodeList[i] ) 
+			exit(255);
+	}
+	dispatch = NewFlowDispatch(NodeList, numWorkers, t_win, EXPIREINTERVALL);
+	if ( !dispatch ) 
+		exit(255);
+
 	// prepare flow thread args
-	p_flow_thread_args = (p_flow_thread_args_t *)malloc(sizeof(p_flow_thread_args_t));
+	p_flow_thread_args = (p_flow_thread_args_t *)calloc(numWorkers, sizeof(p_flow_thread_args_t));
 	if ( !p_flow_thread_args ) {
 		LogError("malloc() error in %s line %d: %s\n", 
 			__FILE__, __LINE__, strerror(errno) );
 		exit(255);
 	}	
-	p_flow_thread_args->fs			   = fs;
-	p_flow_thread_args->t_win		   = t_win;
-	p_flow_thread_args->compress	   = compress;
-	p_flow_thread_args->live		   = device != NULL;
-	p_flow_thread_args->subdir_index   = subdir_index;
-	p_flow_thread_args->parent		   = pthread_self();
-	p_flow_thread_args->NodeList	   = NewNodeList();
-	p_flow_thread_args->time_extension = time_extension;
 
 	err = 0;
-
-	err = pthread_create(&p_flow_thread_args->tid, NULL, p_flow_thread, (void *)p_flow_thread_args);
-	if ( err ) {
-		LogError("pthread_create() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
-		exit(255);
+	for ( i=0; i<numWorkers; i++ ) {
+		p_flow_thread_args_t *args = &p_flow_thread_args[i];
+		// multiple flow threads collect into their own copy of the flow source
+		args->fs			 = numWorkers == 1 ? fs : CopyFlowSource(fs, i, numWorkers);
+		if ( !args->fs ) 
+			exit(255);
+		args->master		 = fs;
+		args->dispatch		 = dispatch;
+		args->numWorkers	 = numWorkers;
+		args->t_win			 = t_win;
+		args->compress		 = compress;
+		args->live			 = device != NULL;
+		args->subdir_index	 = subdir_index;
+		args->parent		 = pthread_self();
+		args->NodeList		 = NodeList[i];
+		args->time_extension = time_extension;
+
+		err = pthread_create(&args->tid, NULL, p_flow_thread, (void *)args);
+		if ( err ) {
+			LogError("pthread_create() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			exit(255);
+		}
+		dbg_printf("Started flow thread[%lu]\n", (long unsigned)args->tid);
 	}
-	dbg_printf("Started flow thread[%lu]\n", (long unsigned)p_flow_thread_args->tid);
 
 	// prepare packet thread args
-	p_packet_thread_args = (p_packet_thread_args_t *)malloc(sizeof(p_packet_thread_args_t));
+	p_packet_thread_args = (p_packet_thread_args_t *)calloc(numCapture, sizeof(p_packet_thread_args_t));
 	if ( !p_packet_thread_args ) {
 		LogError("malloc() error in %s line %d: %s\n", 
 			__FILE__, __LINE__, strerror(errno) );
 		exit(255);
 	}	
-	p_packet_thread_args->pcap_dev		 = pcap_dev;
-	p_packet_thread_args->t_win			 = t_win;
-	p_packet_thread_args->subdir_index	 = subdir_index;
-	p_packet_thread_args->pcap_datadir	 = pcap_datadir;
-	p_packet_thread_args->live			 = device != NULL;
-	p_packet_thread_args->parent		 = pthread_self();
-	p_packet_thread_args->NodeList		 = p_flow_thread_args->NodeList;
-	p_packet_thread_args->time_extension = p_flow_thread_args->time_extension;
-
-	err = pthread_create(&p_packet_thread_args->tid, NULL, p_packet_thread, (void *)p_packet_thread_args);
-	if ( err ) {
-		LogError("pthread_create() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
-		exit(255);
+	for ( i=0; i<numCapture; i++ ) {
+		p_packet_thread_args_t *args = &p_packet_thread_args[i];
+		args->pcap_dev		 = capture_dev[i];
+		args->t_win			 = t_win;
+		args->subdir_index	 = subdir_index;
+		args->pcap_datadir	 = pcap_datadir;
+		args->live			 = device != NULL;
+		args->parent		 = pthread_self();
+		args->dispatch		 = dispatch;
+		args->time_extension = time_extension;
+
+		err = pthread_create(&args->tid, NULL, p_packet_thread, (void *)args);
+		if ( err ) {
+			LogError("pthread_create() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			exit(255);
+		}
+		dbg_printf("Started packet thread[%lu]\n", (long unsigned)args->tid);
 	}
-	dbg_printf("Started packet thread[%lu]\n", (long unsigned)p_packet_thread_args->tid);
 
 	// Wait till done
 	WaitDone();
 
-	dbg_printf("Signal packet thread to terminate\n");
-	SignalThreadTerminate((thread_info_t *)p_packet_thread_args, NULL);
+	dbg_printf("Signal packet threads to terminate\n");
+	for ( i=0; i<numCapture; i++ ) 
+		SignalThreadTerminate((thread_info_t *)&p_packet_thread_args[i], NULL);
 
-	dbg_printf("Signal flow thread to terminate\n");
-	SignalThreadTerminate((thread_info_t *)p_flow_thread_args, &p_packet_thread_args->NodeList->c_list);
+	// all flow threads need to be signaled first, as they close the last file together
+	dbg_printf("Signal flow threads to terminate\n");
+	for ( i=0; i<numWorkers; i++ ) {
+		if ( !p_flow_thread_args[i].done ) {
+			pthread_kill(p_flow_thread_args[i].tid, SIGUSR2);
+			pthread_cond_signal(&NodeList[i]->c_list);
+		}
+	}
+	for ( i=0; i<numWorkers; i++ ) 
+		SignalThreadTerminate((thread_info_t *)&p_flow_thread_args[i], &NodeList[i]->c_list);
 
 	IPFragTree_free();
 
+	for ( i=0; i<numWorkers; i++ ) {
+		if ( p_flow_thread_args[i].fs != fs ) {
+			DisposeFile(p_flow_thread_args[i].fs->nffile);
+			free((void *)p_flow_thread_args[i].fs);
+		}
+		DisposeNodeList(NodeList[i]);
+	}
+	DisposeFlowDispatch(dispatch);
+	DisposeFile(fs->nffile);
+
 	// free arg list
 	free((void *)p_packet_thread_args);
 	free((void *)p_flow_thread_args);
@@ -1613,7 +1898,12 @@ p_flow_thread_args_t *p_flow_thread_args;
 	}
 
 	ReleaseBookkeeper(fs->bookkeeper, DESTROY_BOOKKEEPER);
-	pcap_close(pcap_dev->handle);
+	for ( i=0; i<numCapture; i++ ) {
+#ifdef PACKET_RING
+		ClosePacketRing(capture_dev[i]->ring);
+#endif
+		pcap_close(capture_dev[i]->handle);
+	}
 
 	if ( strlen(pidfile) )
 		unlink(pidfile);
@@ -43,6 +43,7 @@
 #include <sys/param.h>
 #include <netinet/in.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #ifdef HAVE_STDINT_H
 #include <stdint.h>
@@ -61,6 +62,29 @@
 #include "ipconv.h"
 #include "flist.h"
 #include "profile.h"
+#include "nfcolumn.h"
+
+/* parallel block processing */
+#define JOB_FREE	0
+#define JOB_READY	1
+#define JOB_BUSY	2
+#define JOB_DONE	3
+
+typedef struct block_job_s {
+	void		*buff;			// data block incl. block header
+	uint64_t	*match;			// bitmap of matching channels - one row per record
+	uint32_t	match_size;		// number of records the bitmap can hold
+	int			status;
+} block_job_t;
+
+typedef struct worker_ctx_s {
+	pthread_t		tid;
+	FilterEngine_t	*engine;			// private copies of the channel filter engines
+	FilterEngine_t	**engine_list;
+	FilterSet_t		*filter_set;		// private filter set
+	master_record_t	**master_record;	// private expand records - one per extension map slot
+	stat_record_t	*stat_record;		// private channel stat records - summed by StopWorkers()
+} worker_ctx_t;
 
 /* externals */
 extern exporter_t **exporter_list;
@@ -77,12 +101,46 @@ char Ident[IDENTLEN];
 	char influxdb_url[1024]="";
 #endif
 
+static struct worker_pool_s {
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+	int				terminate;
+	int				num_workers;
+	worker_ctx_t	*ctx;
+	int				num_jobs;
+	block_job_t		*job;			// job ring
+	uint64_t		next_put;		// next job to be queued by the main thread
+	uint64_t		next_take;		// next job to be processed by a worker
+	uint64_t		next_merge;		// next job to be merged into the channel files
+	profile_channel_info_t	*channels;
+	unsigned int	num_channels;
+	uint32_t		num_words;		// size of a bitmap row in uint64_t
+} WorkerPool;
+
 /* Function Prototypes */
 static void usage(char *name);
 
 static profile_param_info_t *ParseParams (char *profile_datadir);
 
-static void process_data(profile_channel_info_t *channels, unsigned int num_channels, time_t tslot);
+static inline void ProcessFlowRecord(worker_ctx_t *ctx, common_record_t *flow_record, uint64_t *match);
+
+static void *WorkerThread(void *arg);
+
+static int StartWorkers(profile_channel_info_t *channels, unsigned int num_channels, int num_workers, size_t buff_size);
+
+static int FlowRecordsOnly(nffile_t *nffile, int size);
+
+static void QueueBlock(nffile_t *nffile);
+
+static void MergeJob(block_job_t *job);
+
+static void DrainWorkers(void);
+
+static void ResetMasterRecords(uint32_t map_id);
+
+static void StopWorkers(void);
+
+static void process_data(profile_channel_info_t *channels, unsigned int num_channels, time_t tslot, int num_workers);
 
 /* Functions */
 
@@ -101,6 +159,7 @@ static void usage(char *name) {
 					"-P\t\tprofile stat dir.\n"
 					"-s\t\tprofile subdir.\n"
 					"-Z\t\tCheck filter syntax and exit.\n"
+					"-W <num>\tFilter input blocks with <num> worker threads.\n"
 					"-S subdir\tSub directory format. see nfcapd(1) for format\n"
 					"-z\t\tCompress flows in output file.\n"
 #ifdef HAVE_INFLUXDB
@@ -110,10 +169,322 @@ static void usage(char *name) {
 } /* usage */
 
 
-static void process_data(profile_channel_info_t *channels, unsigned int num_channels, time_t tslot) {
+/*
+ * Parallel block processing
+ * The main thread reads the data blocks and hands them over to the worker threads.
+ * Each worker expands the records of a block, evaluates the channel filters and
+ * records the matching channels of each record in the bitmap of the job. The channel
+ * stat records are updated in private copies. The main thread merges the finished
+ * jobs in block order into the channel files, so the files are identical to the
+ * single threaded run. Blocks containing extension maps, exporter or sampler records
+ * are processed by the main thread, after all pending blocks are merged.
+ */
+static inline void ProcessFlowRecord(worker_ctx_t *ctx, common_record_t *flow_record, uint64_t *match) {
+master_record_t	*master_record;
+exporter_t 		*exp_info;
+uint32_t		map_id, i, j;
+
+	map_id = flow_record->ext_map;
+	if ( map_id >= MAX_EXTENSION_MAPS || extension_map_list->slot[map_id] == NULL ) {
+		LogError("Corrupt data file. Missing extension map %u. Skip record.\n", flow_record->ext_map);
+		return;
+	}
+	exp_info = exporter_list[flow_record->exporter_sysid];
+
+	master_record = ctx->master_record[map_id];
+	if ( !master_record ) {
+		master_record = (master_record_t *)calloc(1, sizeof(master_record_t));
+		if ( !master_record ) {
+			LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			exit(255);
+		}
+		ctx->master_record[map_id] = master_record;
+	}
+
+	ExpandRecord_plan( flow_record, extension_map_list->slot[map_id], 
+		exp_info ? &(exp_info->info) : NULL, master_record);
+
+	// apply all profile filters
+	if ( RunFilterSet(ctx->filter_set, (uint64_t *)master_record) == 0 ) 
+		return;
+
+	for ( i=0; i < WorkerPool.num_words; i++ ) {
+		uint64_t bits = ctx->filter_set->bitmap[i];
+		match[i] = bits;
+		for ( j = i << 6; bits; j++, bits >>= 1 ) {
+			if ( bits & 1 ) 
+				UpdateStat(&ctx->stat_record[j], master_record);
+		}
+	}
+
+} // End of ProcessFlowRecord
+
+static void *WorkerThread(void *arg) {
+worker_ctx_t *ctx = (worker_ctx_t *)arg;
+block_job_t	 *job;
+
+	pthread_mutex_lock(&WorkerPool.mutex);
+	while ( 1 ) {
+		while ( !WorkerPool.terminate && WorkerPool.next_take == WorkerPool.next_put )
+			pthread_cond_wait(&WorkerPool.cond, &WorkerPool.mutex);
+		if ( WorkerPool.terminate )
+			break;
+
+		job = &WorkerPool.job[WorkerPool.next_take % WorkerPool.num_jobs];
+		WorkerPool.next_take++;
+		job->status = JOB_BUSY;
+		pthread_mutex_unlock(&WorkerPool.mutex);
+
+		data_block_header_t *block_header = (data_block_header_t *)job->buff;
+		common_record_t *record_ptr = (common_record_t *)((pointer_addr_t)block_header + sizeof(data_block_header_t));
+		uint32_t i;
+
+		if ( block_header->NumRecords > job->match_size ) {
+			free(job->match);
+			job->match = (uint64_t *)malloc(block_header->NumRecords * WorkerPool.num_words * sizeof(uint64_t));
+			if ( !job->match ) {
+				LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+				exit(255);
+			}
+			job->match_size = block_header->NumRecords;
+		}
+		memset((void *)job->match, 0, block_header->NumRecords * WorkerPool.num_words * sizeof(uint64_t));
+
+		for ( i=0; i < block_header->NumRecords; i++ ) {
+			ProcessFlowRecord(ctx, record_ptr, &job->match[i * WorkerPool.num_words]);
+			record_ptr = (common_record_t *)((pointer_addr_t)record_ptr + record_ptr->size);
+		}
+
+		pthread_mutex_lock(&WorkerPool.mutex);
+		job->status = JOB_DONE;
+		pthread_cond_broadcast(&WorkerPool.cond);
+	}
+	pthread_mutex_unlock(&WorkerPool.mutex);
+
+	pthread_exit(NULL);
+
+} // End of WorkerThread
+
+static int StartWorkers(profile_channel_info_t *channels, unsigned int num_channels, int num_workers, size_t buff_size) {
+int i, err;
+unsigned int j;
+
+	memset((void *)&WorkerPool, 0, sizeof(WorkerPool));
+	WorkerPool.channels		= channels;
+	WorkerPool.num_channels	= num_channels;
+	WorkerPool.num_words	= (num_channels + 63) >> 6;
+
+	WorkerPool.num_workers = num_workers;
+	WorkerPool.ctx = (worker_ctx_t *)calloc(num_workers, sizeof(worker_ctx_t));
+	WorkerPool.num_jobs = 2 * num_workers;
+	WorkerPool.job = (block_job_t *)calloc(WorkerPool.num_jobs, sizeof(block_job_t));
+	if ( !WorkerPool.ctx || !WorkerPool.job ) {
+		LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
+
+	for ( i=0; i<WorkerPool.num_jobs; i++ ) {
+		WorkerPool.job[i].buff = malloc(buff_size);
+		if ( !WorkerPool.job[i].buff ) {
+			LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			return 0;
+		}
+		WorkerPool.job[i].status = JOB_FREE;
+	}
+
+	for ( i=0; i<num_workers; i++ ) {
+		worker_ctx_t *ctx = &WorkerPool.ctx[i];
+		ctx->engine		   = (FilterEngine_t *)calloc(num_channels, sizeof(FilterEngine_t));
+		ctx->engine_list   = (FilterEngine_t **)calloc(num_channels, sizeof(FilterEngine_t *));
+		ctx->stat_record   = (stat_record_t *)calloc(num_channels, sizeof(stat_record_t));
+		ctx->master_record = (master_record_t **)calloc(MAX_EXTENSION_MAPS, sizeof(master_record_t *));
+		if ( !ctx->engine || !ctx->engine_list || !ctx->stat_record || !ctx->master_record ) {
+			LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			return 0;
+		}
+		// the filter programs are read only - each worker needs its own record pointer, label and set
+		for ( j=0; j<num_channels; j++ ) {
+			ctx->engine[j] = *channels[j].engine;
+			ctx->engine_list[j] = &ctx->engine[j];
+			ctx->stat_record[j].first_seen = 0x7fffffff;
+			ctx->stat_record[j].msec_first = 999;
+		}
+		ctx->filter_set = CompileFilterSet(ctx->engine_list, num_channels);
+	}
+
+	pthread_mutex_init(&WorkerPool.mutex, NULL);
+	pthread_cond_init(&WorkerPool.cond, NULL);
+
+	for ( i=0; i<num_workers; i++ ) {
+		err = pthread_create(&WorkerPool.ctx[i].tid, NULL, WorkerThread, (void *)&WorkerPool.ctx[i]);
+		if ( err ) {
+			LogError("pthread_create() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(err) );
+			exit(255);
+		}
+	}
+
+	return 1;
+
+} // End of StartWorkers
+
+static int FlowRecordsOnly(nffile_t *nffile, int size) {
+common_record_t *record_ptr;
+uint32_t i, sumSize;
+
+	sumSize = 0;
+	record_ptr = nffile->buff_ptr;
+	for ( i=0; i < nffile->block_header->NumRecords; i++ ) {
+		if ( (sumSize + record_ptr->size) > size || (record_ptr->size < sizeof(record_header_t)) ) {
+			LogError("Corrupt data file. Inconsistent block size in %s line %d\n", __FILE__, __LINE__);
+			exit(255);
+		}
+		if ( record_ptr->type != CommonRecordType )
+			return 0;
+		sumSize += record_ptr->size;
+		record_ptr = (common_record_t *)((pointer_addr_t)record_ptr + record_ptr->size);
+	}
+
+	return 1;
+
+} // End of FlowRecordsOnly
+
+static void MergeJob(block_job_t *job) {
+profile_channel_info_t *channels = WorkerPool.channels;
+data_block_header_t *block_header = (data_block_header_t *)job->buff;
+common_record_t *flow_record = (common_record_t *)((pointer_addr_t)block_header + sizeof(data_block_header_t));
+uint64_t	*match = job->match;
+uint32_t	i, j, k;
+
+	// same order of records as the single threaded run
+	for ( i=0; i < block_header->NumRecords; i++ ) {
+		for ( k=0; k < WorkerPool.num_words; k++ ) {
+			uint64_t bits = match[k];
+			for ( j = k << 6; bits; j++, bits >>= 1 ) {
+				// shadow profiles do not have files
+				if ( (bits & 1) && channels[j].nffile != NULL ) 
+					AppendToBuffer(channels[j].nffile, (void *)flow_record, flow_record->size);
+			}
+		}
+		match += WorkerPool.num_words;
+		flow_record = (common_record_t *)((pointer_addr_t)flow_record + flow_record->size);
+	}
+
+} // End of MergeJob
+
+static void QueueBlock(nffile_t *nffile) {
+block_job_t	*job;
+void		*_tmp;
+
+	pthread_mutex_lock(&WorkerPool.mutex);
+	job = &WorkerPool.job[WorkerPool.next_put % WorkerPool.num_jobs];
+	if ( job->status != JOB_FREE ) {
+		// ring is full - the slot holds the oldest job, which is merged next
+		while ( job->status != JOB_DONE )
+			pthread_cond_wait(&WorkerPool.cond, &WorkerPool.mutex);
+		pthread_mutex_unlock(&WorkerPool.mutex);
+		MergeJob(job);
+		pthread_mutex_lock(&WorkerPool.mutex);
+		job->status = JOB_FREE;
+		WorkerPool.next_merge++;
+	}
+
+	// swap buffers - the worker takes the block, the file reads the next block into the free buffer
+	_tmp = job->buff;
+	job->buff = nffile->buff_pool[0];
+	nffile->buff_pool[0] = _tmp;
+	nffile->block_header = nffile->buff_pool[0];
+	nffile->buff_ptr = (void *)((pointer_addr_t)nffile->block_header + sizeof(data_block_header_t));
+
+	job->status	= JOB_READY;
+	WorkerPool.next_put++;
+	pthread_cond_broadcast(&WorkerPool.cond);
+	pthread_mutex_unlock(&WorkerPool.mutex);
+
+} // End of QueueBlock
+
+static void DrainWorkers(void) {
+block_job_t	*job;
+
+	// merge all pending jobs in block order
+	pthread_mutex_lock(&WorkerPool.mutex);
+	while ( WorkerPool.next_merge != WorkerPool.next_put ) {
+		job = &WorkerPool.job[WorkerPool.next_merge % WorkerPool.num_jobs];
+		while ( job->status != JOB_DONE )
+			pthread_cond_wait(&WorkerPool.cond, &WorkerPool.mutex);
+		pthread_mutex_unlock(&WorkerPool.mutex);
+		MergeJob(job);
+		pthread_mutex_lock(&WorkerPool.mutex);
+		job->status = JOB_FREE;
+		WorkerPool.next_merge++;
+	}
+	pthread_mutex_unlock(&WorkerPool.mutex);
+
+} // End of DrainWorkers
+
+static void ResetMasterRecords(uint32_t map_id) {
+int i;
+
+	// extension map slot got a new map - the expanded records no longer match
+	for ( i=0; i<WorkerPool.num_workers; i++ ) {
+		if ( WorkerPool.ctx[i].master_record[map_id] ) {
+			free((void *)WorkerPool.ctx[i].master_record[map_id]);
+			WorkerPool.ctx[i].master_record[map_id] = NULL;
+		}
+	}
+
+} // End of ResetMasterRecords
+
+static void StopWorkers(void) {
+profile_channel_info_t *channels = WorkerPool.channels;
+unsigned int j;
+int i;
+
+	DrainWorkers();
+
+	pthread_mutex_lock(&WorkerPool.mutex);
+	WorkerPool.terminate = 1;
+	pthread_cond_broadcast(&WorkerPool.cond);
+	pthread_mutex_unlock(&WorkerPool.mutex);
+
+	for ( i=0; i<WorkerPool.num_workers; i++ )
+		pthread_join(WorkerPool.ctx[i].tid, NULL);
+
+	for ( i=0; i<WorkerPool.num_workers; i++ ) {
+		worker_ctx_t *ctx = &WorkerPool.ctx[i];
+		for ( j=0; j<WorkerPool.num_channels; j++ ) {
+			SumStatRecords(&channels[j].stat_record, &ctx->stat_record[j]);
+			if ( channels[j].nffile ) 
+				SumStatRecords(channels[j].nffile->stat_record, &ctx->stat_record[j]);
+		}
+		for ( j=0; j<MAX_EXTENSION_MAPS; j++ ) {
+			if ( ctx->master_record[j] )
+				free((void *)ctx->master_record[j]);
+		}
+		free((void *)ctx->master_record);
+		free((void *)ctx->stat_record);
+		free((void *)ctx->engine_list);
+		free((void *)ctx->engine);
+	}
+
+	for ( i=0; i<WorkerPool.num_jobs; i++ ) {
+		free(WorkerPool.job[i].buff);
+		free(WorkerPool.job[i].match);
+	}
+	free((void *)WorkerPool.job);
+	free((void *)WorkerPool.ctx);
+	WorkerPool.ctx = NULL;
+
+	pthread_mutex_destroy(&WorkerPool.mutex);
+	pthread_cond_destroy(&WorkerPool.cond);
+
+} // End of StopWorkers
+
+static void process_data(profile_channel_info_t *channels, unsigned int num_channels, time_t tslot, int num_workers) {
 common_record_t	*flow_record;
 nffile_t		*nffile;
-FilterEngine_t	*engine;
+FilterEngine_t	**engine;
+FilterSet_t		*filter_set;
+column_reader_t	*column_reader;
 int 		i, j, done, ret ;
 
 	nffile = GetNextFile(NULL, 0, 0);
@@ -126,6 +497,26 @@ int 		i, j, done, ret ;
 		return;
 	}
 
+	// evaluate all channel filters together - shared predicates are evaluated once per record
+	engine = (FilterEngine_t **)malloc(num_channels * sizeof(FilterEngine_t *));
+	if ( !engine ) {
+		LogError("malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+	for ( j=0; j < num_channels; j++ ) 
+		engine[j] = channels[j].engine;
+	filter_set = CompileFilterSet(engine, num_channels);
+
+	// column blocks are decoded completely - the channel filters are evaluated on the rows
+	column_reader = NewColumnReader(NULL);
+	if ( !column_reader ) 
+		exit(255);
+
+	if ( num_workers && !StartWorkers(channels, num_channels, num_workers, nffile->buff_size) ) {
+		LogError("Failed to start worker threads - continue single threaded");
+		num_workers = 0;
+	}
+
 	// store infos away for later use
 	// although multiple files may be processed, it is assumed that all 
 	// have the same settings
@@ -148,6 +539,9 @@ int 		i, j, done, ret ;
 					LogError("Read error in file '%s': %s\n",GetCurrentFilename(), strerror(errno) );
 				// fall through - get next file in chain
 			case NF_EOF: {
+				// ident filters match the ident of the current file
+				if ( num_workers )
+					DrainWorkers();
 				nffile_t *next = GetNextFile(nffile, 0, 0);
 				if ( next == EMPTY_LIST ) {
 					done = 1;
@@ -161,11 +555,27 @@ int 		i, j, done, ret ;
 				} break; // not really needed
 		}
 
+		if ( nffile->block_header->id == DATA_BLOCK_TYPE_3 ) {
+			ret = DecodeColumnBlock(column_reader, nffile, extension_map_list);
+			if ( ret <= 0 ) 
+				continue;
+		}
+
 		if ( nffile->block_header->id != DATA_BLOCK_TYPE_2 ) {
 			LogError("Can't process block type %u. Skip block.\n", nffile->block_header->id);
 			continue;
 		}
 
+		if ( num_workers ) {
+			// blocks with flow records only are processed by the workers
+			if ( FlowRecordsOnly(nffile, ret) ) {
+				QueueBlock(nffile);
+				continue;
+			}
+			// maps, exporter and sampler records must be processed in sequence
+			DrainWorkers();
+		}
+
 		flow_record = nffile->buff_ptr;
 		uint32_t sumSize = 0;
 		for ( i=0; i < nffile->block_header->NumRecords; i++ ) {
@@ -188,19 +598,19 @@ int 		i, j, done, ret ;
 					} 
 	
 					master_record = &(extension_map_list->slot[map_id]->master_record);
-					ExpandRecord_v2( flow_record, extension_map_list->slot[flow_record->ext_map], 
+					ExpandRecord_plan( flow_record, extension_map_list->slot[flow_record->ext_map], 
 						exp_info ? &(exp_info->info) : NULL, master_record);
 
+					// apply all profile filters
+					if ( RunFilterSet(filter_set, (uint64_t *)master_record) == 0 ) {
+						flow_record = (common_record_t *)((pointer_addr_t)flow_record + flow_record->size);	
+						continue;
+					}
+
 					for ( j=0; j < num_channels; j++ ) {
-						int match;
-	
-						// apply profile filter
-						(channels[j].engine)->nfrecord 	= (uint64_t *)master_record;
-						engine = channels[j].engine;
-						match = (*engine->FilterEngine)(engine);
 	
 						// if profile filter failed -> next profile
-						if ( !match )
+						if ( (filter_set->bitmap[j >> 6] & (1LL << (j & 0x3F))) == 0 )
 							continue;
 	
 						// filter was successful -> continue record processing
@@ -229,6 +639,8 @@ int 		i, j, done, ret ;
 							break; // map already known and flushed
 						case 1: {
 							int j;
+							if ( num_workers )
+								ResetMasterRecords(map->map_id);
 							for ( j=0; j < num_channels; j++ ) {
 								if ( channels[j].nffile != NULL ) {
 									// flush new map
@@ -287,6 +699,9 @@ int 		i, j, done, ret ;
 		} // End of for all umRecords
 	} // End of while !done
 
+	if ( num_workers )
+		StopWorkers();
+
 	// do we need to write data to new file - shadow profiles do not have files.
 	for ( j=0; j < num_channels; j++ ) {
 		if ( channels[j].nffile != NULL ) {
@@ -300,6 +715,8 @@ int 		i, j, done, ret ;
 	}
 	CloseFile(nffile);
 	DisposeFile(nffile);
+	DisposeColumnReader(column_reader);
+	free(engine);
 
 } // End of process_data
 
@@ -477,7 +894,7 @@ struct stat stat_buf;
 profile_param_info_t *profile_list;
 char *rfile, *ffile, *filename, *Mdirs;
 char	*profile_datadir, *profile_statdir, *nameserver;
-int c, syntax_only, subdir_index, stdin_profile_params;
+int c, syntax_only, subdir_index, stdin_profile_params, num_workers;
 time_t tslot;
 
 	profile_datadir = NULL;
@@ -490,6 +907,7 @@ time_t tslot;
 	profile_list	= NULL;
 	nameserver		= NULL;
 	stdin_profile_params = 0;
+	num_workers		= 0;
 	is_anonymized	= 0;
 
 	strncpy(Ident, "none", IDENTLEN);
@@ -498,7 +916,7 @@ time_t tslot;
 	// default file names
 	ffile = "filter.txt";
 	rfile = NULL;
-	while ((c = getopt(argc, argv, "D:HIL:p:P:hi:f:J;r:n:M:S:t:VzZ")) != EOF) {
+	while ((c = getopt(argc, argv, "D:HIL:p:P:hi:f:J;r:n:M:S:t:VW:zZ")) != EOF) {
 		switch (c) {
 			case 'h':
 				usage(argv[0]);
@@ -539,6 +957,13 @@ time_t tslot;
 			case 't':
 				tslot = atoi(optarg);
 				break;
+			case 'W':
+				num_workers = atoi(optarg);
+				if ( num_workers < 1 || num_workers > MAXWORKERS ) {
+					LogError("Number of worker threads %s out of range 1..%d\n", optarg, MAXWORKERS);
+					exit(255);
+				}
+				break;
 			case 'M':
 				Mdirs = optarg;
 				break;
@@ -655,7 +1080,7 @@ time_t tslot;
 
 	SetupInputFileSequence(Mdirs,rfile, NULL);
 
-	process_data(GetChannelInfoList(), num_channels, tslot);
+	process_data(GetChannelInfoList(), num_channels, tslot, num_workers);
 
 	CloseChannels(tslot, compress);
 
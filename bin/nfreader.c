@@ -76,6 +76,8 @@
 #include "collector.h"
 #include "exporter.h"
 #include "flist.h"
+#include "nftree.h"
+#include "nfcolumn.h"
 
 // module limited globals
 extension_map_list_t *extension_map_list;
@@ -159,6 +161,7 @@ static void process_data(void) {
 master_record_t	master_record;
 common_record_t *flow_record;
 nffile_t		*nffile;
+column_reader_t	*column_reader;
 int 		i, done, ret;
 
 	// Get the first file handle
@@ -172,6 +175,13 @@ int 		i, done, ret;
 		return;
 	}
 
+	column_reader = NewColumnReader(NULL);
+	if ( !column_reader ) {
+		CloseFile(nffile);
+		DisposeFile(nffile);
+		return;
+	}
+
 	done = 0;
 	while ( !done ) {
 		// get next data block from file
@@ -200,6 +210,12 @@ int 		i, done, ret;
 				} break; // not really needed
 		}
 
+		if ( nffile->block_header->id == DATA_BLOCK_TYPE_3 ) {
+			ret = DecodeColumnBlock(column_reader, nffile, extension_map_list);
+			if ( ret <= 0 ) 
+				continue;
+		}
+
 		if ( nffile->block_header->id != DATA_BLOCK_TYPE_2 ) {
 			fprintf(stderr, "Can't process block type %u. Skip block.\n", nffile->block_header->id);
 			continue;
@@ -223,7 +239,7 @@ int 		i, done, ret;
 						snprintf(string, 1024, "Corrupt data file! No such extension map id: %u. Skip record", flow_record->ext_map );
 						string[1023] = '\0';
 					} else {
-						ExpandRecord_v2( flow_record, extension_map_list->slot[flow_record->ext_map], 
+						ExpandRecord_plan( flow_record, extension_map_list->slot[flow_record->ext_map], 
 							exp_info ? &(exp_info->info) : NULL, &master_record);
 
 						// update number of flows matching a given map
@@ -276,6 +292,7 @@ int 		i, done, ret;
 
 	CloseFile(nffile);
 	DisposeFile(nffile);
+	DisposeColumnReader(column_reader);
 
 	PackExtensionMapList(extension_map_list);
 
@@ -69,6 +69,7 @@
 #include "netflow_v5_v7.h"
 #include "netflow_v9.h"
 #include "nfprof.h"
+#include "nfcolumn.h"
 
 #define DEFAULTCISCOPORT "9995"
 #define DEFAULTHOSTNAME "127.0.0.1"
@@ -200,6 +201,7 @@ static void send_data(char *rfile, time_t twin_start,
 master_record_t	master_record;
 common_record_t	*flow_record;
 nffile_t		*nffile;
+column_reader_t	*column_reader;
 int 			i, done, ret, again;
 uint32_t		numflows, cnt;
 
@@ -242,6 +244,14 @@ uint32_t		numflows, cnt;
 	// is expanded into this record
 	Engine->nfrecord = (uint64_t *)&master_record;
 
+	// column blocks are filtered on the filter columns before they are decoded
+	column_reader = NewColumnReader(Engine);
+	if ( !column_reader ) {
+		CloseFile(nffile);
+		DisposeFile(nffile);
+		return;
+	}
+
 	cnt = 0;
 	while ( !done ) {
 		// get next data block from file
@@ -270,6 +280,12 @@ uint32_t		numflows, cnt;
 				} break; // not really needed
 		}
 
+		if ( nffile->block_header->id == DATA_BLOCK_TYPE_3 ) {
+			ret = DecodeColumnBlock(column_reader, nffile, extension_map_list);
+			if ( ret <= 0 ) 
+				continue;
+		}
+
 		if ( nffile->block_header->id != DATA_BLOCK_TYPE_2 ) {
 			LogError("Can't process block type %u. Skip block.\n", nffile->block_header->id);
 			continue;
@@ -296,7 +312,7 @@ uint32_t		numflows, cnt;
 					} 
 
 					// if no filter is given, the result is always true
-					ExpandRecord_v2( flow_record, extension_map_list->slot[flow_record->ext_map], NULL, &master_record);
+					ExpandRecord_plan( flow_record, extension_map_list->slot[flow_record->ext_map], NULL, &master_record);
 
 					match = twin_start && (master_record.first < twin_start || master_record.last > twin_end) ? 0 : 1;
 
@@ -327,6 +343,7 @@ uint32_t		numflows, cnt;
 							perror("Error sending data");
 							CloseFile(nffile);
 							DisposeFile(nffile);
+							DisposeColumnReader(column_reader);
 							return;
 						}
 			
@@ -417,6 +434,7 @@ uint32_t		numflows, cnt;
 		CloseFile(nffile);
 		DisposeFile(nffile);
 	}
+	DisposeColumnReader(column_reader);
 
 	close(peer.sockfd);
 
@@ -443,11 +443,15 @@ static int ParseStatString(char *str, int16_t	*StatType, int *flow_record_stat,
 
 static int ParseListOrder(char *s, int multiple_orders, int *direction);
 
-static inline StatRecord_t *stat_hash_lookup(uint64_t *value, uint8_t prot, int hash_num);
+static int Init_Tables(hash_StatTable *table, uint16_t NumBits, uint32_t Prealloc);
 
-static inline StatRecord_t *stat_hash_insert(uint64_t *value, uint8_t prot, int hash_num);
+static void Dispose_Tables(hash_StatTable *table);
 
-static void Expand_StatTable_Blocks(int hash_num);
+static inline StatRecord_t *stat_hash_lookup(hash_StatTable *table, uint64_t *value, uint8_t prot, int order_proto, uint32_t *index_cache);
+
+static inline StatRecord_t *stat_hash_insert(hash_StatTable *table, uint64_t *value, uint8_t prot, uint32_t index_cache);
+
+static void Expand_StatTable_Blocks(hash_StatTable *table);
 
 static inline void PrintSortedFlowcache(SortElement_t *SortList, uint32_t maxindex, outputParams_t *outputParams, 
 		int GuessFlowDirection, printer_t print_record, extension_map_list_t *extension_map_list );
@@ -473,6 +477,7 @@ static int initialised = 0;
 
 #include "nffile_inline.c"
 #include "heapsort_inline.c"
+#include "hash_inline.c"
 #include "applybits_inline.c"
 
 static uint64_t	null_record(FlowTableRecord_t *record, int inout) {
@@ -756,51 +761,77 @@ uint32_t	len,scale;
 
 } // End of SetLimits
 
-int Init_StatTable(uint16_t NumBits, uint32_t Prealloc) {
+static int Init_Tables(hash_StatTable *table, uint16_t NumBits, uint32_t Prealloc) {
 uint32_t maxindex;
 int		 hash_num;
 
-	if ( NumBits == 0 || NumBits > 31 ) {
-		fprintf(stderr, "Numbits outside 1..31\n");
-		exit(255);
-	}
-
-	memset((void *)&SumRecord, 0, sizeof(SumRecord));
-
 	maxindex = (1 << NumBits);
 
-	StatTable = (hash_StatTable *)calloc(NumStats, sizeof(hash_StatTable));
-	if ( !StatTable ) {
-		fprintf(stderr, "malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
-		return 0;
-	}
-
 	for ( hash_num=0; hash_num<NumStats; hash_num++ ) {
-		StatTable[hash_num].IndexMask   = maxindex -1;
-		StatTable[hash_num].NumBits     = NumBits;
-		StatTable[hash_num].Prealloc    = Prealloc;
-		StatTable[hash_num].bucket	  	= (StatRecord_t **)calloc(maxindex, sizeof(StatRecord_t *));
-		StatTable[hash_num].bucketcache = (StatRecord_t **)calloc(maxindex, sizeof(StatRecord_t *));
-		if ( !StatTable[hash_num].bucket || !StatTable[hash_num].bucketcache ) {
+		table[hash_num].IndexMask   = maxindex -1;
+		table[hash_num].NumBits     = NumBits;
+		table[hash_num].Prealloc    = Prealloc;
+		table[hash_num].hash_type	= GetFlowHash(&table[hash_num].hash_seed);
+		table[hash_num].bucket	  	= (StatRecord_t **)calloc(maxindex, sizeof(StatRecord_t *));
+		table[hash_num].bucketcache = (StatRecord_t **)calloc(maxindex, sizeof(StatRecord_t *));
+		if ( !table[hash_num].bucket || !table[hash_num].bucketcache ) {
 			fprintf(stderr, "malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
 			return 0;
 		}
-		StatTable[hash_num].memblock = (StatRecord_t **)calloc(MaxMemBlocks, sizeof(StatRecord_t *));
-		if ( !StatTable[hash_num].memblock ) {
+		table[hash_num].memblock = (StatRecord_t **)calloc(MaxMemBlocks, sizeof(StatRecord_t *));
+		if ( !table[hash_num].memblock ) {
 			fprintf(stderr, "malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
 			return 0;
 		}
-		StatTable[hash_num].memblock[0] = (StatRecord_t *)calloc(Prealloc, sizeof(StatRecord_t));
-		if ( !StatTable[hash_num].memblock[0] ) {
+		table[hash_num].memblock[0] = (StatRecord_t *)calloc(Prealloc, sizeof(StatRecord_t));
+		if ( !table[hash_num].memblock[0] ) {
 			fprintf(stderr, "malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
 			return 0;
 		}
 	
-		StatTable[hash_num].NumBlocks = 1;
-		StatTable[hash_num].MaxBlocks = MaxMemBlocks;
-		StatTable[hash_num].NextBlock = 0;
-		StatTable[hash_num].NextElem  = 0;
+		table[hash_num].NumBlocks = 1;
+		table[hash_num].MaxBlocks = MaxMemBlocks;
+		table[hash_num].NextBlock = 0;
+		table[hash_num].NextElem  = 0;
+	}
+
+	return 1;
+
+} // End of Init_Tables
+
+static void Dispose_Tables(hash_StatTable *table) {
+unsigned int i, hash_num;
+
+	for ( hash_num=0; hash_num<NumStats; hash_num++ ) {
+		free((void *)table[hash_num].bucket);
+		free((void *)table[hash_num].bucketcache);
+		for ( i=0; i<table[hash_num].NumBlocks; i++ ) 
+			free((void *)table[hash_num].memblock[i]);
+		free((void *)table[hash_num].memblock);
+	}
+
+} // End of Dispose_Tables
+
+int Init_StatTable(uint16_t NumBits, uint32_t Prealloc) {
+int		 hash_num;
+
+	if ( NumBits == 0 || NumBits > 31 ) {
+		fprintf(stderr, "Numbits outside 1..31\n");
+		exit(255);
+	}
+
+	memset((void *)&SumRecord, 0, sizeof(SumRecord));
+
+	StatTable = (hash_StatTable *)calloc(NumStats, sizeof(hash_StatTable));
+	if ( !StatTable ) {
+		fprintf(stderr, "malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return 0;
+	}
 
+	if ( !Init_Tables(StatTable, NumBits, Prealloc) )
+		return 0;
+
+	for ( hash_num=0; hash_num<NumStats; hash_num++ ) {
 		if ( StatRequest[hash_num].order_bits == 0 ) {
 			int bit = 1 << PrintOrder;
 			StatRequest[hash_num].order_bits = PrintOrder ? bit : Default_PrintOrder;
@@ -813,19 +844,33 @@ int		 hash_num;
 } // End of Init_StatTable
 
 void Dispose_StatTable() {
-unsigned int i, hash_num;
 
 	if ( !initialised ) 
 		return;
 
-	for ( hash_num=0; hash_num<NumStats; hash_num++ ) {
-		free((void *)StatTable[hash_num].bucket);
-		for ( i=0; i<StatTable[hash_num].NumBlocks; i++ ) 
-			free((void *)StatTable[hash_num].memblock[i]);
-		free((void *)StatTable[hash_num].memblock);
+	Dispose_Tables(StatTable);
+
+} // End of Dispose_StatTable
+
+hash_StatTable *New_StatTable(void) {
+hash_StatTable *table;
+
+	table = (hash_StatTable *)calloc(NumStats, sizeof(hash_StatTable));
+	if ( !table ) {
+		fprintf(stderr, "malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return NULL;
 	}
 
-} // End of Dispose_Tables
+	// same geometry as the global table
+	if ( !Init_Tables(table, StatTable[0].NumBits, StatTable[0].Prealloc) ) {
+		Dispose_Tables(table);
+		free((void *)table);
+		return NULL;
+	}
+
+	return table;
+
+} // End of New_StatTable
 
 int SetStat(char *str, int *element_stat, int *flow_stat) {
 int			flow_record_stat = 0;
@@ -1012,17 +1057,18 @@ int Parse_PrintOrder(char *order) {
 
 } // End of Parse_PrintOrder
 
-static inline StatRecord_t *stat_hash_lookup(uint64_t *value, uint8_t prot, int hash_num) {
+static inline StatRecord_t *stat_hash_lookup(hash_StatTable *table, uint64_t *value, uint8_t prot, int order_proto, uint32_t *index_cache) {
 uint32_t		index;
 StatRecord_t	*record;
 
-	index = value[1] & StatTable[hash_num].IndexMask;
+	*index_cache = KeyHash(table->hash_type, table->hash_seed, (void *)value, 2 * sizeof(uint64_t));
+	index = *index_cache & table->IndexMask;
 
-	if ( StatTable[hash_num].bucket[index] == NULL )
+	if ( table->bucket[index] == NULL )
 		return NULL;
 
-	record = StatTable[hash_num].bucket[index];
-	if ( StatRequest[hash_num].order_proto ) {
+	record = table->bucket[index];
+	if ( order_proto ) {
 		while ( record && ( record->stat_key[1] != value[1] || record->stat_key[0] != value[0] || prot != record->prot ) ) {
 			record = record->next;
 		}
@@ -1035,58 +1081,55 @@ StatRecord_t	*record;
 
 } // End of stat_hash_lookup
 
-static void Expand_StatTable_Blocks(int hash_num) {
+static void Expand_StatTable_Blocks(hash_StatTable *table) {
 
-	if ( StatTable[hash_num].NumBlocks >= StatTable[hash_num].MaxBlocks ) {
-		StatTable[hash_num].MaxBlocks += MaxMemBlocks;
-		StatTable[hash_num].memblock = (StatRecord_t **)realloc(StatTable[hash_num].memblock,
-			StatTable[hash_num].MaxBlocks * sizeof(StatRecord_t *));
-		if ( !StatTable[hash_num].memblock ) {
+	if ( table->NumBlocks >= table->MaxBlocks ) {
+		table->MaxBlocks += MaxMemBlocks;
+		table->memblock = (StatRecord_t **)realloc(table->memblock,
+			table->MaxBlocks * sizeof(StatRecord_t *));
+		if ( !table->memblock ) {
 			fprintf(stderr, "realloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror (errno));
 			exit(250);
 		}
 	}
-	StatTable[hash_num].memblock[StatTable[hash_num].NumBlocks] = 
-		(StatRecord_t *)calloc(StatTable[hash_num].Prealloc, sizeof(StatRecord_t));
+	table->memblock[table->NumBlocks] = 
+		(StatRecord_t *)calloc(table->Prealloc, sizeof(StatRecord_t));
 
-	if ( !StatTable[hash_num].memblock[StatTable[hash_num].NumBlocks] ) {
+	if ( !table->memblock[table->NumBlocks] ) {
 		fprintf(stderr, "calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror (errno));
 		exit(250);
 	}
-	StatTable[hash_num].NextBlock = StatTable[hash_num].NumBlocks++;
-	StatTable[hash_num].NextElem  = 0;
+	table->NextBlock = table->NumBlocks++;
+	table->NextElem  = 0;
 
 } // End of Expand_StatTable_Blocks
 
-static inline StatRecord_t *stat_hash_insert(uint64_t *value, uint8_t prot, int hash_num) {
+static inline StatRecord_t *stat_hash_insert(hash_StatTable *table, uint64_t *value, uint8_t prot, uint32_t index_cache) {
 uint32_t		index;
 StatRecord_t	*record;
 
-	if ( StatTable[hash_num].NextElem >= StatTable[hash_num].Prealloc )
-		Expand_StatTable_Blocks(hash_num);
+	if ( table->NextElem >= table->Prealloc )
+		Expand_StatTable_Blocks(table);
 
-	record = &(StatTable[hash_num].memblock[StatTable[hash_num].NextBlock][StatTable[hash_num].NextElem]);
-	StatTable[hash_num].NextElem++;
+	record = &(table->memblock[table->NextBlock][table->NextElem]);
+	table->NextElem++;
 	record->next     	= NULL;
 	record->stat_key[0] = value[0];
 	record->stat_key[1] = value[1];
 	record->prot		= prot;
 
-	index = value[1] & StatTable[hash_num].IndexMask;
-	if ( StatTable[hash_num].bucket[index] == NULL ) 
-		StatTable[hash_num].bucket[index] = record;
+	index = index_cache & table->IndexMask;
+	if ( table->bucket[index] == NULL ) 
+		table->bucket[index] = record;
 	else
-		StatTable[hash_num].bucketcache[index]->next = record;
-	StatTable[hash_num].bucketcache[index] = record;
+		table->bucketcache[index]->next = record;
+	table->bucketcache[index] = record;
 	
 	return record;
 
 } // End of stat_hash_insert
 
 void AddStat(common_record_t *raw_record, master_record_t *flow_record ) {
-StatRecord_t		*stat_record;
-uint64_t			value[2][2];
-int	j, i;
 
 	SumRecord.ibyte += flow_record->dOctets;
 	SumRecord.ipkg  += flow_record->dPkts;
@@ -1094,6 +1137,16 @@ int	j, i;
 	SumRecord.opkg  += flow_record->out_pkts;
 	SumRecord.flows += flow_record->aggr_flows ? flow_record->aggr_flows : 1;
 
+	AddTableStat(StatTable, raw_record, flow_record, 0);
+
+} // End of AddStat
+
+void AddTableStat(hash_StatTable *table, common_record_t *raw_record, master_record_t *flow_record, uint64_t seq ) {
+StatRecord_t		*stat_record;
+uint64_t			value[2][2];
+uint32_t			index_cache;
+int	j, i;
+
 	// for every requested -s stat do
 	for ( j=0; j<NumStats; j++ ) {
 		int stat   = StatRequest[j].StatType;
@@ -1114,7 +1167,7 @@ int	j, i;
 			if ( i == 1 && value[0][0] == value[1][0] && value[0][1] == value[1][1] ) {
 				break;
 			}
-			stat_record = stat_hash_lookup(value[i], flow_record->prot, j);
+			stat_record = stat_hash_lookup(&table[j], value[i], flow_record->prot, StatRequest[j].order_proto, &index_cache);
 			if ( stat_record ) {
 				stat_record->counter[INBYTES] 	 += flow_record->dOctets;
 				stat_record->counter[INPACKETS]  += flow_record->dPkts;
@@ -1132,7 +1185,7 @@ int	j, i;
 				stat_record->counter[FLOWS] += flow_record->aggr_flows ? flow_record->aggr_flows : 1;
 
 			} else {
-				stat_record = stat_hash_insert(value[i], flow_record->prot, j);
+				stat_record = stat_hash_insert(&table[j], value[i], flow_record->prot, index_cache);
 		
 				stat_record->counter[INBYTES]   = flow_record->dOctets;
 				stat_record->counter[INPACKETS]	= flow_record->dPkts;
@@ -1144,11 +1197,100 @@ int	j, i;
 				stat_record->msec_last			= flow_record->msec_last;
 				stat_record->record_flags		= flow_record->flags & 0x1;
 				stat_record->counter[FLOWS]		= flow_record->aggr_flows ? flow_record->aggr_flows : 1;
+				// src and dst element of the same record get consecutive numbers
+				stat_record->seq				= (seq << 1) | i;
 			}
 		} // for the number of elements in this stat type
 	} // for every requested -s stat
 
-} // End of AddStat
+} // End of AddTableStat
+
+static int StatSeqCMP(const void *p1, const void *p2) {
+StatRecord_t *r1 = *((StatRecord_t **)p1);
+StatRecord_t *r2 = *((StatRecord_t **)p2);
+
+	if ( r1->seq < r2->seq )
+		return -1;
+	if ( r1->seq > r2->seq )
+		return 1;
+	return 0;
+
+} // End of StatSeqCMP
+
+void MergeStatTables(hash_StatTable **tables, int numTables) {
+StatRecord_t	**list, *r, *stat_record;
+uint32_t		i, b, num, index_cache;
+int				j, hash_num;
+
+	for ( hash_num=0; hash_num<NumStats; hash_num++ ) {
+		num = 0;
+		for ( j=0; j<numTables; j++ ) {
+			hash_StatTable *table = &tables[j][hash_num];
+			num += (table->NextBlock * table->Prealloc) + table->NextElem;
+		}
+		if ( num == 0 )
+			continue;
+
+		list = (StatRecord_t **)malloc(num * sizeof(StatRecord_t *));
+		if ( !list ) {
+			fprintf(stderr, "malloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			exit(255);
+		}
+
+		num = 0;
+		for ( j=0; j<numTables; j++ ) {
+			hash_StatTable *table = &tables[j][hash_num];
+			for ( b=0; b<table->NumBlocks; b++ ) {
+				uint32_t numElem = b == table->NextBlock ? table->NextElem : table->Prealloc;
+				for ( i=0; i<numElem; i++ )
+					list[num++] = &(table->memblock[b][i]);
+			}
+		}
+
+		// insert the elements in the order they were first seen, so the global table
+		// ends up exactly the same as if all records were added sequentially
+		if ( num > 1 )
+			qsort((void *)list, num, sizeof(StatRecord_t *), StatSeqCMP);
+
+		for ( i=0; i<num; i++ ) {
+			r = list[i];
+			stat_record = stat_hash_lookup(&StatTable[hash_num], r->stat_key, r->prot, StatRequest[hash_num].order_proto, &index_cache);
+			if ( stat_record ) {
+				stat_record->counter[INBYTES] 	 += r->counter[INBYTES];
+				stat_record->counter[INPACKETS]  += r->counter[INPACKETS];
+				stat_record->counter[OUTBYTES] 	 += r->counter[OUTBYTES];
+				stat_record->counter[OUTPACKETS] += r->counter[OUTPACKETS];
+				stat_record->counter[FLOWS] 	 += r->counter[FLOWS];
+
+				if ( TimeMsec_CMP(r->first, r->msec_first, stat_record->first, stat_record->msec_first) == 2) {
+					stat_record->first 		= r->first;
+					stat_record->msec_first = r->msec_first;
+				}
+				if ( TimeMsec_CMP(r->last, r->msec_last, stat_record->last, stat_record->msec_last) == 1) {
+					stat_record->last 		= r->last;
+					stat_record->msec_last 	= r->msec_last;
+				}
+			} else {
+				stat_record = stat_hash_insert(&StatTable[hash_num], r->stat_key, r->prot, index_cache);
+				memcpy((void *)stat_record->counter, (void *)r->counter, sizeof(r->counter));
+				stat_record->first    		= r->first;
+				stat_record->msec_first 	= r->msec_first;
+				stat_record->last			= r->last;
+				stat_record->msec_last		= r->msec_last;
+				stat_record->record_flags	= r->record_flags;
+				stat_record->seq			= r->seq;
+			}
+		}
+		free((void *)list);
+	}
+
+	for ( j=0; j<numTables; j++ ) {
+		Dispose_Tables(tables[j]);
+		free((void *)tables[j]);
+		tables[j] = NULL;
+	}
+
+} // End of MergeStatTables
 
 static void PrintStatLine(stat_record_t	*stat, outputParams_t *outputParams, StatRecord_t *StatData, 
 		int type, int order_proto, int inout) {
@@ -1464,7 +1606,6 @@ FlowTableRecord_t	*r;
 master_record_t		*aggr_record_mask;
 SortElement_t 		*SortList;
 uint64_t			value;
-uint32_t 			i;
 uint32_t			maxindex, c;
 char				*string;
 
@@ -1483,36 +1624,33 @@ char				*string;
 		}
 
 		// preset SortList table - still unsorted
-		for ( i=0; i<=FlowTable->IndexMask; i++ ) {
-			r = FlowTable->bucket[i];
-			if ( !r ) 
-				continue;
-
-			// foreach elem in this bucket
-			while ( r ) {
-				// we want to sort only those flows which pass the packet or byte limits
-				if ( byte_limit ) {
-				        value = bytes_record(r, order_mode[PrintOrder].inout);
-					if (( byte_mode == LESS && value >= byte_limit ) ||
-						( byte_mode == MORE && value <= byte_limit ) ) {
-						r = r->next;
-						continue;
-					}
+		// foreach record in insertion order
+		r = FlowTable->first;
+		while ( r ) {
+			// we want to sort only those flows which pass the packet or byte limits
+			if ( byte_limit ) {
+			        value = bytes_record(r, order_mode[PrintOrder].inout);
+				if (( byte_mode == LESS && value >= byte_limit ) ||
+					( byte_mode == MORE && value <= byte_limit ) ) {
+					r = r->next;
+					continue;
 				}
-				if ( packet_limit ) {
-				        value = packets_record(r, order_mode[PrintOrder].inout);
-					if (( packet_mode == LESS && value >= packet_limit ) ||
-						( packet_mode == MORE && value <= packet_limit ) ) {
-						r = r->next;
-						continue;
-					}
+			}
+			if ( packet_limit ) {
+			        value = packets_record(r, order_mode[PrintOrder].inout);
+				if (( packet_mode == LESS && value >= packet_limit ) ||
+					( packet_mode == MORE && value <= packet_limit ) ) {
+					r = r->next;
+					continue;
 				}
-				
-				SortList[c].count  = order_mode[PrintOrder].record_function(r, order_mode[PrintOrder].inout);
-				SortList[c].record = (void *)r;
-				c++;
-				r = r->next;
 			}
+
+			SortList[c].count  = order_mode[PrintOrder].record_function(r, order_mode[PrintOrder].inout);
+			SortList[c].record = (void *)r;
+			SortList[c].key    = (void *)r->hash_key;
+			SortList[c].keysize = FlowTable->keysize;
+			c++;
+			r = r->next;
 		}
 
 		maxindex = c;
@@ -1526,66 +1664,64 @@ char				*string;
 	} else {
 		// print them as they came
 		c = 0;
-		for ( i=0; i<=FlowTable->IndexMask; i++ ) {
-			r = FlowTable->bucket[i];
-			while ( r ) {
-				master_record_t	*flow_record;
-				common_record_t *raw_record;
-				int map_id;
-
-				if ( outputParams->topN && c >= outputParams->topN )
-					return;
-
-				// we want to print only those flows which pass the packet or byte limits
-				if ( byte_limit ) {
-				        value = bytes_record(r, order_mode[PrintOrder].inout);
-					if (( byte_mode == LESS && value >= byte_limit ) ||
-						( byte_mode == MORE && value <= byte_limit ) ) {
-						r = r->next;
-						continue;
-					}
+		r = FlowTable->first;
+		while ( r ) {
+			master_record_t	*flow_record;
+			common_record_t *raw_record;
+			int map_id;
+
+			if ( outputParams->topN && c >= outputParams->topN )
+				return;
+
+			// we want to print only those flows which pass the packet or byte limits
+			if ( byte_limit ) {
+			        value = bytes_record(r, order_mode[PrintOrder].inout);
+				if (( byte_mode == LESS && value >= byte_limit ) ||
+					( byte_mode == MORE && value <= byte_limit ) ) {
+					r = r->next;
+					continue;
 				}
-				if ( packet_limit ) {
-				        value = packets_record(r, order_mode[PrintOrder].inout);
-					if (( packet_mode == LESS && value >= packet_limit ) ||
-						( packet_mode == MORE && value <= packet_limit ) ) {
-						r = r->next;
-						continue;
-					}
+			}
+			if ( packet_limit ) {
+			        value = packets_record(r, order_mode[PrintOrder].inout);
+				if (( packet_mode == LESS && value >= packet_limit ) ||
+					( packet_mode == MORE && value <= packet_limit ) ) {
+					r = r->next;
+					continue;
 				}
+			}
 
-				raw_record = &(r->flowrecord);
-				map_id = r->map_info_ref->map->map_id;
-
-				flow_record = &(extension_map_list->slot[map_id]->master_record);
-				ExpandRecord_v2( raw_record, extension_map_list->slot[map_id], r->exp_ref, flow_record);
-				flow_record->dPkts 		= r->counter[INPACKETS];
-				flow_record->dOctets 	= r->counter[INBYTES];
-				flow_record->out_pkts 	= r->counter[OUTPACKETS];
-				flow_record->out_bytes 	= r->counter[OUTBYTES];
-				flow_record->aggr_flows = r->counter[FLOWS];
-
-				// apply IP mask from aggregation, to provide a pretty output
-				if ( FlowTable->has_masks ) {
-					flow_record->V6.srcaddr[0] &= FlowTable->IPmask[0];
-					flow_record->V6.srcaddr[1] &= FlowTable->IPmask[1];
-					flow_record->V6.dstaddr[0] &= FlowTable->IPmask[2];
-					flow_record->V6.dstaddr[1] &= FlowTable->IPmask[3];
-				}
+			raw_record = &(r->flowrecord);
+			map_id = r->map_info_ref->map->map_id;
+
+			flow_record = &(extension_map_list->slot[map_id]->master_record);
+			ExpandRecord_plan( raw_record, extension_map_list->slot[map_id], r->exp_ref, flow_record);
+			flow_record->dPkts 		= r->counter[INPACKETS];
+			flow_record->dOctets 	= r->counter[INBYTES];
+			flow_record->out_pkts 	= r->counter[OUTPACKETS];
+			flow_record->out_bytes 	= r->counter[OUTBYTES];
+			flow_record->aggr_flows = r->counter[FLOWS];
+
+			// apply IP mask from aggregation, to provide a pretty output
+			if ( FlowTable->has_masks ) {
+				flow_record->V6.srcaddr[0] &= FlowTable->IPmask[0];
+				flow_record->V6.srcaddr[1] &= FlowTable->IPmask[1];
+				flow_record->V6.dstaddr[0] &= FlowTable->IPmask[2];
+				flow_record->V6.dstaddr[1] &= FlowTable->IPmask[3];
+			}
 
-				if ( aggr_record_mask ) {
-					ApplyAggrMask(flow_record, aggr_record_mask);
-				}
+			if ( aggr_record_mask ) {
+				ApplyAggrMask(flow_record, aggr_record_mask);
+			}
 
-				if (NeedSwap(GuessDir, flow_record))
-					SwapFlow(flow_record);
+			if (NeedSwap(GuessDir, flow_record))
+				SwapFlow(flow_record);
 
-				print_record((void *)flow_record, &string, outputParams->doTag);
-				printf("%s\n", string);
+			print_record((void *)flow_record, &string, outputParams->doTag);
+			printf("%s\n", string);
 
-				c++;
-				r = r->next;
-			}
+			c++;
+			r = r->next;
 		}
 	}
 } // End of PrintFlowTable
@@ -1618,38 +1754,35 @@ uint32_t			maxindex, c;
 	}
 
 	// preset SortList table - still unsorted
-	for ( i=0; i<=FlowTable->IndexMask; i++ ) {
-		r = FlowTable->bucket[i];
-		if ( !r ) 
-			continue;
-
-		// foreach elem in this bucket
-		while ( r ) {
-			// we want to sort only those flows which pass the packet or byte limits
-			if ( byte_limit ) {
-			        value = bytes_record(r, order_mode[order_index].inout);
-				if (( byte_mode == LESS && value >= byte_limit ) ||
-					( byte_mode == MORE && value <= byte_limit ) ) {
-					r = r->next;
-					continue;
-				}
+	// foreach record in insertion order
+	r = FlowTable->first;
+	while ( r ) {
+		// we want to sort only those flows which pass the packet or byte limits
+		if ( byte_limit ) {
+		        value = bytes_record(r, order_mode[order_index].inout);
+			if (( byte_mode == LESS && value >= byte_limit ) ||
+				( byte_mode == MORE && value <= byte_limit ) ) {
+				r = r->next;
+				continue;
 			}
-			if ( packet_limit ) {
-			        value = packets_record(r, order_mode[order_index].inout);
-				if (( packet_mode == LESS && value >= packet_limit ) ||
-					( packet_mode == MORE && value <= packet_limit ) ) {
-					r = r->next;
-					continue;
-				}
+		}
+		if ( packet_limit ) {
+		        value = packets_record(r, order_mode[order_index].inout);
+			if (( packet_mode == LESS && value >= packet_limit ) ||
+				( packet_mode == MORE && value <= packet_limit ) ) {
+				r = r->next;
+				continue;
 			}
-			
-			// As we touch each flow in the list here, fill in the values for the first requested stat
-			// often, no more than one stat is requested anyway. This saves time
-			SortList[c].count  = order_mode[order_index].record_function(r, order_mode[order_index].inout);
-			SortList[c].record = (void *)r;
-			c++;
-			r = r->next;
 		}
+
+		// As we touch each flow in the list here, fill in the values for the first requested stat
+		// often, no more than one stat is requested anyway. This saves time
+		SortList[c].count  = order_mode[order_index].record_function(r, order_mode[order_index].inout);
+		SortList[c].record = (void *)r;
+		SortList[c].key    = (void *)r->hash_key;
+		SortList[c].keysize = FlowTable->keysize;
+		c++;
+		r = r->next;
 	}
 
 	maxindex = c;
@@ -1732,7 +1865,7 @@ int	i, max;
 		map_id = r->map_info_ref->map->map_id;
 
 		flow_record = &(extension_map_list->slot[map_id]->master_record);
-		ExpandRecord_v2( raw_record, extension_map_list->slot[map_id], r->exp_ref, flow_record);
+		ExpandRecord_plan( raw_record, extension_map_list->slot[map_id], r->exp_ref, flow_record);
 		flow_record->dPkts 		= r->counter[INPACKETS];
 		flow_record->dOctets 	= r->counter[INBYTES];
 		flow_record->out_pkts 	= r->counter[OUTPACKETS];
@@ -1838,8 +1971,9 @@ int32_t 		i, j, hash_num, order_index;
 
 static SortElement_t *StatTopN(int topN, uint32_t *count, int hash_num, int order, int direction) {
 SortElement_t 		*topN_list;
+hash_StatTable		*table;
 StatRecord_t		*r;
-unsigned int		i;
+unsigned int		i, b;
 uint64_t			value;
 uint32_t	   		c, maxindex;
 
@@ -1853,19 +1987,18 @@ uint32_t	   		c, maxindex;
 
 	// preset topN_list table - still unsorted
 	c = 0;
-	// Iterate through all buckets
-	for ( i=0; i <= StatTable[hash_num].IndexMask; i++ ) {
-		r = StatTable[hash_num].bucket[i];
-		// foreach elem in this bucket
-		while ( r ) {
-			// next elem in bucket
+	// Iterate through all records in insertion order
+	table = &StatTable[hash_num];
+	for ( b=0; b<table->NumBlocks; b++ ) {
+		uint32_t numElem = b == table->NextBlock ? table->NextElem : table->Prealloc;
+		for ( i=0; i<numElem; i++ ) {
+			r = &(table->memblock[b][i]);
 
 			// we want to sort only those flows which pass the packet or byte limits
 			if ( byte_limit ) {
 			        value = bytes_element(r, order_mode[order].inout);
 				if (( byte_mode == LESS && value >= byte_limit ) ||
 					( byte_mode == MORE && value <= byte_limit ) ) {
-					r = r->next;
 					continue;
 				}
 			}
@@ -1873,14 +2006,15 @@ uint32_t	   		c, maxindex;
 			        value = packets_element(r, order_mode[order].inout);
 				if (( packet_mode == LESS && value >= packet_limit ) ||
 					( packet_mode == MORE && value <= packet_limit ) ) {
-					r = r->next;
 					continue;
 				}
 			}
 
 			topN_list[c].count  = order_mode[order].element_function(r, order_mode[order].inout);
 			topN_list[c].record = (void *)r;
-			r = r->next;
+			// the key of a stat record: the protocol followed by the element value
+			topN_list[c].key   = (void *)&r->prot;
+			topN_list[c].keysize = (char *)&r->stat_key[2] - (char *)&r->prot;
 			c++;
 		} // foreach element
 	}
@@ -76,6 +76,8 @@ typedef struct StatRecord {
 	// key 
 	uint8_t		prot;
 	uint64_t	stat_key[2];
+	// sequence number of the first record - used to merge thread local tables
+	uint64_t	seq;
 } StatRecord_t;
 
 typedef struct hash_StatTable {
@@ -84,6 +86,8 @@ typedef struct hash_StatTable {
 	uint32_t			IndexMask;		/* Mask which corresponds to NumBits */
 	StatRecord_t 		**bucket;		/* Hash entry point: points to elements in the stat block */
 	StatRecord_t 		**bucketcache;	/* in case of index collisions, this array points to the last element with that index */
+	int					hash_type;		/* hash function and seed - see hash_inline.c */
+	uint64_t			hash_seed;
 
 	/* memory management */
 	/* memory blocks - containing the stat records */
@@ -99,6 +103,9 @@ typedef struct hash_StatTable {
 typedef struct SortElement {
 	void 		*record;
     uint64_t	count;
+	// records with the same count are sorted by key
+	void		*key;
+	uint32_t	keysize;
 } SortElement_t;
 
 #define ASCENDING 1
@@ -122,12 +129,18 @@ int Init_StatTable(uint16_t NumBits, uint32_t Prealloc);
 
 void Dispose_StatTable(void);
 
+hash_StatTable *New_StatTable(void);
+
+void MergeStatTables(hash_StatTable **tables, int numTables);
+
 int SetStat(char *str, int *element_stat, int *flow_stat);
 
 int Parse_PrintOrder(char *order);
 
 void AddStat(common_record_t *raw_record, master_record_t *flow_record );
 
+void AddTableStat(hash_StatTable *table, common_record_t *raw_record, master_record_t *flow_record, uint64_t seq );
+
 void PrintFlowTable(printer_t print_record, outputParams_t *outputParams, int GuessDir, extension_map_list_t *extension_map_list);
 
 void PrintFlowStat(func_prolog_t record_header, printer_t print_record, outputParams_t *outputParams, extension_map_list_t *extension_map_list);
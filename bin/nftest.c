@@ -79,12 +79,17 @@ FilterEngine_t *Engine;
 /* exported fuctions */
 int check_filter_block(char *filter, master_record_t *flow_record, int expect);
 
+void check_filter_set(char **filter, master_record_t *flow_record);
+
 void check_offset(char *text, pointer_addr_t offset, pointer_addr_t expect);
 
 void CheckCompression(char *filename);
 
+int CheckAsyncWriter(char *filename);
+
 int check_filter_block(char *filter, master_record_t *flow_record, int expect) {
-int ret, i;
+int ret, tree_ret, i;
+char		*label;
 uint64_t	*block = (uint64_t *)flow_record;
 
 	Engine = CompileFilter(filter);
@@ -94,6 +99,19 @@ uint64_t	*block = (uint64_t *)flow_record;
 
 	Engine->nfrecord = (uint64_t *)flow_record;
 	ret =  (*Engine->FilterEngine)(Engine);
+	label = Engine->label;
+
+	// compiled filter program and tree interpreter must agree
+	if ( Engine->program ) {
+		tree_ret = Engine->Extended ? RunExtendedFilter(Engine) : RunFilter(Engine);
+		if ( tree_ret != ret || Engine->label != label ) {
+			printf("**** FAILED **** Program and tree differ: %i/%i, label: %s/%s Filter: '%s'\n", 
+				ret, tree_ret, label ? label : "<none>", Engine->label ? Engine->label : "<none>", filter);
+			DumpEngine(Engine);
+			exit(255);
+		}
+	}
+
 	if ( ret == expect ) {
 		printf("Success: Startnode: %i Numblocks: %i Extended: %i Filter: '%s'\n", Engine->StartNode, nblocks(), Engine->Extended, filter);
 	} else {
@@ -112,6 +130,39 @@ uint64_t	*block = (uint64_t *)flow_record;
 	return (ret == expect);
 }
 
+void check_filter_set(char **filter, master_record_t *flow_record) {
+FilterEngine_t	*engine[64];
+FilterSet_t		*set;
+int i, num, match, matched;
+
+	for ( num=0; filter[num]; num++ ) {
+		engine[num] = CompileFilter(filter[num]);
+		if ( !engine[num] ) {
+			exit(254);
+		}
+	}
+
+	// the filter set must match the same engines as each engine on its own
+	set = CompileFilterSet(engine, num);
+	matched = RunFilterSet(set, (uint64_t *)flow_record);
+	for ( i=0; i<num; i++ ) {
+		engine[i]->nfrecord = (uint64_t *)flow_record;
+		match = (*engine[i]->FilterEngine)(engine[i]);
+		if ( match != ((set->bitmap[0] >> i) & 1) ) {
+			printf("**** FAILED **** Filter set differs: %i/%i Filter: '%s'\n", 
+				(int)((set->bitmap[0] >> i) & 1), match, filter[i]);
+			exit(255);
+		}
+		matched -= match;
+	}
+	if ( matched != 0 ) {
+		printf("**** FAILED **** Filter set match count differs\n");
+		exit(255);
+	}
+	printf("Success: Filter set: %i filters, %i predicates\n", num, set->NumPredicates);
+
+} // End of check_filter_set
+
 void check_offset(char *text, pointer_addr_t offset, pointer_addr_t expect) {
 
 	if ( offset == expect ) {
@@ -204,6 +255,158 @@ uint32_t recsize[4];
 
 } // End of CheckCompression
 
+/*
+ * Write flows with the async writer in drop mode, while the writer falls behind 
+ * compressing the blocks. Each block defines a new extension map in the middle of
+ * the block, which is still used by the flows at the beginning of the next block.
+ * Check, that no map is lost and the stat record matches the flows in the file.
+ */
+#define ASYNC_BLOCKS	16
+#define ASYNC_MAPFLOW	1000
+int CheckAsyncWriter(char *filename) {
+nffile_t		*nffile;
+writer_stat_t	writer_stat;
+stat_record_t	*stat_record, stat;
+extension_map_t	*map;
+common_record_t	*flow_record;
+record_header_t	*record;
+uint8_t			*map_valid;
+uint32_t		*p, i, j, map_size, flow_size;
+uint64_t		numflows, numpackets, numbytes;
+int				ret;
+
+	InitExtensionMaps(NO_EXTENSION_LIST);
+
+	SetAsyncWriter(1, 1);
+	nffile = OpenNewFile(filename, NULL, BZ2_COMPRESSED, 0, NULL);
+	SetAsyncWriter(0, 0);
+	if ( !nffile ) {
+		printf("**** FAILED **** Async writer: can not open '%s'\n", filename);
+		return 255;
+	}
+	stat_record = nffile->stat_record;
+
+	map_size  = (sizeof(extension_map_t) + 2 * sizeof(uint16_t) + 3) & ~3;
+	flow_size = COMMON_RECORD_DATA_SIZE + 6 * sizeof(uint32_t);
+	for ( i=0; i<=ASYNC_BLOCKS; i++ ) {
+		j = 0;
+		while ( (nffile->block_header->size + map_size + flow_size) <= WRITE_BUFFSIZE ) {
+			if ( (i == 0 && j == 0) || j == ASYNC_MAPFLOW ) {
+				map = (extension_map_t *)nffile->buff_ptr;
+				map->type	= ExtensionMapType;
+				map->size	= map_size;
+				map->map_id	= j ? i + 1 : i;
+				map->extension_size = 2 * sizeof(uint32_t);
+				map->ex_id[0] = EX_OUT_PKG_4;
+				map->ex_id[1] = EX_OUT_BYTES_4;
+				map->ex_id[2] = 0;
+				nffile->buff_ptr = (void *)((pointer_addr_t)nffile->buff_ptr + map_size);
+				nffile->block_header->size += map_size;
+				nffile->block_header->NumRecords++;
+			}
+
+			flow_record = (common_record_t *)nffile->buff_ptr;
+			memset((void *)flow_record, 0, flow_size);
+			flow_record->type	 = CommonRecordType;
+			flow_record->size	 = flow_size;
+			flow_record->ext_map = j < ASYNC_MAPFLOW ? i : i + 1;
+			flow_record->first	 = 1000000 + i;
+			flow_record->last	 = 1000010 + i;
+			flow_record->prot	 = (j & 1) ? IPPROTO_UDP : IPPROTO_TCP;
+			p = flow_record->data;
+			p[0] = 0x0a000001;
+			p[1] = 0x0a000002 + j;
+			p[2] = j + 1;			// packets
+			p[3] = 100 * (j + 1);	// bytes
+			p[4] = 2;				// out packets
+			p[5] = 200;				// out bytes
+
+			stat_record->numflows++;
+			stat_record->numpackets += p[2] + p[4];
+			stat_record->numbytes	+= p[3] + p[5];
+			if ( flow_record->prot == IPPROTO_TCP ) {
+				stat_record->numflows_tcp++;
+				stat_record->numpackets_tcp += p[2] + p[4];
+				stat_record->numbytes_tcp	+= p[3] + p[5];
+			} else {
+				stat_record->numflows_udp++;
+				stat_record->numpackets_udp += p[2] + p[4];
+				stat_record->numbytes_udp	+= p[3] + p[5];
+			}
+
+			nffile->buff_ptr = (void *)((pointer_addr_t)nffile->buff_ptr + flow_size);
+			nffile->block_header->size += flow_size;
+			nffile->block_header->NumRecords++;
+			j++;
+		}
+		if ( WriteBlock(nffile) <= 0 ) {
+			printf("**** FAILED **** Async writer: write block: %s\n", strerror(errno));
+			return 255;
+		}
+	}
+
+	GetWriterStat(nffile, &writer_stat);
+	CloseUpdateFile(nffile, NULL);
+	DisposeFile(nffile);
+
+	if ( writer_stat.dropped_blocks == 0 ) {
+		printf("**** FAILED **** Async writer: no flows dropped\n");
+		return 255;
+	}
+
+	// read back the file
+	nffile = OpenFile(filename, NULL);
+	map_valid = calloc(MAX_EXTENSION_MAPS, sizeof(uint8_t));
+	if ( !nffile || !map_valid ) {
+		printf("**** FAILED **** Async writer: can not read '%s'\n", filename);
+		return 255;
+	}
+
+	numflows = numpackets = numbytes = 0;
+	while ( (ret = ReadBlock(nffile)) > 0 ) {
+		record = (record_header_t *)nffile->buff_ptr;
+		for ( i=0; i<nffile->block_header->NumRecords; i++ ) {
+			if ( record->type == ExtensionMapType ) {
+				map_valid[((extension_map_t *)record)->map_id] = 1;
+			} else if ( record->type == CommonRecordType ) {
+				flow_record = (common_record_t *)record;
+				if ( !map_valid[flow_record->ext_map] ) {
+					printf("**** FAILED **** Async writer: missing extension map %u\n", flow_record->ext_map);
+					return 255;
+				}
+				p = flow_record->data;
+				numflows++;
+				numpackets += p[2] + p[4];
+				numbytes   += p[3] + p[5];
+			}
+			record = (record_header_t *)((pointer_addr_t)record + record->size);
+		}
+	}
+	stat = *nffile->stat_record;
+	CloseFile(nffile);
+	DisposeFile(nffile);
+	free(map_valid);
+
+	if ( ret < 0 ) {
+		printf("**** FAILED **** Async writer: read error\n");
+		return 255;
+	}
+
+	if ( numflows != stat.numflows || numpackets != stat.numpackets || numbytes != stat.numbytes ||
+		 numflows != (stat.numflows_tcp + stat.numflows_udp) ) {
+		printf("**** FAILED **** Async writer: stat flows: %llu, packets: %llu, bytes: %llu - file flows: %llu, packets: %llu, bytes: %llu\n",
+			(unsigned long long)stat.numflows, (unsigned long long)stat.numpackets, 
+			(unsigned long long)stat.numbytes, (unsigned long long)numflows, 
+			(unsigned long long)numpackets, (unsigned long long)numbytes);
+		return 255;
+	}
+
+	printf("Success: Async writer dropped %llu flows in %u blocks, %llu flows written\n", 
+		(unsigned long long)writer_stat.dropped_records, writer_stat.dropped_blocks, (unsigned long long)numflows);
+	return 0;
+
+} // End of CheckAsyncWriter
+
 int main(int argc, char **argv) {
 master_record_t flow_record;
 common_record_t c_record;
@@ -253,6 +456,9 @@ void *p;
 		exit(255);
 	}
 
+	if ( argc == 3 && strcmp(argv[1], "-W") == 0 ) 
+		exit(CheckAsyncWriter(argv[2]));
+
 	if ( argc == 2 ) {
 		CheckCompression(argv[1]);
 		exit(0);
@@ -483,6 +689,11 @@ void *p;
 	ret = check_filter_block("src ip in [10.10.10.11 172.32.7.0/24]", &flow_record, 1);
 	ret = check_filter_block("src ip in [172.32.7.16 172.32.6.0/24]", &flow_record, 1);
 	ret = check_filter_block("src ip in [10.10.10.11 172.32.6.0/24]", &flow_record, 0);
+	ret = check_filter_block("src ip in [10.0.0.0/8 172.32.0.0/16 10.10.10.11 172.32.6.0/24]", &flow_record, 1);
+	ret = check_filter_block("src ip in [10.0.0.0/8 172.33.0.0/16 10.10.10.11 172.32.7.17 172.32.6.0/24]", &flow_record, 0);
+	ret = check_filter_block("src ip in [0.0.0.0/0]", &flow_record, 1);
+	ret = check_filter_block("src ip in [fe80::/16 172.32.7.16/32]", &flow_record, 1);
+	ret = check_filter_block("src ip in [fe80::/16 172.32.7.17/32]", &flow_record, 0);
 
 	flow_record.srcport = 63;
 	flow_record.dstport = 255;
@@ -525,6 +736,10 @@ void *p;
 	ret = check_filter_block("port in [ 62 63 64 254 256 ]", &flow_record, 1);
 	ret = check_filter_block("port in [ 62 64 254 256 ]", &flow_record, 0);
 	ret = check_filter_block("not port in [ 62 64 254 256 ]", &flow_record, 1);
+	ret = check_filter_block("src port in [ 1 2 3 5 8 13 21 34 55 63 89 144 233 377 610 987 ]", &flow_record, 1);
+	ret = check_filter_block("src port in [ 1 2 3 5 8 13 21 34 55 62 64 89 144 233 377 610 987 ]", &flow_record, 0);
+	ret = check_filter_block("src port in [ 63 ]", &flow_record, 1);
+	ret = check_filter_block("src port in [ 64 ]", &flow_record, 0);
 
 	flow_record.srcas = 123;
 	flow_record.dstas = 456;
@@ -840,6 +1055,22 @@ void *p;
 	ret = check_filter_block("ident none", &flow_record, 0);
 	ret = check_filter_block("not ident none", &flow_record, 1);
 
+	// profile like channel filters with shared predicates
+	{
+		char *filter[] = {
+			"(ident channel0 or ident channel1) and (proto tcp)",
+			"(ident channel0 or ident channel1) and (proto udp)",
+			"(ident channel1) and (proto tcp and src port 63)",
+			"(ident channel1) and (src ip in [172.32.7.16 10.0.0.0/8] or dst port in [ 1 2 3 255 ])",
+			"(ident channel1) and not (src ip in [172.32.7.16 10.0.0.0/8])",
+			"(ident channel2) and (any)",
+			"(ident channel1) and (bpp > 19 and not proto icmp)",
+			"(ident channel0 or ident channel1) and (proto udp)",
+			NULL
+		};
+		check_filter_set(filter, &flow_record);
+	}
+
 	// vlan labels
 	flow_record.src_vlan = 0;
 	flow_record.dst_vlan = 0;
@@ -48,6 +48,8 @@
 #include "ipconv.h"
 #include "nftree.h"
 
+#include "hash_inline.c"
+
 // #include "grammar.h"
 
 /*
@@ -71,6 +73,12 @@ static char		**IdentList;
 
 static void UpdateList(uint32_t a, uint32_t b);
 
+static FilterProgram_t *CompileProgram(FilterEngine_t *engine);
+
+static void *CompileIPList(IPlist_t *root);
+
+static void *CompileULList(ULongtree_t *root);
+
 /* flow processing functions */
 static inline void pps_function(uint64_t *record_data, uint64_t *comp_values);
 static inline void bps_function(uint64_t *record_data, uint64_t *comp_values);
@@ -80,25 +88,66 @@ static inline void mpls_eos_function(uint64_t *record_data, uint64_t *comp_value
 static inline void mpls_any_function(uint64_t *record_data, uint64_t *comp_values);
 static inline void pblock_function(uint64_t *record_data, uint64_t *comp_values);
 
+#ifdef NSEL
+#define PBLOCK_OFFSET	OffsetPortBlock
+#define PBLOCK_WORDS	1
+#else
+#define PBLOCK_OFFSET	0
+#define PBLOCK_WORDS	0
+#endif
+
 /* 
  * flow processing function table:
  * order of entries must correspond with filter functions enum in nftree.h 
+ * offset/words: record words read by the function in addition to the common
+ * record and the required extensions
  */
 static struct flow_procs_map_s {
 	char		*name;
 	flow_proc_t function;
+	uint32_t	offset;
+	uint32_t	words;
 } flow_procs_map[] = {
-	{"none",		NULL},
-	{"pps",			pps_function},
-	{"bps",			bps_function},
-	{"bpp",			bpp_function},
-	{"duration",	duration_function},
-	{"mpls eos",	mpls_eos_function},
-	{"mpls any",	mpls_any_function},
- 	{"pblock", 		pblock_function},
-	{NULL,			NULL}
+	{"none",		NULL, 0, 0},
+	{"pps",			pps_function, 0, 0},
+	{"bps",			bps_function, 0, 0},
+	{"bpp",			bpp_function, 0, 0},
+	{"duration",	duration_function, 0, 0},
+	{"mpls eos",	mpls_eos_function, OffsetMPLS12, 5},
+	{"mpls any",	mpls_any_function, OffsetMPLS12, 5},
+ 	{"pblock", 		pblock_function, PBLOCK_OFFSET, PBLOCK_WORDS},
+	{NULL,			NULL, 0, 0}
 };
 
+/*
+ * Compiled IP list for the filter program:
+ * all list entries with the same prefix mask are stored in one open addressing
+ * hash set. A lookup masks the IP and probes each set once, so the cost depends
+ * on the number of different prefix lengths only - not on the size of the list.
+ * Key 0/0 marks an empty slot - a 0/0 key is flagged with has_zero.
+ */
+typedef struct IPListSet_s {
+	uint64_t	mask[2];		// prefix mask of all entries in this set
+	uint32_t	IndexMask;
+	uint32_t	NumEntries;
+	int			has_zero;		// key 0/0 is element of the set
+	uint64_t	*key;			// 2 uint64_t per slot
+} IPListSet_t;
+
+typedef struct IPListTable_s {
+	uint32_t	NumSets;
+	IPListSet_t	*set;
+} IPListTable_t;
+
+/*
+ * Compiled value list for the filter program:
+ * sorted array searched with a branchless binary search
+ */
+typedef struct ULListArray_s {
+	uint32_t	NumValues;
+	uint64_t	*value;
+} ULListArray_t;
+
 uint64_t *IPstack = NULL;
 uint32_t StartNode;
 uint16_t Extended;
@@ -196,7 +245,10 @@ int	ret;
 	engine->Extended  = Extended;
 	engine->IdentList = IdentList;
 	engine->filter 	  = FilterTree;
-	if ( Extended ) 
+	engine->program	  = CompileProgram(engine);
+	if ( engine->program )
+		engine->FilterEngine = RunFilterProgram;
+	else if ( Extended ) 
 		engine->FilterEngine = RunExtendedFilter;
 	else
 		engine->FilterEngine = RunFilter;
@@ -368,6 +420,270 @@ static void UpdateList(uint32_t a, uint32_t b) {
 
 } /* End of UpdateList */
 
+/*
+ * Lower the filter tree into a flat filter program. The nodes are placed
+ * depth first along the OnTrue path, so a matching record mostly walks
+ * the program sequentially. Returns NULL, if the tree can not be compiled.
+ * The tree interpreter is used in that case.
+ */
+static FilterProgram_t *CompileProgram(FilterEngine_t *engine) {
+FilterProgram_t	*program;
+FilterBlock_t	*block;
+FilterInstr_t	*instr;
+uint32_t		*map, *node, *stack;
+uint32_t		i, n, sp, index;
+
+	program = (FilterProgram_t *)calloc(1, sizeof(FilterProgram_t));
+	map		= (uint32_t *)calloc(NumBlocks, sizeof(uint32_t));
+	node	= (uint32_t *)calloc(NumBlocks + PROG_START, sizeof(uint32_t));
+	stack	= (uint32_t *)malloc((2 * NumBlocks + 1) * sizeof(uint32_t));
+	program->instr = (FilterInstr_t *)calloc(NumBlocks + PROG_START, sizeof(FilterInstr_t));
+	if ( !program || !map || !node || !stack || !program->instr ) {
+		fprintf(stderr, "Memory allocation error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	// assign instruction slots - OnFalse is pushed first, so OnTrue is placed next
+	n  = PROG_START;
+	sp = 0;
+	stack[sp++] = engine->StartNode;
+	while ( sp ) {
+		index = stack[--sp];
+		if ( index == 0 || map[index] )
+			continue;
+		map[index] = n;
+		node[n++]  = index;
+		stack[sp++] = engine->filter[index].OnFalse;
+		stack[sp++] = engine->filter[index].OnTrue;
+	}
+	program->NumInstr = n;
+	program->start	  = engine->StartNode ? PROG_START : PROG_FALSE;
+
+	for ( i=PROG_START; i<n; i++ ) {
+		block = &engine->filter[node[i]];
+		instr = &program->instr[i];
+
+		instr->offset	= block->offset;
+		instr->mask		= block->mask;
+		instr->value	= block->value;
+		instr->label	= block->label;
+		instr->data		= block->data;
+		instr->function = block->function;
+
+		// a jump to node 0 terminates the tree with the - possibly inverted - result
+		instr->OnTrue  = block->OnTrue  ? map[block->OnTrue]  : ( block->invert ? PROG_FALSE : PROG_TRUE );
+		instr->OnFalse = block->OnFalse ? map[block->OnFalse] : ( block->invert ? PROG_TRUE : PROG_FALSE );
+
+		switch (block->comp) {
+			case CMP_EQ:
+				instr->op = block->mask == 0xffffffffffffffffLL ? OP_EQ64 : OP_EQ;
+				break;
+			case CMP_GT:
+				instr->op = OP_GT;
+				break;
+			case CMP_LT:
+				instr->op = OP_LT;
+				break;
+			case CMP_FLAGS:
+				// inverted flags match any of the flags
+				instr->op = block->invert ? OP_ANY : OP_EQ;
+				break;
+			case CMP_IDENT:
+				instr->op	= OP_IDENT;
+				instr->data = engine->IdentList[block->value];
+				break;
+			case CMP_IPLIST:
+				instr->op	= OP_IPLIST;
+				instr->data = CompileIPList((IPlist_t *)block->data);
+				break;
+			case CMP_ULLIST:
+				instr->op	= OP_ULLIST;
+				instr->data = CompileULList((ULongtree_t *)block->data);
+				break;
+			default:
+				instr->op = 0xFFFF;
+		}
+
+		if ( block->function ) {
+			// the function calculates the value to compare
+			instr->comp = instr->op == OP_EQ64 ? OP_EQ : instr->op;
+			instr->op	= OP_FUNCTION;
+			if ( instr->comp > OP_ANY )
+				instr->op = 0xFFFF;
+		}
+
+		if ( instr->op == 0xFFFF ) {
+			// unknown comperator - leave it to the tree interpreter
+			free(program->instr);
+			free(program);
+			program = NULL;
+			break;
+		}
+	}
+
+	free(map);
+	free(node);
+	free(stack);
+
+	return program;
+
+} // End of CompileProgram
+
+static inline uint32_t IPListHash(uint64_t *ip) {
+	return MX64Hash(ip, 2, 0);
+} // End of IPListHash
+
+static void IPListSetInsert(IPListSet_t *set, uint64_t *ip) {
+uint32_t index;
+
+	if ( ip[0] == 0 && ip[1] == 0 ) {
+		set->has_zero = 1;
+		return;
+	}
+
+	index = IPListHash(ip) & set->IndexMask;
+	while ( set->key[2*index] || set->key[2*index+1] ) {
+		// duplicate entry
+		if ( set->key[2*index] == ip[0] && set->key[2*index+1] == ip[1] )
+			return;
+		index = (index + 1) & set->IndexMask;
+	}
+	set->key[2*index]	= ip[0];
+	set->key[2*index+1] = ip[1];
+
+} // End of IPListSetInsert
+
+static void *CompileIPList(IPlist_t *root) {
+IPListTable_t			*list;
+IPListSet_t			*set;
+struct IPListNode	*node;
+uint32_t			i, size;
+
+	list = (IPListTable_t *)calloc(1, sizeof(IPListTable_t));
+	if ( !list ) {
+		fprintf(stderr, "Memory allocation error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	// count the entries of each prefix mask
+	RB_FOREACH(node, IPtree, root) {
+		for ( i=0; i<list->NumSets; i++ ) {
+			if ( list->set[i].mask[0] == node->mask[0] && list->set[i].mask[1] == node->mask[1] )
+				break;
+		}
+		if ( i == list->NumSets ) {
+			list->set = (IPListSet_t *)realloc(list->set, (list->NumSets + 1) * sizeof(IPListSet_t));
+			if ( !list->set ) {
+				fprintf(stderr, "Memory allocation error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+				exit(255);
+			}
+			memset((void *)&list->set[i], 0, sizeof(IPListSet_t));
+			list->set[i].mask[0] = node->mask[0];
+			list->set[i].mask[1] = node->mask[1];
+			list->NumSets++;
+		}
+		list->set[i].NumEntries++;
+	}
+
+	// size each set for a load factor below 50%
+	for ( i=0; i<list->NumSets; i++ ) {
+		set = &list->set[i];
+		size = 4;
+		while ( size < 2 * set->NumEntries )
+			size <<= 1;
+		set->IndexMask = size - 1;
+		set->key = (uint64_t *)calloc(2 * size, sizeof(uint64_t));
+		if ( !set->key ) {
+			fprintf(stderr, "Memory allocation error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			exit(255);
+		}
+	}
+
+	RB_FOREACH(node, IPtree, root) {
+		uint64_t ip[2];
+		for ( i=0; i<list->NumSets; i++ ) {
+			if ( list->set[i].mask[0] == node->mask[0] && list->set[i].mask[1] == node->mask[1] )
+				break;
+		}
+		ip[0] = node->ip[0] & node->mask[0];
+		ip[1] = node->ip[1] & node->mask[1];
+		IPListSetInsert(&list->set[i], ip);
+	}
+
+	return (void *)list;
+
+} // End of CompileIPList
+
+static inline int IPListFind(IPListTable_t *list, uint64_t *nfrecord) {
+IPListSet_t *set;
+uint64_t	ip[2];
+uint32_t	i, index;
+
+	for ( i=0; i<list->NumSets; i++ ) {
+		set = &list->set[i];
+		ip[0] = nfrecord[0] & set->mask[0];
+		ip[1] = nfrecord[1] & set->mask[1];
+		if ( ip[0] == 0 && ip[1] == 0 ) {
+			if ( set->has_zero )
+				return 1;
+			continue;
+		}
+		index = IPListHash(ip) & set->IndexMask;
+		while ( set->key[2*index] || set->key[2*index+1] ) {
+			if ( set->key[2*index] == ip[0] && set->key[2*index+1] == ip[1] )
+				return 1;
+			index = (index + 1) & set->IndexMask;
+		}
+	}
+	return 0;
+
+} // End of IPListFind
+
+static void *CompileULList(ULongtree_t *root) {
+ULListArray_t				*list;
+struct ULongListNode	*node;
+
+	list = (ULListArray_t *)calloc(1, sizeof(ULListArray_t));
+	if ( !list ) {
+		fprintf(stderr, "Memory allocation error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	RB_FOREACH(node, ULongtree, root) 
+		list->NumValues++;
+
+	list->value = (uint64_t *)malloc((list->NumValues + 1) * sizeof(uint64_t));
+	if ( !list->value ) {
+		fprintf(stderr, "Memory allocation error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	// the tree walk returns the values in ascending order
+	list->NumValues = 0;
+	RB_FOREACH(node, ULongtree, root) 
+		list->value[list->NumValues++] = node->value;
+
+	return (void *)list;
+
+} // End of CompileULList
+
+static inline int ULListFind(ULListArray_t *list, uint64_t value) {
+uint64_t	*base = list->value;
+uint32_t	n = list->NumValues;
+
+	if ( n == 0 )
+		return 0;
+
+	// branchless binary search - compiles to conditional moves
+	while ( n > 1 ) {
+		uint32_t half = n >> 1;
+		base = base[half] <= value ? base + half : base;
+		n -= half;
+	}
+	return *base == value;
+
+} // End of ULListFind
+
 /*
  * Dump Filterlist 
  */
@@ -413,6 +729,17 @@ uint32_t i, j;
 		printf("\n");
 	}
 	printf("NumBlocks: %i\n", NumBlocks - 1);
+	if ( engine->program ) {
+		FilterProgram_t *program = engine->program;
+		printf("Program: %u instructions, start: %u\n", program->NumInstr - PROG_START, program->start);
+		for (i=PROG_START; i<program->NumInstr; i++ ) {
+			FilterInstr_t *instr = &program->instr[i];
+			printf("%4u: Op: %u, Comp: %u, Offset: %u, Mask: %.16llx, Value: %.16llx, OnTrue: %u, OnFalse: %u\n",
+				i, instr->op, instr->comp, instr->offset, (unsigned long long)instr->mask, 
+				(unsigned long long)instr->value, instr->OnTrue, instr->OnFalse);
+		}
+	} else 
+		printf("Program: none - tree interpreter\n");
 	for ( i=0; i<NumIdents; i++ ) {
 		printf("Ident %i: %s\n", i, IdentList[i]);
 	}
@@ -517,6 +844,528 @@ int	evaluate, invert;
 
 } /* End of RunExtendedFilter */
 
+/* evaluate a single instruction of a filter program */
+static inline int EvalInstr(FilterInstr_t *instr, uint64_t *nfrecord) {
+
+	switch (instr->op) {
+		case OP_EQ:
+			return ( nfrecord[instr->offset] & instr->mask ) == instr->value;
+		case OP_EQ64:
+			return nfrecord[instr->offset] == instr->value;
+		case OP_GT:
+			return ( nfrecord[instr->offset] & instr->mask ) > instr->value;
+		case OP_LT:
+			return ( nfrecord[instr->offset] & instr->mask ) < instr->value;
+		case OP_ANY:
+			return ( nfrecord[instr->offset] & instr->mask ) != 0;
+		case OP_IDENT:
+			return strncmp(CurrentIdent, (char *)instr->data, IDENTLEN) == 0 ;
+		case OP_IPLIST:
+			return IPListFind((IPListTable_t *)instr->data, &nfrecord[instr->offset]);
+		case OP_ULLIST:
+			return ULListFind((ULListArray_t *)instr->data, nfrecord[instr->offset] & instr->mask);
+		case OP_FUNCTION: {
+			uint64_t comp_value[2];
+			comp_value[0] = nfrecord[instr->offset] & instr->mask;
+			comp_value[1] = instr->value;
+			instr->function(nfrecord, comp_value);
+			switch (instr->comp) {
+				case OP_EQ:
+					return comp_value[0] == comp_value[1];
+				case OP_GT:
+					return comp_value[0] > comp_value[1];
+				case OP_LT:
+					return comp_value[0] < comp_value[1];
+				default:	// OP_ANY
+					return comp_value[0] > 0;
+			}
+			} break;
+	}
+	return 0;
+
+} // End of EvalInstr
+
+/* compiled filter program */
+int RunFilterProgram(FilterEngine_t *engine) {
+FilterInstr_t	*instr;
+uint64_t		*nfrecord = engine->nfrecord;
+uint32_t		index;
+
+	engine->label = NULL;
+	index = engine->program->start;
+	while ( index >= PROG_START ) {
+		instr = &engine->program->instr[index];
+
+		// same label evaluation as RunExtendedFilter()
+		if ( EvalInstr(instr, nfrecord) ) {
+			if ( instr->label )
+				engine->label = instr->label;
+			index = instr->OnTrue;
+		} else {
+			engine->label = NULL;
+			index = instr->OnFalse;
+		}
+	}
+	return index;
+
+} /* End of RunFilterProgram */
+
+/*
+ * Zone of a data block: returns 0, if the instruction is false for all flows of the block.
+ * Returns 1, if the instruction may be true for any flow.
+ */
+static int ZoneInstr(FilterInstr_t *instr, void *data) {
+block_zone_t *zone = (block_zone_t *)data;
+uint64_t	*bitmap, value;
+uint32_t	i;
+
+	switch (instr->op) {
+		case OP_EQ:
+		case OP_EQ64:
+		case OP_GT:
+		case OP_LT:
+			break;
+		case OP_ULLIST: {
+			// port lists
+			ULListArray_t *list = (ULListArray_t *)instr->data;
+			if ( instr->offset != OffsetPort || (instr->mask != MaskSrcPort && instr->mask != MaskDstPort) )
+				return 1;
+			bitmap = instr->mask == MaskSrcPort ? zone->srcport : zone->dstport;
+			for ( i=0; i<list->NumValues; i++ ) {
+				uint32_t port = instr->mask == MaskSrcPort ? list->value[i] >> ShiftSrcPort : list->value[i] >> ShiftDstPort;
+				if ( ZONE_TEST_BIT(bitmap, ZONE_PORT_BIT(port)) ) 
+					return 1;
+			}
+			return 0;
+			} break;
+		default:
+			return 1;
+	}
+
+	// IP address words: the masked value of a prefix mask keeps the order of the values
+	if ( instr->offset >= OffsetSrcIPv6a && instr->offset <= OffsetDstIPv6b && (~instr->mask & (~instr->mask + 1)) == 0 ) {
+		uint32_t k = instr->offset - OffsetSrcIPv6a;
+		uint64_t min = zone->ip_min[k] & instr->mask;
+		uint64_t max = zone->ip_max[k] & instr->mask;
+		switch (instr->op) {
+			case OP_GT:
+				return max > instr->value;
+			case OP_LT:
+				return min < instr->value;
+			default:
+				return instr->value >= min && instr->value <= max;
+		}
+	}
+
+	if ( instr->op == OP_GT || instr->op == OP_LT ) 
+		return 1;
+
+	value = instr->value;
+	if ( instr->offset == OffsetProto && instr->mask == MaskProto ) 
+		return ZONE_TEST_BIT(zone->proto, (value & MaskProto) >> ShiftProto);
+	if ( instr->offset == OffsetPort && instr->mask == MaskSrcPort ) 
+		return ZONE_TEST_BIT(zone->srcport, ZONE_PORT_BIT((value & MaskSrcPort) >> ShiftSrcPort));
+	if ( instr->offset == OffsetPort && instr->mask == MaskDstPort ) 
+		return ZONE_TEST_BIT(zone->dstport, ZONE_PORT_BIT((value & MaskDstPort) >> ShiftDstPort));
+	if ( instr->offset == OffsetExporterSysID && instr->mask == MaskExporterSysID ) 
+		return (zone->exporter >> (((value & MaskExporterSysID) >> ShiftExporterSysID) & 0x3F)) & 1;
+
+	return 1;
+
+} /* End of ZoneInstr */
+
+/*
+ * Walks all paths of the filter program. An instruction, for which maybe() returns 0,
+ * is false for all flows in question and only continues with OnFalse.
+ * Returns 1, if the result 1 of the program is reachable.
+ */
+static int ProgramReachable(FilterProgram_t *program, int (*maybe)(FilterInstr_t *, void *), void *data) {
+uint32_t		*stack, sp, index;
+uint8_t			*visited;
+int				match;
+
+	if ( !program ) 
+		return 1;
+
+	// each instruction is expanded once and pushes 2 targets
+	visited = (uint8_t *)calloc(program->NumInstr, sizeof(uint8_t));
+	stack	= (uint32_t *)malloc((2 * program->NumInstr + 1) * sizeof(uint32_t));
+	if ( !visited || !stack ) {
+		free(visited);
+		free(stack);
+		return 1;
+	}
+
+	match = 0;
+	sp = 0;
+	stack[sp++] = program->start;
+	while ( sp && !match ) {
+		index = stack[--sp];
+		if ( index == PROG_TRUE ) {
+			match = 1;
+		} else if ( index >= PROG_START && !visited[index] ) {
+			FilterInstr_t *instr = &program->instr[index];
+			visited[index] = 1;
+			stack[sp++] = instr->OnFalse;
+			if ( maybe(instr, data) ) 
+				stack[sp++] = instr->OnTrue;
+		}
+	}
+
+	free(visited);
+	free(stack);
+	return match;
+
+} /* End of ProgramReachable */
+
+/*
+ * Returns 1, if any flow of the block zone may match the filter program.
+ */
+int ZoneMatchFilter(FilterEngine_t *engine, struct block_zone_s *zone) {
+
+	return ProgramReachable(engine->program, ZoneInstr, (void *)zone);
+
+} /* End of ZoneMatchFilter */
+
+typedef struct ip_lookup_ctx_s {
+	ip_lookup_t	lookup;
+	void		*data;
+} ip_lookup_ctx_t;
+
+/*
+ * IP address tests: returns 0, if no flow in question has the address.
+ * A single address compares the lower word of the address only, prefixes are not resolved.
+ */
+static int IPInstr(FilterInstr_t *instr, void *data) {
+ip_lookup_ctx_t	*ctx = (ip_lookup_ctx_t *)data;
+uint64_t		ip[2];
+uint32_t		i, j;
+
+	if ( instr->op == OP_EQ64 && (instr->offset == OffsetSrcIPv6b || instr->offset == OffsetDstIPv6b) ) {
+		ip[0] = 0;
+		ip[1] = instr->value;
+		return ctx->lookup(ip, 0, ctx->data);
+	}
+
+	if ( instr->op == OP_IPLIST && (instr->offset == OffsetSrcIPv6a || instr->offset == OffsetDstIPv6a) ) {
+		IPListTable_t *list = (IPListTable_t *)instr->data;
+		for ( i=0; i<list->NumSets; i++ ) {
+			IPListSet_t *set = &list->set[i];
+			if ( set->mask[0] != 0xffffffffffffffffLL || set->mask[1] != 0xffffffffffffffffLL ) 
+				return 1;
+			ip[0] = ip[1] = 0;
+			if ( set->has_zero && ctx->lookup(ip, 1, ctx->data) ) 
+				return 1;
+			for ( j=0; j<=set->IndexMask; j++ ) {
+				uint64_t *key = &set->key[2*j];
+				if ( (key[0] || key[1]) && ctx->lookup(key, 1, ctx->data) ) 
+					return 1;
+			}
+		}
+		return 0;
+	}
+
+	return 1;
+
+} /* End of IPInstr */
+
+/*
+ * Returns 1, if any flow may match the filter program, when only the addresses
+ * for which lookup() returns 1 are present.
+ */
+int IPMatchFilter(FilterEngine_t *engine, ip_lookup_t lookup, void *data) {
+ip_lookup_ctx_t	ctx;
+
+	ctx.lookup = lookup;
+	ctx.data   = data;
+	return ProgramReachable(engine->program, IPInstr, (void *)&ctx);
+
+} /* End of IPMatchFilter */
+
+static int MarkRecordWords(uint64_t *mask, uint32_t NumWords, uint32_t offset, uint32_t words) {
+uint32_t i;
+
+	for ( i=offset; i<offset+words; i++ ) {
+		if ( i >= NumWords ) 
+			return 0;
+		mask[i >> 6] |= 1LL << (i & 0x3F);
+	}
+	return 1;
+
+} /* End of MarkRecordWords */
+
+/*
+ * Set a bit in mask for each word of the master record, the filter program reads.
+ * Returns 0, if the words are unknown and the filter needs the full record.
+ */
+int FilterRecordMask(FilterEngine_t *engine, uint64_t *mask, uint32_t NumWords) {
+FilterProgram_t *program = engine->program;
+uint32_t i, j;
+
+	if ( !program ) 
+		return 0;
+
+	for ( i=PROG_START; i<program->NumInstr; i++ ) {
+		FilterInstr_t *instr = &program->instr[i];
+		switch (instr->op) {
+			case OP_IDENT:
+				break;
+			case OP_IPLIST:
+				// IPv6 address in 2 words
+				if ( !MarkRecordWords(mask, NumWords, instr->offset, 2) ) 
+					return 0;
+				break;
+			case OP_FUNCTION:
+				for ( j=0; flow_procs_map[j].name; j++ ) {
+					if ( flow_procs_map[j].function == instr->function ) 
+						break;
+				}
+				if ( flow_procs_map[j].name == NULL ) 
+					return 0;
+				if ( !MarkRecordWords(mask, NumWords, flow_procs_map[j].offset, flow_procs_map[j].words) ) 
+					return 0;
+				// fall through - function value is read from offset
+			default:
+				if ( !MarkRecordWords(mask, NumWords, instr->offset, 1) ) 
+					return 0;
+		}
+	}
+
+	return 1;
+
+} /* End of FilterRecordMask */
+
+/*
+ * Filter set: the filter programs of several engines, such as the channels of nfprofile,
+ * evaluated with shared predicates. Identical instructions of all programs are mapped to
+ * the same predicate, which is evaluated at most once per record. The result is cached
+ * with the generation number of the record.
+ */
+static int SameList(FilterInstr_t *a, FilterInstr_t *b) {
+uint32_t i;
+
+	switch (a->op) {
+		case OP_IDENT:
+			return strncmp((char *)a->data, (char *)b->data, IDENTLEN) == 0;
+		case OP_IPLIST: {
+			IPListTable_t *la = (IPListTable_t *)a->data;
+			IPListTable_t *lb = (IPListTable_t *)b->data;
+			if ( la->NumSets != lb->NumSets )
+				return 0;
+			for ( i=0; i<la->NumSets; i++ ) {
+				IPListSet_t *sa = &la->set[i];
+				IPListSet_t *sb = &lb->set[i];
+				if ( sa->mask[0] != sb->mask[0] || sa->mask[1] != sb->mask[1] || 
+					 sa->NumEntries != sb->NumEntries || sa->has_zero != sb->has_zero ||
+					 sa->IndexMask != sb->IndexMask )
+					return 0;
+				if ( memcmp((void *)sa->key, (void *)sb->key, 2 * (sa->IndexMask + 1) * sizeof(uint64_t)) != 0 )
+					return 0;
+			}
+			return 1;
+			} break;
+		case OP_ULLIST: {
+			ULListArray_t *la = (ULListArray_t *)a->data;
+			ULListArray_t *lb = (ULListArray_t *)b->data;
+			return la->NumValues == lb->NumValues && 
+				memcmp((void *)la->value, (void *)lb->value, la->NumValues * sizeof(uint64_t)) == 0;
+			} break;
+	}
+	return 1;
+
+} // End of SameList
+
+static inline int SamePredicate(FilterInstr_t *a, FilterInstr_t *b) {
+
+	return a->op == b->op && a->comp == b->comp && a->offset == b->offset && a->mask == b->mask &&
+		a->value == b->value && a->function == b->function && SameList(a, b);
+
+} // End of SamePredicate
+
+static int SameProgram(FilterSet_t *set, uint32_t a, uint32_t b) {
+FilterProgram_t	*pa = set->engine[a]->program;
+FilterProgram_t	*pb = set->engine[b]->program;
+uint32_t i;
+
+	if ( !pa || !pb || pa->NumInstr != pb->NumInstr || pa->start != pb->start )
+		return 0;
+
+	for ( i=PROG_START; i<pa->NumInstr; i++ ) {
+		if ( set->predicate[a][i] != set->predicate[b][i] ||
+			 pa->instr[i].OnTrue != pb->instr[i].OnTrue || pa->instr[i].OnFalse != pb->instr[i].OnFalse )
+			return 0;
+		if ( pa->instr[i].label != pb->instr[i].label && 
+			 ( !pa->instr[i].label || !pb->instr[i].label || strcmp(pa->instr[i].label, pb->instr[i].label) != 0 ) )
+			return 0;
+	}
+	return 1;
+
+} // End of SameProgram
+
+FilterSet_t *CompileFilterSet(FilterEngine_t **engine, uint32_t num_engines) {
+FilterSet_t		*set;
+FilterProgram_t	*program;
+FilterInstr_t	*instr;
+uint32_t		*slot;
+uint32_t		i, j, size, index, NumInstr;
+
+	set = (FilterSet_t *)calloc(1, sizeof(FilterSet_t));
+	if ( !set ) {
+		fprintf(stderr, "Memory allocation error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+	set->NumEngines = num_engines;
+	set->engine	 	= engine;
+	set->predicate	= (uint32_t **)calloc(num_engines, sizeof(uint32_t *));
+	set->bitmap	 	= (uint64_t *)calloc((num_engines + 63) >> 6, sizeof(uint64_t));
+	if ( !set->predicate || !set->bitmap ) {
+		fprintf(stderr, "Memory allocation error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	NumInstr = 0;
+	for ( i=0; i<num_engines; i++ ) {
+		if ( engine[i]->program )
+			NumInstr += engine[i]->program->NumInstr;
+	}
+
+	// temporary open addressing index of all distinct predicates - 0 marks an empty slot
+	size = 16;
+	while ( size < 2 * NumInstr )
+		size <<= 1;
+	slot		= (uint32_t *)calloc(size, sizeof(uint32_t));
+	set->instr	= (FilterInstr_t **)calloc(NumInstr + 1, sizeof(FilterInstr_t *));
+	if ( !slot || !set->instr ) {
+		fprintf(stderr, "Memory allocation error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+
+	for ( i=0; i<num_engines; i++ ) {
+		program = engine[i]->program;
+		// engines without program are run by their own filter engine
+		if ( !program ) 
+			continue;
+
+		set->predicate[i] = (uint32_t *)calloc(program->NumInstr, sizeof(uint32_t));
+		if ( !set->predicate[i] ) {
+			fprintf(stderr, "Memory allocation error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			exit(255);
+		}
+		for ( j=PROG_START; j<program->NumInstr; j++ ) {
+			uint64_t key[4];
+			instr = &program->instr[j];
+			key[0] = ((uint64_t)instr->op << 48) | ((uint64_t)instr->comp << 32) | instr->offset;
+			key[1] = instr->mask;
+			key[2] = instr->value;
+			key[3] = (uint64_t)(size_t)instr->function;
+
+			index = MX64Hash(key, 4, 0) & (size - 1);
+			while ( slot[index] && !SamePredicate(set->instr[slot[index]], instr) )
+				index = (index + 1) & (size - 1);
+
+			if ( slot[index] == 0 ) {
+				// new predicate - index 0 is reserved
+				set->NumPredicates++;
+				set->instr[set->NumPredicates] = instr;
+				slot[index] = set->NumPredicates;
+			}
+			set->predicate[i][j] = slot[index];
+		}
+	}
+	free(slot);
+
+	// channels often share the complete filter - evaluate such programs only once
+	set->alias = (uint32_t *)calloc(num_engines, sizeof(uint32_t));
+	if ( !set->alias ) {
+		fprintf(stderr, "Memory allocation error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+	for ( i=0; i<num_engines; i++ ) {
+		set->alias[i] = i;
+		if ( !engine[i]->program )
+			continue;
+		for ( j=0; j<i; j++ ) {
+			if ( set->alias[j] == j && SameProgram(set, i, j) ) {
+				set->alias[i] = j;
+				break;
+			}
+		}
+	}
+
+	set->stamp	= (uint32_t *)calloc(set->NumPredicates + 1, sizeof(uint32_t));
+	set->result	= (uint8_t *)calloc(set->NumPredicates + 1, sizeof(uint8_t));
+	if ( !set->stamp || !set->result ) {
+		fprintf(stderr, "Memory allocation error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		exit(255);
+	}
+	set->generation = 0;
+
+	return set;
+
+} // End of CompileFilterSet
+
+int RunFilterSet(FilterSet_t *set, uint64_t *nfrecord) {
+FilterEngine_t	*engine;
+FilterInstr_t	*instr;
+uint32_t		*predicate, *stamp;
+uint8_t			*result;
+uint32_t		i, index, generation, p;
+int				evaluate, matched;
+
+	// new record - invalidate all cached results
+	generation = ++set->generation;
+	if ( generation == 0 ) {
+		memset((void *)set->stamp, 0, (set->NumPredicates + 1) * sizeof(uint32_t));
+		generation = set->generation = 1;
+	}
+	stamp  = set->stamp;
+	result = set->result;
+
+	memset((void *)set->bitmap, 0, ((set->NumEngines + 63) >> 6) * sizeof(uint64_t));
+	matched = 0;
+	for ( i=0; i<set->NumEngines; i++ ) {
+		engine = set->engine[i];
+		engine->nfrecord = nfrecord;
+		if ( set->alias[i] != i ) {
+			// same program as an engine before
+			evaluate = ( set->bitmap[set->alias[i] >> 6] >> (set->alias[i] & 0x3F) ) & 1;
+			engine->label = set->engine[set->alias[i]]->label;
+		} else if ( !engine->program ) {
+			evaluate = (*engine->FilterEngine)(engine);
+		} else {
+			predicate = set->predicate[i];
+			engine->label = NULL;
+			index = engine->program->start;
+			while ( index >= PROG_START ) {
+				instr = &engine->program->instr[index];
+				p = predicate[index];
+				if ( stamp[p] != generation ) {
+					result[p] = EvalInstr(instr, nfrecord);
+					stamp[p]  = generation;
+				}
+
+				// same label evaluation as RunFilterProgram()
+				if ( result[p] ) {
+					if ( instr->label )
+						engine->label = instr->label;
+					index = instr->OnTrue;
+				} else {
+					engine->label = NULL;
+					index = instr->OnFalse;
+				}
+			}
+			evaluate = index;
+		}
+		if ( evaluate ) {
+			set->bitmap[i >> 6] |= 1LL << (i & 0x3F);
+			matched++;
+		}
+	}
+
+	return matched;
+
+} // End of RunFilterSet
+
 void AddLabel(uint32_t index, char *label) {
 
 	FilterTree[index].label = strdup(label);
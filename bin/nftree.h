@@ -65,6 +65,44 @@ typedef struct FilterBlock {
 	void		*data;				/* any additional data for this block */
 } FilterBlock_t;
 
+/*
+ * Filter program: the filter tree lowered into a flat array of instructions
+ * Each instruction is specialized for its comparator. Jump targets are instruction
+ * indices; index 0 and 1 terminate the program with the result 0 or 1.
+ */
+enum {	OP_EQ = 0,		/* ( value & mask ) == cmp */
+		OP_EQ64,		/* value == cmp - mask all bits */
+		OP_GT,			/* ( value & mask ) > cmp */
+		OP_LT,			/* ( value & mask ) < cmp */
+		OP_ANY,			/* ( value & mask ) != 0 - inverted flags */
+		OP_IDENT,		/* ident string compare */
+		OP_IPLIST,		/* IP address in list */
+		OP_ULLIST,		/* value in list */
+		OP_FUNCTION		/* flow processing function followed by EQ, GT, LT or FLAGS */
+};
+
+#define PROG_FALSE	0
+#define PROG_TRUE	1
+#define PROG_START	2
+
+typedef struct FilterInstr_s {
+	uint16_t	op;					/* OP_* */
+	uint16_t	comp;				/* comperator for OP_FUNCTION */
+	uint32_t	offset;
+	uint64_t	mask;
+	uint64_t	value;
+	uint32_t	OnTrue, OnFalse;	/* next instruction */
+	flow_proc_t	function;			/* function for flow processing */
+	char		*label;				/* label, if any */
+	void		*data;				/* list or ident string */
+} FilterInstr_t;
+
+typedef struct FilterProgram_s {
+	uint32_t		NumInstr;		/* including the 2 result slots */
+	uint32_t		start;			/* first instruction */
+	FilterInstr_t	*instr;
+} FilterProgram_t;
+
 typedef struct FilterEngine_data_s {
 	FilterBlock_t	*filter;
 	uint32_t		StartNode;
@@ -72,9 +110,27 @@ typedef struct FilterEngine_data_s {
 	char			**IdentList;
 	uint64_t		*nfrecord;
 	char			*label;
+	FilterProgram_t	*program;		/* compiled filter program - NULL: use tree interpreter */
 	int (*FilterEngine)(struct FilterEngine_data_s *);
 } FilterEngine_t;
 
+/* 
+ * Filter set: several filter engines evaluated together
+ * Each distinct predicate of all programs is evaluated at most once per record.
+ */
+typedef struct FilterSet_s {
+	uint32_t		NumEngines;
+	uint32_t		NumPredicates;
+	FilterEngine_t	**engine;
+	uint32_t		**predicate;	/* per engine: instruction index -> predicate index */
+	uint32_t		*alias;			/* per engine: first engine with the same program */
+	FilterInstr_t	**instr;		/* per predicate: instruction evaluating the predicate */
+	uint32_t		*stamp;			/* per predicate: generation of the cached result */
+	uint8_t			*result;		/* per predicate: cached result */
+	uint32_t		generation;		/* incremented for each record */
+	uint64_t		*bitmap;		/* bit set for each matching engine */
+} FilterSet_t;
+
 /* 
  * Filter Engine Functions
  */
@@ -86,6 +142,22 @@ int RunFilter(FilterEngine_t *engine);
 
 int RunExtendedFilter(FilterEngine_t *engine);
 
+int RunFilterProgram(FilterEngine_t *engine);
+
+struct block_zone_s;
+int ZoneMatchFilter(FilterEngine_t *engine, struct block_zone_s *zone);
+
+// returns 1, if the address is present - exact: 0 compare the lower word ip[1] only
+typedef int (*ip_lookup_t)(uint64_t *ip, int exact, void *data);
+
+int IPMatchFilter(FilterEngine_t *engine, ip_lookup_t lookup, void *data);
+
+int FilterRecordMask(FilterEngine_t *engine, uint64_t *mask, uint32_t NumWords);
+
+FilterSet_t *CompileFilterSet(FilterEngine_t **engine, uint32_t num_engines);
+
+int RunFilterSet(FilterSet_t *set, uint64_t *nfrecord);
+
 void ClearFilter(void);
 
 void DumpEngine(FilterEngine_t *engine);
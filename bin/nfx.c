@@ -37,6 +37,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <ctype.h>
 #include <string.h>
 #include <stdarg.h>
@@ -126,6 +127,12 @@ extension_descriptor_t extension_descriptor[] = {
 
 uint32_t Max_num_extensions;
 
+// master record words needed before the filter runs - lazy expansion is off, if not set
+static uint64_t ExpandMask[EXPAND_MASK_SIZE];
+static int		LazyExpand = 0;
+
+static void SplitExpandPlan(extension_info_t *extension_info);
+
 static int VerifyExtensionMap(extension_map_t *map);
 
 extension_map_list_t *InitExtensionMaps(int AllocateList) {
@@ -173,6 +180,9 @@ extension_info_t *l;
 		extension_info_t *tmp = l;
 		l = l->next;
 		free(tmp->map);
+		free(tmp->plan);
+		free(tmp->filter_plan);
+		free(tmp->match_plan);
 		free(tmp);
 	}
 	free(extension_map_list);
@@ -194,7 +204,9 @@ uint16_t map_id;
 	}
 
 	map_id = map->map_id == INIT_ID ? 0 : map->map_id & EXTENSION_MAP_MASK;
-	map->map_id = map_id;
+	// do not dirty the page of a memory mapped block
+	if ( map->map_id != map_id ) 
+		map->map_id = map_id;
 	dbg_printf("Insert Extension Map:\n");
 
 #ifdef DEVEL
@@ -264,6 +276,11 @@ uint16_t map_id;
 			return -1;
 		}
 		memcpy((void *)l->map, (void *)map, map->size);
+		l->plan = BuildExpandPlan(l->map);
+		l->filter_plan = NULL;
+		l->match_plan  = NULL;
+		if ( LazyExpand && l->plan ) 
+			SplitExpandPlan(l);
 
 		// append new extension to list
 		*(extension_map_list->last_map) = l;
@@ -291,6 +308,375 @@ uint16_t map_id;
 
 } // End of Insert_Extension_Map
 
+static void AddExpandOp(expand_plan_t *plan, uint16_t type, uint16_t dst, uint16_t src, uint16_t len) {
+expand_op_t *op = plan->NumOps ? &plan->op[plan->NumOps-1] : NULL;
+
+	// merge with previous copy, if both src and dst are contiguous
+	if ( op && type == XP_COPY && op->type == XP_COPY && 
+		 (op->dst + op->len) == dst && (op->src + op->len) == src ) {
+		op->len += len;
+		return;
+	}
+
+	op = &plan->op[plan->NumOps++];
+	op->type = type;
+	op->len	 = len;
+	op->dst	 = dst;
+	op->src	 = src;
+
+} // End of AddExpandOp
+
+/*
+ * Lower the merged copies of a plan into fixed size copies, which compile to
+ * plain load/store instructions instead of a memcpy() call, and sort the ops by type
+ */
+static void LowerExpandPlan(expand_plan_t *plan, expand_plan_t *lowered) {
+int i, type;
+
+	for ( type=XP_COPY8; type<XP_MAXOP; type++ ) {
+		for ( i=0; i<plan->NumOps; i++ ) {
+			expand_op_t *op = &plan->op[i];
+			uint16_t dst, src, len;
+
+			if ( op->type != XP_COPY ) {
+				if ( op->type == type ) 
+					lowered->op[lowered->NumOps++] = *op;
+				continue;
+			}
+
+			dst = op->dst;
+			src = op->src;
+			len = op->len;
+			if ( len >= 24 ) {
+				uint16_t words = len & ~7;
+				if ( type == XP_COPYN ) 
+					AddExpandOp(lowered, XP_COPYN, dst, src, words);
+				dst += words;
+				src += words;
+				len -= words;
+			}
+			while ( len ) {
+				uint16_t size = len >= 8 ? 8 : (len >= 4 ? 4 : (len >= 2 ? 2 : 1));
+				int copy = size == 8 ? XP_COPY8 : (size == 4 ? XP_COPY4 : (size == 2 ? XP_COPY2 : XP_COPY1));
+				if ( type == copy ) 
+					AddExpandOp(lowered, copy, dst, src, size);
+				dst += size;
+				src += size;
+				len -= size;
+			}
+		}
+	}
+	lowered->op[lowered->NumOps].type = XP_END;
+
+	for ( i=0; i<lowered->NumOps; i++ ) {
+		if ( lowered->op[i].type < XP_GROUPS ) 
+			lowered->NumGroup[lowered->op[i].type]++;
+	}
+
+} // End of LowerExpandPlan
+
+#define MR(field) offsetof(master_record_t, field)
+#define XCOPY(field, tpl, member) AddExpandOp(plan, XP_COPY, MR(field), offset + offsetof(tpl, member), sizeof(((master_record_t *)0)->field))
+
+/*
+ * Build the expand plan for this extension map. Each extension is translated
+ * into the same copy operations ExpandRecord_v2 does for it.
+ * Returns NULL, if the map contains extensions, which need ExpandRecord_v2
+ */
+expand_plan_t *BuildExpandPlan(extension_map_t *map) {
+expand_plan_t *plan, *lowered;
+uint32_t offset, num_ops;
+int i;
+
+	// no extension generates more than 8 ops
+	num_ops = 1;
+	i = 0;
+	while ( map->ex_id[i++] ) 
+		num_ops += 8;
+
+	plan = (expand_plan_t *)calloc(1, sizeof(expand_plan_t) + num_ops * sizeof(expand_op_t));
+	if ( !plan ) {
+		LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		return NULL;
+	}
+
+	offset = 0;
+	i = 0;
+	while ( map->ex_id[i] ) {
+		switch (map->ex_id[i++]) {
+			// 0 - 3 should never be in an extension table so - ignore it
+			case 0:
+			case 1:
+			case 2:
+			case 3:
+				break;
+			case EX_IO_SNMP_2:
+				AddExpandOp(plan, XP_WIDEN16, MR(input), offset + offsetof(tpl_ext_4_t, input), 0);
+				AddExpandOp(plan, XP_WIDEN16, MR(output), offset + offsetof(tpl_ext_4_t, output), 0);
+				offset += offsetof(tpl_ext_4_t, data);
+				break;
+			case EX_IO_SNMP_4:
+				XCOPY(input, tpl_ext_5_t, input);
+				XCOPY(output, tpl_ext_5_t, output);
+				offset += offsetof(tpl_ext_5_t, data);
+				break;
+			case EX_AS_2:
+				AddExpandOp(plan, XP_WIDEN16, MR(srcas), offset + offsetof(tpl_ext_6_t, src_as), 0);
+				AddExpandOp(plan, XP_WIDEN16, MR(dstas), offset + offsetof(tpl_ext_6_t, dst_as), 0);
+				offset += offsetof(tpl_ext_6_t, data);
+				break;
+			case EX_AS_4:
+				XCOPY(srcas, tpl_ext_7_t, src_as);
+				XCOPY(dstas, tpl_ext_7_t, dst_as);
+				offset += offsetof(tpl_ext_7_t, data);
+				break;
+			case EX_MULIPLE:
+				XCOPY(any, tpl_ext_8_t, any);
+				offset += offsetof(tpl_ext_8_t, data);
+				break;
+			case EX_NEXT_HOP_v4:
+				AddExpandOp(plan, XP_IPV4, MR(ip_nexthop), offset + offsetof(tpl_ext_9_t, nexthop), 0);
+				plan->set_flags   &= ~FLAG_IPV6_NH;
+				plan->clear_flags |= FLAG_IPV6_NH;
+				offset += offsetof(tpl_ext_9_t, data);
+				break;
+			case EX_NEXT_HOP_v6:
+				XCOPY(ip_nexthop.V6, tpl_ext_10_t, nexthop);
+				plan->set_flags   |= FLAG_IPV6_NH;
+				plan->clear_flags &= ~FLAG_IPV6_NH;
+				offset += offsetof(tpl_ext_10_t, data);
+				break;
+			case EX_NEXT_HOP_BGP_v4:
+				AddExpandOp(plan, XP_IPV4, MR(bgp_nexthop), offset + offsetof(tpl_ext_11_t, bgp_nexthop), 0);
+				plan->set_flags   &= ~FLAG_IPV6_NHB;
+				plan->clear_flags |= FLAG_IPV6_NHB;
+				offset += offsetof(tpl_ext_11_t, data);
+				break;
+			case EX_NEXT_HOP_BGP_v6:
+				XCOPY(bgp_nexthop.V6, tpl_ext_12_t, bgp_nexthop);
+				plan->set_flags   |= FLAG_IPV6_NHB;
+				plan->clear_flags &= ~FLAG_IPV6_NHB;
+				offset += offsetof(tpl_ext_12_t, data);
+				break;
+			case EX_VLAN:
+				XCOPY(src_vlan, tpl_ext_13_t, src_vlan);
+				XCOPY(dst_vlan, tpl_ext_13_t, dst_vlan);
+				offset += offsetof(tpl_ext_13_t, data);
+				break;
+			case EX_OUT_PKG_4:
+				AddExpandOp(plan, XP_WIDEN32, MR(out_pkts), offset + offsetof(tpl_ext_14_t, out_pkts), 0);
+				offset += offsetof(tpl_ext_14_t, data);
+				break;
+			case EX_OUT_PKG_8:
+				XCOPY(out_pkts, tpl_ext_15_t, out_pkts);
+				offset += offsetof(tpl_ext_15_t, data);
+				break;
+			case EX_OUT_BYTES_4:
+				AddExpandOp(plan, XP_WIDEN32, MR(out_bytes), offset + offsetof(tpl_ext_16_t, out_bytes), 0);
+				offset += offsetof(tpl_ext_16_t, data);
+				break;
+			case EX_OUT_BYTES_8:
+				XCOPY(out_bytes, tpl_ext_17_t, out_bytes);
+				offset += offsetof(tpl_ext_17_t, data);
+				break;
+			case EX_AGGR_FLOWS_4:
+				AddExpandOp(plan, XP_WIDEN32, MR(aggr_flows), offset + offsetof(tpl_ext_18_t, aggr_flows), 0);
+				offset += offsetof(tpl_ext_18_t, data);
+				break;
+			case EX_AGGR_FLOWS_8:
+				XCOPY(aggr_flows, tpl_ext_19_t, aggr_flows);
+				offset += offsetof(tpl_ext_19_t, data);
+				break;
+			case EX_MAC_1:
+				XCOPY(in_src_mac, tpl_ext_20_t, in_src_mac);
+				XCOPY(out_dst_mac, tpl_ext_20_t, out_dst_mac);
+				offset += offsetof(tpl_ext_20_t, data);
+				break;
+			case EX_MAC_2:
+				XCOPY(in_dst_mac, tpl_ext_21_t, in_dst_mac);
+				XCOPY(out_src_mac, tpl_ext_21_t, out_src_mac);
+				offset += offsetof(tpl_ext_21_t, data);
+				break;
+			case EX_MPLS:
+				XCOPY(mpls_label, tpl_ext_22_t, mpls_label);
+				offset += offsetof(tpl_ext_22_t, data);
+				break;
+			case EX_ROUTER_IP_v4:
+				AddExpandOp(plan, XP_IPV4, MR(ip_router), offset + offsetof(tpl_ext_23_t, router_ip), 0);
+				plan->set_flags   &= ~FLAG_IPV6_EXP;
+				plan->clear_flags |= FLAG_IPV6_EXP;
+				offset += offsetof(tpl_ext_23_t, data);
+				break;
+			case EX_ROUTER_IP_v6:
+				XCOPY(ip_router.V6, tpl_ext_24_t, router_ip);
+				plan->set_flags   |= FLAG_IPV6_EXP;
+				plan->clear_flags &= ~FLAG_IPV6_EXP;
+				offset += offsetof(tpl_ext_24_t, data);
+				break;
+			case EX_ROUTER_ID:
+				XCOPY(engine_type, tpl_ext_25_t, engine_type);
+				XCOPY(engine_id, tpl_ext_25_t, engine_id);
+				offset += offsetof(tpl_ext_25_t, data);
+				break;
+			case EX_BGPADJ:
+				XCOPY(bgpNextAdjacentAS, tpl_ext_26_t, bgpNextAdjacentAS);
+				XCOPY(bgpPrevAdjacentAS, tpl_ext_26_t, bgpPrevAdjacentAS);
+				offset += offsetof(tpl_ext_26_t, data);
+				break;
+			case EX_LATENCY:
+				XCOPY(client_nw_delay_usec, tpl_ext_latency_t, client_nw_delay_usec);
+				XCOPY(server_nw_delay_usec, tpl_ext_latency_t, server_nw_delay_usec);
+				XCOPY(appl_latency_usec, tpl_ext_latency_t, appl_latency_usec);
+				offset += offsetof(tpl_ext_latency_t, data);
+				break;
+			case EX_RECEIVED:
+				XCOPY(received, tpl_ext_27_t, received);
+				offset += offsetof(tpl_ext_27_t, data);
+				break;
+#ifdef NSEL
+			case EX_NSEL_COMMON:
+				XCOPY(event_time, tpl_ext_37_t, event_time);
+				XCOPY(conn_id, tpl_ext_37_t, conn_id);
+				XCOPY(event, tpl_ext_37_t, fw_event);
+				AddExpandOp(plan, XP_SET8, MR(event_flag), FW_EVENT, 0);
+				XCOPY(fw_xevent, tpl_ext_37_t, fw_xevent);
+				XCOPY(icmp, tpl_ext_37_t, nsel_icmp);
+				XCOPY(sec_group_tag, tpl_ext_37_t, sec_group_tag);
+				offset += offsetof(tpl_ext_37_t, data);
+				break;
+			case EX_NSEL_XLATE_PORTS:
+				XCOPY(xlate_src_port, tpl_ext_38_t, xlate_src_port);
+				XCOPY(xlate_dst_port, tpl_ext_38_t, xlate_dst_port);
+				offset += offsetof(tpl_ext_38_t, data);
+				break;
+			case EX_NSEL_XLATE_IP_v4:
+				AddExpandOp(plan, XP_IPV4, MR(xlate_src_ip), offset + offsetof(tpl_ext_39_t, xlate_src_ip), 0);
+				AddExpandOp(plan, XP_IPV4, MR(xlate_dst_ip), offset + offsetof(tpl_ext_39_t, xlate_dst_ip), 0);
+				AddExpandOp(plan, XP_SET32, MR(xlate_flags), 0, 0);
+				offset += offsetof(tpl_ext_39_t, data);
+				break;
+			case EX_NSEL_XLATE_IP_v6:
+				XCOPY(xlate_src_ip.V6, tpl_ext_40_t, xlate_src_ip);
+				XCOPY(xlate_dst_ip.V6, tpl_ext_40_t, xlate_dst_ip);
+				AddExpandOp(plan, XP_SET32, MR(xlate_flags), 1, 0);
+				offset += offsetof(tpl_ext_40_t, data);
+				break;
+			case EX_NSEL_ACL:
+				XCOPY(ingress_acl_id, tpl_ext_41_t, ingress_acl_id);
+				XCOPY(egress_acl_id, tpl_ext_41_t, egress_acl_id);
+				offset += offsetof(tpl_ext_41_t, data);
+				break;
+			case EX_NSEL_USER:
+				AddExpandOp(plan, XP_STRING, MR(username), offset, sizeof(((master_record_t *)0)->username));
+				offset += offsetof(tpl_ext_42_t, data);
+				break;
+			case EX_NSEL_USER_MAX:
+				AddExpandOp(plan, XP_STRING, MR(username), offset, sizeof(((master_record_t *)0)->username));
+				offset += offsetof(tpl_ext_43_t, data);
+				break;
+			case EX_NEL_COMMON:
+			case EX_NEL_GLOBAL_IP_v4:
+			case EX_PORT_BLOCK_ALLOC:
+				// NEL compat handling and port block fixup - leave them to ExpandRecord_v2
+				free(plan);
+				return NULL;
+#endif
+		}
+	}
+	plan->op[plan->NumOps].type = XP_END;
+
+	// a merged copy is lowered into at most 5 ops
+	lowered = (expand_plan_t *)calloc(1, sizeof(expand_plan_t) + 5 * plan->NumOps * sizeof(expand_op_t));
+	if ( !lowered ) {
+		LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+		free(plan);
+		return NULL;
+	}
+	lowered->set_flags	 = plan->set_flags;
+	lowered->clear_flags = plan->clear_flags;
+	LowerExpandPlan(plan, lowered);
+	free(plan);
+
+	return lowered;
+
+} // End of BuildExpandPlan
+
+/*
+ * Enable lazy expansion: mask has a bit set for each word of the master record,
+ * which must be expanded before the filter runs. Must be called before any extension
+ * map is inserted. Returns 0, if the mask is too small for the master record.
+ */
+int SetExpandMask(uint64_t *mask) {
+
+	if ( (sizeof(master_record_t) >> 3) > (EXPAND_MASK_SIZE * 64) ) 
+		return 0;
+
+	memcpy((void *)ExpandMask, (void *)mask, sizeof(ExpandMask));
+	LazyExpand = 1;
+	return 1;
+
+} // End of SetExpandMask
+
+static uint32_t ExpandOpSize(expand_op_t *op) {
+
+	switch (op->type) {
+		case XP_IPV4:
+			return sizeof(ip_addr_t);
+		case XP_WIDEN16:
+		case XP_SET32:
+			return sizeof(uint32_t);
+		case XP_WIDEN32:
+			return sizeof(uint64_t);
+		case XP_SET8:
+			return sizeof(uint8_t);
+		default:
+			return op->len;
+	}
+
+} // End of ExpandOpSize
+
+/*
+ * Split the expand plan of this extension into the ops for the fields in ExpandMask,
+ * and the remaining ops, which are only needed for records matching the filter.
+ */
+static void SplitExpandPlan(extension_info_t *extension_info) {
+expand_plan_t *plan = extension_info->plan;
+expand_plan_t *part[2];
+int i, j;
+
+	for ( j=0; j<2; j++ ) {
+		part[j] = (expand_plan_t *)calloc(1, sizeof(expand_plan_t) + plan->NumOps * sizeof(expand_op_t));
+		if ( !part[j] ) {
+			LogError("calloc() error in %s line %d: %s\n", __FILE__, __LINE__, strerror(errno) );
+			free(part[0]);
+			return;
+		}
+		part[j]->set_flags	 = plan->set_flags;
+		part[j]->clear_flags = plan->clear_flags;
+	}
+
+	// ops keep their order, so each part stays grouped by type
+	for ( i=0; i<plan->NumOps; i++ ) {
+		expand_op_t *op = &plan->op[i];
+		uint32_t word, last = (op->dst + ExpandOpSize(op) - 1) >> 3;
+		int needed = 0;
+		for ( word = op->dst >> 3; word <= last; word++ ) {
+			if ( ExpandMask[word >> 6] & (1LL << (word & 0x3F)) ) 
+				needed = 1;
+		}
+		j = needed ? 0 : 1;
+		part[j]->op[part[j]->NumOps++] = *op;
+		if ( op->type < XP_GROUPS ) 
+			part[j]->NumGroup[op->type]++;
+	}
+	part[0]->op[part[0]->NumOps].type = XP_END;
+	part[1]->op[part[1]->NumOps].type = XP_END;
+
+	extension_info->filter_plan = part[0];
+	extension_info->match_plan  = part[1];
+
+} // End of SplitExpandPlan
+
 void PackExtensionMapList(extension_map_list_t *extension_map_list) {
 extension_info_t *l;
 int i, free_slot;
@@ -564,6 +950,10 @@ uint64_t total_bytes;
 				total_bytes += ret;
 		}
 
+		// column blocks hold flow records only - no extension map records
+		if ( nffile->block_header->id == DATA_BLOCK_TYPE_3 ) 
+			continue;
+
 		if ( nffile->block_header->id != DATA_BLOCK_TYPE_2 ) {
 			skipped_blocks++;
 			continue;
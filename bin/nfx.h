@@ -954,12 +954,61 @@ typedef struct extension_descriptor_s {
 	char		*description;
 } extension_descriptor_t;
 
+/*
+ * Expand plan
+ * A list of copy operations, which expands the optional extensions of a record into
+ * the master record. The plan is built once per extension map, when the map is inserted,
+ * so records no longer need to walk the map and decode each extension id.
+ * Adjacent copies are merged, as the order of the extensions in a record follows
+ * the layout of the master record. As all extensions write disjoint fields of the
+ * master record, the ops are grouped by type and the most frequent types are run
+ * in their own loops without dispatching each op.
+ */
+#define XP_END		0	// end of plan
+#define XP_COPY		1	// copy len bytes - lowered into the fixed size copies below
+// grouped ops
+#define XP_COPY8	2	// copy 8 bytes
+#define XP_COPY4	3	// copy 4 bytes
+#define XP_COPY2	4	// copy 2 bytes
+#define XP_COPYN	5	// copy len bytes as 8 byte words
+#define XP_IPV4		6	// uint32_t src -> IPv4 ip_addr_t dst
+#define XP_WIDEN16	7	// uint16_t src -> uint32_t dst
+#define XP_WIDEN32	8	// uint32_t src -> uint64_t dst
+#define XP_GROUPS	9
+// remaining ops
+#define XP_COPY1	9	// copy 1 byte
+#define XP_SET8		10	// set uint8_t dst to value src
+#define XP_SET32	11	// set uint32_t dst to value src
+#define XP_STRING	12	// copy 0 terminated string of max len bytes
+#define XP_MAXOP	13
+
+typedef struct expand_op_s {
+	uint16_t	type;	// XP_* operation
+	uint16_t	len;	// number of bytes
+	uint16_t	dst;	// offset in master record
+	uint16_t	src;	// offset of data after the required extensions or value
+} expand_op_t;
+
+typedef struct expand_plan_s {
+	uint8_t		set_flags;				// record flags set by the extensions
+	uint8_t		clear_flags;			// record flags cleared by the extensions
+	uint16_t	NumOps;
+	uint8_t		NumGroup[XP_GROUPS];	// number of ops of each grouped type
+	expand_op_t	op[1];					// ops sorted by type - last op is XP_END
+} expand_plan_t;
+
+// size of an expand mask in uint64_t - one bit for each word of the master record
+#define EXPAND_MASK_SIZE	2
+
 typedef struct extension_info_s {
 	struct extension_info_s *next;
 	extension_map_t	*map;
 	extension_map_t	*exportMap;
 	uint32_t		ref_count;
 	uint32_t		*offset_cache;
+	expand_plan_t	*plan;			// NULL, if the map needs ExpandRecord_v2
+	expand_plan_t	*filter_plan;	// lazy expansion: ops for the fields the filter reads
+	expand_plan_t	*match_plan;	// lazy expansion: remaining ops for matching records
 	master_record_t	master_record;
 } extension_info_t;
 
@@ -978,6 +1027,10 @@ void PackExtensionMapList(extension_map_list_t *extension_map_list);
 
 int Insert_Extension_Map(extension_map_list_t *extension_map_list, extension_map_t *map);
 
+expand_plan_t *BuildExpandPlan(extension_map_t *map);
+
+int SetExpandMask(uint64_t *mask);
+
 void SetupExtensionDescriptors(char *options);
 
 void PrintExtensionMap(extension_map_t *map);
@@ -75,8 +75,6 @@ char 		*_s, as[IP_STRING_LEN], ds[IP_STRING_LEN];
 char		datestr1[64], datestr2[64], datestr3[64];
 char		s_snet[IP_STRING_LEN], s_dnet[IP_STRING_LEN];
 ssize_t		slen, _slen;
-time_t		when;
-struct tm 	*ts;
 master_record_t *r = (master_record_t *)record;
 
 	as[0] = 0;
@@ -109,13 +107,9 @@ master_record_t *r = (master_record_t *)record;
 	as[IP_STRING_LEN-1] = 0;
 	ds[IP_STRING_LEN-1] = 0;
 
-	when = r->first;
-	ts = localtime(&when);
-	strftime(datestr1, 63, "%Y-%m-%d %H:%M:%S", ts);
+	FormatTimeStamp(r->first, datestr1);
 
-	when = r->last;
-	ts = localtime(&when);
-	strftime(datestr2, 63, "%Y-%m-%d %H:%M:%S", ts);
+	FormatTimeStamp(r->last, datestr2);
 
 	double duration = r->last - r->first;
 	duration += ((double)r->msec_last - (double)r->msec_first) / 1000.0;
@@ -325,11 +319,8 @@ master_record_t *r = (master_record_t *)record;
 		slen = STRINGSIZE - _slen;
 
 	// Date flow received
-	when = r->received / 1000LL;
- 	ts = localtime(&when);
- 	strftime(datestr3, 63, ",%Y-%m-%d %H:%M:%S", ts);
- 
- 	snprintf(_s, slen-1, "%s.%03llu", datestr3, (long long unsigned)r->received % 1000LL);
+	FormatTimeStampMsec(r->received / 1000LL, r->received % 1000LL, datestr3);
+ 	snprintf(_s, slen-1, ",%s", datestr3);
  	        _slen = strlen(data_string);
  	        _s = data_string + _slen;
  	        slen = STRINGSIZE - _slen;
@@ -668,44 +668,20 @@ static void String_Version(master_record_t *r, char *string) {
 } // End of String_Version
 
 static void String_FirstSeen(master_record_t *r, char *string) {
-time_t 	tt;
-struct tm * ts;
-char 	*s;
-
-	tt = r->first;
-	ts = localtime(&tt);
-	strftime(string, MAX_STRING_LENGTH-1, "%Y-%m-%d %H:%M:%S", ts);
-	s = string + strlen(string);
-	snprintf(s, MAX_STRING_LENGTH-strlen(string)-1,".%03u", r->msec_first);
-	string[MAX_STRING_LENGTH-1] = '\0';
+
+	FormatTimeStampMsec(r->first, r->msec_first, string);
 
 } // End of String_FirstSeen
 
 static void String_LastSeen(master_record_t *r, char *string) {
-time_t 	tt;
-struct tm * ts;
-char 	*s;
-
-	tt = r->last;
-	ts = localtime(&tt);
-	strftime(string, MAX_STRING_LENGTH-1, "%Y-%m-%d %H:%M:%S", ts);
-	s = string + strlen(string);
-	snprintf(s, MAX_STRING_LENGTH-strlen(string)-1,".%03u", r->msec_last);
-	string[MAX_STRING_LENGTH-1] = '\0';
+
+	FormatTimeStampMsec(r->last, r->msec_last, string);
 
 } // End of String_LastSeen
 
 static void String_Received(master_record_t *r, char *string) {
-time_t 	tt;
-struct tm * ts;
-char 	*s;
-
-	tt = r->received / 1000LL;
-	ts = localtime(&tt);
-	strftime(string, MAX_STRING_LENGTH-1, "%Y-%m-%d %H:%M:%S", ts);
-	s = string + strlen(string);
-	snprintf(s, MAX_STRING_LENGTH-strlen(string)-1,".%03llu", r->received % 1000LL);
-	string[MAX_STRING_LENGTH-1] = '\0';
+
+	FormatTimeStampMsec(r->received / 1000LL, r->received % 1000LL, string);
 
 } // End of String_Received
 
@@ -733,16 +709,8 @@ static void String_LastSeenRaw(master_record_t *r, char *string) {
 
 #ifdef NSEL
 static void String_EventTime(master_record_t *r, char *string) {
-time_t 	tt;
-struct tm * ts;
-char 	*s;
-
-	tt = r->event_time / 1000LL;
-	ts = localtime(&tt);
-	strftime(string, MAX_STRING_LENGTH-1, "%Y-%m-%d %H:%M:%S", ts);
-	s = string + strlen(string);
-	snprintf(s, MAX_STRING_LENGTH-strlen(string)-1,".%03llu", r->event_time % 1000LL);
-	string[MAX_STRING_LENGTH-1] = '\0';
+
+	FormatTimeStampMsec(r->event_time / 1000LL, r->event_time % 1000LL, string);
 
 } // End of String_EventTime
 #endif
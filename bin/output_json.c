@@ -91,19 +91,15 @@ void flow_record_to_json(void *record, char ** s, int tag) {
 char 		*_s, as[IP_STRING_LEN], ds[IP_STRING_LEN], *datestr1, *datestr2, datebuff[64], flags_str[16];
 int			i, id;
 ssize_t		slen, _slen;
-time_t		when;
-struct tm 	*ts;
 master_record_t *r = (master_record_t *)record;
 extension_map_t	*extension_map = r->map_ref;
 
-	when = r->first;
-	ts = localtime(&when);
-	strftime(datebuff, 63, "%Y-%m-%dT%H:%M:%S", ts);
+	FormatTimeStamp(r->first, datebuff);
+	datebuff[10] = 'T';
 	asprintf(&datestr1, "%s.%u", datebuff, r->msec_first);
 
-	when = r->last;
-	ts = localtime(&when);
-	strftime(datebuff, 63, "%Y-%m-%dT%H:%M:%S", ts);
+	FormatTimeStamp(r->last, datebuff);
+	datebuff[10] = 'T';
 	asprintf(&datestr2, "%s.%u", datebuff, r->msec_last);
 
 	String_Flags(record, flags_str);
@@ -390,9 +386,8 @@ extension_map_t	*extension_map = r->map_ref;
 				break;
 			case EX_RECEIVED: {
 				char *datestr, datebuff[64];
-				when = r->received / 1000LL;
-				ts = localtime(&when);
-				strftime(datebuff, 63, "%Y-%m-%dT%H:%M:%S", ts);
+				FormatTimeStamp(r->received / 1000LL, datebuff);
+				datebuff[10] = 'T';
 				asprintf(&datestr, "%s.%llu", datebuff, (long long unsigned)r->received % 1000L);
 
 				snprintf(_s, slen-1,
@@ -403,9 +398,8 @@ extension_map_t	*extension_map = r->map_ref;
 #ifdef NSEL
 			case EX_NSEL_COMMON: {
 				char *datestr, datebuff[64];
-				when = r->event_time / 1000LL;
-				ts = localtime(&when);
-				strftime(datebuff, 63, "%Y-%m-%dT%H:%M:%S", ts);
+				FormatTimeStamp(r->event_time / 1000LL, datebuff);
+				datebuff[10] = 'T';
 				asprintf(&datestr, "%s.%llu", datebuff, r->event_time % 1000LL);
 				snprintf(_s, slen-1,
 "	\"connect_id\" : \"%u\",\n"
@@ -72,8 +72,6 @@ char 		*_s, as[IP_STRING_LEN], ds[IP_STRING_LEN], datestr1[64], datestr2[64], da
 char		s_snet[IP_STRING_LEN], s_dnet[IP_STRING_LEN];
 int			i, id;
 ssize_t		slen, _slen;
-time_t		when;
-struct tm 	*ts;
 master_record_t *r = (master_record_t *)record;
 extension_map_t	*extension_map = r->map_ref;
 
@@ -107,13 +105,9 @@ extension_map_t	*extension_map = r->map_ref;
 	as[IP_STRING_LEN-1] = 0;
 	ds[IP_STRING_LEN-1] = 0;
 
-	when = r->first;
-	ts = localtime(&when);
-	strftime(datestr1, 63, "%Y-%m-%d %H:%M:%S", ts);
+	FormatTimeStamp(r->first, datestr1);
 
-	when = r->last;
-	ts = localtime(&when);
-	strftime(datestr2, 63, "%Y-%m-%d %H:%M:%S", ts);
+	FormatTimeStamp(r->last, datestr2);
 
 	char *type;
 	char version[8];
@@ -423,9 +417,7 @@ extension_map_t	*extension_map = r->map_ref;
 				slen = STRINGSIZE - _slen;
 				break;
 			case EX_RECEIVED:
-				when = r->received / 1000LL;
-				ts = localtime(&when);
-				strftime(datestr3, 63, "%Y-%m-%d %H:%M:%S", ts);
+				FormatTimeStamp(r->received / 1000LL, datestr3);
 
 				snprintf(_s, slen-1,
 "  received at  =     %13llu [%s.%03llu]\n"
@@ -436,9 +428,7 @@ extension_map_t	*extension_map = r->map_ref;
 				break;
 #ifdef NSEL
 			case EX_NSEL_COMMON: {
-				when = r->event_time / 1000LL;
-				ts = localtime(&when);
-				strftime(datestr3, 63, "%Y-%m-%d %H:%M:%S", ts);
+				FormatTimeStamp(r->event_time / 1000LL, datestr3);
 				snprintf(_s, slen-1,
 "  connect ID   =        %10u\n"
 "  fw event     =             %5u: %s\n"
@@ -34,6 +34,7 @@
 #include <stddef.h>
 #include <sys/types.h>
 #include <string.h>
+#include <time.h>
 
 #ifdef HAVE_STDINT_H
 #include <stdint.h>
@@ -359,3 +360,71 @@ static char s[16];
 
 	// not reached
 } // End of EventXString
+
+/*
+ * Formatted time stamps are cached per thread. Records printed in sequence mostly
+ * share the same minute - only a change of the minute needs localtime() and strftime().
+ * Within the same minute only the seconds are rewritten. The cache is indexed by
+ * minute, so first, last and received time stamps rarely evict each other.
+ */
+#define TIMECACHE_SIZE	4
+typedef struct timeCache_s {
+	time_t	minute;		// start of the cached local minute
+	time_t	second;		// time of the cached string
+	char	string[TIMESTAMP_LEN];
+} timeCache_t;
+
+static __thread timeCache_t timeCache[TIMECACHE_SIZE];
+
+int FormatTimeStamp(time_t when, char *string) {
+timeCache_t *cache = &timeCache[(when / 60) & (TIMECACHE_SIZE - 1)];
+
+	if ( cache->string[0] == '\0' || when < cache->minute || when >= (cache->minute + 60) ) {
+		struct tm ts;
+		size_t len;
+
+		if ( localtime_r(&when, &ts) == NULL ) {
+			string[0] = '\0';
+			return 0;
+		}
+		len = strftime(string, TIMESTAMP_LEN, "%Y-%m-%d %H:%M:%S", &ts);
+		if ( len != (TIMESTAMP_LEN - 1) ) {
+			// not a 4 digit year - do not cache
+			cache->string[0] = '\0';
+			return len;
+		}
+		memcpy(cache->string, string, TIMESTAMP_LEN);
+		cache->minute = when - ts.tm_sec;
+		cache->second = when;
+		return len;
+	}
+
+	if ( when != cache->second ) {
+		uint32_t sec = when - cache->minute;
+		cache->string[TIMESTAMP_LEN - 3] = '0' + sec / 10;
+		cache->string[TIMESTAMP_LEN - 2] = '0' + sec % 10;
+		cache->second = when;
+	}
+	memcpy(string, cache->string, TIMESTAMP_LEN);
+
+	return TIMESTAMP_LEN - 1;
+
+} // End of FormatTimeStamp
+
+int FormatTimeStampMsec(time_t when, uint32_t msec, char *string) {
+int len;
+
+	len = FormatTimeStamp(when, string);
+	if ( msec < 1000 ) {
+		string[len++] = '.';
+		string[len++] = '0' + msec / 100;
+		string[len++] = '0' + (msec / 10) % 10;
+		string[len++] = '0' + msec % 10;
+		string[len] = '\0';
+	} else {
+		len += snprintf(string + len, 12, ".%03u", msec);
+	}
+
+	return len;
+
+} // End of FormatTimeStampMsec
@@ -32,6 +32,10 @@
 #define _OUTPUT_UTIL_H 1
 
 #include <stdbool.h>
+#include <time.h>
+
+// length of "YYYY-mm-dd HH:MM:SS" incl. '\0' - add 12 bytes for the msec part
+#define TIMESTAMP_LEN	20
 
 typedef void (*printer_t)(void *, char **, int);
 typedef void (*func_prolog_t)(void);
@@ -67,4 +71,8 @@ char *EventString(int event);
 
 char *EventXString(int xevent);
 
+int FormatTimeStamp(time_t when, char *string);
+
+int FormatTimeStampMsec(time_t when, uint32_t msec, char *string);
+
 #endif // _OUTPUT_UTIL_H
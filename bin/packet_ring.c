@@ -0,0 +1,260 @@
+/*
+ *  Copyright (c) 2020, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#ifdef HAVE_CONFIG_H 
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include <pcap.h>
+
+#include "packet_ring.h"
+
+#ifdef PACKET_RING
+
+#include <net/if_arp.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+
+#include "util.h"
+
+static int AttachFilter(int fd, int snaplen, struct bpf_program *filter) {
+struct sock_filter snap_filter;
+struct sock_fprog fprog;
+
+	if ( filter ) {
+		// a compiled bpf program matches the layout of the kernel socket filter
+		fprog.len	 = filter->bf_len;
+		fprog.filter = (struct sock_filter *)filter->bf_insns;
+	} else {
+		// accept all packets - cut at snaplen
+		snap_filter.code = BPF_RET | BPF_K;
+		snap_filter.jt	 = 0;
+		snap_filter.jf	 = 0;
+		snap_filter.k	 = snaplen;
+		fprog.len	 = 1;
+		fprog.filter = &snap_filter;
+	}
+
+	return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog));
+
+} // End of AttachFilter
+
+packet_ring_t *OpenPacketRing(char *device, int snaplen, int timeout, struct bpf_program *filter, char *errbuf) {
+packet_ring_t *ring;
+struct tpacket_req3 req;
+struct sockaddr_ll ll;
+struct packet_mreq mreq;
+struct ifreq ifr;
+int fd, version, reserve, ifindex;
+
+	// no protocol - the socket receives nothing, until it is bound to the device
+	// otherwise packets of all devices queue up, while the ring is set up
+	fd = socket(AF_PACKET, SOCK_RAW, 0);
+	if ( fd < 0 ) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "socket() error: %s", strerror(errno));
+		return NULL;
+	}
+
+	// only ethernet framed devices are supported
+	memset((void *)&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, device, IFNAMSIZ-1);
+	if ( ioctl(fd, SIOCGIFHWADDR, &ifr) < 0 ) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "ioctl(SIOCGIFHWADDR) error for %s: %s", device, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	if ( ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER && ifr.ifr_hwaddr.sa_family != ARPHRD_LOOPBACK ) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "Unsupported hardware type %u of %s", ifr.ifr_hwaddr.sa_family, device);
+		close(fd);
+		return NULL;
+	}
+	ifindex = if_nametoindex(device);
+
+	// filter the packets before they get into the ring
+	if ( AttachFilter(fd, snaplen, filter) < 0 ) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "setsockopt(SO_ATTACH_FILTER) error: %s", strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	version = TPACKET_V3;
+	if ( setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0 ) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "setsockopt(PACKET_VERSION) error: %s", strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	// headroom to reinsert the VLAN tag
+	reserve = VLAN_TAG_LEN;
+	if ( setsockopt(fd, SOL_PACKET, PACKET_RESERVE, &reserve, sizeof(reserve)) < 0 ) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "setsockopt(PACKET_RESERVE) error: %s", strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	memset((void *)&req, 0, sizeof(req));
+	req.tp_block_size 	   = RING_BLOCKSIZE;
+	req.tp_block_nr		   = RING_BLOCKS;
+	req.tp_frame_size	   = RING_FRAMESIZE;
+	req.tp_frame_nr		   = (RING_BLOCKSIZE / RING_FRAMESIZE) * RING_BLOCKS;
+	req.tp_retire_blk_tov  = timeout;
+	if ( setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0 ) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "setsockopt(PACKET_RX_RING) error: %s", strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	ring = (packet_ring_t *)calloc(1, sizeof(packet_ring_t));
+	if ( !ring ) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "malloc() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	ring->fd		= fd;
+	ring->numBlocks	= req.tp_block_nr;
+	ring->blockSize	= req.tp_block_size;
+	ring->map_size	= (size_t)req.tp_block_size * req.tp_block_nr;
+	ring->timeout	= timeout;
+	ring->snaplen	= snaplen;
+	ring->loopback	= ifr.ifr_hwaddr.sa_family == ARPHRD_LOOPBACK;
+
+	ring->map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if ( ring->map == MAP_FAILED ) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "mmap() error: %s", strerror(errno));
+		close(fd);
+		free(ring);
+		return NULL;
+	}
+
+	memset((void *)&ll, 0, sizeof(ll));
+	ll.sll_family	= AF_PACKET;
+	ll.sll_protocol = htons(ETH_P_ALL);
+	ll.sll_ifindex	= ifindex;
+	if ( bind(fd, (struct sockaddr *)&ll, sizeof(ll)) < 0 ) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "bind() error on %s: %s", device, strerror(errno));
+		ClosePacketRing(ring);
+		return NULL;
+	}
+
+	memset((void *)&mreq, 0, sizeof(mreq));
+	mreq.mr_ifindex = ifindex;
+	mreq.mr_type	= PACKET_MR_PROMISC;
+	if ( setsockopt(fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0 ) {
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "setsockopt(PACKET_ADD_MEMBERSHIP) error: %s", strerror(errno));
+		ClosePacketRing(ring);
+		return NULL;
+	}
+
+	return ring;
+
+} // End of OpenPacketRing
+
+void ClosePacketRing(packet_ring_t *ring) {
+
+	if ( !ring )
+		return;
+
+	munmap(ring->map, ring->map_size);
+	close(ring->fd);
+	free(ring);
+
+} // End of ClosePacketRing
+
+// hand back the current block and wait for the next one: 1 next block, 0 timeout, -1 error
+int PacketRingNextBlock(packet_ring_t *ring) {
+struct tpacket_block_desc *block_desc;
+struct pollfd pfd;
+
+	if ( ring->block_desc ) {
+		// all packets processed - return the block to the kernel
+		__atomic_store_n(&ring->block_desc->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		ring->block_desc = NULL;
+		ring->block = (ring->block + 1) % ring->numBlocks;
+	}
+
+	block_desc = (struct tpacket_block_desc *)(ring->map + (size_t)ring->block * ring->blockSize);
+	if ( (__atomic_load_n(&block_desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0 ) {
+		pfd.fd		= ring->fd;
+		pfd.events	= POLLIN | POLLERR;
+		pfd.revents = 0;
+		if ( poll(&pfd, 1, ring->timeout) < 0 && errno != EINTR ) {
+			LogError("poll() error in %s line %d: %s", __FILE__, __LINE__, strerror(errno) );
+			return -1;
+		}
+		if ( (__atomic_load_n(&block_desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0 ) 
+			// timeout or interrupted
+			return 0;
+	}
+
+	ring->block_desc = block_desc;
+	ring->remaining	 = block_desc->hdr.bh1.num_pkts;
+	ring->packet	 = (struct tpacket3_hdr *)((uint8_t *)block_desc + block_desc->hdr.bh1.offset_to_first_pkt);
+
+	return ring->remaining ? 1 : 0;
+
+} // End of PacketRingNextBlock
+
+int PacketRingStats(packet_ring_t *ring, struct pcap_stat *stat) {
+struct tpacket_stats_v3 tp_stats;
+socklen_t len = sizeof(tp_stats);
+
+	// the kernel resets the counters with each read
+	if ( getsockopt(ring->fd, SOL_PACKET, PACKET_STATISTICS, &tp_stats, &len) < 0 ) 
+		return -1;
+
+	ring->packets += tp_stats.tp_packets;
+	ring->drops	  += tp_stats.tp_drops;
+
+	memset((void *)stat, 0, sizeof(struct pcap_stat));
+	stat->ps_recv	= ring->packets;
+	stat->ps_drop	= ring->drops;
+
+	return 0;
+
+} // End of PacketRingStats
+
+#endif
@@ -0,0 +1,158 @@
+/*
+ *  Copyright (c) 2020, Peter Haag
+ *  All rights reserved.
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions are met:
+ *  
+ *   * Redistributions of source code must retain the above copyright notice, 
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright notice, 
+ *     this list of conditions and the following disclaimer in the documentation 
+ *     and/or other materials provided with the distribution.
+ *   * Neither the name of the author nor the names of its contributors may be 
+ *     used to endorse or promote products derived from this software without 
+ *     specific prior written permission.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE 
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *  
+ */
+
+#ifndef _PACKET_RING_H
+#define _PACKET_RING_H 1
+
+#ifdef HAVE_CONFIG_H 
+#include "config.h"
+#endif
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include <string.h>
+#include <arpa/inet.h>
+#include <pcap.h>
+
+#ifdef HAVE_LINUX_IF_PACKET_H
+#include <linux/if_packet.h>
+#endif
+
+/*
+ * AF_PACKET TPACKET_V3 receive ring - Linux only
+ * The kernel fills blocks of packets into a ring, mapped into user space. The packets 
+ * are processed directly in the ring, and each block is handed back to the kernel
+ * as a whole, once all its packets are processed.
+ */
+#ifdef TPACKET3_HDRLEN
+#define PACKET_RING 1
+
+#define RING_BLOCKSIZE	(1 << 20)	// 1MB blocks
+#define RING_BLOCKS		64			// 64MB ring
+#define RING_FRAMESIZE	2048
+
+// the kernel strips the 802.1Q tag - it is reinserted into the headroom before the packet
+#define VLAN_TAG_LEN	4
+#define VLAN_TPID		0x8100
+
+typedef struct packet_ring_s {
+	int			fd;
+	uint8_t		*map;		// the mapped ring
+	size_t		map_size;
+	uint32_t	numBlocks;
+	uint32_t	blockSize;
+	uint32_t	block;		// current block
+	int			timeout;	// poll timeout in ms
+	int			snaplen;
+	int			loopback;	// device is a loopback device
+
+	// packets of the current block
+	struct tpacket_block_desc	*block_desc;
+	struct tpacket3_hdr			*packet;
+	uint32_t	remaining;
+
+	struct pcap_pkthdr	hdr;	// header of the current packet
+
+	// accumulated socket stats
+	uint32_t	packets;
+	uint32_t	drops;
+} packet_ring_t;
+
+packet_ring_t *OpenPacketRing(char *device, int snaplen, int timeout, struct bpf_program *filter, char *errbuf);
+
+void ClosePacketRing(packet_ring_t *ring);
+
+int PacketRingNextBlock(packet_ring_t *ring);
+
+int PacketRingStats(packet_ring_t *ring, struct pcap_stat *stat);
+
+/*
+ * returns the next packet of the ring like pcap_next_ex(): 1 packet, 0 timeout, -1 error
+ * the packet stays valid until the next call
+ */
+static inline int PacketRingNext(packet_ring_t *ring, struct pcap_pkthdr **hdr, const u_char **data) {
+struct tpacket3_hdr *packet;
+uint8_t	 *frame;
+uint32_t caplen, len;
+
+	do {
+		if ( ring->remaining == 0 ) {
+			int ret = PacketRingNextBlock(ring);
+			if ( ret <= 0 )
+				return ret;
+		}
+
+		packet = ring->packet;
+		ring->packet = (struct tpacket3_hdr *)((uint8_t *)packet + packet->tp_next_offset);
+		ring->remaining--;
+
+		// loopback devices see each packet twice - skip the outgoing one
+	} while ( ring->loopback && 
+		((struct sockaddr_ll *)((uint8_t *)packet + TPACKET_ALIGN(sizeof(struct tpacket3_hdr))))->sll_pkttype == PACKET_OUTGOING );
+
+	frame  = (uint8_t *)packet + packet->tp_mac;
+	caplen = packet->tp_snaplen;
+	len	   = packet->tp_len;
+#ifdef TP_STATUS_VLAN_VALID
+	// rebuild the 802.1Q header as libpcap does - the headroom is reserved by PACKET_RESERVE
+	if ( (packet->hv1.tp_vlan_tci || (packet->tp_status & TP_STATUS_VLAN_VALID)) && caplen >= 12 ) {
+		uint16_t tag[2];
+#ifdef TP_STATUS_VLAN_TPID_VALID
+		tag[0] = htons((packet->tp_status & TP_STATUS_VLAN_TPID_VALID) ? packet->hv1.tp_vlan_tpid : VLAN_TPID);
+#else
+		tag[0] = htons(VLAN_TPID);
+#endif
+		tag[1] = htons(packet->hv1.tp_vlan_tci);
+		frame -= VLAN_TAG_LEN;
+		memmove(frame, frame + VLAN_TAG_LEN, 12);
+		memcpy(frame + 12, tag, VLAN_TAG_LEN);
+		caplen += VLAN_TAG_LEN;
+		len	   += VLAN_TAG_LEN;
+		if ( caplen > (uint32_t)ring->snaplen ) 
+			caplen = ring->snaplen;
+	}
+#endif
+
+	ring->hdr.ts.tv_sec	 = packet->tp_sec;
+	ring->hdr.ts.tv_usec = packet->tp_nsec / 1000;
+	ring->hdr.caplen	 = caplen;
+	ring->hdr.len		 = len;
+	*hdr  = &ring->hdr;
+	*data = (const u_char *)frame;
+
+	return 1;
+
+} // End of PacketRingNext
+
+#endif
+
+#endif // _PACKET_RING_H
@@ -89,11 +89,228 @@
 #include <stdint.h>
 #endif
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AESNI 1
+#include <wmmintrin.h>
+#endif
+
 #include "panonymizer.h"
 
 static	uint8_t m_key[16]; //128 bit secret key
 static	uint8_t m_pad[16]; //128 bit secret pad
 
+// incremented by each PAnonymizer_Init() - invalidates the caches
+static	uint32_t m_generation = 0;
+
+/*
+ * Prefix memoization
+ * The one-time-pad bits of the first n positions depend only on the first n bits
+ * of the address. Each thread caches the full anonymized addresses as well as the 
+ * pad bits of the /24 IPv4 and /64 IPv6 prefixes, so the addresses of a known 
+ * prefix need only the PRF rounds of the remaining bits.
+ */
+#define V4_CACHE_BITS		16
+#define V4_PREFIX_BITS		12
+#define V6_CACHE_BITS		12
+#define V6_PREFIX_BITS		12
+
+typedef struct v4_entry_s {
+	uint32_t	addr;
+	uint32_t	anon;
+} v4_entry_t;
+
+typedef struct v4_prefix_s {
+	uint32_t	prefix;		// addr >> 8
+	uint32_t	pad;		// pad bits of positions 0..23
+} v4_prefix_t;
+
+typedef struct v6_entry_s {
+	uint64_t	addr[2];
+	uint64_t	anon[2];
+} v6_entry_t;
+
+typedef struct v6_prefix_s {
+	uint64_t	prefix;		// first 8 bytes of the address
+	uint64_t	pad;		// pad bytes of positions 0..63
+} v6_prefix_t;
+
+typedef struct anon_cache_s {
+	uint32_t	generation;
+	uint8_t		*v4_valid;
+	v4_entry_t	*v4;
+	uint8_t		*v4_prefix_valid;
+	v4_prefix_t	*v4_prefix;
+	uint8_t		*v6_valid;
+	v6_entry_t	*v6;
+	uint8_t		*v6_prefix_valid;
+	v6_prefix_t	*v6_prefix;
+} anon_cache_t;
+
+// each thread anonymizes with its own cache
+static __thread anon_cache_t *anon_cache = NULL;
+
+#ifdef HAVE_AESNI
+static int		use_aesni = 0;
+static __m128i	aes_key[11];		// expanded AES-128 encryption key
+#endif
+
+/* Function Prototypes */
+static anon_cache_t *GetCache(void);
+
+static void FreeCache(anon_cache_t *cache);
+
+static void PRF(uint8_t (*input)[16], uint8_t *output, int num);
+
+#ifdef HAVE_AESNI
+static void AESNI_KeyExpand(const uint8_t *key);
+
+static void AESNI_Encrypt(uint8_t (*input)[16], uint8_t *output, int num);
+#endif
+
+#ifdef HAVE_AESNI
+#define AES_KEY_ROUND(r, rcon) { \
+	__m128i t = _mm_aeskeygenassist_si128(aes_key[r-1], rcon); \
+	__m128i k = aes_key[r-1]; \
+	t = _mm_shuffle_epi32(t, 0xff); \
+	k = _mm_xor_si128(k, _mm_slli_si128(k, 4)); \
+	k = _mm_xor_si128(k, _mm_slli_si128(k, 4)); \
+	k = _mm_xor_si128(k, _mm_slli_si128(k, 4)); \
+	aes_key[r] = _mm_xor_si128(k, t); \
+}
+
+__attribute__((target("aes,sse2")))
+static void AESNI_KeyExpand(const uint8_t *key) {
+
+	aes_key[0] = _mm_loadu_si128((const __m128i *)key);
+	AES_KEY_ROUND(1, 0x01);
+	AES_KEY_ROUND(2, 0x02);
+	AES_KEY_ROUND(3, 0x04);
+	AES_KEY_ROUND(4, 0x08);
+	AES_KEY_ROUND(5, 0x10);
+	AES_KEY_ROUND(6, 0x20);
+	AES_KEY_ROUND(7, 0x40);
+	AES_KEY_ROUND(8, 0x80);
+	AES_KEY_ROUND(9, 0x1b);
+	AES_KEY_ROUND(10, 0x36);
+
+} // End of AESNI_KeyExpand
+
+/*
+ * Encrypt num blocks and return the first byte of each cipher block
+ * 4 blocks are encrypted interleaved to hide the latency of aesenc
+ */
+__attribute__((target("aes,sse2")))
+static void AESNI_Encrypt(uint8_t (*input)[16], uint8_t *output, int num) {
+int i, r;
+
+	for ( i=0; (i+4) <= num; i+=4 ) {
+		__m128i b0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)input[i]), aes_key[0]);
+		__m128i b1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)input[i+1]), aes_key[0]);
+		__m128i b2 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)input[i+2]), aes_key[0]);
+		__m128i b3 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)input[i+3]), aes_key[0]);
+		for ( r=1; r<10; r++ ) {
+			b0 = _mm_aesenc_si128(b0, aes_key[r]);
+			b1 = _mm_aesenc_si128(b1, aes_key[r]);
+			b2 = _mm_aesenc_si128(b2, aes_key[r]);
+			b3 = _mm_aesenc_si128(b3, aes_key[r]);
+		}
+		output[i]   = (uint8_t)_mm_cvtsi128_si32(_mm_aesenclast_si128(b0, aes_key[10]));
+		output[i+1] = (uint8_t)_mm_cvtsi128_si32(_mm_aesenclast_si128(b1, aes_key[10]));
+		output[i+2] = (uint8_t)_mm_cvtsi128_si32(_mm_aesenclast_si128(b2, aes_key[10]));
+		output[i+3] = (uint8_t)_mm_cvtsi128_si32(_mm_aesenclast_si128(b3, aes_key[10]));
+	}
+	for ( ; i<num; i++ ) {
+		__m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i *)input[i]), aes_key[0]);
+		for ( r=1; r<10; r++ ) 
+			b = _mm_aesenc_si128(b, aes_key[r]);
+		output[i] = (uint8_t)_mm_cvtsi128_si32(_mm_aesenclast_si128(b, aes_key[10]));
+	}
+
+} // End of AESNI_Encrypt
+#endif
+
+/*
+ * Pseudorandom function: encrypt num input blocks and return the first byte 
+ * of each cipher block. Only the most significant bit is used.
+ */
+static void PRF(uint8_t (*input)[16], uint8_t *output, int num) {
+uint8_t rin_output[16];
+int i;
+
+#ifdef HAVE_AESNI
+	if ( use_aesni ) {
+		AESNI_Encrypt(input, output, num);
+		return;
+	}
+#endif
+
+	for ( i=0; i<num; i++ ) {
+		Rijndael_blockEncrypt(input[i], 128, rin_output);
+		output[i] = rin_output[0];
+	}
+
+} // End of PRF
+
+static void FreeCache(anon_cache_t *cache) {
+
+	free(cache->v4_valid);
+	free(cache->v4);
+	free(cache->v4_prefix_valid);
+	free(cache->v4_prefix);
+	free(cache->v6_valid);
+	free(cache->v6);
+	free(cache->v6_prefix_valid);
+	free(cache->v6_prefix);
+	free(cache);
+
+} // End of FreeCache
+
+void PAnonymizer_FreeCache(void) {
+
+	if ( anon_cache ) {
+		FreeCache(anon_cache);
+		anon_cache = NULL;
+	}
+
+} // End of PAnonymizer_FreeCache
+
+static anon_cache_t *GetCache(void) {
+anon_cache_t *cache = anon_cache;
+
+	if ( cache == NULL ) {
+		cache = calloc(1, sizeof(anon_cache_t));
+		if ( !cache ) 
+			return NULL;
+		cache->v4_valid		   = calloc(1 << V4_CACHE_BITS, sizeof(uint8_t));
+		cache->v4			   = malloc((1 << V4_CACHE_BITS) * sizeof(v4_entry_t));
+		cache->v4_prefix_valid = calloc(1 << V4_PREFIX_BITS, sizeof(uint8_t));
+		cache->v4_prefix	   = malloc((1 << V4_PREFIX_BITS) * sizeof(v4_prefix_t));
+		cache->v6_valid		   = calloc(1 << V6_CACHE_BITS, sizeof(uint8_t));
+		cache->v6			   = malloc((1 << V6_CACHE_BITS) * sizeof(v6_entry_t));
+		cache->v6_prefix_valid = calloc(1 << V6_PREFIX_BITS, sizeof(uint8_t));
+		cache->v6_prefix	   = malloc((1 << V6_PREFIX_BITS) * sizeof(v6_prefix_t));
+		if ( !cache->v4_valid || !cache->v4 || !cache->v4_prefix_valid || !cache->v4_prefix ||
+			 !cache->v6_valid || !cache->v6 || !cache->v6_prefix_valid || !cache->v6_prefix ) {
+			FreeCache(cache);
+			return NULL;
+		}
+		cache->generation = m_generation;
+		anon_cache = cache;
+	}
+
+	if ( cache->generation != m_generation ) {
+		// new key
+		memset(cache->v4_valid, 0, 1 << V4_CACHE_BITS);
+		memset(cache->v4_prefix_valid, 0, 1 << V4_PREFIX_BITS);
+		memset(cache->v6_valid, 0, 1 << V6_CACHE_BITS);
+		memset(cache->v6_prefix_valid, 0, 1 << V6_PREFIX_BITS);
+		cache->generation = m_generation;
+	}
+
+	return cache;
+
+} // End of GetCache
+
 // Init
 void PAnonymizer_Init(uint8_t * key) {
   //initialize the 128-bit secret key.
@@ -102,6 +319,13 @@ void PAnonymizer_Init(uint8_t * key) {
   Rijndael_init(ECB, Encrypt, key, Key16Bytes, NULL);
   //initialize the 128-bit secret pad. The pad is encrypted before being used for padding.
   Rijndael_blockEncrypt(key + 16, 128, m_pad);  
+#ifdef HAVE_AESNI
+  //use AES-NI, if the CPU supports it. Both produce the same cipher blocks.
+  use_aesni = __builtin_cpu_supports("aes");
+  if ( use_aesni ) 
+	AESNI_KeyExpand(m_key);
+#endif
+  m_generation++;
 }
 
 int ParseCryptoPAnKey ( char *s, char *key ) {
@@ -144,21 +368,39 @@ uint32_t len = strlen(s);
 
 //Anonymization funtion
 uint32_t anonymize(const uint32_t orig_addr) {
-    uint8_t rin_output[16];
-    uint8_t rin_input[16];
+    uint8_t rin_output[32];
+    uint8_t rin_input[32][16];
 
     uint32_t result = 0;
     uint32_t first4bytes_pad, first4bytes_input;
-    int pos;
+    uint32_t hash = 0;
+    int pos, start;
+    anon_cache_t *cache = GetCache();
+
+    if ( cache ) {
+	hash = (orig_addr * 2654435761U) >> (32 - V4_CACHE_BITS);
+	if ( cache->v4_valid[hash] && cache->v4[hash].addr == orig_addr ) 
+	  return cache->v4[hash].anon;
+    }
 
-    memcpy(rin_input, m_pad, 16);
     first4bytes_pad = (((uint32_t) m_pad[0]) << 24) + (((uint32_t) m_pad[1]) << 16) +
 	(((uint32_t) m_pad[2]) << 8) + (uint32_t) m_pad[3]; 
 
+    // the pad bits of the /24 prefix may be known already
+    start = 0;
+    if ( cache ) {
+	uint32_t prefix = orig_addr >> 8;
+	uint32_t phash  = (prefix * 2654435761U) >> (32 - V4_PREFIX_BITS);
+	if ( cache->v4_prefix_valid[phash] && cache->v4_prefix[phash].prefix == prefix ) {
+	  result = cache->v4_prefix[phash].pad;
+	  start  = 24;
+	}
+    }
+
     // For each prefixes with length from 0 to 31, generate a bit using the Rijndael cipher,
     // which is used as a pseudorandom function here. The bits generated in every rounds
     // are combineed into a pseudorandom one-time-pad.
-    for (pos = 0; pos <= 31 ; pos++) { 
+    for (pos = start; pos <= 31 ; pos++) { 
 
 	//Padding: The most significant pos bits are taken from orig_addr. The other 128-pos 
         //bits are taken from m_pad. The variables first4bytes_pad and first4bytes_input are used
@@ -169,18 +411,33 @@ uint32_t anonymize(const uint32_t orig_addr) {
 	else {
 	  first4bytes_input = ((orig_addr >> (32-pos)) << (32-pos)) | ((first4bytes_pad<<pos) >> pos);
 	}
-	rin_input[0] = (uint8_t) (first4bytes_input >> 24);
-	rin_input[1] = (uint8_t) ((first4bytes_input << 8) >> 24);
-	rin_input[2] = (uint8_t) ((first4bytes_input << 16) >> 24);
-	rin_input[3] = (uint8_t) ((first4bytes_input << 24) >> 24);
+	memcpy(rin_input[pos], m_pad, 16);
+	rin_input[pos][0] = (uint8_t) (first4bytes_input >> 24);
+	rin_input[pos][1] = (uint8_t) ((first4bytes_input << 8) >> 24);
+	rin_input[pos][2] = (uint8_t) ((first4bytes_input << 16) >> 24);
+	rin_input[pos][3] = (uint8_t) ((first4bytes_input << 24) >> 24);
+    }
 
-	//Encryption: The Rijndael cipher is used as pseudorandom function. During each 
-	//round, only the first bit of rin_output is used.
-	Rijndael_blockEncrypt(rin_input, 128, rin_output);	
+    //Encryption: The Rijndael cipher is used as pseudorandom function. During each 
+    //round, only the first bit of rin_output is used. All rounds are independent.
+    PRF(&rin_input[start], &rin_output[start], 32 - start);
+
+    //Combination: the bits are combined into a pseudorandom one-time-pad
+    for (pos = start; pos <= 31 ; pos++) { 
+	result |=  (rin_output[pos] >> 7) << (31-pos);
+    }
 
-	//Combination: the bits are combined into a pseudorandom one-time-pad
-	result |=  (rin_output[0] >> 7) << (31-pos);
+    if ( cache ) {
+	uint32_t prefix = orig_addr >> 8;
+	uint32_t phash  = (prefix * 2654435761U) >> (32 - V4_PREFIX_BITS);
+	cache->v4_prefix[phash].prefix = prefix;
+	cache->v4_prefix[phash].pad	   = result & 0xFFFFFF00;
+	cache->v4_prefix_valid[phash]  = 1;
+	cache->v4[hash].addr = orig_addr;
+	cache->v4[hash].anon = result ^ orig_addr;
+	cache->v4_valid[hash] = 1;
     }
+
     //XOR the orginal address with the pseudorandom one-time-pad
     return result ^ orig_addr;
 }
@@ -190,40 +447,80 @@ uint32_t anonymize(const uint32_t orig_addr) {
  * anon_addr return the result in the same order
  */
 void anonymize_v6(const uint64_t orig_addr[2], uint64_t *anon_addr) {
-    uint8_t rin_output[16], *orig_bytes, *result;
-    uint8_t rin_input[16];
+    uint8_t rin_output[128], *orig_bytes, *result;
+    uint8_t rin_input[128][16];
+    uint32_t hash = 0, phash = 0;
+    anon_cache_t *cache = GetCache();
 
-    int pos, i, bit_num, left_byte;
+    int pos, start, i, bit_num, left_byte;
+
+	if ( cache ) {
+		hash = (uint32_t)(((orig_addr[0] ^ (orig_addr[1] * 0x9E3779B97F4A7C15ULL)) * 0x9E3779B97F4A7C15ULL) >> (64 - V6_CACHE_BITS));
+		if ( cache->v6_valid[hash] && cache->v6[hash].addr[0] == orig_addr[0] && cache->v6[hash].addr[1] == orig_addr[1] ) {
+			anon_addr[0] = cache->v6[hash].anon[0];
+			anon_addr[1] = cache->v6[hash].anon[1];
+			return;
+		}
+	}
 
 	anon_addr[0] = anon_addr[1] = 0;
 	result 		 = (uint8_t *)anon_addr;
 	orig_bytes 	 = (uint8_t *)orig_addr;
 
+	// the pad bytes of the /64 prefix may be known already
+	start = 0;
+	if ( cache ) {
+		phash = (uint32_t)((orig_addr[0] * 0x9E3779B97F4A7C15ULL) >> (64 - V6_PREFIX_BITS));
+		if ( cache->v6_prefix_valid[phash] && cache->v6_prefix[phash].prefix == orig_addr[0] ) {
+			anon_addr[0] = cache->v6_prefix[phash].pad;
+			start = 64;
+		}
+	}
+
     // For each prefixes with length from 0 to 127, generate a bit using the Rijndael cipher,
     // which is used as a pseudorandom function here. The bits generated in every rounds
     // are combineed into a pseudorandom one-time-pad.
-    for (pos = 0; pos <= 127 ; pos++) { 
+    for (pos = start; pos <= 127 ; pos++) { 
 		bit_num = pos & 0x7;
 		left_byte = (pos >> 3);
 		
 		for ( i=0; i<left_byte; i++ ) {
-			rin_input[i] = orig_bytes[i];
+			rin_input[pos][i] = orig_bytes[i];
 		}
-		rin_input[left_byte] = orig_bytes[left_byte] >> (7-bit_num) << (7-bit_num) | (m_pad[left_byte]<<bit_num) >> bit_num;
+		rin_input[pos][left_byte] = orig_bytes[left_byte] >> (7-bit_num) << (7-bit_num) | (m_pad[left_byte]<<bit_num) >> bit_num;
 		for ( i=left_byte+1; i<16; i++ ) {
-			rin_input[i] = m_pad[i];
+			rin_input[pos][i] = m_pad[i];
 		}
+    }
 
-		//Encryption: The Rijndael cipher is used as pseudorandom function. During each 
-		//round, only the first bit of rin_output is used.
-		Rijndael_blockEncrypt(rin_input, 128, rin_output);	
+	//Encryption: The Rijndael cipher is used as pseudorandom function. During each 
+	//round, only the first bit of rin_output is used. All rounds are independent.
+	PRF(&rin_input[start], &rin_output[start], 128 - start);
 
-		//Combination: the bits are combined into a pseudorandom one-time-pad
-		result[left_byte] |= (rin_output[0] >> 7) << bit_num;
+    for (pos = start; pos <= 127 ; pos++) { 
+		bit_num = pos & 0x7;
+		left_byte = (pos >> 3);
 
+		//Combination: the bits are combined into a pseudorandom one-time-pad
+		result[left_byte] |= (rin_output[pos] >> 7) << bit_num;
     }
+
+	if ( cache ) {
+		cache->v6_prefix[phash].prefix = orig_addr[0];
+		cache->v6_prefix[phash].pad	   = anon_addr[0];
+		cache->v6_prefix_valid[phash]  = 1;
+	}
+
     //XOR the orginal address with the pseudorandom one-time-pad
 	anon_addr[0] ^= orig_addr[0];
 	anon_addr[1] ^= orig_addr[1];
 
+	if ( cache ) {
+		cache->v6[hash].addr[0] = orig_addr[0];
+		cache->v6[hash].addr[1] = orig_addr[1];
+		cache->v6[hash].anon[0] = anon_addr[0];
+		cache->v6[hash].anon[1] = anon_addr[1];
+		cache->v6_valid[hash]	= 1;
+	}
+
 }
@@ -265,6 +265,7 @@ struct FlowNode *Node;
 			// flush node
 			if ( StorePcapFlow(fs, NewNode) ) {
 				Remove_Node(NewNode);
+				return;
 			}
 		}
 
@@ -297,9 +298,8 @@ struct FlowNode *Node;
 		if ( StorePcapFlow(fs, Node) ) {
 			Remove_Node(Node);
 		}
-	} else {
-		Free_Node(NewNode);
 	}
+	Free_Node(NewNode);
 
 
 } // End of ProcessTCPFlow
@@ -374,7 +374,7 @@ void ProcessFlowNode(FlowSource_t *fs, struct FlowNode *node) {
 
 } // End of ProcessFlowNode
 
-void ProcessPacket(NodeList_t *NodeList, pcap_dev_t *pcap_dev, const struct pcap_pkthdr *hdr, const u_char *data) {
+void ProcessPacket(FlowDispatch_t *dispatch, pcap_dev_t *pcap_dev, const struct pcap_pkthdr *hdr, const u_char *data) {
 struct FlowNode	*Node;
 struct ip 	  *ip;
 void		  *payload, *defragmented;
@@ -382,7 +382,7 @@ uint32_t	  size_ip, offset, data_len, payload_len, bytes;
 uint16_t	  version, ethertype, proto;
 char		  s1[64];
 char		  s2[64];
-static unsigned pkg_cnt = 0;
+static __thread unsigned pkg_cnt = 0;
 
 	pkg_cnt++;
 	dbg_printf("\nNext Packet: %u\n", pkg_cnt);
@@ -640,7 +640,7 @@ pkt->vlans[pkt->vlan_count].pcp = (p[0] >> 5) & 7;
 				if ( (bytes == payload_len) && (Node->src_port == 53 || Node->dst_port == 53) )
  					content_decode_dns(Node, payload, payload_len);
 			}
-			Push_Node(NodeList, Node);
+			Dispatch_Node(dispatch, Node);
 			} break;
 		case IPPROTO_TCP: {
 			struct tcphdr *tcp = (struct tcphdr *)payload;
@@ -678,7 +678,7 @@ pkt->vlans[pkt->vlan_count].pcp = (p[0] >> 5) & 7;
 			Node->flags = tcp->th_flags;
 			Node->src_port = ntohs(tcp->th_sport);
 			Node->dst_port = ntohs(tcp->th_dport);
-			Push_Node(NodeList, Node);
+			Dispatch_Node(dispatch, Node);
 
 			} break;
 		case IPPROTO_ICMP: {
@@ -688,7 +688,7 @@ pkt->vlans[pkt->vlan_count].pcp = (p[0] >> 5) & 7;
 			dbg_printf("IPv%d ICMP proto: %u, type: %u, code: %u\n",
 				version, ip->ip_p, icmp->icmp_type, icmp->icmp_code);
 			Node->bytes -= sizeof(struct udphdr);
-			Push_Node(NodeList, Node);
+			Dispatch_Node(dispatch, Node);
 			} break;
 		case IPPROTO_ICMPV6: {
 			struct icmp6_hdr *icmp6 = (struct icmp6_hdr *)payload;
@@ -696,7 +696,7 @@ pkt->vlans[pkt->vlan_count].pcp = (p[0] >> 5) & 7;
 			Node->dst_port = (icmp6->icmp6_type << 8 ) + icmp6->icmp6_code;
 			dbg_printf("IPv%d ICMP proto: %u, type: %u, code: %u\n",
 				version, ip->ip_p, icmp6->icmp6_type, icmp6->icmp6_code);
-			Push_Node(NodeList, Node);
+			Dispatch_Node(dispatch, Node);
 			} break;
 		case IPPROTO_IPV6: {
 			uint32_t size_inner_ip = sizeof(struct ip6_hdr);
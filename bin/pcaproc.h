@@ -55,6 +55,7 @@ typedef struct proc_stat_s {
 
 typedef struct pcap_dev_s {
     pcap_t  *handle;
+    struct packet_ring_s *ring;	// native receive ring - NULL for libpcap
     uint32_t snaplen;
     uint32_t linkoffset;
     uint32_t linktype;
@@ -85,6 +86,6 @@ void PcapDump(pcapfile_t *pcapfile,  struct pcap_pkthdr *h, const u_char *sp);
 
 void ProcessFlowNode(FlowSource_t *fs, struct FlowNode *node);
 
-void ProcessPacket(NodeList_t *nodeList, pcap_dev_t *pcap_dev, const struct pcap_pkthdr *hdr, const u_char *data);
+void ProcessPacket(FlowDispatch_t *dispatch, pcap_dev_t *pcap_dev, const struct pcap_pkthdr *hdr, const u_char *data);
 
 #endif // _PCAPROC_H
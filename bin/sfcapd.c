@@ -116,7 +116,7 @@ static void kill_launcher(int pid);
 
 static void IntHandler(int signal);
 
-static inline FlowSource_t *GetFlowSource(struct sockaddr_storage *ss);
+static inline FlowSource_t *GetFlowSource(FlowSource_t *FlowSource, struct sockaddr_storage *ss);
 
 static void daemonize(void);
 
@@ -148,6 +148,8 @@ static void usage(char *name) {
 					"-z\t\tLZO compress flows in output file.\n"
 					"-y\t\tLZ4 compress flows in output file.\n"
 					"-j\t\tBZ2 compress flows in output file.\n"
+					"-W num[:drop]\tQueue num blocks for an async writer thread. drop: drop flows if queue full.\n"
+					"-Q\t\tWrite a block index into each file.\n"
 					"-B bufflen\tSet socket buffer to bufflen bytes\n"
 					"-e\t\tExpire data at each cycle.\n"
 					"-D\t\tFork to background\n"
@@ -347,23 +349,19 @@ static void format_file_block_header(data_block_header_t *header) {
 static void run(packet_function_t receive_packet, int socket, repeater_t *repeater,
 	time_t twin, time_t t_begin, int report_seq, int use_subdirs, char *time_extension, int compress) {
 FlowSource_t			*fs;
-struct sockaddr_storage sf_sender;
-socklen_t 	sf_sender_size = sizeof(sf_sender);
+packet_batch_t			*batch;
 time_t 		t_start, t_now;
 uint64_t	export_packets;
 uint32_t	blast_cnt, blast_failures, ignored_packets;
 ssize_t		cnt;
-void 		*in_buff;
 int 		err;
 srecord_t	*commbuff;
 
 	Init_sflow(verbose);
 
-	in_buff  = malloc(NETWORK_INPUT_BUFF_SIZE);
-	if ( !in_buff ) {
-		LogError("malloc() buffer allocation error: %s", strerror(errno));
+	batch = NewPacketBatch(PACKET_BATCH, NETWORK_INPUT_BUFF_SIZE);
+	if ( !batch ) 
 		return;
-	}
 
 	// init vars
 	commbuff = (srecord_t *)shmem;
@@ -405,37 +403,31 @@ srecord_t	*commbuff;
 		struct timeval tv;
 		int i;
 
-		/* read next bunch of data into beginn of input buffer */
+		/* read next batch of packets into the packet buffers */
 		if ( !done) {
 
 #ifdef PCAP
-
-			// Debug code to read from pcap file
-			// cnt = NextPacket(in_buff, NETWORK_INPUT_BUFF_SIZE);
-			cnt = receive_packet (socket, in_buff, NETWORK_INPUT_BUFF_SIZE , 0, 
-				(struct sockaddr *)&sf_sender, &sf_sender_size);
-			if ( cnt == -2 )
-				done = 1;
-#else
-
-			cnt = recvfrom (socket, in_buff, NETWORK_INPUT_BUFF_SIZE , 0, 
-				(struct sockaddr *)&sf_sender, &sf_sender_size);
+			if ( receive_packet != recvfrom ) {
+				// Debug code to read from pcap file
+				packet_t *packet = &batch->packet[0];
+				packet->sender_size = sizeof(packet->sender);
+				cnt = receive_packet (socket, packet->buff, NETWORK_INPUT_BUFF_SIZE , 0, 
+					(struct sockaddr *)&packet->sender, &packet->sender_size);
+				if ( cnt == -2 )
+					done = 1;
+				packet->len = cnt;
+				batch->num_packets = cnt > 0 ? 1 : 0;
+			} else
 #endif
+			cnt = ReceiveBatch(socket, batch);
+
 			if ( cnt == -1 && errno != EINTR ) {
 				LogError("ERROR: recvfrom: %s", strerror(errno));
 				continue;
 			}
 
-			i = 0;
-			while ( repeater[i].hostname && (i < MAX_REPEATERS)) {
-				ssize_t len;
-				len = sendto(repeater[i].sockfd, in_buff, cnt, 0, 
-						(struct sockaddr *)&(repeater[i].addr), repeater[i].addrlen);
-				if ( len < 0 ) {
-					LogError("ERROR: sendto(): %s", strerror(errno));
-				}
-				i++;
-			}
+			if ( cnt > 0 ) 
+				RepeatBatch(batch, repeater);
 		}
 
 		/* Periodic file renaming, if time limit reached or if we are done.  */
@@ -470,6 +462,8 @@ srecord_t	*commbuff;
 				char nfcapd_filename[MAXPATHLEN];
 				char error[255];
 				nffile_t *nffile = fs->nffile;
+				writer_stat_t writer_stat;
+				int has_writer_stat;
 
 				if ( verbose ) {
 					// Dump to stdout
@@ -512,6 +506,8 @@ srecord_t	*commbuff;
 	
 				// Flush Exporter Stat to file
 				FlushExporterStats(fs);
+				// writer stat is lost, when the file is closed
+				has_writer_stat = GetWriterStat(nffile, &writer_stat);
 				// Write Stat record and close file
 				CloseUpdateFile(nffile, fs->Ident);
 
@@ -542,6 +538,12 @@ srecord_t	*commbuff;
 					(unsigned long long)nffile->stat_record->numpackets, 
 					(unsigned long long)nffile->stat_record->numbytes, nffile->stat_record->sequence_failure, fs->bad_packets);
 
+				if ( has_writer_stat ) 
+					LogInfo("Ident: '%s' Writer: Blocks: %u, Max queued: %u, Stalls: %u, Stall time: %llu ms, Dropped blocks: %u, Dropped records: %llu", 
+						fs->Ident, writer_stat.blocks, writer_stat.max_queued, writer_stat.stalls, 
+						(unsigned long long)(writer_stat.stall_usec/1000), writer_stat.dropped_blocks, 
+						(unsigned long long)writer_stat.dropped_records);
+
 				// reset stat record
 				fs->bad_packets = 0;
 				fs->first_seen 	= 0xffffffffffffLL;
@@ -622,45 +624,51 @@ srecord_t	*commbuff;
 		if ( cnt == 0 )
 			continue;
 
-		// get flow source record for current packet, identified by sender IP address
+		// process all packets of the batch
+		for ( i=0; i<batch->num_packets; i++ ) {
+			packet_t *packet = &batch->packet[i];
+			cnt = packet->len;
 
-		fs = GetFlowSource(&sf_sender);
-		if ( fs == NULL ) {
-			LogError("Skip UDP packet. Ignored packets so far %u packets", ignored_packets);
-			ignored_packets++;
-			continue;
-		}
+			// get flow source record for current packet, identified by sender IP address
 
+			fs = GetFlowSource(FlowSource, &packet->sender);
+			if ( fs == NULL ) {
+				LogError("Skip UDP packet. Ignored packets so far %u packets", ignored_packets);
+				ignored_packets++;
+				continue;
+			}
 
-		/* check for too little data - cnt must be > 0 at this point */
-		if ( cnt < sizeof(common_flow_header_t) ) {
-			LogError("Ident: %s, Data length error: too little data for common netflow header. cnt: %i",fs->Ident, (int)cnt);
-			fs->bad_packets++;
-			continue;
-		}
-		fs->received = tv;
-
-		/* Process data - have a look at the common header */
-		Process_sflow(in_buff, cnt, fs);
-
-		// each Process_xx function has to process the entire input buffer, therefore it's empty now.
-		export_packets++;
-
-		// flush current buffer to disc
-		if ( fs->nffile->block_header->size > BUFFSIZE ) {
-			// fishy! - we already wrote into someone elses memory! - I'm sorry
-			// reset output buffer - data may be lost, as we don not know, where it happen
-			fs->nffile->block_header->size 		 = 0;
-			fs->nffile->block_header->NumRecords = 0;
-			fs->nffile->buff_ptr = (void *)((pointer_addr_t)fs->nffile->block_header + sizeof(data_block_header_t) );
-			LogError("### Software bug ### Ident: %s, output buffer overflow: expect memory inconsitency", fs->Ident);
+
+			/* check for too little data - cnt must be > 0 at this point */
+			if ( cnt < sizeof(common_flow_header_t) ) {
+				LogError("Ident: %s, Data length error: too little data for common netflow header. cnt: %i",fs->Ident, (int)cnt);
+				fs->bad_packets++;
+				continue;
+			}
+			fs->received = tv;
+
+			/* Process data - have a look at the common header */
+			Process_sflow(packet->buff, cnt, fs);
+
+			// each Process_xx function has to process the entire input buffer, therefore it's empty now.
+			export_packets++;
+
+			// flush current buffer to disc
+			if ( fs->nffile->block_header->size > BUFFSIZE ) {
+				// fishy! - we already wrote into someone elses memory! - I'm sorry
+				// reset output buffer - data may be lost, as we don not know, where it happen
+				fs->nffile->block_header->size 		 = 0;
+				fs->nffile->block_header->NumRecords = 0;
+				fs->nffile->buff_ptr = (void *)((pointer_addr_t)fs->nffile->block_header + sizeof(data_block_header_t) );
+				LogError("### Software bug ### Ident: %s, output buffer overflow: expect memory inconsitency", fs->Ident);
+			}
 		}
 	}
 
 	if ( verbose && blast_failures ) {
 		fprintf(stderr, "Total missed packets: %u\n", blast_failures);
 	}
-	free(in_buff);
+	FreePacketBatch(batch);
 
 	fs = FlowSource;
 	while ( fs ) {
@@ -717,7 +725,7 @@ char	*pcap_file = NULL;
 	FlowSource		= NULL;
 	extension_tags	= DefaultExtensions;
 
-	while ((c = getopt(argc, argv, "46ewhEVI:DB:b:f:jl:N:n:p:J:P:R:S:T:t:x:ru:g:zZ")) != EOF) {
+	while ((c = getopt(argc, argv, "46ewhEVI:DB:b:f:jl:N:n:p:J:P:QR:S:T:t:x:ru:g:W:zZ")) != EOF) {
 		switch (c) {
 			case 'h':
 				usage(argv[0]);
@@ -884,6 +892,28 @@ char	*pcap_file = NULL;
 			case 'x':
 				launch_process = optarg;
 				break;
+			case 'Q':
+				SetBlockIndex(1);
+				break;
+			case 'W': {
+				// async block writer: -W num[:drop]
+				char *s = strchr(optarg, ':');
+				int drop = 0;
+				if ( s ) {
+					*s++ = '\0';
+					if ( strcmp(s, "drop") != 0 ) {
+						LogError("Unknown write queue option '%s'", s);
+						exit(255);
+					}
+					drop = 1;
+				}
+				int queue_blocks = atoi(optarg);
+				if ( queue_blocks < 1 || queue_blocks > MAXWRITEQUEUE ) {
+					LogError("Write queue length out of range 1..%d", MAXWRITEQUEUE);
+					exit(255);
+				}
+				SetAsyncWriter(queue_blocks, drop);
+				} break;
 			case 'Z':
 				time_extension	= "%Y%m%d%H%M%z";
 				spec_time_extension = 1;
@@ -947,7 +977,7 @@ char	*pcap_file = NULL;
 	if ( mcastgroup ) 
 		sock = Multicast_receive_socket (mcastgroup, listenport, family, bufflen);
 	else 
-		sock = Unicast_receive_socket(bindhost, listenport, family, bufflen );
+		sock = Unicast_receive_socket(bindhost, listenport, family, bufflen, 0);
 
 	if ( sock == -1 ) {
 		fprintf(stderr,"Terminated due to errors.\n");
@@ -1059,7 +1089,7 @@ char	*pcap_file = NULL;
 			case 0:
 				// child
 				close(sock);
-				launcher(shmem, FlowSource, launch_process, expire);
+				launcher(shmem, FlowSource, launch_process, expire, 0);
 				exit(0);
 				break;
 			case -1:
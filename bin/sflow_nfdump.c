@@ -313,18 +313,20 @@ int i, id, extension_size, map_size, map_index;
 
 static exporter_sflow_t *GetExporter(FlowSource_t *fs, uint32_t agentSubId, uint32_t meanSkipCount) {
 exporter_sflow_t **e = (exporter_sflow_t **)&(fs->exporter_data);
+exporter_sflow_t *exporter;
 sampler_t *sampler;
 #define IP_STRING_LEN   40
 char ipstr[IP_STRING_LEN];
 int i;
 
 	// search the appropriate exporter engine
-	while ( *e ) {
-		if ( (*e)->info.id == agentSubId && (*e)->info.version == SFLOW_VERSION &&
-			 (*e)->info.ip.V6[0] == fs->ip.V6[0] && (*e)->info.ip.V6[1] == fs->ip.V6[1]) 
-			return *e;
+	exporter = (exporter_sflow_t *)LookupExporter(fs, SFLOW_VERSION, agentSubId);
+	if ( exporter ) 
+		return exporter;
+
+	// append new exporter
+	while ( *e ) 
 		e = &((*e)->next);
-	}
 
 	if ( fs->sa_family == AF_INET ) {
 		uint32_t _ip = htonl(fs->ip.V4);
@@ -376,6 +378,7 @@ int i;
 	sampler->next				= NULL;
 
 	FlushInfoExporter(fs, &((*e)->info));
+	IndexExporter(fs, (exporter_t *)(*e));
 	sampler->info.exporter_sysid		= (*e)->info.sysid;
 	FlushInfoSampler(fs, &(sampler->info));
 
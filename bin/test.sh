@@ -101,6 +101,23 @@ fi
 diff test5.out nfdump.test.out > test5.diff || true
 diff test5.diff nfdump.test.diff
 
+# same replay into nfcapd with two receivers
+mkdir tmp/multi
+./nfcapd -p 65530 -c 2 -T '*' -l tmp/multi -D -P tmp/multi/pidfile
+sleep 1
+./nfreplay -r test.flows -v9 -H 127.0.0.1 -p 65530
+sleep 1
+kill -TERM `cat tmp/multi/pidfile`;
+sleep 1
+if [ -f tmp/multi/pidfile ]; then
+	echo nfcapd -c 2 does not terminate
+	exit 255
+fi
+./nfdump -r tmp/multi/nfcapd.* -q -o raw | grep -v 'received at' > test6.out
+diff -u test5.out test6.out
+rm -f tmp/multi/nfcapd.*
+rmdir tmp/multi
+
 mkdir memck.$$
 # OpenBSD
 export MALLOC_OPTIONS=AFGJS
@@ -117,15 +134,155 @@ export MallocCorruptionAbort=1
 ./nfdump -r test.flows -w test-2.flows 'host  172.16.14.18'
 ./nfdump -r test.flows -O tstart -w test-2.flows 'host  172.16.14.18'
 ./nfanon -K abcdefghijklmnopqrstuvwxyz012345 -r test.flows -w anon.flows
+./nfanon -K abcdefghijklmnopqrstuvwxyz012345 -r test.flows -w test-anon.flows -W 2
+./nfdump -q -r anon.flows -o raw > test10.out
+./nfdump -q -r test-anon.flows -o raw > test11.out
+diff -u test10.out test11.out
 ./nfdump -J 0 -r test.flows
 ./nfdump -J 1 -r test.flows
 ./nfdump -J 2 -r test.flows
 ./nfdump -J 3 -r test.flows
+# LZ4 read with and without mmap
+./nfdump -q -r test.flows -o raw > test2.out
+diff -u test2.out nfdump.test.out
+./nfdump -U -q -r test.flows -o raw > test2.out
+diff -u test2.out nfdump.test.out
 ./nfdump -J 2 -r test.flows
 ./nfdump -J 1 -r test.flows
-./nfdump -J 0 -r test.flows
+if ./nfdump -v test.flows | grep -q '^Index'; then
+	echo Block index written without -Q
+	exit 255
+fi
+./nfdump -Q -J 0 -r test.flows
 ./nfdump -q -r test.flows -o raw > test2.out
 diff -u test2.out nfdump.test.out
+./nfdump -U -q -r test.flows -o raw > test2.out
+diff -u test2.out nfdump.test.out
+# block index
+./nfdump -v test.flows | grep -q '^Index'
+# IP index
+./nfdump -q -r test.flows -o raw 'host 172.16.14.18' > test8.out
+./nfindex -r test.flows
+./nfdump -q -r test.flows -o raw 'host 172.16.14.18' > test9.out
+diff -u test8.out test9.out
+rm -f test.flows.ipidx
+# column blocks
+./nfdump -q -r test.flows -o raw 'proto tcp and dst port 25' > test6.out
+./nfreader -r test.flows > test14.out
+./nfdump -J 4 -r test.flows
+./nfdump -q -r test.flows -o raw > test2.out
+diff -u test2.out nfdump.test.out
+./nfdump -q -r test.flows -o raw 'proto tcp and dst port 25' > test7.out
+diff -u test6.out test7.out
+./nfreader -r test.flows > test15.out
+diff -u test14.out test15.out
+./nfindex -r test.flows
+./nfdump -q -r test.flows -o raw 'host 172.16.14.18' > test9.out
+diff -u test8.out test9.out
+rm -f test.flows.ipidx
+mkdir tmp/column
+./nfcapd -p 65530 -T '*' -l tmp/column -D -P tmp/column/pidfile
+sleep 1
+./nfreplay -r test.flows -v9 -H 127.0.0.1 -p 65530
+sleep 1
+kill -TERM `cat tmp/column/pidfile`;
+sleep 1
+./nfdump -r tmp/column/nfcapd.* -q -o raw | grep -v 'received at' > test7.out
+diff -u test5.out test7.out
+rm -f tmp/column/nfcapd.*
+rmdir tmp/column
+./nfanon -K abcdefghijklmnopqrstuvwxyz012345 -r test.flows -w test-anon.flows
+./nfdump -q -r test-anon.flows -o raw > test11.out
+diff -u test10.out test11.out
+# multi block file - double the flows 11 times
+mkdir tmp/big
+./nfdump -r test.flows -w tmp/big/nfcapd.1
+for i in 1 2 3 4 5 6 7 8 9 10 11; do
+	ln tmp/big/nfcapd.1 tmp/big/nfcapd.2
+	./nfdump -R tmp/big -w tmp/nfcapd.big
+	rm -f tmp/big/nfcapd.*
+	mv tmp/nfcapd.big tmp/big/nfcapd.1
+done
+# read ahead threads
+./nfdump -r tmp/big/nfcapd.1 -z -w test-big.flows
+./nfdump -q -r test-big.flows -o raw > test12.out
+./nfdump -q -r test-big.flows -o raw -P 3 > test13.out
+diff -u test12.out test13.out
+./nfdump -r tmp/big/nfcapd.1 -j -w test-big.flows
+./nfdump -q -r test-big.flows -o raw -P 2 > test13.out
+diff -u test12.out test13.out
+# async writer
+./nfdump -r tmp/big/nfcapd.1 -y -k 4 -w test-big.flows
+./nfdump -q -r test-big.flows -o raw > test13.out
+diff -u test12.out test13.out
+./nfdump -J 2 -k 4 -r test-big.flows
+./nfdump -q -r test-big.flows -o raw > test13.out
+diff -u test12.out test13.out
+# aggregation and statistics threads
+for opt in '-a' '-A srcip,dstport' '-s record/bytes' '-s ip -n 0' '-s srcport -s dstport/flows'; do
+	./nfdump -q -r test-big.flows $opt > test12.out
+	./nfdump -q -r test-big.flows $opt -W 3 > test13.out
+	diff -u test12.out test13.out
+done
+rm -f tmp/big/nfcapd.*
+# block index with disjoint time and port zones - the replayed flows to
+# dst port 25 all start before 10:33 and go first into the file
+cp tmp/nfcapd.* tmp/big/nfcapd.1
+for i in 1 2 3 4 5 6 7 8 9 10 11; do
+	ln tmp/big/nfcapd.1 tmp/big/nfcapd.2
+	./nfdump -R tmp/big -w tmp/nfcapd.big
+	rm -f tmp/big/nfcapd.*
+	mv tmp/nfcapd.big tmp/big/nfcapd.1
+done
+./nfdump -r tmp/big/nfcapd.1 -w tmp/nfcapd.zone1 'dst port 25'
+./nfdump -r tmp/big/nfcapd.1 -w tmp/nfcapd.zone2 'not dst port 25'
+rm -f tmp/big/nfcapd.*
+mv tmp/nfcapd.zone1 tmp/big/nfcapd.1
+mv tmp/nfcapd.zone2 tmp/big/nfcapd.2
+./nfdump -R tmp/big -w test-big.flows
+./nfdump -R tmp/big -Q -w test-zone.flows
+./nfdump -q -r test-big.flows -o raw -t 2004/07/11.10:33:00-2004/07/11.10:40:00 > test12.out
+./nfdump -q -r test-zone.flows -o raw -t 2004/07/11.10:33:00-2004/07/11.10:40:00 > test13.out
+diff -u test12.out test13.out
+./nfdump -r test-zone.flows -o raw -t 2004/07/11.10:33:00-2004/07/11.10:40:00 | grep -q '^Blocks pruned by index'
+./nfdump -q -r test-big.flows -o raw 'dst port 52345' > test12.out
+./nfdump -q -r test-zone.flows -o raw 'dst port 52345' > test13.out
+diff -u test12.out test13.out
+./nfdump -r test-zone.flows -o raw 'dst port 52345' | grep -q '^Blocks pruned by index'
+# a time window skips the whole first file of -R with and without file probe
+rm -f tmp/big/nfcapd.*
+./nfdump -r test-big.flows -t 2004/07/11.10:30:00-2004/07/11.10:31:30 -w tmp/big/nfcapd.1
+./nfdump -r test-big.flows -t 2004/07/11.10:33:00-2004/07/11.10:40:00 -w tmp/big/nfcapd.2
+./nfdump -r tmp/big/nfcapd.2 -o raw -t 2004/07/11.10:33:00-2004/07/11.10:40:00 | grep -v '^Sys:' > test12.out
+./nfdump -R tmp/big -o raw -t 2004/07/11.10:33:00-2004/07/11.10:40:00 | grep -v '^Sys:' > test13.out
+diff -u test12.out test13.out
+./nfdump -Y -R tmp/big -o raw -t 2004/07/11.10:33:00-2004/07/11.10:40:00 | grep -v '^Sys:' > test13.out
+diff -u test12.out test13.out
+# Top N records with the same count print in the same order, whatever order the flows are read
+for opt in '-a -O flows -n 20' '-A srcip -O packets -n 20' '-s srcport -n 20' '-s dstip/flows -n 20'; do
+	./nfdump -q -R tmp/big $opt -H sfh > test12.out
+	mv tmp/big/nfcapd.1 tmp/big/nfcapd.3
+	./nfdump -q -R tmp/big $opt -H mx64 -W 3 > test13.out
+	mv tmp/big/nfcapd.3 tmp/big/nfcapd.1
+	diff -u test12.out test13.out
+done
+rm -f tmp/big/nfcapd.*
+rmdir tmp/big
+# async writer dropping flows under back-pressure
+./nftest -W test-drop.flows
+# nfpcapd with a node cache much smaller than the number of active flows
+if [ -x ./nfpcapd ]; then
+	./nfgen -P 20000 > test.pcap
+	mkdir tmp/pcap1 tmp/pcap2
+	./nfpcapd -r test.pcap -l tmp/pcap1 -t 300
+	timeout 120 ./nfpcapd -r test.pcap -l tmp/pcap2 -t 300 -B 1024 -c 4
+	# flows get flushed early - the aggregated flows must match
+	./nfdump -q -R tmp/pcap1 -A srcip,srcport -o 'fmt:%sa %sp %pkt %byt' | sort > test12.out
+	./nfdump -q -R tmp/pcap2 -A srcip,srcport -o 'fmt:%sa %sp %pkt %byt' | sort > test13.out
+	diff -u test12.out test13.out
+	rm -f tmp/pcap1/* tmp/pcap2/* test.pcap
+	rmdir tmp/pcap1 tmp/pcap2
+fi
 rm -f tmp/nfcapd.* test*.out test*.flows
 [ -d tmp ] && rmdir tmp
 [ -d memck.$$ ] && rm -rf  memck.$$